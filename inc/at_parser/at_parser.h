@@ -11,11 +11,60 @@
 #ifndef AT_PARSER_H
 #define AT_PARSER_H
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif // __cplusplus
 
 typedef struct at_parser* at_parser_handle_t;
+typedef struct at_parser_registry* at_parser_registry_handle_t;
+
+/**
+ * @brief The first byte of a binary command frame, it never starts a text line.
+ * @details A binary frame (all fields little endian) is laid out as:
+ * start (1) | command type (1) | command id (2) | argument count (1) | argument lengths (2 each) | argument bytes.
+ * 
+ */
+#define AT_PARSER_BINARY_FRAME_START 0xFE
+
+/**
+ * @brief The size of a binary frame without the argument lengths and bytes.
+ * 
+ */
+#define AT_PARSER_BINARY_FRAME_HEADER_SIZE 5
+
+/**
+ * @brief The byte that ends a body (Ctrl-Z), see at_parser_enter_body_mode.
+ * 
+ */
+#define AT_PARSER_BODY_END_CHAR 0x1A
+
+/**
+ * @brief The byte that cancels a body (ESC), see at_parser_enter_body_mode.
+ * 
+ */
+#define AT_PARSER_BODY_CANCEL_CHAR 0x1B
+
+/**
+ * @brief The byte that (three times) escapes from data mode, see at_parser_enter_data_mode.
+ * 
+ */
+#define AT_PARSER_DATA_ESCAPE_CHAR '+'
+
+/**
+ * @brief The amount of buckets of the line length histogram, see at_parser_get_line_histogram.
+ * 
+ */
+#define AT_PARSER_LINE_HISTOGRAM_BUCKETS 16
+
+/**
+ * @brief The amount of QoS classes, see at_parser_qos_class.
+ * 
+ */
+#define AT_PARSER_QOS_CLASS_COUNT 4
 
 /**
  * @brief The different kind of instructions that can be parsed by the parser.
@@ -38,12 +87,215 @@ struct at_parser_argument {
     size_t length;      ///< The length of the string.
 };
 
+/**
+ * @brief The flow control state that the sender should follow.
+ * 
+ */
+enum at_parser_flow_state
+{
+    AT_PARSER_FLOW_RESUME, ///< The sender may send (e.g. XON or assert RTS).
+    AT_PARSER_FLOW_PAUSE,  ///< The sender should stop sending (e.g. XOFF or deassert RTS).
+};
+
 /**
  * @brief Callback that is called when a command has been parsed in the buffer.
  * 
  */
 typedef void (*at_parser_received_command)(at_parser_handle_t parser, void *userdata, const char* command_name, enum at_parser_command_type type, struct at_parser_argument* argument_list, size_t argument_list_length);
 
+/**
+ * @brief The events that are passed to a body handler.
+ * 
+ */
+enum at_parser_body_event
+{
+    AT_PARSER_BODY_DATA,     ///< The next chunk of the body.
+    AT_PARSER_BODY_END,      ///< The body was ended with Ctrl-Z.
+    AT_PARSER_BODY_CANCEL,   ///< The body was cancelled with ESC.
+    AT_PARSER_BODY_OVERFLOW, ///< The body went over its maximum length, the rest was dropped up to the Ctrl-Z or ESC (that ended it).
+};
+
+/**
+ * @brief Callback that receives the body of a command in body mode.
+ * @details The data is only valid during the call, it is NULL for anything but AT_PARSER_BODY_DATA.
+ * 
+ */
+typedef void (*at_parser_body_handler)(at_parser_handle_t parser, void *userdata, enum at_parser_body_event event, const char *data, size_t length);
+
+/**
+ * @brief Callback that receives the data in data mode.
+ * @details The data points into the buffer that was fed to the parser and is only valid during the call.
+ * 
+ */
+typedef void (*at_parser_data_sink)(at_parser_handle_t parser, void *userdata, const char *data, size_t length);
+
+/**
+ * @brief Callback that is called when the parser escaped from data mode to command mode.
+ * 
+ */
+typedef void (*at_parser_data_escape_callback)(at_parser_handle_t parser, void *userdata);
+
+/**
+ * @brief Callback that is called when the flow control state of the parser changes.
+ * 
+ */
+typedef void (*at_parser_flow_control_callback)(at_parser_handle_t parser, void *userdata, enum at_parser_flow_state state);
+
+/**
+ * @brief Callback that writes a response of the parser (or its handlers) to the other side.
+ * 
+ */
+typedef void (*at_parser_response_writer)(at_parser_handle_t parser, void *userdata, const char *data, size_t length);
+
+/**
+ * @brief Clock hook used by the parser for anything time related.
+ * @details The unit of the ticks is up to the application (e.g. milliseconds), it is allowed to wrap around.
+ * 
+ */
+typedef uint32_t (*at_parser_clock)(void *userdata);
+
+/**
+ * @brief Limits on the work done by a single at_parser_process_buffer_budgeted call.
+ * @details A limit of 0 means no limit.
+ * 
+ */
+struct at_parser_budget
+{
+    size_t max_lines;  ///< The maximum amount of lines to dispatch.
+    size_t max_bytes;  ///< The maximum amount of bytes to consume.
+    bool use_deadline; ///< Stop once the clock (see at_parser_set_clock) reaches the deadline.
+    uint32_t deadline; ///< The clock tick to stop at.
+};
+
+/**
+ * @brief Watermarks for the flow control of a parser.
+ * @details The parser pauses when the buffer occupancy or the pending commands reach their high watermark
+ * and resumes when both are at or below their low watermark. A high watermark of 0 disables that watermark.
+ * 
+ */
+struct at_parser_flow_control_config
+{
+    size_t buffer_high_watermark;             ///< Amount of buffered bytes that pauses the sender.
+    size_t buffer_low_watermark;              ///< Amount of buffered bytes to resume the sender.
+    size_t pending_high_watermark;            ///< Amount of pending commands that pauses the sender.
+    size_t pending_low_watermark;             ///< Amount of pending commands to resume the sender.
+    at_parser_flow_control_callback callback; ///< Called when the flow control state changes.
+    void *userdata;                           ///< Passed to the callback.
+};
+
+/**
+ * @brief Memory allocator that is used for every allocation a parser makes.
+ * @details The functions follow the malloc, realloc and free semantics and get the context as first argument.
+ * A parser only calls them from within its own API calls, so a per parser arena or pool needs no locking.
+ * 
+ */
+struct at_parser_allocator
+{
+    void *(*allocate)(void *context, size_t size);              ///< Like malloc, returns NULL when out of memory.
+    void *(*reallocate)(void *context, void *ptr, size_t size); ///< Like realloc, ptr is never NULL.
+    void (*deallocate)(void *context, void *ptr);               ///< Like free, ptr is never NULL.
+    void *context;                                              ///< Passed to every function.
+};
+
+/**
+ * @brief The result of a command in a batch, it decides the final result code the parser writes.
+ * 
+ */
+enum at_parser_batch_result
+{
+    AT_PARSER_BATCH_RESULT_NONE,  ///< Nothing is written (the handler answered itself, or the command has no answer).
+    AT_PARSER_BATCH_RESULT_OK,    ///< "OK\r\n" is written.
+    AT_PARSER_BATCH_RESULT_ERROR, ///< "ERROR\r\n" is written.
+};
+
+/**
+ * @brief The QoS class of a command, it decides the order in which a batch is passed to the batch handler.
+ * 
+ */
+enum at_parser_qos_class
+{
+    AT_PARSER_QOS_LOW,    ///< Bulk commands, they go after everything else.
+    AT_PARSER_QOS_NORMAL, ///< The default class.
+    AT_PARSER_QOS_HIGH,   ///< Latency critical commands (e.g. a watchdog kick), they go before the normal commands.
+    AT_PARSER_QOS_ABORT,  ///< Cancels every queued command that isn't an abort command, and is dispatched right away.
+};
+
+/**
+ * @brief Statistics of a QoS class in batch mode, the wait is the time in clock ticks (see at_parser_set_clock) from
+ * parsing a command to passing it to the batch handler.
+ * 
+ */
+struct at_parser_qos_stats
+{
+    size_t dispatched;   ///< The commands passed to the batch handler.
+    size_t cancelled;    ///< The commands cancelled by an abort command.
+    size_t depth;        ///< The commands that are queued right now.
+    size_t max_depth;    ///< The most commands that were queued at once.
+    uint32_t max_wait;   ///< The longest wait.
+    uint64_t total_wait; ///< The sum of the waits of the dispatched commands.
+};
+
+/**
+ * @brief A command that is passed to the batch handler.
+ * @details The name and arguments are owned by the parser and only valid during the batch handler call.
+ * The handler fills in the response and result of the command.
+ * 
+ */
+struct at_parser_command_record
+{
+    const char *command_name;                       ///< The name of the command (NULL terminated).
+    size_t command_name_length;                     ///< The length of the name.
+    enum at_parser_command_type type;               ///< The type of the command.
+    const struct at_parser_argument *argument_list; ///< The arguments, NULL when there are none.
+    size_t argument_list_length;                    ///< The amount of arguments.
+    const char *response;                           ///< Set by the handler, information response that is written before the result code.
+    size_t response_length;                         ///< Set by the handler, the length of the response.
+    enum at_parser_batch_result result;             ///< Set by the handler, AT_PARSER_BATCH_RESULT_NONE by default.
+    enum at_parser_qos_class qos;                   ///< The QoS class of the command.
+};
+
+/**
+ * @brief Callback that is called with all commands that were parsed in one call to the parser.
+ * 
+ */
+typedef void (*at_parser_batch_handler)(at_parser_handle_t parser, void *userdata, struct at_parser_command_record *records, size_t record_count);
+
+/**
+ * @brief Configuration of data mode.
+ * 
+ */
+struct at_parser_data_mode_config
+{
+    at_parser_data_sink sink;               ///< Receives the data.
+    void *sink_userdata;                    ///< Passed to the sink.
+    uint32_t guard_time;                    ///< Clock ticks of silence before and after the "+++", 0 escapes as soon as "+++" is received.
+    at_parser_data_escape_callback escaped; ///< Called after escaping to command mode, may be NULL.
+    void *escaped_userdata;                 ///< Passed to escaped.
+};
+
+/**
+ * @brief Policy for a buffer that follows the length of the received lines.
+ * 
+ */
+struct at_parser_buffer_policy
+{
+    size_t min_size;        ///< The smallest buffer size.
+    size_t max_size;        ///< The largest buffer size, longer lines are dropped like with a fixed buffer.
+    size_t shrink_after;    ///< The amount of lines after which the buffer is shrunk when they were all short, 0 to never shrink.
+};
+
+/**
+ * @brief The lengths of the lines a parser received.
+ * @details Bucket 0 counts lines of 0 and 1 bytes, bucket i lines of 2^i up to 2^(i + 1) - 1 bytes and the last bucket
+ * all longer lines as well. The length excludes the line end.
+ * 
+ */
+struct at_parser_line_histogram
+{
+    size_t counts[AT_PARSER_LINE_HISTOGRAM_BUCKETS];
+    size_t longest;         ///< The longest line.
+};
+
 /**
  * @brief Construct a new command parser.
  * 
@@ -55,6 +307,19 @@ typedef void (*at_parser_received_command)(at_parser_handle_t parser, void *user
  */
 extern int at_parser_create(at_parser_handle_t *handle, size_t buffer_size, char escape_char, char arg_separator);
 
+/**
+ * @brief Construct a new command parser that makes all its allocations through the allocator.
+ * @details at_parser_create uses malloc, realloc and free. Registries are shared between parsers and keep using those.
+ * 
+ * @param handle The resulting handle location.
+ * @param buffer_size The size of the internal AT command buffer (should be at least the length of your longest command string + \r\n).
+ * @param escape_char The character that can be used to escape quote's in the set arguments.
+ * @param arg_separator The character used to separate arguments in the set command.
+ * @param allocator The allocator to use, it is copied.
+ * @return int 0 on success, other on error.
+ */
+extern int at_parser_create_with_allocator(at_parser_handle_t *handle, size_t buffer_size, char escape_char, char arg_separator, const struct at_parser_allocator *allocator);
+
 /**
  * @brief Cleans up any resources allocated by the parser.
  * 
@@ -82,6 +347,57 @@ extern int at_parser_add_command_handler(at_parser_handle_t parser, const char*
  */
 extern int at_parser_remove_command_handler(at_parser_handle_t parser, const char* command_name, at_parser_received_command handler);
 
+/**
+ * @brief Construct a new (empty) command registry.
+ * @details A registry holds command handlers that can be shared by any number of parsers.
+ * Handlers are added while building, after which the registry is frozen into a compact read-only layout
+ * and can be attached to parsers with at_parser_attach_registry.
+ * 
+ * @param registry The resulting registry location.
+ * @return int 0 on success, other on error.
+ */
+extern int at_parser_registry_create(at_parser_registry_handle_t *registry);
+
+/**
+ * @brief Cleans up any resources allocated by the registry.
+ * @note All parsers the registry is attached to should be freed or detached first.
+ * 
+ * @param registry The registry to delete.
+ */
+extern void at_parser_registry_free(at_parser_registry_handle_t registry);
+
+/**
+ * @brief Register a callback in the registry for when a command has been parsed.
+ * 
+ * @param registry The registry to add the handler to, must not be frozen yet.
+ * @param command_name The name of the AT command to listen to (AT+<command_name>).
+ * @param handler The callback that should be called when the command is available.
+ * @param userdata The userdata that is passed to the handler.
+ * @return int 0 on success, other on error.
+ */
+extern int at_parser_registry_add_command_handler(at_parser_registry_handle_t registry, const char* command_name, at_parser_received_command handler, void *userdata);
+
+/**
+ * @brief Freezes the registry into its compact read-only layout.
+ * @details All command names are interned into a single string pool and the handlers are stored in contiguous arrays sorted by name.
+ * After freezing no handlers can be added anymore.
+ * 
+ * @param registry The registry to freeze.
+ * @return int 0 on success, other on error.
+ */
+extern int at_parser_registry_freeze(at_parser_registry_handle_t registry);
+
+/**
+ * @brief Attach a frozen registry to a parser.
+ * @details The parser only keeps a reference, so the registry must outlive the parser.
+ * Handlers in the registry are called before the handlers registered on the parser itself.
+ * 
+ * @param parser The parser to attach the registry to.
+ * @param registry The frozen registry to attach, or NULL to detach the current one.
+ * @return int 0 on success, other on error.
+ */
+extern int at_parser_attach_registry(at_parser_handle_t parser, at_parser_registry_handle_t registry);
+
 /**
  * @brief Ingests the buffer and processes the current parser buffer for new commands.
  * 
@@ -92,6 +408,385 @@ extern int at_parser_remove_command_handler(at_parser_handle_t parser, const cha
  */
 extern int at_parser_process_buffer(at_parser_handle_t parser, const char* buffer, size_t buffer_len);
 
+/**
+ * @brief Ingests the buffer like at_parser_process_buffer, but defers the remaining data while the pending commands are over their watermark.
+ * @details Ingesting stops at the line end after which the pending commands reached the high watermark.
+ * The deferred bytes (buffer_len - accepted) should be offered again once the flow control resumes.
+ * 
+ * @param parser The parser to ingest the new data.
+ * @param buffer The data to ingest.
+ * @param buffer_len The length of the data to ingest.
+ * @param accepted The location to store the amount of bytes that were accepted.
+ * @return int 0 on success, other on error.
+ */
+extern int at_parser_process_buffer_partial(at_parser_handle_t parser, const char* buffer, size_t buffer_len, size_t *accepted);
+
+/**
+ * @brief Ingests the buffer like at_parser_process_buffer, but stops once the budget is used up.
+ * @details Complete lines that weren't dispatched yet stay in the parser and are dispatched first on the next call,
+ * so a next call should pass the remaining data (buffer + consumed), or no data at all to only finish the pending lines.
+ * 
+ * @param parser The parser to ingest the new data.
+ * @param buffer The data to ingest, may be NULL when buffer_len is 0.
+ * @param buffer_len The length of the data to ingest.
+ * @param budget The limits for this call.
+ * @param consumed The location to store the amount of bytes that were consumed.
+ * @return int 0 on success, other on error.
+ */
+extern int at_parser_process_buffer_budgeted(at_parser_handle_t parser, const char* buffer, size_t buffer_len, const struct at_parser_budget *budget, size_t *consumed);
+
+/**
+ * @brief Check if the parser has complete lines that weren't dispatched yet because of an exhausted budget.
+ * 
+ * @param parser The parser to check.
+ * @return true There are complete lines waiting.
+ * @return false There are no complete lines waiting.
+ */
+extern bool at_parser_has_pending_lines(at_parser_handle_t parser);
+
+/**
+ * @brief Set the clock that the parser uses.
+ * 
+ * @param parser The parser to set the clock on.
+ * @param clock The clock hook, or NULL to remove it (not while data mode with a guard time is active).
+ * @param userdata The userdata that is passed to the clock.
+ * @return int 0 on success, other on error.
+ */
+extern int at_parser_set_clock(at_parser_handle_t parser, at_parser_clock clock, void *userdata);
+
+/**
+ * @brief Set the writer that is used for the responses of the parser.
+ * 
+ * @param parser The parser to set the writer on.
+ * @param writer The writer, or NULL to remove it.
+ * @param userdata The userdata that is passed to the writer.
+ * @return int 0 on success, other on error.
+ */
+extern int at_parser_set_response_writer(at_parser_handle_t parser, at_parser_response_writer writer, void *userdata);
+
+/**
+ * @brief Get the writer that is used for the responses of the parser.
+ * 
+ * @param parser The parser to get the writer of.
+ * @param writer The location to store the writer (NULL when there is none).
+ * @param userdata The location to store the userdata of the writer.
+ * @return int 0 on success, other on error.
+ */
+extern int at_parser_get_response_writer(at_parser_handle_t parser, at_parser_response_writer *writer, void **userdata);
+
+/**
+ * @brief Write (a part of) a response through the writer of the parser.
+ * @details Handlers should use this instead of writing to the transport themselves, so the response can be cached or scheduled.
+ * 
+ * @param parser The parser to write the response for.
+ * @param data The response data.
+ * @param length The length of the response data.
+ * @return int 0 on success, other on error (e.g. no writer set).
+ */
+extern int at_parser_write_response(at_parser_handle_t parser, const char *data, size_t length);
+
+/**
+ * @brief Enable flow control signaling on the parser.
+ * 
+ * @param parser The parser to configure.
+ * @param config The watermarks and callback to use (copied), or NULL to disable flow control.
+ * @return int 0 on success, other on error.
+ */
+extern int at_parser_set_flow_control(at_parser_handle_t parser, const struct at_parser_flow_control_config *config);
+
+/**
+ * @brief Report the amount of commands that are waiting in the application (downstream) queue.
+ * 
+ * @param parser The parser the commands came from.
+ * @param pending The current amount of pending commands.
+ * @return int 0 on success, other on error.
+ */
+extern int at_parser_update_pending_commands(at_parser_handle_t parser, size_t pending);
+
+/**
+ * @brief Get the current flow control state of the parser.
+ * 
+ * @param parser The parser to get the state of.
+ * @return enum at_parser_flow_state The current state, AT_PARSER_FLOW_RESUME when flow control is disabled.
+ */
+extern enum at_parser_flow_state at_parser_get_flow_state(at_parser_handle_t parser);
+
+/**
+ * @brief Processes a single complete line in place, without copying it into the internal buffer.
+ * @details The internal buffer is not touched, so this can be used on memory that holds whole lines already (e.g. a mapped file).
+ * 
+ * @param parser The parser to process the line with.
+ * @param line The line to process, without the trailing \r\n.
+ * @param line_len The length of the line.
+ * @return int 0 on success, other on error.
+ */
+extern int at_parser_process_line(at_parser_handle_t parser, const char* line, size_t line_len);
+
+/**
+ * @brief Dispatches a command that was parsed elsewhere to the handlers, as if the parser parsed it itself.
+ * @details Used to replay commands that were parsed ahead of time (e.g. on another thread) in the right order.
+ * 
+ * @param parser The parser to dispatch the command with.
+ * @param command_name The name of the command, it doesn't have to be NULL terminated.
+ * @param command_name_length The length of the name.
+ * @param type The type of the command.
+ * @param argument_list The arguments of the command, may be NULL when there are none.
+ * @param argument_list_length The amount of arguments.
+ * @return int 0 on success, other on error.
+ */
+extern int at_parser_dispatch_command(at_parser_handle_t parser, const char* command_name, size_t command_name_length, enum at_parser_command_type type, struct at_parser_argument *argument_list, size_t argument_list_length);
+
+/**
+ * @brief Get the free part of the internal buffer, so data can be read into the parser without an intermediate copy.
+ * @details When the internal buffer is full, the same bytes are dropped as at_parser_process_buffer would.
+ * Write at most available bytes into the buffer and hand them to the parser with at_parser_commit_ingest.
+ * 
+ * @param parser The parser to get the buffer from.
+ * @param buffer The location to store the start of the free buffer part.
+ * @param available The location to store the amount of free bytes.
+ * @return int 0 on success, other on error.
+ */
+extern int at_parser_get_ingest_buffer(at_parser_handle_t parser, char **buffer, size_t *available);
+
+/**
+ * @brief Processes the bytes that were written into the buffer returned by at_parser_get_ingest_buffer.
+ * 
+ * @param parser The parser to ingest the new data.
+ * @param length The amount of bytes that were written.
+ * @return int 0 on success, other on error.
+ */
+extern int at_parser_commit_ingest(at_parser_handle_t parser, size_t length);
+
+/**
+ * @brief Get the id of a command in a frozen registry, used to address the command in binary frames.
+ * @details The id is the position of the name in the sorted registry, so it is the same for every registry that
+ * is built from the same set of command names.
+ * 
+ * @param registry The frozen registry.
+ * @param command_name The name of the command.
+ * @param id The location to store the id.
+ * @return int 0 on success, other on error (e.g. unknown command).
+ */
+extern int at_parser_registry_get_command_id(at_parser_registry_handle_t registry, const char* command_name, uint16_t *id);
+
+/**
+ * @brief Enable or disable binary command frames on a parser.
+ * @details When enabled, a line that starts with AT_PARSER_BINARY_FRAME_START is a binary frame. The frame is dispatched
+ * to the handlers of the command in the attached registry and the parser itself, without scanning or unescaping
+ * the arguments. Text lines and binary frames can be mixed on the same stream. Frames must fit in the parser buffer
+ * (or the max_size of its buffer policy), frames with an unknown command id are dropped.
+ * 
+ * @param parser The parser to configure.
+ * @param enabled True to recognise binary frames.
+ * @return int 0 on success, other on error.
+ */
+extern int at_parser_set_binary_framing(at_parser_handle_t parser, bool enabled);
+
+/**
+ * @brief Encode a binary command frame.
+ * 
+ * @param buffer The buffer to encode the frame in.
+ * @param buffer_len The size of the buffer.
+ * @param command_id The id of the command, see at_parser_registry_get_command_id.
+ * @param type The type of the command.
+ * @param argument_list The arguments, at most 255 with at most 65535 bytes each.
+ * @param argument_list_length The amount of arguments.
+ * @param frame_length The location to store the length of the encoded frame.
+ * @return int 0 on success, other on error (e.g. the buffer is too small).
+ */
+extern int at_parser_encode_binary_frame(char *buffer, size_t buffer_len, uint16_t command_id, enum at_parser_command_type type, const struct at_parser_argument *argument_list, size_t argument_list_length, size_t *frame_length);
+
+/**
+ * @brief Enable or disable batched dispatch on a parser.
+ * @details In batch mode the parsed commands (text lines and binary frames) are not passed to the command handlers and
+ * the registry, but collected and passed to the batch handler in one call at the end of each call that feeds the parser
+ * (at_parser_process_buffer, at_parser_commit_ingest, ...), or sooner when max_batch commands are collected.
+ * The batch is ordered on QoS class (highest first, in arrival order within a class, see at_parser_set_command_qos).
+ * After the handler returns, the response and result code of every command are written with the response writer in
+ * that same order. A V.250 peer matches responses to its commands by order, so once commands have different classes
+ * it can only match them when the responses are tagged (e.g. with the command name in the information response).
+ * The batch handler must not feed the parser it is called from.
+ * 
+ * @param parser The parser to configure.
+ * @param handler The batch handler, or NULL to dispatch every command to its handlers again.
+ * @param userdata The userdata that is passed to the batch handler.
+ * @param max_batch The maximum amount of commands in a batch, 0 for no limit.
+ * @return int 0 on success, other on error.
+ */
+extern int at_parser_set_batch_handler(at_parser_handle_t parser, at_parser_batch_handler handler, void *userdata, size_t max_batch);
+
+/**
+ * @brief Set the QoS class of a command (AT_PARSER_QOS_NORMAL by default).
+ * @details In batch mode a batch is passed to the batch handler ordered on QoS class (highest first, in arrival order
+ * within a class), so the responses are written in that order too. An abort command cancels the queued commands that
+ * aren't abort commands, they are answered with "ERROR\r\n", and the batch is dispatched right away instead of at the
+ * end of the call. Without batch mode every command is dispatched as soon as it is parsed, so the class has no effect.
+ * 
+ * @param parser The parser.
+ * @param command_name The name of the command (copied).
+ * @param qos The QoS class.
+ * @return int 0 on success, other on error.
+ */
+extern int at_parser_set_command_qos(at_parser_handle_t parser, const char *command_name, enum at_parser_qos_class qos);
+
+/**
+ * @brief Get the statistics of a QoS class.
+ * 
+ * @param parser The parser.
+ * @param qos The QoS class.
+ * @param stats The location to store the statistics.
+ * @return int 0 on success, other on error.
+ */
+extern int at_parser_get_qos_stats(at_parser_handle_t parser, enum at_parser_qos_class qos, struct at_parser_qos_stats *stats);
+
+/**
+ * @brief Clear the statistics of every QoS class, the depth of the queued commands is kept.
+ * 
+ * @param parser The parser.
+ * @return int 0 on success, other on error.
+ */
+extern int at_parser_clear_qos_stats(at_parser_handle_t parser);
+
+/**
+ * @brief Switch the parser to body mode, for commands that take free text after a prompt (e.g. AT+CMGS).
+ * @details Call it from a command handler, the prompt ("\r\n> ") is written with the response writer (the output scheduler
+ * writes the response up to the prompt right away). Everything after
+ * the command line is passed to the body handler in chunks (straight from the fed buffers, not copied) until Ctrl-Z
+ * ends it or ESC cancels it. Then the parser continues parsing commands right after that byte.
+ * The body handler gets exactly one AT_PARSER_BODY_END, AT_PARSER_BODY_CANCEL or AT_PARSER_BODY_OVERFLOW event, body mode
+ * is left before that event so the handler can enter it again. Not available in batch mode.
+ * 
+ * @param parser The parser.
+ * @param handler The body handler.
+ * @param userdata The userdata that is passed to the body handler.
+ * @param max_length The maximum length of the body, 0 for no limit.
+ * @return int 0 on success, other on error.
+ */
+extern int at_parser_enter_body_mode(at_parser_handle_t parser, at_parser_body_handler handler, void *userdata, size_t max_length);
+
+/**
+ * @brief Check if the parser is in body mode.
+ * 
+ * @param parser The parser.
+ * @return true The parser passes everything to the body handler.
+ * @return false The parser parses commands.
+ */
+extern bool at_parser_is_in_body_mode(at_parser_handle_t parser);
+
+/**
+ * @brief Switch the parser to (transparent) data mode.
+ * @details Everything after the current command line (when called from a handler) is passed to the sink without
+ * buffering or parsing it, until the escape sequence "+++" is received. With a guard time the "+++" must follow at least
+ * guard_time ticks of silence (see at_parser_set_clock), its bytes must be less than guard_time apart, and it only escapes
+ * after guard_time ticks of silence after it (see at_parser_poll_data_mode). A "+++" that doesn't escape is passed to the
+ * sink. On escape "OK\r\n" is written and the parser parses commands again, starting right after the "+++".
+ * Not available in batch mode or body mode.
+ * 
+ * @param parser The parser.
+ * @param config The configuration (copied).
+ * @return int 0 on success, other on error (e.g. a guard time without a clock).
+ */
+extern int at_parser_enter_data_mode(at_parser_handle_t parser, const struct at_parser_data_mode_config *config);
+
+/**
+ * @brief Switch the parser back to command mode without the escape sequence (e.g. when the connection is closed).
+ * 
+ * @param parser The parser.
+ * @return int 0 on success, other on error.
+ */
+extern int at_parser_leave_data_mode(at_parser_handle_t parser);
+
+/**
+ * @brief Check the guard time after a received "+++", call it periodically in data mode when a guard time is used.
+ * 
+ * @param parser The parser.
+ * @return int 0 on success, other on error.
+ */
+extern int at_parser_poll_data_mode(at_parser_handle_t parser);
+
+/**
+ * @brief Check if the parser is in data mode.
+ * 
+ * @param parser The parser.
+ * @return true The parser passes everything to the data sink.
+ * @return false The parser parses commands.
+ */
+extern bool at_parser_is_in_data_mode(at_parser_handle_t parser);
+
+/**
+ * @brief Enable or disable early rejection of unknown commands.
+ * @details The command name of a line is matched against the command handlers, the (frozen) registry and the command
+ * table while the line is still arriving. As soon as no command can match, the rest of the line is skipped without
+ * buffering it and "ERROR\r\n" is written at the line end. Complete lines with an unknown command are answered with
+ * "ERROR\r\n" as well. Lines that don't start with "AT+" are skipped silently, like they are ignored without early
+ * rejection. In batch mode every command name is passed to the batch handler, so only those lines are skipped.
+ *
+ * @param parser The parser.
+ * @param enabled True to reject unknown commands early.
+ * @return int 0 on success, other on error.
+ */
+extern int at_parser_set_early_reject(at_parser_handle_t parser, bool enabled);
+
+/**
+ * @brief Let the buffer size of a parser follow the received lines.
+ * @details When a line or binary frame doesn't fit the buffer, the buffer is doubled (up to max_size) instead of dropping
+ * bytes. When the last shrink_after lines (binary frames included) would all fit a quarter of the buffer, it is halved
+ * (down to min_size) as far as that holds. The buffer is only resized between calls that feed the parser, so handlers
+ * never see it move (don't call this function from a handler either).
+ * 
+ * @param parser The parser.
+ * @param policy The policy (copied), NULL to keep the current buffer size.
+ * @return int 0 on success, other on error (e.g. min_size is 0 or larger than max_size, or allocation failed).
+ */
+extern int at_parser_set_buffer_policy(at_parser_handle_t parser, const struct at_parser_buffer_policy *policy);
+
+/**
+ * @brief Get the current buffer size of a parser.
+ * 
+ * @param parser The parser.
+ * @return size_t The buffer size, 0 on error.
+ */
+extern size_t at_parser_get_buffer_size(at_parser_handle_t parser);
+
+/**
+ * @brief Get the histogram of the line lengths a parser received.
+ * 
+ * @param parser The parser.
+ * @param histogram The location to store the histogram.
+ * @return int 0 on success, other on error.
+ */
+extern int at_parser_get_line_histogram(at_parser_handle_t parser, struct at_parser_line_histogram *histogram);
+
+/**
+ * @brief Clear the histogram of the line lengths a parser received.
+ * 
+ * @param parser The parser.
+ * @return int 0 on success, other on error.
+ */
+extern int at_parser_clear_line_histogram(at_parser_handle_t parser);
+
+/**
+ * @brief Keep a history of the recently parsed commands.
+ * @details The name, type and parsed arguments of the last depth command lines are kept in memory owned by the parser.
+ * A line that is byte for byte the same as one in the history (found by hash, then compared) is dispatched with the
+ * arguments that were parsed before, without parsing it again. The V.250 "A/" (which needs no line end) repeats the
+ * last dispatched command, or writes "ERROR\r\n" when there is none. Handlers get the arguments of the history, so
+ * they must not change the argument list.
+ * 
+ * @param parser The parser.
+ * @param depth The amount of commands to keep, 0 to disable the history (and "A/").
+ * @return int 0 on success, other on error.
+ */
+extern int at_parser_set_history(at_parser_handle_t parser, size_t depth);
+
+/**
+ * @brief Get the amount of commands that were dispatched from the history (repeated lines and "A/").
+ * 
+ * @param parser The parser.
+ * @return size_t The amount of commands.
+ */
+extern size_t at_parser_get_history_hits(at_parser_handle_t parser);
+
 #ifdef __cplusplus
 }
 #endif // __cplusplus
@@ -0,0 +1,169 @@
+/**
+ * @file at_parser_cache.h
+ * @author Giel Willemsen
+ * @brief TTL response cache with request coalescing for polled commands.
+ * @version 0.1
+ * @date 2023-06-14
+ *
+ * @copyright Copyright (c) 2023, See LICENSE
+ *
+ */
+#ifndef AT_PARSER_CACHE_H
+#define AT_PARSER_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "at_parser/at_parser.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+typedef struct at_parser_cache* at_parser_cache_handle_t;
+typedef struct at_parser_cache_entry* at_parser_cache_ticket_t;
+
+/**
+ * @brief Counters of the cache.
+ *
+ */
+struct at_parser_cache_stats
+{
+    size_t hits;        ///< Requests answered from a cached response.
+    size_t static_hits; ///< Requests answered from a static response.
+    size_t misses;      ///< Requests that called the handler.
+    size_t coalesced;   ///< Requests that waited on an identical request that was still being computed.
+};
+
+/**
+ * @brief Construct a new response cache.
+ * @details The cache can be shared by many parsers. Responses are cached on the command, the command type and the argument bytes.
+ *
+ * @param cache The resulting handle location.
+ * @param max_entries The maximum amount of cached responses.
+ * @param clock The clock used for the time to live of the responses.
+ * @param clock_userdata The userdata that is passed to the clock.
+ * @return int 0 on success, other on error.
+ */
+extern int at_parser_cache_create(at_parser_cache_handle_t *cache, size_t max_entries, at_parser_clock clock, void *clock_userdata);
+
+/**
+ * @brief Cleans up any resources allocated by the cache.
+ * @note All parsers the cache is attached to should be freed or detached first.
+ *
+ * @param cache The cache to delete.
+ */
+extern void at_parser_cache_free(at_parser_cache_handle_t cache);
+
+/**
+ * @brief Add a command whose responses are cached.
+ * @details The handler must write its response with at_parser_write_response, that's what gets cached.
+ * Commands must be added before the cache is attached.
+ *
+ * @param cache The cache to add the command to.
+ * @param command_name The name of the AT command (AT+<command_name>), only one handler per name.
+ * @param handler The handler that computes the response.
+ * @param userdata The userdata that is passed to the handler.
+ * @param ttl The time (in clock ticks) that a response stays valid.
+ * @return int 0 on success, other on error.
+ */
+extern int at_parser_cache_add_command(at_parser_cache_handle_t cache, const char *command_name, at_parser_received_command handler, void *userdata, uint32_t ttl);
+
+/**
+ * @brief Set a precomputed response for a command type, the handler is never called for that type.
+ * @details Meant for static answers such as the `AT+<command>=?` (AT_PARSER_COMMAND_TYPE_QUERY) form.
+ *
+ * @param cache The cache the command is added to.
+ * @param command_name The name of the command.
+ * @param type The command type to answer statically.
+ * @param response The response (copied).
+ * @param length The length of the response.
+ * @return int 0 on success, other on error.
+ */
+extern int at_parser_cache_set_static_response(at_parser_cache_handle_t cache, const char *command_name, enum at_parser_command_type type, const char *response, size_t length);
+
+/**
+ * @brief Register the cached commands on a parser.
+ *
+ * @param cache The cache with the commands.
+ * @param parser The parser to register them on.
+ * @return int 0 on success, other on error.
+ */
+extern int at_parser_cache_attach_parser(at_parser_cache_handle_t cache, at_parser_handle_t parser);
+
+/**
+ * @brief Remove the cached commands from a parser.
+ * @details Deferred responses that the parser is waiting on are no longer written to it.
+ * A parser must be detached before it is freed while the cache is in use, also when its commands come from a registry.
+ *
+ * @param cache The cache with the commands.
+ * @param parser The parser to remove them from.
+ * @return int 0 on success, other on error.
+ */
+extern int at_parser_cache_detach_parser(at_parser_cache_handle_t cache, at_parser_handle_t parser);
+
+/**
+ * @brief Register the cached commands in a registry (that is not frozen yet).
+ *
+ * @param cache The cache with the commands.
+ * @param registry The registry to register them in.
+ * @return int 0 on success, other on error.
+ */
+extern int at_parser_cache_attach_registry(at_parser_cache_handle_t cache, at_parser_registry_handle_t registry);
+
+/**
+ * @brief Drop the cached responses of a command.
+ * @details Responses that are still being computed are delivered, but not cached.
+ *
+ * @param cache The cache to invalidate.
+ * @param command_name The command to invalidate, or NULL for all commands.
+ * @return int 0 on success, other on error.
+ */
+extern int at_parser_cache_invalidate(at_parser_cache_handle_t cache, const char *command_name);
+
+/**
+ * @brief Set how long identical requests are coalesced on a deferred response.
+ * @details Once the timeout passes, the next identical request calls the handler again and the overdue response isn't cached.
+ * Requests that were already coalesced still get the overdue response when its ticket is completed.
+ *
+ * @param cache The cache to configure.
+ * @param timeout The time (in clock ticks) after deferring, 0 to wait for the ticket without a limit (the default).
+ * @return int 0 on success, other on error.
+ */
+extern int at_parser_cache_set_pending_timeout(at_parser_cache_handle_t cache, uint32_t timeout);
+
+/**
+ * @brief Defer the response of the command that is currently being handled.
+ * @details Only valid from within a cached handler. Identical requests that arrive before the ticket is completed
+ * are coalesced and get the response once it is completed, see at_parser_cache_set_pending_timeout.
+ * Every ticket must be completed, also when it is overdue.
+ *
+ * @param cache The cache that called the handler.
+ * @return at_parser_cache_ticket_t The ticket to complete the response with, NULL when not called from a cached handler.
+ */
+extern at_parser_cache_ticket_t at_parser_cache_defer(at_parser_cache_handle_t cache);
+
+/**
+ * @brief Complete a deferred response, it is written to every parser that requested it and cached.
+ *
+ * @param cache The cache that deferred the response.
+ * @param ticket The ticket from at_parser_cache_defer.
+ * @param response The (remaining part of the) response.
+ * @param length The length of the response.
+ * @return int 0 on success, other on error.
+ */
+extern int at_parser_cache_complete(at_parser_cache_handle_t cache, at_parser_cache_ticket_t ticket, const char *response, size_t length);
+
+/**
+ * @brief Get the counters of the cache.
+ *
+ * @param cache The cache to get the counters of.
+ * @param stats The location to store the counters.
+ * @return int 0 on success, other on error.
+ */
+extern int at_parser_cache_get_stats(at_parser_cache_handle_t cache, struct at_parser_cache_stats *stats);
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
+
+#endif // AT_PARSER_CACHE_H
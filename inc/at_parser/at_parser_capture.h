@@ -0,0 +1,100 @@
+/**
+ * @file at_parser_capture.h
+ * @author Giel Willemsen
+ * @brief Parallel, in place parsing of (memory mapped) capture files for offline analysis.
+ * @version 0.1
+ * @date 2023-06-14
+ *
+ * @copyright Copyright (c) 2023, See LICENSE
+ *
+ */
+#ifndef AT_PARSER_CAPTURE_H
+#define AT_PARSER_CAPTURE_H
+
+#include <stddef.h>
+#include "at_parser/at_parser.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+/**
+ * @brief The order in which the handlers are called for the parsed commands.
+ *
+ */
+enum at_parser_capture_order
+{
+    /**
+     * @brief Chunks are parsed in parallel, the commands are dispatched from the calling thread in file order.
+     * The parsed commands of every chunk are kept until all chunks are parsed, so this needs memory for all the commands in the capture.
+     */
+    AT_PARSER_CAPTURE_ORDER_GLOBAL,
+    /**
+     * @brief Chunks are parsed and dispatched in parallel, handlers are called concurrently from the worker threads.
+     * Within a chunk the commands are dispatched in file order.
+     */
+    AT_PARSER_CAPTURE_ORDER_PER_CHUNK,
+};
+
+/**
+ * @brief Options for processing a capture.
+ *
+ */
+struct at_parser_capture_options
+{
+    size_t thread_count;                ///< The amount of worker threads (and chunks), 0 to use all online cores.
+    enum at_parser_capture_order order; ///< The order in which handlers are called.
+    size_t max_line_length;             ///< Longer lines are skipped, like they would overflow a parser buffer. 0 for no limit.
+    char escape_char;                   ///< The character that can be used to escape quote's in the set arguments.
+    char arg_separator;                 ///< The character used to separate arguments in the set command.
+};
+
+/**
+ * @brief Statistics about a processed capture.
+ *
+ */
+struct at_parser_capture_result
+{
+    size_t chunk_count;   ///< The amount of chunks the capture was split in.
+    size_t line_count;    ///< The amount of lines in the capture.
+    size_t command_count; ///< The amount of lines that were dispatched as a command.
+};
+
+/**
+ * @brief Memory maps a capture file and processes it in place with at_parser_capture_process_memory.
+ *
+ * @param path The path of the capture file.
+ * @param registry The frozen registry with the handlers for the commands.
+ * @param options The options for processing the capture.
+ * @param result Optional location to store statistics about the capture.
+ * @return int 0 on success, other on error.
+ */
+extern int at_parser_capture_process_file(const char *path, at_parser_registry_handle_t registry, const struct at_parser_capture_options *options, struct at_parser_capture_result *result);
+
+/**
+ * @brief Processes a capture that is already in memory, the lines are parsed in place without copying them.
+ * @details The capture is split on line boundaries in a chunk per thread. Lines end with \n, an optional \r before it is ignored.
+ * Handlers receive the parser of the thread that dispatches the command and can use at_parser_capture_current_chunk to get the chunk.
+ *
+ * @param data The capture data.
+ * @param length The length of the capture data.
+ * @param registry The frozen registry with the handlers for the commands.
+ * @param options The options for processing the capture.
+ * @param result Optional location to store statistics about the capture.
+ * @return int 0 on success, other on error.
+ */
+extern int at_parser_capture_process_memory(const char *data, size_t length, at_parser_registry_handle_t registry, const struct at_parser_capture_options *options, struct at_parser_capture_result *result);
+
+/**
+ * @brief Get the index of the chunk that the current thread is dispatching commands for.
+ * @details Only valid when called from within a handler that is called by the capture processing.
+ *
+ * @return size_t The index of the chunk.
+ */
+extern size_t at_parser_capture_current_chunk(void);
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
+
+#endif // AT_PARSER_CAPTURE_H
@@ -0,0 +1,83 @@
+/**
+ * @file at_parser_checksum.h
+ * @author Giel Willemsen
+ * @brief Optional checksum suffix on command lines, for noisy links.
+ * @version 0.1
+ * @date 2023-06-14
+ *
+ * @copyright Copyright (c) 2023, See LICENSE
+ *
+ */
+#ifndef AT_PARSER_CHECKSUM_H
+#define AT_PARSER_CHECKSUM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "at_parser/at_parser.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+/**
+ * @brief The character between a command line and its checksum, e.g. "AT+CSQ*1A".
+ *
+ */
+#define AT_PARSER_CHECKSUM_SEPARATOR '*'
+
+/**
+ * @brief The checksum algorithms, the checksum is written as a fixed amount of hexadecimal digits (either case).
+ *
+ */
+enum at_parser_checksum_type
+{
+    AT_PARSER_CHECKSUM_NONE,   ///< No checksum.
+    AT_PARSER_CHECKSUM_XOR,    ///< XOR of all bytes, 2 digits.
+    AT_PARSER_CHECKSUM_CRC16,  ///< CRC-16/CCITT-FALSE (poly 0x1021, init 0xFFFF), 4 digits.
+    AT_PARSER_CHECKSUM_CRC32,  ///< CRC-32 (IEEE 802.3, as used by zlib), 8 digits.
+    AT_PARSER_CHECKSUM_CRC32C, ///< CRC-32C (Castagnoli), 8 digits, uses the SSE4.2 crc32 instruction when the CPU has it.
+};
+
+/**
+ * @brief Get the amount of hexadecimal digits of a checksum.
+ *
+ * @param type The checksum algorithm.
+ * @return size_t The amount of digits, 0 for AT_PARSER_CHECKSUM_NONE.
+ */
+extern size_t at_parser_checksum_get_digits(enum at_parser_checksum_type type);
+
+/**
+ * @brief Compute a checksum, e.g. to add it to a command line that is sent to a parser.
+ *
+ * @param type The checksum algorithm.
+ * @param data The data (the command line without the separator and line end).
+ * @param length The length of the data.
+ * @return uint32_t The checksum.
+ */
+extern uint32_t at_parser_checksum_compute(enum at_parser_checksum_type type, const char *data, size_t length);
+
+/**
+ * @brief Require a checksum suffix on every command line of a parser.
+ * @details A line is "<command line>*<checksum>", the checksum covers everything in front of the separator.
+ * Lines with a missing or wrong checksum are dropped (and counted) before they are dispatched.
+ * Binary frames, bodies and data mode are not affected.
+ *
+ * @param parser The parser.
+ * @param type The checksum algorithm, AT_PARSER_CHECKSUM_NONE to parse lines without a checksum again.
+ * @return int 0 on success, other on error.
+ */
+extern int at_parser_set_line_checksum(at_parser_handle_t parser, enum at_parser_checksum_type type);
+
+/**
+ * @brief Get the amount of lines that a parser dropped because of their checksum.
+ *
+ * @param parser The parser.
+ * @return size_t The amount of lines.
+ */
+extern size_t at_parser_get_checksum_failures(at_parser_handle_t parser);
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
+
+#endif // AT_PARSER_CHECKSUM_H
@@ -0,0 +1,150 @@
+/**
+ * @file at_parser_cmux.h
+ * @author Giel Willemsen
+ * @brief 3GPP TS 27.010 (CMUX) multiplexer layer that feeds a parser per DLC.
+ * @version 0.1
+ * @date 2023-06-14
+ *
+ * @copyright Copyright (c) 2023, See LICENSE
+ *
+ */
+#ifndef AT_PARSER_CMUX_H
+#define AT_PARSER_CMUX_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "at_parser/at_parser.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+typedef struct at_parser_cmux* at_parser_cmux_handle_t;
+
+/**
+ * @brief The framing option of the multiplexer.
+ *
+ */
+enum at_parser_cmux_mode
+{
+    AT_PARSER_CMUX_MODE_BASIC,    ///< Frames delimited by 0xF9 with a length field.
+    AT_PARSER_CMUX_MODE_ADVANCED, ///< Frames delimited by 0x7E with 0x7D transparency (byte stuffing).
+};
+
+/**
+ * @brief Callback that writes the muxed frames to the physical link.
+ *
+ */
+typedef void (*at_parser_cmux_writer)(at_parser_cmux_handle_t mux, void *userdata, const char *data, size_t length);
+
+/**
+ * @brief Counters of the multiplexer.
+ *
+ */
+struct at_parser_cmux_stats
+{
+    size_t frames;      ///< Valid frames that were received.
+    size_t reassembled; ///< Frames that were split over multiple calls and had to be copied before they could be decoded.
+    size_t fcs_errors;  ///< Frames that were dropped because of a wrong FCS.
+    size_t discarded;   ///< Information frames that were dropped because their DLC isn't open.
+};
+
+/**
+ * @brief Construct a new multiplexer.
+ * @details The multiplexer acts as the responding station, it accepts the DLCs that the other side opens with SABM.
+ *
+ * @param mux The resulting handle location.
+ * @param mode The framing option.
+ * @param max_frame_size The maximum amount of information bytes in a frame (N1), between 1 and 32767.
+ * @param writer The callback that writes the outgoing frames.
+ * @param userdata The userdata that is passed to the writer.
+ * @return int 0 on success, other on error.
+ */
+extern int at_parser_cmux_create(at_parser_cmux_handle_t *mux, enum at_parser_cmux_mode mode, size_t max_frame_size, at_parser_cmux_writer writer, void *userdata);
+
+/**
+ * @brief Cleans up any resources allocated by the multiplexer.
+ * @note The parsers of the DLCs are not freed, but their response writer is removed.
+ *
+ * @param mux The multiplexer to delete.
+ */
+extern void at_parser_cmux_free(at_parser_cmux_handle_t mux);
+
+/**
+ * @brief Attach a parser to a DLC, the payload of the DLC is fed to the parser and its responses are sent on the DLC.
+ * @details The response writer of the parser is replaced by the multiplexer.
+ *
+ * @param mux The multiplexer.
+ * @param dlci The DLC, between 1 and 63 (DLC 0 is the control channel).
+ * @param parser The parser for the DLC.
+ * @return int 0 on success, other on error.
+ */
+extern int at_parser_cmux_attach(at_parser_cmux_handle_t mux, uint8_t dlci, at_parser_handle_t parser);
+
+/**
+ * @brief Detach the parser of a DLC, the DLC is closed.
+ *
+ * @param mux The multiplexer.
+ * @param dlci The DLC.
+ * @return int 0 on success, other on error.
+ */
+extern int at_parser_cmux_detach(at_parser_cmux_handle_t mux, uint8_t dlci);
+
+/**
+ * @brief Check if the other side opened a DLC.
+ *
+ * @param mux The multiplexer.
+ * @param dlci The DLC.
+ * @return true The DLC is open.
+ * @return false The DLC is closed.
+ */
+extern bool at_parser_cmux_is_open(at_parser_cmux_handle_t mux, uint8_t dlci);
+
+/**
+ * @brief Demultiplex data received from the physical link.
+ * @details Frames that are completely inside the data are decoded in place and their payload is passed to the parser
+ * of the DLC without copying it. Only a frame that is split over multiple calls is buffered.
+ * The output generated while processing (responses and control frames) is written with one writer call at the end.
+ *
+ * @param mux The multiplexer.
+ * @param data The received data.
+ * @param length The length of the data.
+ * @return int 0 on success, other on error.
+ */
+extern int at_parser_cmux_process(at_parser_cmux_handle_t mux, const char *data, size_t length);
+
+/**
+ * @brief Queue data to be sent on a DLC, it is split in frames of at most max_frame_size bytes.
+ * @details The frames are written by at_parser_cmux_flush, or at the end of at_parser_cmux_process.
+ *
+ * @param mux The multiplexer.
+ * @param dlci The DLC, it must be open.
+ * @param data The data to send.
+ * @param length The length of the data.
+ * @return int 0 on success, other on error.
+ */
+extern int at_parser_cmux_write(at_parser_cmux_handle_t mux, uint8_t dlci, const char *data, size_t length);
+
+/**
+ * @brief Write all queued frames with a single writer call.
+ *
+ * @param mux The multiplexer.
+ * @return int 0 on success, other on error.
+ */
+extern int at_parser_cmux_flush(at_parser_cmux_handle_t mux);
+
+/**
+ * @brief Get the counters of the multiplexer.
+ *
+ * @param mux The multiplexer.
+ * @param stats The location to store the counters.
+ * @return int 0 on success, other on error.
+ */
+extern int at_parser_cmux_get_stats(at_parser_cmux_handle_t mux, struct at_parser_cmux_stats *stats);
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
+
+#endif // AT_PARSER_CMUX_H
@@ -0,0 +1,138 @@
+/**
+ * @file at_parser_command_table.h
+ * @author Giel Willemsen
+ * @brief Read only command tables, generated offline by at_parser_gen from a command spec.
+ * @version 0.1
+ * @date 2023-06-14
+ *
+ * @copyright Copyright (c) 2023, See LICENSE
+ *
+ */
+#ifndef AT_PARSER_COMMAND_TABLE_H
+#define AT_PARSER_COMMAND_TABLE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "at_parser/at_parser.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+/**
+ * @brief The bit of a command type in at_parser_table_command::types.
+ *
+ */
+#define AT_PARSER_COMMAND_TYPE_BIT(type) (1u << (type))
+
+/**
+ * @brief The kind of value an argument must have.
+ *
+ */
+enum at_parser_argument_kind
+{
+    AT_PARSER_ARGUMENT_INTEGER, ///< A decimal integer between min and max (inclusive).
+    AT_PARSER_ARGUMENT_STRING,  ///< A string with a length between min and max (inclusive), after removing the quotes.
+};
+
+/**
+ * @brief The schema of a single argument of a SET command.
+ *
+ */
+struct at_parser_argument_schema
+{
+    enum at_parser_argument_kind kind;
+    bool optional; ///< An optional argument may be left out or empty, only trailing arguments can be optional.
+    int32_t min;   ///< The minimum value, or the minimum length of a string.
+    int32_t max;   ///< The maximum value, or the maximum length of a string.
+};
+
+/**
+ * @brief A command in a command table.
+ *
+ */
+struct at_parser_table_command
+{
+    const char *name;                                  ///< The name of the command (NULL terminated).
+    size_t name_length;                                ///< The length of the name.
+    uint8_t types;                                     ///< The allowed command types, see AT_PARSER_COMMAND_TYPE_BIT.
+    const struct at_parser_argument_schema *arguments; ///< The arguments of a SET command.
+    size_t argument_count;                             ///< The amount of arguments.
+    size_t required_arguments;                         ///< The amount of arguments that are not optional.
+    const char *help_response;                         ///< The complete answer (result code included) to "=?", NULL to call the handler.
+    size_t help_response_length;                       ///< The length of the help response.
+    at_parser_received_command handler;                ///< Called for commands that pass the checks.
+};
+
+/**
+ * @brief A command table with a collision free (perfect) hash on the command names.
+ *
+ */
+struct at_parser_command_table
+{
+    const struct at_parser_table_command *commands; ///< The commands.
+    size_t command_count;                           ///< The amount of commands.
+    const uint16_t *slots;                          ///< For every hash slot the index of the command + 1, 0 for an empty slot.
+    size_t slot_mask;                               ///< The amount of slots - 1, the amount of slots is a power of two.
+    uint32_t seed;                                  ///< The seed that makes the hash collision free for this table.
+};
+
+/**
+ * @brief The hash that is used for the slots of a command table (seeded FNV-1a).
+ *
+ * @param seed The seed of the table.
+ * @param name The name of the command.
+ * @param name_length The length of the name.
+ * @return uint32_t The hash, masked with the slot mask to get the slot.
+ */
+static inline uint32_t at_parser_command_table_hash(uint32_t seed, const char *name, size_t name_length)
+{
+    uint32_t hash = 2166136261u ^ seed;
+    for (size_t i = 0; i < name_length; i++)
+    {
+        hash ^= (uint8_t)name[i];
+        hash *= 16777619u;
+    }
+    return hash ^ (hash >> 15); // Fold the better mixed high bits into the low bits that are used as slot.
+}
+
+/**
+ * @brief Find a command in a command table.
+ *
+ * @param table The command table.
+ * @param name The name of the command (doesn't have to be NULL terminated).
+ * @param name_length The length of the name.
+ * @return const struct at_parser_table_command* The command, NULL when it isn't in the table.
+ */
+extern const struct at_parser_table_command *at_parser_command_table_find(const struct at_parser_command_table *table, const char *name, size_t name_length);
+
+/**
+ * @brief Check the arguments of a SET command against the schema of the command.
+ *
+ * @param command The command from the table.
+ * @param argument_list The arguments.
+ * @param argument_list_length The amount of arguments.
+ * @return true The arguments are valid.
+ * @return false The arguments don't match the schema.
+ */
+extern bool at_parser_command_table_validate(const struct at_parser_table_command *command, const struct at_parser_argument *argument_list, size_t argument_list_length);
+
+/**
+ * @brief Attach a command table to a parser, commands in the table are dispatched from it.
+ * @details Commands in the table are handled by the table only, the registry and command handlers of the parser are used for
+ * the other commands. A command with a type that isn't allowed or with invalid arguments is answered with "ERROR\r\n",
+ * "=?" (AT_PARSER_COMMAND_TYPE_QUERY) is answered with the help response when the command has one. Answers go to the response writer.
+ *
+ * @param parser The parser.
+ * @param table The table (usually generated), or NULL to detach it. It must stay valid while attached.
+ * @param userdata The userdata that is passed to the handlers in the table.
+ * @return int 0 on success, other on error.
+ */
+extern int at_parser_attach_command_table(at_parser_handle_t parser, const struct at_parser_command_table *table, void *userdata);
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
+
+#endif // AT_PARSER_COMMAND_TABLE_H
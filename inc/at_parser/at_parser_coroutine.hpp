@@ -0,0 +1,289 @@
+/**
+ * @file at_parser_coroutine.hpp
+ * @author Giel Willemsen
+ * @brief C++20 coroutine wrapper to co_await commands parsed by an AT parser.
+ * @version 0.1
+ * @date 2023-06-14
+ *
+ * @copyright Copyright (c) 2023, See LICENSE
+ *
+ */
+#ifndef AT_PARSER_COROUTINE_HPP
+#define AT_PARSER_COROUTINE_HPP
+
+#include <coroutine>
+#include <deque>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "at_parser/at_parser.h"
+
+namespace at_parser_coroutine
+{
+
+/**
+ * @brief Executor that resumes the awaiting coroutine directly from within the parser callback.
+ * @details Because the coroutine runs before the callback returns, the command is handed out without copying it. The
+ * parser frees the arguments as soon as the coroutine suspends, on anything, and the callback returns.
+ *
+ */
+struct inline_executor
+{
+    static constexpr bool resumes_inline = true;
+
+    void execute(std::coroutine_handle<> handle) const
+    {
+        handle.resume();
+    }
+};
+
+/**
+ * @brief View on a parsed command.
+ * @details The view is only valid until the coroutine's next suspension point (any co_await), copy what is needed after
+ * it. With the inline_executor it points into the parser's argument list.
+ *
+ */
+struct command_view
+{
+    std::string_view name;
+    at_parser_command_type type = AT_PARSER_COMMAND_TYPE_EXECUTE;
+    std::span<const at_parser_argument> arguments;
+
+    /**
+     * @brief Get the argument at index as a string view.
+     *
+     * @param index The index of the argument.
+     * @return std::string_view The argument value.
+     */
+    std::string_view argument(size_t index) const
+    {
+        return std::string_view(arguments[index].value, arguments[index].length);
+    }
+};
+
+/**
+ * @brief Allows a coroutine to co_await the commands that are received by a parser.
+ * @details The session registers itself as handler for every command passed to listen.
+ * Commands that arrive while no coroutine is waiting are queued (copied) in the session.
+ * Only one coroutine should await a session at a time and only one session should exist per parser.
+ *
+ * The executor decides how the awaiting coroutine is resumed. It must provide a `void execute(std::coroutine_handle<>)`
+ * and a `static constexpr bool resumes_inline`. When the executor doesn't resume inline the command is copied once into the
+ * session, since the parser memory is gone by the time the coroutine runs.
+ *
+ * @tparam Executor The executor used to resume the awaiting coroutine.
+ */
+template <typename Executor = inline_executor>
+class session
+{
+public:
+    class awaitable;
+
+    explicit session(at_parser_handle_t parser, Executor executor = Executor()) : parser(parser), executor(std::move(executor))
+    {
+    }
+
+    session(const session &) = delete;
+    session &operator=(const session &) = delete;
+
+    ~session()
+    {
+        for (const std::string &name : names)
+        {
+            at_parser_remove_command_handler(parser, name.c_str(), &session::received_command);
+        }
+    }
+
+    /**
+     * @brief Start listening for the command on the parser.
+     *
+     * @param command_name The name of the AT command to listen to (AT+<command_name>).
+     * @return int 0 on success, other on error.
+     */
+    int listen(const char *command_name)
+    {
+        int rc = at_parser_add_command_handler(parser, command_name, &session::received_command, this);
+        if (rc == 0)
+        {
+            names.emplace_back(command_name);
+        }
+        return rc;
+    }
+
+    /**
+     * @brief Await the next command that is received.
+     *
+     * @return awaitable Resumes with a command_view of the command.
+     */
+    awaitable next_command()
+    {
+        return awaitable(*this, std::nullopt);
+    }
+
+    /**
+     * @brief Await the next command with the given name, other commands stay queued.
+     *
+     * @param command_name The name of the command to wait for.
+     * @return awaitable Resumes with a command_view of the command.
+     */
+    awaitable next_command(std::string_view command_name)
+    {
+        return awaitable(*this, command_name);
+    }
+
+    /**
+     * @brief Get the amount of commands that are queued because nobody was waiting for them.
+     *
+     * @return size_t The amount of queued commands.
+     */
+    size_t queued() const
+    {
+        return pending.size();
+    }
+
+    class awaitable
+    {
+    public:
+        awaitable(session &owner, std::optional<std::string_view> filter) : owner(owner), filter(filter)
+        {
+        }
+
+        bool await_ready()
+        {
+            for (auto it = owner.pending.begin(); it != owner.pending.end(); ++it)
+            {
+                if (matches(it->name))
+                {
+                    owner.current = std::move(*it);
+                    owner.pending.erase(it);
+                    owner.result = owner.current.view();
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        void await_suspend(std::coroutine_handle<> handle)
+        {
+            owner.waiter = this;
+            this->handle = handle;
+        }
+
+        command_view await_resume() const
+        {
+            return owner.result;
+        }
+
+    private:
+        friend class session;
+
+        bool matches(std::string_view name) const
+        {
+            return !filter.has_value() || *filter == name;
+        }
+
+        session &owner;
+        std::optional<std::string_view> filter;
+        std::coroutine_handle<> handle;
+    };
+
+private:
+    struct owned_command
+    {
+        std::string name;
+        at_parser_command_type type = AT_PARSER_COMMAND_TYPE_EXECUTE;
+        std::string data;
+        std::vector<at_parser_argument> arguments;
+
+        owned_command() = default;
+
+        owned_command(const char *command_name, at_parser_command_type type, const at_parser_argument *argument_list, size_t argument_list_length) : name(command_name), type(type)
+        {
+            size_t total = 0;
+            for (size_t i = 0; i < argument_list_length; i++)
+            {
+                total += argument_list[i].length;
+            }
+            data.reserve(total);
+            for (size_t i = 0; i < argument_list_length; i++)
+            {
+                data.append(argument_list[i].value, argument_list[i].length);
+            }
+            arguments.reserve(argument_list_length);
+            for (size_t i = 0; i < argument_list_length; i++)
+            {
+                arguments.push_back({nullptr, argument_list[i].length});
+            }
+            rebase();
+        }
+
+        // The argument values point into data, which may move along with the object (small string optimization).
+        owned_command(owned_command &&other) noexcept : name(std::move(other.name)), type(other.type), data(std::move(other.data)), arguments(std::move(other.arguments))
+        {
+            rebase();
+        }
+
+        owned_command &operator=(owned_command &&other) noexcept
+        {
+            name = std::move(other.name);
+            type = other.type;
+            data = std::move(other.data);
+            arguments = std::move(other.arguments);
+            rebase();
+            return *this;
+        }
+
+        void rebase()
+        {
+            size_t offset = 0;
+            for (at_parser_argument &argument : arguments)
+            {
+                argument.value = data.data() + offset;
+                offset += argument.length;
+            }
+        }
+
+        command_view view() const
+        {
+            return command_view{name, type, arguments};
+        }
+    };
+
+    static void received_command(at_parser_handle_t, void *userdata, const char *command_name, enum at_parser_command_type type, struct at_parser_argument *argument_list, size_t argument_list_length)
+    {
+        session *self = static_cast<session *>(userdata);
+        awaitable *waiter = self->waiter;
+        if (waiter == nullptr || !waiter->matches(command_name))
+        {
+            self->pending.emplace_back(command_name, type, argument_list, argument_list_length);
+            return;
+        }
+        self->waiter = nullptr;
+        if constexpr (Executor::resumes_inline)
+        {
+            self->result = command_view{command_name, type, std::span<const at_parser_argument>(argument_list, argument_list_length)};
+        }
+        else
+        {
+            self->current = owned_command(command_name, type, argument_list, argument_list_length);
+            self->result = self->current.view();
+        }
+        self->executor.execute(waiter->handle);
+    }
+
+    at_parser_handle_t parser;
+    Executor executor;
+    std::vector<std::string> names;
+    std::deque<owned_command> pending;
+    owned_command current;
+    command_view result;
+    awaitable *waiter = nullptr;
+};
+
+} // namespace at_parser_coroutine
+
+#endif // AT_PARSER_COROUTINE_HPP
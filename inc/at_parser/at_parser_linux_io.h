@@ -0,0 +1,113 @@
+/**
+ * @file at_parser_linux_io.h
+ * @author Giel Willemsen
+ * @brief Optional epoll based Linux tty/pty driver that feeds AT parsers.
+ * @version 0.1
+ * @date 2023-06-14
+ *
+ * @copyright Copyright (c) 2023, See LICENSE
+ *
+ */
+#ifndef AT_PARSER_LINUX_IO_H
+#define AT_PARSER_LINUX_IO_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "at_parser/at_parser.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+typedef struct at_parser_linux_io* at_parser_linux_io_handle_t;
+
+/**
+ * @brief Callback that is called when the other side of a channel hung up or the file descriptor has an error.
+ * @details The channel is no longer polled after this, but stays registered until it is removed.
+ *
+ */
+typedef void (*at_parser_linux_io_hangup)(at_parser_linux_io_handle_t io, void *userdata, int fd, at_parser_handle_t parser);
+
+/**
+ * @brief Construct a new I/O driver.
+ *
+ * @param io The resulting handle location.
+ * @param max_events The maximum amount of ready channels that are handled per epoll_wait.
+ * @return int 0 on success, other on error.
+ */
+extern int at_parser_linux_io_create(at_parser_linux_io_handle_t *io, size_t max_events);
+
+/**
+ * @brief Cleans up any resources allocated by the driver.
+ * @note The file descriptors and parsers of the channels are not closed or freed.
+ *
+ * @param io The driver to delete.
+ */
+extern void at_parser_linux_io_free(at_parser_linux_io_handle_t io);
+
+/**
+ * @brief Set the callback for channels that hung up.
+ *
+ * @param io The driver to set the callback on.
+ * @param callback The callback, or NULL to remove it.
+ * @param userdata The userdata that is passed to the callback.
+ * @return int 0 on success, other on error.
+ */
+extern int at_parser_linux_io_set_hangup_callback(at_parser_linux_io_handle_t io, at_parser_linux_io_hangup callback, void *userdata);
+
+/**
+ * @brief Add a tty/pty file descriptor, the data read from it is fed to the parser.
+ * @details The file descriptor is switched to non-blocking mode.
+ *
+ * @param io The driver to add the channel to.
+ * @param fd The file descriptor to read from and write to.
+ * @param parser The parser that ingests the data read from fd.
+ * @return int 0 on success, other on error.
+ */
+extern int at_parser_linux_io_add_channel(at_parser_linux_io_handle_t io, int fd, at_parser_handle_t parser);
+
+/**
+ * @brief Remove a channel from the driver, pending output is discarded.
+ *
+ * @param io The driver to remove the channel from.
+ * @param fd The file descriptor of the channel.
+ * @return int 0 on success, other on error.
+ */
+extern int at_parser_linux_io_remove_channel(at_parser_linux_io_handle_t io, int fd);
+
+/**
+ * @brief Queue data to be written to a channel.
+ * @details Queued data is written with a single writev per channel at the end of at_parser_linux_io_poll or by at_parser_linux_io_flush.
+ *
+ * @param io The driver the channel belongs to.
+ * @param fd The file descriptor of the channel.
+ * @param data The data to write.
+ * @param length The length of the data.
+ * @param copy When false data is referenced instead of copied, so it must stay valid until it is written (e.g. a string literal).
+ * @return int 0 on success, other on error.
+ */
+extern int at_parser_linux_io_write(at_parser_linux_io_handle_t io, int fd, const char *data, size_t length, bool copy);
+
+/**
+ * @brief Write the queued data of all channels.
+ * @details Data that can't be written without blocking stays queued and is written once the channel is writable again.
+ *
+ * @param io The driver to flush.
+ * @return int 0 on success, other on error.
+ */
+extern int at_parser_linux_io_flush(at_parser_linux_io_handle_t io);
+
+/**
+ * @brief Wait for ready channels, read their data directly into the parser buffers and flush the queued output.
+ *
+ * @param io The driver to poll.
+ * @param timeout_ms The maximum time to wait in milliseconds, -1 to wait forever.
+ * @return int The amount of channels that had events, or negative on error.
+ */
+extern int at_parser_linux_io_poll(at_parser_linux_io_handle_t io, int timeout_ms);
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
+
+#endif // AT_PARSER_LINUX_IO_H
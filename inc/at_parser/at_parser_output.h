@@ -0,0 +1,161 @@
+/**
+ * @file at_parser_output.h
+ * @author Giel Willemsen
+ * @brief Output scheduler that keeps responses and URCs whole on the wire.
+ * @version 0.1
+ * @date 2023-06-14
+ *
+ * @copyright Copyright (c) 2023, See LICENSE
+ *
+ */
+#ifndef AT_PARSER_OUTPUT_H
+#define AT_PARSER_OUTPUT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "at_parser/at_parser.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+typedef struct at_parser_output* at_parser_output_handle_t;
+
+/**
+ * @brief Callback that writes to the link.
+ * @details It may write less than length when the link is busy, the rest is written by a later flush (together with
+ * anything that was queued in the meantime). It is called with the lock of the scheduler held, so writes never interleave
+ * and it must not call the scheduler itself.
+ *
+ * @return size_t The amount of bytes that were written.
+ */
+typedef size_t (*at_parser_output_writer)(at_parser_output_handle_t output, void *userdata, const char *data, size_t length);
+
+/**
+ * @brief Configuration of an output scheduler.
+ *
+ */
+struct at_parser_output_config
+{
+    size_t queue_size;                ///< Bytes of complete messages that can wait for the link, also the limit of a single open response.
+    size_t urc_queue_size;            ///< Bytes of URCs that can be deferred while a response is open.
+    uint32_t max_urc_delay;           ///< Clock ticks a URC may be deferred, then it goes out at the next line boundary. 0 waits for the end of the response.
+    bool coalesce;                    ///< Only write on at_parser_output_flush and at_parser_output_poll (or when the queue is full).
+    at_parser_output_writer writer;   ///< Writes to the link.
+    void *writer_userdata;            ///< Passed to the writer.
+    at_parser_clock clock;            ///< Clock for the URC latency bound, may be NULL when max_urc_delay is 0.
+    void *clock_userdata;             ///< Passed to the clock.
+};
+
+/**
+ * @brief Counters of an output scheduler.
+ *
+ */
+struct at_parser_output_stats
+{
+    size_t writes;        ///< Writer calls.
+    size_t bytes;         ///< Bytes written.
+    size_t responses;     ///< Responses that were completed.
+    size_t urcs;          ///< URCs that were sent.
+    size_t deferred_urcs; ///< URCs that had to wait for a response.
+    size_t forced_urcs;   ///< Deferred URCs that went out between the lines of a response because of the latency bound.
+    size_t dropped;       ///< Bytes dropped because the queues were full.
+};
+
+/**
+ * @brief Construct a new output scheduler.
+ * @note The scheduler locks its queues itself, so at_parser_output_send_urc may be called from any thread while another
+ * one runs the parser. Parsing needs no lock of the caller.
+ *
+ * @param output The resulting handle location.
+ * @param config The configuration (copied).
+ * @return int 0 on success, other on error.
+ */
+extern int at_parser_output_create(at_parser_output_handle_t *output, const struct at_parser_output_config *config);
+
+/**
+ * @brief Cleans up any resources allocated by the scheduler, output that wasn't written is lost.
+ * @note The attached parser is not freed, but its response writer is removed.
+ *
+ * @param output The scheduler to delete.
+ */
+extern void at_parser_output_free(at_parser_output_handle_t output);
+
+/**
+ * @brief Send the responses of a parser through the scheduler, the response writer of the parser is replaced.
+ * @details A response is open from its first byte (or at_parser_output_begin_response) until it ends with a final result code
+ * (OK, ERROR, +CME ERROR, +CMS ERROR, NO CARRIER, BUSY, NO ANSWER, NO DIALTONE, CONNECT [<text>]), with the "\r\n> " prompt of
+ * at_parser_enter_body_mode or until at_parser_output_end_response is called. Only then it is queued as a whole.
+ *
+ * @param output The scheduler.
+ * @param parser The parser, or NULL to detach the current one.
+ * @return int 0 on success, other on error.
+ */
+extern int at_parser_output_attach(at_parser_output_handle_t output, at_parser_handle_t parser);
+
+/**
+ * @brief Open a response before anything is written, URCs are deferred from now on.
+ *
+ * @param output The scheduler.
+ * @return int 0 on success, other on error.
+ */
+extern int at_parser_output_begin_response(at_parser_output_handle_t output);
+
+/**
+ * @brief Close the open response, for responses that don't end with a final result code.
+ *
+ * @param output The scheduler.
+ * @return int 0 on success, other on error.
+ */
+extern int at_parser_output_end_response(at_parser_output_handle_t output);
+
+/**
+ * @brief Send an unsolicited result code, it is deferred while a response is open.
+ *
+ * @param output The scheduler.
+ * @param urc The complete URC (line end included).
+ * @param length The length of the URC.
+ * @return int 0 on success, other on error (e.g. it doesn't fit the queue).
+ */
+extern int at_parser_output_send_urc(at_parser_output_handle_t output, const char *urc, size_t length);
+
+/**
+ * @brief Check the URC latency bound and write the queued output.
+ * @details Call it periodically when max_urc_delay is set, or when the writer didn't take everything.
+ *
+ * @param output The scheduler.
+ * @return int 0 on success, other on error.
+ */
+extern int at_parser_output_poll(at_parser_output_handle_t output);
+
+/**
+ * @brief Write all queued output with one writer call.
+ *
+ * @param output The scheduler.
+ * @return int 0 on success, other on error.
+ */
+extern int at_parser_output_flush(at_parser_output_handle_t output);
+
+/**
+ * @brief Get the amount of queued bytes that still have to be written.
+ *
+ * @param output The scheduler.
+ * @return size_t The amount of bytes, open responses and deferred URCs excluded.
+ */
+extern size_t at_parser_output_get_queued(at_parser_output_handle_t output);
+
+/**
+ * @brief Get the counters of the scheduler.
+ *
+ * @param output The scheduler.
+ * @param stats The location to store the counters.
+ * @return int 0 on success, other on error.
+ */
+extern int at_parser_output_get_stats(at_parser_output_handle_t output, struct at_parser_output_stats *stats);
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
+
+#endif // AT_PARSER_OUTPUT_H
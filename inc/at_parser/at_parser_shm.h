@@ -0,0 +1,165 @@
+/**
+ * @file at_parser_shm.h
+ * @author Giel Willemsen
+ * @brief Lock free single producer, single consumer ring in shared memory (memfd), to pass bytes or parsed commands
+ * between processes.
+ * @version 0.1
+ * @date 2023-06-14
+ *
+ * @copyright Copyright (c) 2023, See LICENSE
+ *
+ */
+#ifndef AT_PARSER_SHM_H
+#define AT_PARSER_SHM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "at_parser/at_parser.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+typedef struct at_parser_shm_ring* at_parser_shm_ring_handle_t;
+
+/**
+ * @brief The kind of a message in the ring.
+ *
+ */
+enum at_parser_shm_message_kind
+{
+    AT_PARSER_SHM_MESSAGE_RAW = 1, ///< Raw bytes, e.g. as read from a serial port.
+    AT_PARSER_SHM_MESSAGE_COMMAND, ///< A parsed command with its arguments.
+};
+
+/**
+ * @brief A message in the ring, all pointers point into the shared memory and are valid until at_parser_shm_release.
+ *
+ */
+struct at_parser_shm_message
+{
+    enum at_parser_shm_message_kind kind;
+    const char *data;                  ///< The raw bytes, or the encoded command.
+    size_t length;                     ///< The length of data.
+    const char *command_name;          ///< The name of a command (NULL terminated), NULL for raw bytes.
+    size_t command_name_length;        ///< The length of the name.
+    enum at_parser_command_type type;  ///< The type of a command.
+    size_t argument_count;             ///< The amount of arguments of a command, see at_parser_shm_message_get_argument.
+};
+
+/**
+ * @brief Create a ring in a new memfd.
+ * @details The fd can be shared with the other process (inherited by fork, or passed over a Unix socket with
+ * SCM_RIGHTS) which opens it with at_parser_shm_ring_open. Exactly one process pushes and one process peeks.
+ *
+ * @param ring The resulting handle location.
+ * @param capacity The amount of bytes in the ring, a power of two of at least 64 bytes.
+ * @return int 0 on success, other on error.
+ */
+extern int at_parser_shm_ring_create(at_parser_shm_ring_handle_t *ring, size_t capacity);
+
+/**
+ * @brief Open a ring that was created (by another process).
+ *
+ * @param ring The resulting handle location.
+ * @param fd The fd of the ring, it is duplicated so the caller keeps its own fd.
+ * @return int 0 on success, other on error (e.g. the fd is not a ring).
+ */
+extern int at_parser_shm_ring_open(at_parser_shm_ring_handle_t *ring, int fd);
+
+/**
+ * @brief Unmap the ring and close its fd, the ring itself lives until every process closed it.
+ *
+ * @param ring The ring to close.
+ */
+extern void at_parser_shm_ring_free(at_parser_shm_ring_handle_t ring);
+
+/**
+ * @brief Get the fd of the ring, to share it with another process.
+ *
+ * @param ring The ring.
+ * @return int The fd, -1 on error.
+ */
+extern int at_parser_shm_ring_get_fd(at_parser_shm_ring_handle_t ring);
+
+/**
+ * @brief Push raw bytes (producer only).
+ *
+ * @param ring The ring.
+ * @param data The bytes.
+ * @param length The amount of bytes.
+ * @return int 0 on success, other on error (e.g. the ring is full, which is counted as a drop).
+ */
+extern int at_parser_shm_push_raw(at_parser_shm_ring_handle_t ring, const char *data, size_t length);
+
+/**
+ * @brief Push a parsed command (producer only).
+ *
+ * @param ring The ring.
+ * @param command_name The name of the command.
+ * @param command_name_length The length of the name.
+ * @param type The type of the command.
+ * @param argument_list The arguments, may be NULL when there are none.
+ * @param argument_list_length The amount of arguments.
+ * @return int 0 on success, other on error (e.g. the ring is full, which is counted as a drop).
+ */
+extern int at_parser_shm_push_command(at_parser_shm_ring_handle_t ring, const char *command_name, size_t command_name_length, enum at_parser_command_type type, const struct at_parser_argument *argument_list, size_t argument_list_length);
+
+/**
+ * @brief Batch handler that pushes every parsed command into a ring, see at_parser_set_batch_handler.
+ * @details Use the ring as userdata. The commands get no result code, the consumer answers them.
+ *
+ */
+extern void at_parser_shm_forward_batch(at_parser_handle_t parser, void *userdata, struct at_parser_command_record *records, size_t record_count);
+
+/**
+ * @brief Get the oldest message without removing it (consumer only), it is not copied.
+ * @details Records whose sizes don't fit the ring, or whose argument table and name don't fit the record, are skipped
+ * and counted, see at_parser_shm_get_rejected.
+ *
+ * @param ring The ring.
+ * @param message The location to store the message.
+ * @return int 0 on success, other on error (e.g. the ring is empty).
+ */
+extern int at_parser_shm_peek(at_parser_shm_ring_handle_t ring, struct at_parser_shm_message *message);
+
+/**
+ * @brief Remove the message that was returned by the last at_parser_shm_peek (consumer only).
+ *
+ * @param ring The ring.
+ * @return int 0 on success, other on error (e.g. nothing was peeked).
+ */
+extern int at_parser_shm_release(at_parser_shm_ring_handle_t ring);
+
+/**
+ * @brief Get an argument of a command message.
+ *
+ * @param message The message.
+ * @param index The index of the argument.
+ * @param argument The location to store the argument, its value points into the shared memory.
+ * @return int 0 on success, other on error.
+ */
+extern int at_parser_shm_message_get_argument(const struct at_parser_shm_message *message, size_t index, struct at_parser_argument *argument);
+
+/**
+ * @brief Get the amount of messages the producer dropped because the ring was full.
+ *
+ * @param ring The ring.
+ * @return uint64_t The amount of messages.
+ */
+extern uint64_t at_parser_shm_get_dropped(at_parser_shm_ring_handle_t ring);
+
+/**
+ * @brief Get the amount of corrupt records the consumer skipped.
+ * @details A record whose length can't be trusted skips everything that was published before it was peeked.
+ *
+ * @param ring The ring (of the consumer).
+ * @return uint64_t The amount of records.
+ */
+extern uint64_t at_parser_shm_get_rejected(at_parser_shm_ring_handle_t ring);
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
+
+#endif // AT_PARSER_SHM_H
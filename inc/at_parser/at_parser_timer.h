@@ -0,0 +1,160 @@
+/**
+ * @file at_parser_timer.h
+ * @author Giel Willemsen
+ * @brief Hierarchical timer wheel that can be shared by many parsers (and the application).
+ * @version 0.1
+ * @date 2023-06-14
+ *
+ * @copyright Copyright (c) 2023, See LICENSE
+ *
+ */
+#ifndef AT_PARSER_TIMER_H
+#define AT_PARSER_TIMER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "at_parser/at_parser.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+typedef struct at_parser_timer_wheel* at_parser_timer_wheel_handle_t;
+
+/**
+ * @brief The longest timeout (in clock ticks) of a timer, longer timeouts are shortened to it.
+ *
+ */
+#define AT_PARSER_TIMER_MAX_TIMEOUT ((UINT32_C(1) << 26) - 1)
+
+struct at_parser_timer;
+
+/**
+ * @brief Callback that is called when a timer expires, the timer is no longer armed and can be armed again.
+ *
+ */
+typedef void (*at_parser_timer_callback)(struct at_parser_timer *timer, void *userdata);
+
+/**
+ * @brief A timer, it is owned by the user (usually embedded in a larger struct) so arming it never allocates.
+ * @details Initialize it with at_parser_timer_init, the fields are private to the wheel.
+ *
+ */
+struct at_parser_timer
+{
+    struct at_parser_timer *next;
+    struct at_parser_timer *prev;
+    at_parser_timer_wheel_handle_t wheel; ///< The wheel the timer is armed on, NULL when not armed.
+    uint32_t expires;
+    uint8_t level;                        ///< The level of the wheel the timer is in, 0 is the root level.
+    at_parser_timer_callback callback;
+    void *userdata;
+};
+
+/**
+ * @brief What a parser does with a partial line when the inter-character timeout expires.
+ *
+ */
+enum at_parser_line_timeout_action
+{
+    AT_PARSER_LINE_TIMEOUT_DISCARD, ///< Drop the partial line.
+    AT_PARSER_LINE_TIMEOUT_COMMIT,  ///< Process the partial line as if it was terminated.
+};
+
+/**
+ * @brief Construct a new timer wheel.
+ *
+ * @param wheel The resulting handle location.
+ * @param clock The clock that the timeouts are measured in (e.g. milliseconds).
+ * @param userdata The userdata that is passed to the clock.
+ * @return int 0 on success, other on error.
+ */
+extern int at_parser_timer_wheel_create(at_parser_timer_wheel_handle_t *wheel, at_parser_clock clock, void *userdata);
+
+/**
+ * @brief Cleans up any resources allocated by the wheel, timers that are still armed are disarmed without expiring.
+ *
+ * @param wheel The wheel to delete.
+ */
+extern void at_parser_timer_wheel_free(at_parser_timer_wheel_handle_t wheel);
+
+/**
+ * @brief Run the callbacks of the timers that expired since the last call.
+ * @details Call it periodically (e.g. every tick, or after waiting at_parser_timer_wheel_get_next_timeout), the
+ * callbacks run in expiry order and may arm or cancel any timer.
+ *
+ * @param wheel The wheel.
+ * @return size_t The amount of timers that expired.
+ */
+extern size_t at_parser_timer_wheel_advance(at_parser_timer_wheel_handle_t wheel);
+
+/**
+ * @brief Get the amount of ticks until the wheel needs to be advanced.
+ * @details This is a lower bound, timers that are further away can take a few extra (cheap) advances.
+ *
+ * @param wheel The wheel.
+ * @param ticks The location to store the amount of ticks.
+ * @return int 0 on success, other on error (e.g. no timer is armed).
+ */
+extern int at_parser_timer_wheel_get_next_timeout(at_parser_timer_wheel_handle_t wheel, uint32_t *ticks);
+
+/**
+ * @brief Get the amount of armed timers.
+ *
+ * @param wheel The wheel.
+ * @return size_t The amount of armed timers.
+ */
+extern size_t at_parser_timer_wheel_get_armed(at_parser_timer_wheel_handle_t wheel);
+
+/**
+ * @brief Initialize a timer, this has to happen once before it is armed.
+ *
+ * @param timer The timer.
+ * @param callback The callback that is called when it expires.
+ * @param userdata The userdata that is passed to the callback.
+ */
+extern void at_parser_timer_init(struct at_parser_timer *timer, at_parser_timer_callback callback, void *userdata);
+
+/**
+ * @brief Arm (or re-arm) a timer, this is O(1).
+ *
+ * @param wheel The wheel to arm the timer on.
+ * @param timer The timer, it is cancelled first when it was armed already.
+ * @param timeout The amount of clock ticks until it expires.
+ * @return int 0 on success, other on error.
+ */
+extern int at_parser_timer_arm(at_parser_timer_wheel_handle_t wheel, struct at_parser_timer *timer, uint32_t timeout);
+
+/**
+ * @brief Cancel a timer, this is O(1) and does nothing when the timer isn't armed.
+ *
+ * @param timer The timer.
+ */
+extern void at_parser_timer_cancel(struct at_parser_timer *timer);
+
+/**
+ * @brief Check if a timer is armed.
+ *
+ * @param timer The timer.
+ * @return true The timer is armed and didn't expire yet.
+ * @return false The timer isn't armed.
+ */
+extern bool at_parser_timer_is_armed(const struct at_parser_timer *timer);
+
+/**
+ * @brief Set an inter-character timeout on a parser, a partial line that doesn't grow for the timeout is discarded or committed.
+ *
+ * @param parser The parser.
+ * @param wheel The wheel to arm the timeout on, or NULL to remove the timeout.
+ * @param timeout The amount of clock ticks since the last received byte.
+ * @param action What to do with the partial line.
+ * @return int 0 on success, other on error.
+ */
+extern int at_parser_set_line_timeout(at_parser_handle_t parser, at_parser_timer_wheel_handle_t wheel, uint32_t timeout, enum at_parser_line_timeout_action action);
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
+
+#endif // AT_PARSER_TIMER_H
@@ -14,6 +14,9 @@
 #include <string.h>
 #include <ctype.h>
 #include "at_parser/at_parser.h"
+#include "at_parser/at_parser_command_table.h"
+#include "at_parser/at_parser_timer.h"
+#include "at_parser/at_parser_checksum.h"
 
 #ifndef min
 #define min(one, two) ((one) < (two) ? (one) : (two))
@@ -23,6 +26,25 @@
 #define max(one, two) ((one) > (two) ? (one) : (two))
 #endif // max
 
+// Static USDT probes (provider at_parser) for perf, bpftrace and SystemTap. Without AT_PARSER_ENABLE_USDT they
+// expand to nothing, so the arguments aren't even evaluated. Names are passed with their length as they aren't NULL terminated.
+#ifdef AT_PARSER_ENABLE_USDT
+#include <sys/sdt.h>
+#define TRACE_LINE_COMPLETE(parser, line, length) DTRACE_PROBE3(at_parser, line_complete, parser, line, length)
+#define TRACE_ARGUMENT_PARSE(parser, length, count) DTRACE_PROBE3(at_parser, argument_parse, parser, length, count)
+#define TRACE_DISPATCH_BEGIN(parser, name, length, type) DTRACE_PROBE4(at_parser, dispatch_begin, parser, name, length, type)
+#define TRACE_DISPATCH_END(parser, name, length, type) DTRACE_PROBE4(at_parser, dispatch_end, parser, name, length, type)
+#define TRACE_BUFFER_OVERFLOW(parser, used) DTRACE_PROBE2(at_parser, buffer_overflow, parser, used)
+#define TRACE_BUFFER_DROP(parser, length) DTRACE_PROBE2(at_parser, buffer_drop, parser, length)
+#else
+#define TRACE_LINE_COMPLETE(parser, line, length) ((void)0)
+#define TRACE_ARGUMENT_PARSE(parser, length, count) ((void)0)
+#define TRACE_DISPATCH_BEGIN(parser, name, length, type) ((void)0)
+#define TRACE_DISPATCH_END(parser, name, length, type) ((void)0)
+#define TRACE_BUFFER_OVERFLOW(parser, used) ((void)0)
+#define TRACE_BUFFER_DROP(parser, length) ((void)0)
+#endif // AT_PARSER_ENABLE_USDT
+
 struct callback_entry
 {
     at_parser_received_command callback;
@@ -33,14 +55,195 @@ struct callback_entry
 
 typedef struct callback_entry *callback_entry_handle_t;
 
+struct registry_entry
+{
+    at_parser_received_command callback;
+    void *userdata;
+    size_t name_offset; ///< Offset of the (NULL terminated) name in the registry name pool.
+};
+
+struct registry_sort_item
+{
+    const char *name;
+    const struct registry_entry *entry;
+    bool duplicate;
+};
+
+struct registry_name
+{
+    size_t name_offset;
+    size_t name_length;
+    size_t first_entry;
+    size_t entry_count;
+};
+
+struct at_parser_registry
+{
+    bool frozen;
+    char *name_pool;
+    size_t name_pool_used;
+    size_t name_pool_capacity;
+    struct registry_entry *entries;
+    size_t entry_count;
+    size_t entry_capacity;
+    struct registry_name *names; ///< Sorted on name, only valid once frozen.
+    size_t name_count;
+    void *frozen_block;          ///< Single allocation holding names, entries and the name pool once frozen.
+};
+
+struct batch_item
+{
+    size_t name_offset;     ///< Offset of the (NULL terminated) name in the batch pool.
+    size_t name_length;
+    enum at_parser_command_type type;
+    size_t first_argument;
+    size_t argument_count;
+    enum at_parser_qos_class qos;
+    uint32_t queued_at;     ///< The clock tick the command was parsed at.
+};
+
+struct batch_argument
+{
+    size_t value_offset;    ///< Offset of the (NULL terminated) value in the batch pool.
+    size_t length;
+};
+
+struct command_batch
+{
+    at_parser_batch_handler handler;
+    void *userdata;
+    size_t limit;
+    bool dispatching;
+    struct batch_item *items;
+    size_t item_count;
+    size_t item_capacity;
+    struct batch_argument *arguments;
+    size_t argument_count;
+    size_t argument_capacity;
+    char *pool;             ///< Copies of the names and arguments, the lines they came from are gone by the time the batch is dispatched.
+    size_t pool_used;
+    size_t pool_capacity;
+    struct at_parser_command_record *records; ///< Same capacity as items, so a dispatch never has to allocate.
+    struct at_parser_argument *views;         ///< Same capacity as arguments.
+};
+
+struct body_mode
+{
+    at_parser_body_handler handler;
+    void *userdata;
+    size_t max_length;
+    size_t length;
+    bool active;
+    bool overflow;  ///< Went over max_length, the rest is dropped until the body ends.
+};
+
+struct data_mode
+{
+    struct at_parser_data_mode_config config;
+    bool active;
+    uint32_t last_byte_at;
+    uint8_t escape_count;   ///< The escape characters that are held back, they might be the start of the escape sequence.
+};
+
+struct qos_entry
+{
+    size_t name_offset;     ///< Offset of the name in the QoS name pool.
+    size_t name_length;
+    enum at_parser_qos_class qos;
+};
+
+struct qos_table
+{
+    struct qos_entry *entries;
+    size_t entry_count;
+    size_t entry_capacity;
+    char *pool;
+    size_t pool_used;
+    size_t pool_capacity;
+    struct at_parser_qos_stats stats[AT_PARSER_QOS_CLASS_COUNT];
+};
+
+struct history_entry
+{
+    char *block;            ///< The argument list, then the line, then the argument values.
+    size_t block_capacity;
+    size_t line_length;
+    uint32_t hash;
+    enum at_parser_command_type type;
+    size_t name_length;
+    size_t argument_count;
+    uint64_t last_used;     ///< 0 for an empty entry.
+};
+
+struct command_history
+{
+    struct history_entry *entries;
+    size_t depth;
+    uint64_t uses;                  ///< Counts the uses, to find the least recently used entry.
+    struct history_entry *last;     ///< The last dispatched command, it is repeated by A/.
+    size_t hits;
+    bool dispatching;               ///< An entry is being dispatched, so the entries must not change.
+};
+
+struct early_reject
+{
+    bool enabled;
+    bool skipping;  ///< The current line can't match a command, it is skipped up to its line end.
+    bool answer;    ///< Write ERROR at the end of the skipped line.
+};
+
+struct adaptive_buffer
+{
+    struct at_parser_buffer_policy policy;
+    bool enabled;
+    size_t window_lines;    ///< The lines since the buffer was last resized or checked.
+    size_t window_longest;  ///< The longest of those lines.
+};
+
 struct at_parser
 {
+    struct at_parser_allocator allocator;
+    at_parser_registry_handle_t registry;
     callback_entry_handle_t callbacks;
     char *buffer;
     size_t buffer_length;
     size_t buffer_used;
+    size_t scan_position;   ///< Position in the buffer up to where there is no line end.
+    at_parser_clock clock;
+    void *clock_userdata;
+    at_parser_response_writer writer;
+    void *writer_userdata;
     char escape_char;
     char arg_separator;
+    struct at_parser_flow_control_config flow;
+    bool flow_enabled;
+    bool flow_paused;
+    bool pending_over;      ///< The pending commands went over the high watermark and not yet under the low watermark.
+    size_t pending_commands;
+    bool binary_framing;
+    struct command_batch batch;
+    const struct at_parser_command_table *command_table;
+    void *command_table_userdata;
+    struct at_parser_timer line_timer;
+    at_parser_timer_wheel_handle_t line_timer_wheel;
+    uint32_t line_timeout;
+    enum at_parser_line_timeout_action line_timeout_action;
+    struct body_mode body;
+    struct data_mode data;
+    enum at_parser_checksum_type checksum;
+    size_t checksum_failures;
+    struct early_reject reject;
+    struct at_parser_line_histogram histogram;
+    struct adaptive_buffer adaptive;
+    struct qos_table qos;
+    struct command_history history;
+};
+
+struct budget_state
+{
+    const struct at_parser_budget *budget;
+    size_t lines;
+    bool exhausted;
 };
 
 static inline bool is_alpha_ascii(char chr)
@@ -53,28 +256,94 @@ static callback_entry_handle_t get_tail(callback_entry_handle_t start);
 static callback_entry_handle_t find_before(callback_entry_handle_t start, callback_entry_handle_t item);
 static void remove_callback_handler(at_parser_handle_t parser, callback_entry_handle_t item);
 static int add_callback_handler(at_parser_handle_t parser, const char *name, at_parser_received_command handler, void *userdata);
-static int find_char(const char *str, size_t str_len, char chr);
 static void remove_buffer(at_parser_handle_t parser, size_t len);
+static void drop_buffer(at_parser_handle_t parser);
+static bool resize_buffer(at_parser_handle_t parser, size_t length);
+static bool grow_buffer(at_parser_handle_t parser);
+static void shrink_buffer(at_parser_handle_t parser);
+static void record_line_length(at_parser_handle_t parser, size_t length);
+static void record_window_length(at_parser_handle_t parser, size_t length);
+static bool process_lines(at_parser_handle_t parser, struct budget_state *budget);
+static size_t ingest(at_parser_handle_t parser, const char *buffer, size_t buffer_len, bool defer_when_paused, struct budget_state *budget);
+static bool budget_exhausted(at_parser_handle_t parser, struct budget_state *budget);
+static void update_flow_state(at_parser_handle_t parser);
+static void restart_line_timer(at_parser_handle_t parser);
+static size_t process_body(at_parser_handle_t parser, const char *data, size_t length);
+static size_t process_data(at_parser_handle_t parser, const char *data, size_t length);
+static void release_escape_chars(at_parser_handle_t parser);
+static void escape_data_mode(at_parser_handle_t parser);
+static void line_timeout_expired(struct at_parser_timer *timer, void *userdata);
+static size_t skip_rejected_line(at_parser_handle_t parser, const char *data, size_t length);
+static bool reject_line_early(at_parser_handle_t parser, const char *line, size_t length);
+static void reject_buffered_line(at_parser_handle_t parser);
+static bool can_match_name(at_parser_handle_t parser, const char *name, size_t name_length, bool complete);
 static void process_string_line(at_parser_handle_t parser, const char *str, size_t len);
+static void dispatch_command(at_parser_handle_t parser, const char *command, size_t command_length, enum at_parser_command_type type, struct at_parser_argument *args, size_t arg_length);
+static inline bool is_repeat_command(at_parser_handle_t parser, const char *str, size_t len);
+static void repeat_command(at_parser_handle_t parser);
+static struct history_entry *find_history(at_parser_handle_t parser, const char *str, size_t len, uint32_t hash);
+static void store_history(at_parser_handle_t parser, const char *str, size_t len, uint32_t hash, size_t command_length, enum at_parser_command_type type, const struct at_parser_argument *args, size_t arg_length);
+static void dispatch_history(at_parser_handle_t parser, struct history_entry *entry);
+static void free_history(at_parser_handle_t parser);
+static bool check_line_checksum(at_parser_handle_t parser, const char *str, size_t *len);
+static bool is_binary_frame_start(at_parser_handle_t parser, const char *str);
+static size_t get_binary_frame_length(const char *str, size_t len);
+static size_t process_binary_frame(at_parser_handle_t parser, const char *str, size_t len);
 static size_t get_command_length(const char *str, size_t str_len);
 static bool parse_argument_list(at_parser_handle_t parser, const char *arg_list, size_t str_len, struct at_parser_argument **list, size_t *list_length);
-static void free_argument_list(struct at_parser_argument *list);
-static struct at_parser_argument *add_to_argument_list(struct at_parser_argument *list, size_t list_len, const char *value, size_t value_length, char escape_char);
+static void free_argument_list(at_parser_handle_t parser, struct at_parser_argument *list, size_t list_length);
+static struct at_parser_argument *add_to_argument_list(at_parser_handle_t parser, struct at_parser_argument *list, size_t list_len, const char *value, size_t value_length, char escape_char);
 static void sanitize_quoted_string_to(char *string, char escape_char, size_t length, char *to);
 static size_t sanitize_quoted_string_length(const char *string, size_t length, char escape_char);
+static int compare_registry_sort_items(const void *one, const void *two);
+static const struct registry_name *find_registry_name(at_parser_registry_handle_t registry, const char *name, size_t name_length);
+static bool has_registry_prefix(at_parser_registry_handle_t registry, const char *prefix, size_t prefix_length);
+static void dispatch_registry(at_parser_handle_t parser, const char *command, size_t command_length, enum at_parser_command_type type, struct at_parser_argument *args, size_t arg_length);
+static void dispatch_registry_name(at_parser_handle_t parser, const struct registry_name *name, enum at_parser_command_type type, struct at_parser_argument *args, size_t arg_length);
+static void dispatch_callbacks(at_parser_handle_t parser, const char *command, size_t command_length, enum at_parser_command_type type, struct at_parser_argument *args, size_t arg_length);
+static bool dispatch_command_table(at_parser_handle_t parser, const char *command, size_t command_length, enum at_parser_command_type type, struct at_parser_argument *args, size_t arg_length);
+static void write_result(at_parser_handle_t parser, const char *result, size_t length);
+static void add_to_batch(at_parser_handle_t parser, const char *command, size_t command_length, enum at_parser_command_type type, const struct at_parser_argument *args, size_t arg_length);
+static void flush_batch(at_parser_handle_t parser);
+static void cancel_batch(at_parser_handle_t parser);
+static void sort_batch(struct command_batch *batch);
+static enum at_parser_qos_class get_command_qos(at_parser_handle_t parser, const char *command, size_t command_length);
+static void free_batch(at_parser_handle_t parser);
+static bool reserve_array(at_parser_handle_t parser, void **array, size_t *capacity, size_t needed, size_t element_size);
+static void *default_allocate(void *context, size_t size);
+static void *default_reallocate(void *context, void *ptr, size_t size);
+static void default_deallocate(void *context, void *ptr);
+static inline void *parser_allocate(at_parser_handle_t parser, size_t size);
+static inline void *parser_reallocate(at_parser_handle_t parser, void *ptr, size_t size);
+static inline void parser_deallocate(at_parser_handle_t parser, void *ptr);
+
+static const struct at_parser_allocator default_allocator = {default_allocate, default_reallocate, default_deallocate, NULL};
 
 extern int at_parser_create(at_parser_handle_t *parser, size_t buffer_size, char escape_char, char arg_separator)
 {
-    at_parser_handle_t handle = calloc(1, sizeof(struct at_parser));
+    return at_parser_create_with_allocator(parser, buffer_size, escape_char, arg_separator, &default_allocator);
+}
+
+extern int at_parser_create_with_allocator(at_parser_handle_t *parser, size_t buffer_size, char escape_char, char arg_separator, const struct at_parser_allocator *allocator)
+{
+    if (parser == NULL || allocator == NULL || allocator->allocate == NULL || allocator->reallocate == NULL || allocator->deallocate == NULL)
+    {
+        return -1;
+    }
+    at_parser_handle_t handle = allocator->allocate(allocator->context, sizeof(struct at_parser));
     if (handle == NULL)
     {
         return -1;
     }
-    handle->buffer = calloc(1, buffer_size);
+    memset(handle, 0, sizeof(struct at_parser));
+    handle->allocator = *allocator;
+    handle->buffer = parser_allocate(handle, buffer_size);
     if (handle->buffer == NULL)
     {
+        parser_deallocate(handle, handle);
         return -1;
     }
+    memset(handle->buffer, 0, buffer_size);
     handle->buffer_length = buffer_size;
     handle->buffer_used = 0;
     handle->escape_char = escape_char;
@@ -90,14 +359,19 @@ extern void at_parser_free(at_parser_handle_t handle)
     {
         if (handle->buffer != NULL)
         {
-            free(handle->buffer);
+            parser_deallocate(handle, handle->buffer);
             handle->buffer = NULL;
         }
+        at_parser_timer_cancel(&handle->line_timer);
         while(handle->callbacks != NULL)
         {
             remove_callback_handler(handle, handle->callbacks);
         }
-        free(handle);
+        free_batch(handle);
+        parser_deallocate(handle, handle->qos.entries);
+        parser_deallocate(handle, handle->qos.pool);
+        free_history(handle);
+        parser_deallocate(handle, handle);
     }
 }
 
@@ -133,242 +407,1804 @@ extern int at_parser_remove_command_handler(at_parser_handle_t parser, const cha
     return 0;
 }
 
-extern int at_parser_process_buffer(at_parser_handle_t parser, const char *buffer, size_t buffer_len)
+extern int at_parser_registry_create(at_parser_registry_handle_t *registry)
 {
-    if (parser == NULL || buffer == NULL)
+    if (registry == NULL)
     {
         return -1;
     }
-    size_t consumed = 0;
-    while (consumed != buffer_len)
+    at_parser_registry_handle_t handle = calloc(1, sizeof(struct at_parser_registry));
+    if (handle == NULL)
     {
-        size_t copy_len = min(parser->buffer_length - parser->buffer_used, buffer_len - consumed);
-        if (copy_len == 0) {
-            remove_buffer(parser, max(min(parser->buffer_length / 10, 1), 5)); // Drop between 1 and 5 bytes, depending on buffer size.
-            continue; // There is nothing to copy now, so just ignore this iteration.
+        return -1;
+    }
+    *registry = handle;
+    return 0;
+}
+
+extern void at_parser_registry_free(at_parser_registry_handle_t registry)
+{
+    if (registry != NULL)
+    {
+        if (registry->frozen)
+        {
+            free(registry->frozen_block);
         }
-        memcpy(parser->buffer + parser->buffer_used, buffer + consumed, copy_len);
-        parser->buffer_used = (parser->buffer_used + copy_len);
-        consumed += copy_len;
-        int res = 0;
-        do
+        else
         {
-            res = find_char(parser->buffer, parser->buffer_used, '\r');
-            if (res >= 0)
-            {
-                res = find_char(parser->buffer, parser->buffer_used, '\n');
-                if (res >= 0)
-                {
-                    const size_t drop_length = res + 1;                   // could be that the '\n' is at char index 0
-                    process_string_line(parser, parser->buffer, res - 1); // Remove the \r
-                    remove_buffer(parser, drop_length);
-                }
-            }
-        } while (res >= 0);
+            free(registry->entries);
+            free(registry->name_pool);
+        }
+        free(registry);
     }
-    return 0;
 }
 
-static callback_entry_handle_t find_callback(callback_entry_handle_t start, const char *cmd, at_parser_received_command callback)
+extern int at_parser_registry_add_command_handler(at_parser_registry_handle_t registry, const char *command_name, at_parser_received_command handler, void *userdata)
 {
-    callback_entry_handle_t current = start;
-    while (current != NULL && strlen(current->command) == strlen(cmd) && strcmp(current->command, cmd) != 0 && current->callback != callback && current->next != NULL)
+    if (registry == NULL || command_name == NULL || handler == NULL || registry->frozen)
     {
-        current = current->next;
+        return -1;
     }
-    if (current != NULL && strlen(current->command) == strlen(cmd) && strcmp(current->command, cmd) == 0 && current->callback == callback)
+    const size_t name_size = strlen(command_name) + 1;
+    if (registry->entry_count == registry->entry_capacity)
     {
-        return current;
+        size_t new_capacity = max(registry->entry_capacity * 2, 16);
+        struct registry_entry *new_entries = realloc(registry->entries, new_capacity * sizeof(struct registry_entry));
+        if (new_entries == NULL)
+        {
+            return -1;
+        }
+        registry->entries = new_entries;
+        registry->entry_capacity = new_capacity;
     }
-    else
+    if (registry->name_pool_capacity - registry->name_pool_used < name_size)
     {
-        return NULL;
+        size_t new_capacity = max(registry->name_pool_capacity * 2, registry->name_pool_used + name_size);
+        char *new_pool = realloc(registry->name_pool, new_capacity);
+        if (new_pool == NULL)
+        {
+            return -1;
+        }
+        registry->name_pool = new_pool;
+        registry->name_pool_capacity = new_capacity;
     }
+    memcpy(registry->name_pool + registry->name_pool_used, command_name, name_size);
+
+    struct registry_entry *entry = &registry->entries[registry->entry_count];
+    entry->callback = handler;
+    entry->userdata = userdata;
+    entry->name_offset = registry->name_pool_used;
+    registry->name_pool_used += name_size;
+    registry->entry_count++;
+    return 0;
 }
 
-static callback_entry_handle_t get_tail(callback_entry_handle_t start)
+extern int at_parser_registry_freeze(at_parser_registry_handle_t registry)
 {
-    callback_entry_handle_t current = start;
-    while (current != NULL && current->next != NULL)
+    if (registry == NULL)
     {
-        current = current->next;
+        return -1;
     }
-    return current;
-}
-
-static callback_entry_handle_t find_before(callback_entry_handle_t start, callback_entry_handle_t item)
-{
-    callback_entry_handle_t previous = NULL;
-    callback_entry_handle_t current = start;
-    while (current != item && current != NULL && current->next != NULL)
+    if (registry->frozen)
     {
-        previous = current;
-        current = current->next;
+        return 0;
     }
-    if (current == item)
+    // Sort on name (and registration order within a name) so that the names are grouped and can be binary searched.
+    struct registry_sort_item *items = malloc(max(registry->entry_count, 1) * sizeof(struct registry_sort_item));
+    if (items == NULL)
     {
-        return previous;
+        return -1;
     }
-    else
+    for (size_t i = 0; i < registry->entry_count; i++)
     {
-        return NULL;
+        items[i].name = registry->name_pool + registry->entries[i].name_offset;
+        items[i].entry = &registry->entries[i];
+        items[i].duplicate = false;
     }
-}
+    qsort(items, registry->entry_count, sizeof(struct registry_sort_item), compare_registry_sort_items);
 
-static void remove_callback_handler(at_parser_handle_t parser, callback_entry_handle_t item)
-{
-    if (item == NULL)
+    // Count the unique names, the unique (name, handler) pairs and the size of the interned pool.
+    // Duplicated name and handler pairs are only registered once, like at_parser_add_command_handler does.
+    size_t name_count = 0;
+    size_t entry_count = 0;
+    size_t pool_size = 0;
+    size_t name_start = 0;
+    for (size_t i = 0; i < registry->entry_count; i++)
     {
-        return;
+        if (i == 0 || strcmp(items[i].name, items[i - 1].name) != 0)
+        {
+            name_start = i;
+            name_count++;
+            pool_size += strlen(items[i].name) + 1;
+        }
+        for (size_t j = name_start; j < i && !items[i].duplicate; j++)
+        {
+            items[i].duplicate = items[j].entry->callback == items[i].entry->callback;
+        }
+        entry_count += items[i].duplicate ? 0 : 1;
     }
-    if (parser != NULL)
+
+    const size_t names_size = name_count * sizeof(struct registry_name);
+    const size_t entries_size = entry_count * sizeof(struct registry_entry);
+    char *block = malloc(max(names_size + entries_size + pool_size, 1));
+    if (block == NULL)
     {
-        callback_entry_handle_t before = find_before(parser->callbacks, item);
-        if (before != NULL)
+        free(items);
+        return -1;
+    }
+    struct registry_name *new_names = (struct registry_name *)block;
+    struct registry_entry *new_entries = (struct registry_entry *)(block + names_size);
+    char *new_pool = block + names_size + entries_size;
+
+    // Intern the names and copy the entries into the contiguous arrays.
+    size_t name_index = 0;
+    size_t entry_index = 0;
+    size_t pool_used = 0;
+    for (size_t i = 0; i < registry->entry_count; i++)
+    {
+        if (i == 0 || strcmp(items[i].name, items[i - 1].name) != 0)
         {
-            before->next = item->next;
+            const size_t name_length = strlen(items[i].name);
+            memcpy(new_pool + pool_used, items[i].name, name_length + 1);
+            new_names[name_index].name_offset = pool_used;
+            new_names[name_index].name_length = name_length;
+            new_names[name_index].first_entry = entry_index;
+            new_names[name_index].entry_count = 0;
+            pool_used += name_length + 1;
+            name_index++;
         }
-        else
+        if (!items[i].duplicate)
         {
-            parser->callbacks = item->next;
+            struct registry_name *current = &new_names[name_index - 1];
+            new_entries[entry_index].callback = items[i].entry->callback;
+            new_entries[entry_index].userdata = items[i].entry->userdata;
+            new_entries[entry_index].name_offset = current->name_offset;
+            current->entry_count++;
+            entry_index++;
         }
     }
-    free(item->command);
-    free(item);
+    free(items);
+
+    free(registry->entries);
+    free(registry->name_pool);
+    registry->frozen_block = block;
+    registry->names = new_names;
+    registry->name_count = name_count;
+    registry->entries = new_entries;
+    registry->entry_count = entry_count;
+    registry->entry_capacity = entry_count;
+    registry->name_pool = new_pool;
+    registry->name_pool_used = pool_size;
+    registry->name_pool_capacity = pool_size;
+    registry->frozen = true;
+    return 0;
 }
 
-static int add_callback_handler(at_parser_handle_t parser, const char *name, at_parser_received_command handler, void *userdata)
+extern int at_parser_attach_registry(at_parser_handle_t parser, at_parser_registry_handle_t registry)
 {
-    callback_entry_handle_t new_item = malloc(sizeof(struct callback_entry));
-    if (new_item == NULL)
+    if (parser == NULL || (registry != NULL && !registry->frozen))
     {
         return -1;
     }
+    parser->registry = registry;
+    return 0;
+}
 
-    new_item->command = malloc(strlen(name) + 1);
-    if (new_item->command == NULL)
+extern int at_parser_process_buffer(at_parser_handle_t parser, const char *buffer, size_t buffer_len)
+{
+    if (parser == NULL || buffer == NULL)
     {
-        free(new_item);
         return -1;
     }
-    strcpy(new_item->command, name);
-
-    new_item->callback = handler;
-    new_item->userdata = userdata;
-    new_item->next = NULL;
+    ingest(parser, buffer, buffer_len, false, NULL);
+    flush_batch(parser);
+    return 0;
+}
 
-    if (parser->callbacks == NULL)
+extern int at_parser_process_buffer_partial(at_parser_handle_t parser, const char *buffer, size_t buffer_len, size_t *accepted)
+{
+    if (parser == NULL || buffer == NULL || accepted == NULL)
     {
-        parser->callbacks = new_item;
+        return -1;
     }
-    else
+    *accepted = ingest(parser, buffer, buffer_len, true, NULL);
+    flush_batch(parser);
+    return 0;
+}
+
+extern int at_parser_process_buffer_budgeted(at_parser_handle_t parser, const char *buffer, size_t buffer_len, const struct at_parser_budget *budget, size_t *consumed)
+{
+    if (parser == NULL || (buffer == NULL && buffer_len != 0) || budget == NULL || consumed == NULL)
     {
-        get_tail(parser->callbacks)->next = new_item;
+        return -1;
     }
+    struct budget_state state = {budget, 0, false};
+    *consumed = ingest(parser, buffer, buffer_len, false, &state);
+    flush_batch(parser);
     return 0;
 }
 
-static int find_char(const char *str, size_t str_len, char chr)
+extern bool at_parser_has_pending_lines(at_parser_handle_t parser)
 {
-    size_t index = 0;
-    while (str[index] != chr && index < str_len)
+    if (parser == NULL)
     {
-        index++;
+        return false;
     }
-    if (str[index] == chr)
+    if (parser->buffer_used > 0 && is_binary_frame_start(parser, parser->buffer))
     {
-        return (int)index;
+        const size_t frame_length = get_binary_frame_length(parser->buffer, parser->buffer_used);
+        return frame_length != 0 && frame_length <= parser->buffer_used;
     }
-    else
+    const char *line_end = memchr(parser->buffer, '\n', parser->buffer_used);
+    return line_end != NULL && memchr(parser->buffer, '\r', parser->buffer_used) != NULL;
+}
+
+extern int at_parser_set_clock(at_parser_handle_t parser, at_parser_clock clock, void *userdata)
+{
+    if (parser == NULL || (clock == NULL && parser->data.active && parser->data.config.guard_time != 0))
     {
         return -1;
     }
+    parser->clock = clock;
+    parser->clock_userdata = userdata;
+    return 0;
 }
 
-static void remove_buffer(at_parser_handle_t parser, size_t len)
+extern int at_parser_set_response_writer(at_parser_handle_t parser, at_parser_response_writer writer, void *userdata)
 {
-    size_t remove_len = parser->buffer_used > len ? len : parser->buffer_used;
-    memcpy(parser->buffer, parser->buffer + len, parser->buffer_used - remove_len);
-    parser->buffer_used -= remove_len;
+    if (parser == NULL)
+    {
+        return -1;
+    }
+    parser->writer = writer;
+    parser->writer_userdata = userdata;
+    return 0;
 }
 
-static void process_string_line(at_parser_handle_t parser, const char *str, size_t len)
+extern int at_parser_get_response_writer(at_parser_handle_t parser, at_parser_response_writer *writer, void **userdata)
 {
-    if (len < 4)
+    if (parser == NULL || writer == NULL || userdata == NULL)
     {
-        return;
+        return -1;
     }
-    if (str[0] != 'A' || str[1] != 'T' || str[2] != '+')
+    *writer = parser->writer;
+    *userdata = parser->writer_userdata;
+    return 0;
+}
+
+extern int at_parser_write_response(at_parser_handle_t parser, const char *data, size_t length)
+{
+    if (parser == NULL || data == NULL || parser->writer == NULL)
     {
-        return;
+        return -1;
     }
-    const char *command_start = str + 3; // + 3 for the AT+
-    const size_t command_length = get_command_length(command_start, len);
-    const size_t extra_start_at = command_length + 3;
-    const size_t extra_length = len - extra_start_at;
+    parser->writer(parser, parser->writer_userdata, data, length);
+    return 0;
+}
 
-    struct at_parser_argument *args = NULL;
-    size_t arg_length = 0;
-    enum at_parser_command_type type = AT_PARSER_COMMAND_TYPE_EXECUTE;
-    bool error = false;
-    if (extra_length == 1 && str[extra_start_at] == '?')
+extern int at_parser_set_flow_control(at_parser_handle_t parser, const struct at_parser_flow_control_config *config)
+{
+    if (parser == NULL)
     {
-        type = AT_PARSER_COMMAND_TYPE_TEST;
+        return -1;
     }
-    else if (extra_length == 2 && (str[extra_start_at] == '=' && str[extra_start_at + 1] == '?'))
+    if (config == NULL)
     {
-        type = AT_PARSER_COMMAND_TYPE_QUERY;
+        parser->flow_enabled = false;
+        parser->flow_paused = false;
+        parser->pending_over = false;
+        return 0;
     }
-    else if (extra_length >= 2 && str[extra_start_at] == '=')
+    if (config->callback == NULL || config->buffer_low_watermark > config->buffer_high_watermark || config->pending_low_watermark > config->pending_high_watermark)
     {
-        parse_argument_list(parser, str + extra_start_at + 1, extra_length - 1, &args, &arg_length);
-        type = AT_PARSER_COMMAND_TYPE_SET;
+        return -1;
     }
-    else if (extra_length != 0)
+    parser->flow = *config;
+    parser->flow_enabled = true;
+    update_flow_state(parser);
+    return 0;
+}
+
+extern int at_parser_update_pending_commands(at_parser_handle_t parser, size_t pending)
+{
+    if (parser == NULL)
     {
-        error = true;
+        return -1;
     }
-    if (!error)
+    parser->pending_commands = pending;
+    update_flow_state(parser);
+    return 0;
+}
+
+extern enum at_parser_flow_state at_parser_get_flow_state(at_parser_handle_t parser)
+{
+    return parser != NULL && parser->flow_paused ? AT_PARSER_FLOW_PAUSE : AT_PARSER_FLOW_RESUME;
+}
+
+extern int at_parser_process_line(at_parser_handle_t parser, const char *line, size_t line_len)
+{
+    if (parser == NULL || line == NULL)
     {
-        callback_entry_handle_t item = parser->callbacks;
-        do
-        {
-            if (item != NULL)
-            {
-                if (strlen(item->command) == command_length && strncmp(item->command, command_start, command_length) == 0)
-                {
-                    if (item->callback)
-                    {
-                        item->callback(parser, item->userdata, item->command, type, args, arg_length);
-                    }
-                }
-                item = item->next;
-            }
-        } while (item != NULL);
+        return -1;
     }
+    process_string_line(parser, line, line_len);
+    flush_batch(parser);
+    return 0;
 }
 
-static size_t get_command_length(const char *str, size_t str_len)
+extern int at_parser_dispatch_command(at_parser_handle_t parser, const char *command_name, size_t command_name_length, enum at_parser_command_type type, struct at_parser_argument *argument_list, size_t argument_list_length)
 {
-    size_t length = 0;
+    if (parser == NULL || command_name == NULL || (argument_list == NULL && argument_list_length != 0))
+    {
+        return -1;
+    }
+    dispatch_command(parser, command_name, command_name_length, type, argument_list, argument_list_length);
+    flush_batch(parser);
+    return 0;
+}
 
-    while (isascii(str[length]) && isalpha((int)str[length]) && length < str_len)
+extern int at_parser_get_ingest_buffer(at_parser_handle_t parser, char **buffer, size_t *available)
+{
+    if (parser == NULL || buffer == NULL || available == NULL)
     {
-        length++;
+        return -1;
     }
-    return length;
+    if (parser->buffer_used == parser->buffer_length)
+    {
+        process_lines(parser, NULL); // Lines left by a budgeted call shouldn't be dropped.
+        flush_batch(parser);
+    }
+    if (parser->buffer_used == parser->buffer_length && !grow_buffer(parser))
+    {
+        drop_buffer(parser);
+    }
+    *buffer = parser->buffer + parser->buffer_used;
+    *available = parser->buffer_length - parser->buffer_used;
+    return 0;
 }
 
-static bool parse_argument_list(at_parser_handle_t parser, const char *arg_list, size_t str_len, struct at_parser_argument **list, size_t *list_length)
+extern int at_parser_commit_ingest(at_parser_handle_t parser, size_t length)
 {
-    if (list == NULL || arg_list == NULL || list_length == NULL)
+    if (parser == NULL || length > parser->buffer_length - parser->buffer_used)
     {
-        return false;
+        return -1;
     }
-    size_t position = 0;
-    char separator = parser->arg_separator;
-    char escape = parser->escape_char;
-    do
+    parser->buffer_used += length;
+    if (parser->reject.skipping)
+    {
+        remove_buffer(parser, skip_rejected_line(parser, parser->buffer, parser->buffer_used));
+    }
+    process_lines(parser, NULL);
+    reject_buffered_line(parser);
+    flush_batch(parser);
+    shrink_buffer(parser);
+    update_flow_state(parser);
+    restart_line_timer(parser);
+    return 0;
+}
+
+extern int at_parser_registry_get_command_id(at_parser_registry_handle_t registry, const char *command_name, uint16_t *id)
+{
+    if (registry == NULL || !registry->frozen || command_name == NULL || id == NULL)
+    {
+        return -1;
+    }
+    const struct registry_name *name = find_registry_name(registry, command_name, strlen(command_name));
+    if (name == NULL || (size_t)(name - registry->names) > UINT16_MAX)
+    {
+        return -1;
+    }
+    *id = (uint16_t)(name - registry->names);
+    return 0;
+}
+
+extern int at_parser_set_binary_framing(at_parser_handle_t parser, bool enabled)
+{
+    if (parser == NULL)
+    {
+        return -1;
+    }
+    parser->binary_framing = enabled;
+    return 0;
+}
+
+extern int at_parser_encode_binary_frame(char *buffer, size_t buffer_len, uint16_t command_id, enum at_parser_command_type type, const struct at_parser_argument *argument_list, size_t argument_list_length, size_t *frame_length)
+{
+    if (buffer == NULL || frame_length == NULL || argument_list_length > UINT8_MAX || (argument_list == NULL && argument_list_length != 0))
+    {
+        return -1;
+    }
+    size_t length = AT_PARSER_BINARY_FRAME_HEADER_SIZE + 2 * argument_list_length;
+    for (size_t i = 0; i < argument_list_length; i++)
+    {
+        if (argument_list[i].length > UINT16_MAX)
+        {
+            return -1;
+        }
+        length += argument_list[i].length;
+    }
+    if (length > buffer_len)
+    {
+        return -1;
+    }
+    unsigned char *out = (unsigned char *)buffer;
+    *out++ = AT_PARSER_BINARY_FRAME_START;
+    *out++ = (unsigned char)type;
+    *out++ = (unsigned char)(command_id & 0xFF);
+    *out++ = (unsigned char)(command_id >> 8);
+    *out++ = (unsigned char)argument_list_length;
+    for (size_t i = 0; i < argument_list_length; i++)
+    {
+        *out++ = (unsigned char)(argument_list[i].length & 0xFF);
+        *out++ = (unsigned char)(argument_list[i].length >> 8);
+    }
+    for (size_t i = 0; i < argument_list_length; i++)
+    {
+        memcpy(out, argument_list[i].value, argument_list[i].length);
+        out += argument_list[i].length;
+    }
+    *frame_length = length;
+    return 0;
+}
+
+extern int at_parser_attach_command_table(at_parser_handle_t parser, const struct at_parser_command_table *table, void *userdata)
+{
+    if (parser == NULL || (table != NULL && (table->commands == NULL || table->slots == NULL)))
+    {
+        return -1;
+    }
+    parser->command_table = table;
+    parser->command_table_userdata = userdata;
+    return 0;
+}
+
+extern int at_parser_set_batch_handler(at_parser_handle_t parser, at_parser_batch_handler handler, void *userdata, size_t max_batch)
+{
+    if (parser == NULL || parser->batch.dispatching)
+    {
+        return -1;
+    }
+    parser->batch.handler = handler;
+    parser->batch.userdata = userdata;
+    parser->batch.limit = max_batch;
+    return 0;
+}
+
+extern int at_parser_set_command_qos(at_parser_handle_t parser, const char *command_name, enum at_parser_qos_class qos)
+{
+    if (parser == NULL || command_name == NULL || (unsigned)qos >= AT_PARSER_QOS_CLASS_COUNT)
+    {
+        return -1;
+    }
+    struct qos_table *table = &parser->qos;
+    const size_t name_length = strlen(command_name);
+    for (size_t i = 0; i < table->entry_count; i++)
+    {
+        struct qos_entry *entry = &table->entries[i];
+        if (entry->name_length == name_length && memcmp(table->pool + entry->name_offset, command_name, name_length) == 0)
+        {
+            entry->qos = qos;
+            return 0;
+        }
+    }
+    if (!reserve_array(parser, (void **)&table->entries, &table->entry_capacity, table->entry_count + 1, sizeof(struct qos_entry)) ||
+        !reserve_array(parser, (void **)&table->pool, &table->pool_capacity, table->pool_used + name_length, sizeof(char)))
+    {
+        return -1;
+    }
+    struct qos_entry *entry = &table->entries[table->entry_count++];
+    entry->name_offset = table->pool_used;
+    entry->name_length = name_length;
+    entry->qos = qos;
+    memcpy(table->pool + table->pool_used, command_name, name_length);
+    table->pool_used += name_length;
+    return 0;
+}
+
+extern int at_parser_get_qos_stats(at_parser_handle_t parser, enum at_parser_qos_class qos, struct at_parser_qos_stats *stats)
+{
+    if (parser == NULL || stats == NULL || (unsigned)qos >= AT_PARSER_QOS_CLASS_COUNT)
+    {
+        return -1;
+    }
+    *stats = parser->qos.stats[qos];
+    return 0;
+}
+
+extern int at_parser_clear_qos_stats(at_parser_handle_t parser)
+{
+    if (parser == NULL)
+    {
+        return -1;
+    }
+    for (size_t i = 0; i < AT_PARSER_QOS_CLASS_COUNT; i++)
+    {
+        const size_t depth = parser->qos.stats[i].depth;
+        memset(&parser->qos.stats[i], 0, sizeof(struct at_parser_qos_stats));
+        parser->qos.stats[i].depth = depth;
+        parser->qos.stats[i].max_depth = depth;
+    }
+    return 0;
+}
+
+extern int at_parser_set_history(at_parser_handle_t parser, size_t depth)
+{
+    if (parser == NULL || parser->history.dispatching)
+    {
+        return -1;
+    }
+    struct history_entry *entries = NULL;
+    if (depth > 0)
+    {
+        entries = parser_allocate(parser, depth * sizeof(struct history_entry));
+        if (entries == NULL)
+        {
+            return -1;
+        }
+        memset(entries, 0, depth * sizeof(struct history_entry));
+    }
+    const size_t hits = parser->history.hits;
+    free_history(parser);
+    parser->history.entries = entries;
+    parser->history.depth = depth;
+    parser->history.hits = hits;
+    return 0;
+}
+
+extern size_t at_parser_get_history_hits(at_parser_handle_t parser)
+{
+    return parser != NULL ? parser->history.hits : 0;
+}
+
+extern int at_parser_set_line_timeout(at_parser_handle_t parser, at_parser_timer_wheel_handle_t wheel, uint32_t timeout, enum at_parser_line_timeout_action action)
+{
+    if (parser == NULL || (action != AT_PARSER_LINE_TIMEOUT_DISCARD && action != AT_PARSER_LINE_TIMEOUT_COMMIT))
+    {
+        return -1;
+    }
+    at_parser_timer_cancel(&parser->line_timer);
+    at_parser_timer_init(&parser->line_timer, line_timeout_expired, parser);
+    parser->line_timer_wheel = wheel;
+    parser->line_timeout = timeout;
+    parser->line_timeout_action = action;
+    restart_line_timer(parser);
+    return 0;
+}
+
+extern int at_parser_enter_body_mode(at_parser_handle_t parser, at_parser_body_handler handler, void *userdata, size_t max_length)
+{
+    if (parser == NULL || handler == NULL || parser->batch.handler != NULL || parser->data.active)
+    {
+        return -1;
+    }
+    parser->body.handler = handler;
+    parser->body.userdata = userdata;
+    parser->body.max_length = max_length;
+    parser->body.length = 0;
+    parser->body.active = true;
+    parser->body.overflow = false;
+    write_result(parser, "\r\n> ", 4);
+    return 0;
+}
+
+extern bool at_parser_is_in_body_mode(at_parser_handle_t parser)
+{
+    return parser != NULL && parser->body.active;
+}
+
+extern int at_parser_enter_data_mode(at_parser_handle_t parser, const struct at_parser_data_mode_config *config)
+{
+    if (parser == NULL || config == NULL || config->sink == NULL || (config->guard_time != 0 && parser->clock == NULL) || parser->batch.handler != NULL || parser->body.active)
+    {
+        return -1;
+    }
+    parser->data.config = *config;
+    parser->data.active = true;
+    parser->data.escape_count = 0;
+    parser->data.last_byte_at = parser->clock != NULL ? parser->clock(parser->clock_userdata) : 0; // The command line counts as the last byte.
+    return 0;
+}
+
+extern int at_parser_leave_data_mode(at_parser_handle_t parser)
+{
+    if (parser == NULL)
+    {
+        return -1;
+    }
+    if (parser->data.active)
+    {
+        release_escape_chars(parser);
+        parser->data.active = false;
+    }
+    return 0;
+}
+
+extern int at_parser_poll_data_mode(at_parser_handle_t parser)
+{
+    if (parser == NULL)
+    {
+        return -1;
+    }
+    struct data_mode *data = &parser->data;
+    if (data->active && data->escape_count == 3 && data->config.guard_time != 0 && parser->clock != NULL && (uint32_t)(parser->clock(parser->clock_userdata) - data->last_byte_at) >= data->config.guard_time)
+    {
+        escape_data_mode(parser);
+    }
+    return 0;
+}
+
+extern bool at_parser_is_in_data_mode(at_parser_handle_t parser)
+{
+    return parser != NULL && parser->data.active;
+}
+
+extern int at_parser_set_line_checksum(at_parser_handle_t parser, enum at_parser_checksum_type type)
+{
+    if (parser == NULL || (type != AT_PARSER_CHECKSUM_NONE && at_parser_checksum_get_digits(type) == 0))
+    {
+        return -1;
+    }
+    parser->checksum = type;
+    return 0;
+}
+
+extern size_t at_parser_get_checksum_failures(at_parser_handle_t parser)
+{
+    return parser != NULL ? parser->checksum_failures : 0;
+}
+
+extern int at_parser_set_early_reject(at_parser_handle_t parser, bool enabled)
+{
+    if (parser == NULL)
+    {
+        return -1;
+    }
+    parser->reject.enabled = enabled; // A line that is being skipped is skipped to its end, its start is gone.
+    return 0;
+}
+
+extern int at_parser_set_buffer_policy(at_parser_handle_t parser, const struct at_parser_buffer_policy *policy)
+{
+    if (parser == NULL || (policy != NULL && (policy->min_size == 0 || policy->min_size > policy->max_size)))
+    {
+        return -1;
+    }
+    if (policy == NULL)
+    {
+        parser->adaptive.enabled = false;
+        return 0;
+    }
+    const size_t length = max(min(max(parser->buffer_length, policy->min_size), policy->max_size), parser->buffer_used);
+    if (length != parser->buffer_length && !resize_buffer(parser, length))
+    {
+        return -1;
+    }
+    parser->adaptive.policy = *policy;
+    parser->adaptive.enabled = true;
+    parser->adaptive.window_lines = 0;
+    parser->adaptive.window_longest = 0;
+    return 0;
+}
+
+extern size_t at_parser_get_buffer_size(at_parser_handle_t parser)
+{
+    return parser != NULL ? parser->buffer_length : 0;
+}
+
+extern int at_parser_get_line_histogram(at_parser_handle_t parser, struct at_parser_line_histogram *histogram)
+{
+    if (parser == NULL || histogram == NULL)
+    {
+        return -1;
+    }
+    *histogram = parser->histogram;
+    return 0;
+}
+
+extern int at_parser_clear_line_histogram(at_parser_handle_t parser)
+{
+    if (parser == NULL)
+    {
+        return -1;
+    }
+    memset(&parser->histogram, 0, sizeof(parser->histogram));
+    return 0;
+}
+
+static callback_entry_handle_t find_callback(callback_entry_handle_t start, const char *cmd, at_parser_received_command callback)
+{
+    callback_entry_handle_t current = start;
+    while (current != NULL && !(current->callback == callback && strcmp(current->command, cmd) == 0))
+    {
+        current = current->next;
+    }
+    return current;
+}
+
+static callback_entry_handle_t get_tail(callback_entry_handle_t start)
+{
+    callback_entry_handle_t current = start;
+    while (current != NULL && current->next != NULL)
+    {
+        current = current->next;
+    }
+    return current;
+}
+
+static callback_entry_handle_t find_before(callback_entry_handle_t start, callback_entry_handle_t item)
+{
+    callback_entry_handle_t previous = NULL;
+    callback_entry_handle_t current = start;
+    while (current != item && current != NULL && current->next != NULL)
+    {
+        previous = current;
+        current = current->next;
+    }
+    if (current == item)
+    {
+        return previous;
+    }
+    else
+    {
+        return NULL;
+    }
+}
+
+static void remove_callback_handler(at_parser_handle_t parser, callback_entry_handle_t item)
+{
+    if (item == NULL)
+    {
+        return;
+    }
+    if (parser != NULL)
+    {
+        callback_entry_handle_t before = find_before(parser->callbacks, item);
+        if (before != NULL)
+        {
+            before->next = item->next;
+        }
+        else
+        {
+            parser->callbacks = item->next;
+        }
+    }
+    parser_deallocate(parser, item->command);
+    parser_deallocate(parser, item);
+}
+
+static int add_callback_handler(at_parser_handle_t parser, const char *name, at_parser_received_command handler, void *userdata)
+{
+    callback_entry_handle_t new_item = parser_allocate(parser, sizeof(struct callback_entry));
+    if (new_item == NULL)
+    {
+        return -1;
+    }
+
+    new_item->command = parser_allocate(parser, strlen(name) + 1);
+    if (new_item->command == NULL)
+    {
+        parser_deallocate(parser, new_item);
+        return -1;
+    }
+    strcpy(new_item->command, name);
+
+    new_item->callback = handler;
+    new_item->userdata = userdata;
+    new_item->next = NULL;
+
+    if (parser->callbacks == NULL)
+    {
+        parser->callbacks = new_item;
+    }
+    else
+    {
+        get_tail(parser->callbacks)->next = new_item;
+    }
+    return 0;
+}
+
+static void remove_buffer(at_parser_handle_t parser, size_t len)
+{
+    size_t remove_len = parser->buffer_used > len ? len : parser->buffer_used;
+    memmove(parser->buffer, parser->buffer + remove_len, parser->buffer_used - remove_len);
+    parser->buffer_used -= remove_len;
+    parser->scan_position = parser->scan_position > remove_len ? parser->scan_position - remove_len : 0;
+}
+
+/**
+ * @brief Make room in a full buffer, the oldest bytes are dropped.
+ * 
+ */
+static void drop_buffer(at_parser_handle_t parser)
+{
+    const size_t length = min(parser->buffer_used, max(min(parser->buffer_length / 10, 1), 5)); // Drop between 1 and 5 bytes, depending on buffer size.
+    TRACE_BUFFER_OVERFLOW(parser, parser->buffer_used);
+    TRACE_BUFFER_DROP(parser, length);
+    remove_buffer(parser, length);
+}
+
+static bool resize_buffer(at_parser_handle_t parser, size_t length)
+{
+    char *buffer = parser_reallocate(parser, parser->buffer, length);
+    if (buffer == NULL)
+    {
+        return false;
+    }
+    parser->buffer = buffer;
+    parser->buffer_length = length;
+    return true;
+}
+
+/**
+ * @brief Make room in a full buffer by doubling it, when the buffer policy allows it.
+ * 
+ * @return true The buffer has grown.
+ * @return false The buffer can't grow, the caller drops bytes instead.
+ */
+static bool grow_buffer(at_parser_handle_t parser)
+{
+    struct adaptive_buffer *adaptive = &parser->adaptive;
+    if (!adaptive->enabled || parser->buffer_length >= adaptive->policy.max_size)
+    {
+        return false;
+    }
+    if (!resize_buffer(parser, min(parser->buffer_length * 2, adaptive->policy.max_size)))
+    {
+        return false;
+    }
+    adaptive->window_lines = 0;
+    adaptive->window_longest = 0;
+    return true;
+}
+
+/**
+ * @brief Halve the buffer while the recent lines fit a quarter of it, so a single longer line doesn't grow it again.
+ * 
+ */
+static void shrink_buffer(at_parser_handle_t parser)
+{
+    struct adaptive_buffer *adaptive = &parser->adaptive;
+    if (!adaptive->enabled || adaptive->policy.shrink_after == 0 || adaptive->window_lines < adaptive->policy.shrink_after)
+    {
+        return;
+    }
+    const size_t needed = adaptive->window_longest + 2; // + 2 for the \r\n
+    size_t length = parser->buffer_length;
+    while (length > adaptive->policy.min_size && length / 4 >= needed && max(length / 2, adaptive->policy.min_size) >= parser->buffer_used)
+    {
+        length = max(length / 2, adaptive->policy.min_size);
+    }
+    adaptive->window_lines = 0;
+    adaptive->window_longest = 0;
+    if (length != parser->buffer_length)
+    {
+        resize_buffer(parser, length);
+    }
+}
+
+static void record_line_length(at_parser_handle_t parser, size_t length)
+{
+    size_t bucket = 0;
+    for (size_t rest = length; rest > 1 && bucket < AT_PARSER_LINE_HISTOGRAM_BUCKETS - 1; rest >>= 1)
+    {
+        bucket++;
+    }
+    parser->histogram.counts[bucket]++;
+    parser->histogram.longest = max(parser->histogram.longest, length);
+    record_window_length(parser, length);
+}
+
+/**
+ * @brief Count a line or binary frame in the window that decides when the buffer shrinks.
+ * 
+ */
+static void record_window_length(at_parser_handle_t parser, size_t length)
+{
+    parser->adaptive.window_lines++;
+    parser->adaptive.window_longest = max(parser->adaptive.window_longest, length);
+}
+
+static size_t ingest(at_parser_handle_t parser, const char *buffer, size_t buffer_len, bool defer_when_paused, struct budget_state *budget)
+{
+    // Lines that were left from an exhausted budget go first.
+    if (!process_lines(parser, budget))
+    {
+        return 0;
+    }
+    const size_t max_bytes = budget != NULL && budget->budget->max_bytes != 0 ? min(budget->budget->max_bytes, buffer_len) : buffer_len;
+    size_t consumed = 0;
+    while (parser->buffer_used == 0 && consumed != max_bytes && !(defer_when_paused && parser->pending_over) && !budget_exhausted(parser, budget))
+    {
+        if (parser->body.active)
+        {
+            consumed += process_body(parser, buffer + consumed, max_bytes - consumed);
+            continue;
+        }
+        if (parser->data.active)
+        {
+            consumed += process_data(parser, buffer + consumed, max_bytes - consumed);
+            continue;
+        }
+        if (parser->reject.skipping)
+        {
+            consumed += skip_rejected_line(parser, buffer + consumed, max_bytes - consumed);
+            continue;
+        }
+        // Nothing is buffered, so complete lines that would fit the buffer are processed in place without copying them.
+        const size_t window = min(parser->buffer_length, max_bytes - consumed);
+        if (is_binary_frame_start(parser, buffer + consumed))
+        {
+            const size_t frame_length = process_binary_frame(parser, buffer + consumed, window);
+            if (frame_length == 0)
+            {
+                break;
+            }
+            consumed += frame_length;
+            if (budget != NULL)
+            {
+                budget->lines++;
+            }
+            continue;
+        }
+        if (is_repeat_command(parser, buffer + consumed, max_bytes - consumed))
+        {
+            repeat_command(parser);
+            consumed += 2;
+            if (budget != NULL)
+            {
+                budget->lines++;
+            }
+            continue;
+        }
+        const char *line_end = memchr(buffer + consumed, '\n', window);
+        if (line_end == NULL && reject_line_early(parser, buffer + consumed, window))
+        {
+            continue; // The incomplete line is skipped before it is copied into the buffer.
+        }
+        if (line_end == NULL || line_end == buffer + consumed || line_end[-1] != '\r')
+        {
+            break;
+        }
+        const size_t line_length = (size_t)(line_end - (buffer + consumed));
+        process_string_line(parser, buffer + consumed, line_length - 1); // Remove the \r
+        consumed += line_length + 1;
+        if (budget != NULL)
+        {
+            budget->lines++;
+        }
+    }
+    while (consumed != max_bytes && !(defer_when_paused && parser->pending_over) && !budget_exhausted(parser, budget))
+    {
+        if (parser->body.active && parser->buffer_used == 0)
+        {
+            // A body is never buffered, it goes to the body handler straight from the caller's buffer.
+            consumed += process_body(parser, buffer + consumed, max_bytes - consumed);
+            continue;
+        }
+        if (parser->data.active && parser->buffer_used == 0)
+        {
+            consumed += process_data(parser, buffer + consumed, max_bytes - consumed);
+            continue;
+        }
+        if (parser->reject.skipping && parser->buffer_used == 0)
+        {
+            consumed += skip_rejected_line(parser, buffer + consumed, max_bytes - consumed);
+            continue;
+        }
+        size_t copy_len = min(parser->buffer_length - parser->buffer_used, max_bytes - consumed);
+        if (copy_len == 0) {
+            if (!grow_buffer(parser))
+            {
+                drop_buffer(parser);
+            }
+            continue; // There is nothing to copy now, so just ignore this iteration.
+        }
+        if (defer_when_paused)
+        {
+            // Only take up to the next line end, so the remainder can be deferred when the handler fills up the pending queue.
+            const char *line_end = memchr(buffer + consumed, '\n', copy_len);
+            copy_len = line_end != NULL ? (size_t)(line_end - (buffer + consumed)) + 1 : copy_len;
+        }
+        memcpy(parser->buffer + parser->buffer_used, buffer + consumed, copy_len);
+        parser->buffer_used = (parser->buffer_used + copy_len);
+        consumed += copy_len;
+        process_lines(parser, budget);
+        reject_buffered_line(parser);
+        update_flow_state(parser);
+    }
+    shrink_buffer(parser);
+    update_flow_state(parser);
+    if (consumed > 0 || parser->buffer_used == 0)
+    {
+        restart_line_timer(parser);
+    }
+    return consumed;
+}
+
+static bool budget_exhausted(at_parser_handle_t parser, struct budget_state *budget)
+{
+    if (budget == NULL)
+    {
+        return false;
+    }
+    if (!budget->exhausted)
+    {
+        const struct at_parser_budget *limits = budget->budget;
+        if (limits->max_lines != 0 && budget->lines >= limits->max_lines)
+        {
+            budget->exhausted = true;
+        }
+        else if (limits->use_deadline && parser->clock != NULL && (int32_t)(parser->clock(parser->clock_userdata) - limits->deadline) >= 0)
+        {
+            budget->exhausted = true;
+        }
+    }
+    return budget->exhausted;
+}
+
+static void update_flow_state(at_parser_handle_t parser)
+{
+    if (!parser->flow_enabled)
+    {
+        return;
+    }
+    const struct at_parser_flow_control_config *flow = &parser->flow;
+    if (flow->pending_high_watermark != 0)
+    {
+        if (parser->pending_commands >= flow->pending_high_watermark)
+        {
+            parser->pending_over = true;
+        }
+        else if (parser->pending_commands <= flow->pending_low_watermark)
+        {
+            parser->pending_over = false;
+        }
+    }
+    else
+    {
+        parser->pending_over = false; // A new config can disable the watermark while the parser was paused for it.
+    }
+    const bool buffer_high = flow->buffer_high_watermark != 0 && parser->buffer_used >= flow->buffer_high_watermark;
+    const bool buffer_low = flow->buffer_high_watermark == 0 || parser->buffer_used <= flow->buffer_low_watermark;
+    if (!parser->flow_paused && (buffer_high || parser->pending_over))
+    {
+        parser->flow_paused = true;
+        flow->callback(parser, flow->userdata, AT_PARSER_FLOW_PAUSE);
+    }
+    else if (parser->flow_paused && buffer_low && !parser->pending_over)
+    {
+        parser->flow_paused = false;
+        flow->callback(parser, flow->userdata, AT_PARSER_FLOW_RESUME);
+    }
+}
+
+/**
+ * @brief Restart the inter-character timeout when there is a partial line, and stop it when there is none.
+ * 
+ */
+static void restart_line_timer(at_parser_handle_t parser)
+{
+    if (parser->line_timer_wheel == NULL || (parser->buffer_used == 0 && !parser->reject.skipping))
+    {
+        at_parser_timer_cancel(&parser->line_timer);
+        return;
+    }
+    at_parser_timer_arm(parser->line_timer_wheel, &parser->line_timer, parser->line_timeout);
+}
+
+static void line_timeout_expired(struct at_parser_timer *timer, void *userdata)
+{
+    (void)timer;
+    at_parser_handle_t parser = (at_parser_handle_t)userdata;
+    process_lines(parser, NULL); // Complete lines left by a budgeted call go first.
+    if (parser->buffer_used > 0)
+    {
+        if (parser->line_timeout_action == AT_PARSER_LINE_TIMEOUT_COMMIT && !is_binary_frame_start(parser, parser->buffer))
+        {
+            const size_t length = parser->buffer[parser->buffer_used - 1] == '\r' ? parser->buffer_used - 1 : parser->buffer_used;
+            process_string_line(parser, parser->buffer, length);
+        }
+        else
+        {
+            TRACE_BUFFER_DROP(parser, parser->buffer_used);
+        }
+        remove_buffer(parser, parser->buffer_used);
+    }
+    if (parser->reject.skipping)
+    {
+        // The timeout ends the skipped line as well.
+        if (parser->line_timeout_action == AT_PARSER_LINE_TIMEOUT_COMMIT && parser->reject.answer)
+        {
+            write_result(parser, "ERROR\r\n", 7);
+        }
+        parser->reject.skipping = false;
+    }
+    flush_batch(parser);
+    update_flow_state(parser);
+}
+
+/**
+ * @brief Pass the next part of a body to the body handler.
+ * 
+ * @return size_t The amount of bytes that belonged to the body (the Ctrl-Z or ESC included).
+ */
+static size_t process_body(at_parser_handle_t parser, const char *data, size_t length)
+{
+    struct body_mode *body = &parser->body;
+    // Both scans use memchr, the ESC scan only has to look in front of the Ctrl-Z.
+    const char *end = memchr(data, AT_PARSER_BODY_END_CHAR, length);
+    const char *cancel = memchr(data, AT_PARSER_BODY_CANCEL_CHAR, end != NULL ? (size_t)(end - data) : length);
+    const char *terminator = cancel != NULL ? cancel : end;
+    const size_t body_length = terminator != NULL ? (size_t)(terminator - data) : length;
+    if (!body->overflow && body_length > 0)
+    {
+        const size_t room = body->max_length == 0 ? body_length : body->max_length - body->length;
+        const size_t chunk = min(body_length, room);
+        if (chunk > 0)
+        {
+            body->length += chunk;
+            body->handler(parser, body->userdata, AT_PARSER_BODY_DATA, data, chunk);
+        }
+        body->overflow = chunk < body_length;
+    }
+    if (terminator == NULL)
+    {
+        return length;
+    }
+    const enum at_parser_body_event event = body->overflow ? AT_PARSER_BODY_OVERFLOW : (terminator == cancel ? AT_PARSER_BODY_CANCEL : AT_PARSER_BODY_END);
+    body->active = false;
+    body->handler(parser, body->userdata, event, NULL, 0);
+    return body_length + 1;
+}
+
+/**
+ * @brief Pass data to the data sink, while looking for the escape sequence.
+ * 
+ * @return size_t The amount of bytes that were data (the escape sequence included), the rest is parsed as commands.
+ */
+static size_t process_data(at_parser_handle_t parser, const char *data, size_t length)
+{
+    struct data_mode *mode = &parser->data;
+    const uint32_t guard_time = mode->config.guard_time;
+    const uint32_t now = parser->clock != NULL ? parser->clock(parser->clock_userdata) : 0;
+    const bool after_silence = guard_time != 0 && (uint32_t)(now - mode->last_byte_at) >= guard_time;
+    if (length > 0)
+    {
+        mode->last_byte_at = now;
+    }
+    size_t position = 0;
+    while (position < length)
+    {
+        if (mode->escape_count > 0)
+        {
+            // All bytes of one buffer arrived at the same time, so only the first one can be too late.
+            if (mode->escape_count < 3 && data[position] == AT_PARSER_DATA_ESCAPE_CHAR && (position > 0 || guard_time == 0 || !after_silence))
+            {
+                mode->escape_count++;
+                position++;
+                if (mode->escape_count == 3 && guard_time == 0)
+                {
+                    escape_data_mode(parser);
+                    return position;
+                }
+                continue;
+            }
+            release_escape_chars(parser);
+        }
+        if (guard_time != 0)
+        {
+            // The escape sequence can only start after the guard time, which is the start of a buffer, so nothing has to be scanned.
+            if (position == 0 && after_silence && data[0] == AT_PARSER_DATA_ESCAPE_CHAR)
+            {
+                mode->escape_count = 1;
+                position = 1;
+                continue;
+            }
+            mode->config.sink(parser, mode->config.sink_userdata, data + position, length - position);
+            return length;
+        }
+        const char *escape = memchr(data + position, AT_PARSER_DATA_ESCAPE_CHAR, length - position);
+        const size_t data_end = escape != NULL ? (size_t)(escape - data) : length;
+        if (data_end > position)
+        {
+            mode->config.sink(parser, mode->config.sink_userdata, data + position, data_end - position);
+        }
+        if (escape == NULL)
+        {
+            return length;
+        }
+        mode->escape_count = 1;
+        position = data_end + 1;
+    }
+    return length;
+}
+
+/**
+ * @brief The held back escape characters turned out to be data, pass them to the sink.
+ * 
+ */
+static void release_escape_chars(at_parser_handle_t parser)
+{
+    static const char escape_chars[3] = {AT_PARSER_DATA_ESCAPE_CHAR, AT_PARSER_DATA_ESCAPE_CHAR, AT_PARSER_DATA_ESCAPE_CHAR};
+    if (parser->data.escape_count > 0)
+    {
+        parser->data.config.sink(parser, parser->data.config.sink_userdata, escape_chars, parser->data.escape_count);
+        parser->data.escape_count = 0;
+    }
+}
+
+static void escape_data_mode(at_parser_handle_t parser)
+{
+    parser->data.active = false;
+    parser->data.escape_count = 0;
+    write_result(parser, "OK\r\n", 4);
+    if (parser->data.config.escaped != NULL)
+    {
+        parser->data.config.escaped(parser, parser->data.config.escaped_userdata);
+    }
+}
+
+static bool process_lines(at_parser_handle_t parser, struct budget_state *budget)
+{
+    size_t start = 0;
+    while (!budget_exhausted(parser, budget))
+    {
+        if (parser->body.active)
+        {
+            // A handler entered body mode, the rest of the buffer belongs to the body.
+            start += process_body(parser, parser->buffer + start, parser->buffer_used - start);
+            if (parser->body.active)
+            {
+                break;
+            }
+            continue;
+        }
+        if (parser->data.active)
+        {
+            // A handler entered data mode, the rest of the buffer is data.
+            start += process_data(parser, parser->buffer + start, parser->buffer_used - start);
+            if (parser->data.active)
+            {
+                break;
+            }
+            continue;
+        }
+        if (start < parser->buffer_used && is_binary_frame_start(parser, parser->buffer + start))
+        {
+            const size_t frame_length = process_binary_frame(parser, parser->buffer + start, parser->buffer_used - start);
+            if (frame_length == 0)
+            {
+                break; // Wait for the rest of the frame.
+            }
+            start += frame_length;
+            if (budget != NULL)
+            {
+                budget->lines++;
+            }
+            continue;
+        }
+        if (is_repeat_command(parser, parser->buffer + start, parser->buffer_used - start))
+        {
+            repeat_command(parser);
+            start += 2;
+            if (budget != NULL)
+            {
+                budget->lines++;
+            }
+            continue;
+        }
+        // Only the bytes that weren't scanned before are searched for the line end.
+        const size_t scan_from = max(parser->scan_position, start);
+        const char *line_end = memchr(parser->buffer + scan_from, '\n', parser->buffer_used - scan_from);
+        if (line_end == NULL)
+        {
+            parser->scan_position = parser->buffer_used;
+            break;
+        }
+        const size_t res = (size_t)(line_end - parser->buffer);
+        parser->scan_position = res;
+        const bool has_cr = (res > start && line_end[-1] == '\r') || memchr(parser->buffer + start, '\r', parser->buffer_used - start) != NULL;
+        if (!has_cr)
+        {
+            break; // A line is only complete once there is a \r as well.
+        }
+        process_string_line(parser, parser->buffer + start, res > start ? res - start - 1 : 0); // Remove the \r
+        start = res + 1;
+        if (budget != NULL)
+        {
+            budget->lines++;
+        }
+    }
+    remove_buffer(parser, start);
+    return budget == NULL || !budget->exhausted;
+}
+
+/**
+ * @brief Check and remove the checksum suffix of a line.
+ * 
+ * @return true The checksum is correct, len is shortened to the line without the suffix.
+ * @return false The suffix is missing or the checksum is wrong.
+ */
+static bool check_line_checksum(at_parser_handle_t parser, const char *str, size_t *len)
+{
+    const size_t digits = at_parser_checksum_get_digits(parser->checksum);
+    if (*len < digits + 1 || str[*len - digits - 1] != AT_PARSER_CHECKSUM_SEPARATOR)
+    {
+        return false;
+    }
+    const size_t payload_length = *len - digits - 1;
+    uint32_t expected = 0;
+    for (size_t i = payload_length + 1; i < *len; i++)
+    {
+        const char chr = (char)tolower((unsigned char)str[i]);
+        if (chr >= '0' && chr <= '9')
+        {
+            expected = (expected << 4) | (uint32_t)(chr - '0');
+        }
+        else if (chr >= 'a' && chr <= 'f')
+        {
+            expected = (expected << 4) | (uint32_t)(chr - 'a' + 10);
+        }
+        else
+        {
+            return false;
+        }
+    }
+    if (at_parser_checksum_compute(parser->checksum, str, payload_length) != expected)
+    {
+        return false;
+    }
+    *len = payload_length;
+    return true;
+}
+
+/**
+ * @brief Skip the bytes of a rejected line.
+ * 
+ * @return size_t The amount of bytes that belonged to the line (the line end included).
+ */
+static size_t skip_rejected_line(at_parser_handle_t parser, const char *data, size_t length)
+{
+    const char *line_end = memchr(data, '\n', length);
+    if (line_end == NULL)
+    {
+        return length;
+    }
+    parser->reject.skipping = false;
+    if (parser->reject.answer)
+    {
+        write_result(parser, "ERROR\r\n", 7);
+    }
+    return (size_t)(line_end - data) + 1;
+}
+
+/**
+ * @brief Check the start of an incomplete line, and start skipping it when no command can match it.
+ * 
+ * @return true The line is rejected, the caller drops the given bytes.
+ * @return false The line might still be a command.
+ */
+static bool reject_line_early(at_parser_handle_t parser, const char *line, size_t length)
+{
+    if (!parser->reject.enabled || length == 0)
+    {
+        return false;
+    }
+    if (memcmp(line, "AT+", min(length, 3)) != 0)
+    {
+        parser->reject.skipping = true;
+        parser->reject.answer = false; // Such lines are ignored.
+        return true;
+    }
+    if (length <= 3)
+    {
+        return false;
+    }
+    const char *name = line + 3;
+    size_t name_length = 0;
+    // The name ends at the first non letter, like in get_command_length.
+    while (name_length < length - 3 && isascii(name[name_length]) && isalpha((int)name[name_length]))
+    {
+        name_length++;
+    }
+    if (can_match_name(parser, name, name_length, name_length < length - 3))
+    {
+        return false;
+    }
+    parser->reject.skipping = true;
+    parser->reject.answer = true;
+    return true;
+}
+
+/**
+ * @brief Check the incomplete line in the buffer, a rejected line is dropped from the buffer.
+ * 
+ */
+static void reject_buffered_line(at_parser_handle_t parser)
+{
+    // The scan position is only at the end when the buffer holds nothing but an incomplete line.
+    if (parser->buffer_used == 0 || parser->scan_position != parser->buffer_used || parser->body.active || parser->data.active || is_binary_frame_start(parser, parser->buffer))
+    {
+        return;
+    }
+    if (reject_line_early(parser, parser->buffer, parser->buffer_used))
+    {
+        TRACE_BUFFER_DROP(parser, parser->buffer_used);
+        remove_buffer(parser, parser->buffer_used);
+    }
+}
+
+/**
+ * @brief Check if a command name (or the start of one) can match a command of the parser.
+ * 
+ * @param complete The name is complete, otherwise it only has to be the start of a command name.
+ */
+static bool can_match_name(at_parser_handle_t parser, const char *name, size_t name_length, bool complete)
+{
+    if (parser->batch.handler != NULL)
+    {
+        return true; // The batch handler gets every command.
+    }
+    for (callback_entry_handle_t item = parser->callbacks; item != NULL; item = item->next)
+    {
+        // strncmp stops at the end of a shorter handler name, so this is a prefix match.
+        if (strncmp(item->command, name, name_length) == 0 && (!complete || item->command[name_length] == '\0'))
+        {
+            return true;
+        }
+    }
+    if (parser->registry != NULL)
+    {
+        if (complete ? find_registry_name(parser->registry, name, name_length) != NULL : has_registry_prefix(parser->registry, name, name_length))
+        {
+            return true;
+        }
+    }
+    const struct at_parser_command_table *table = parser->command_table;
+    if (table != NULL)
+    {
+        if (complete)
+        {
+            return at_parser_command_table_find(table, name, name_length) != NULL;
+        }
+        for (size_t i = 0; i < table->command_count; i++)
+        {
+            if (table->commands[i].name_length >= name_length && memcmp(table->commands[i].name, name, name_length) == 0)
+            {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+static void process_string_line(at_parser_handle_t parser, const char *str, size_t len)
+{
+    TRACE_LINE_COMPLETE(parser, str, len);
+    record_line_length(parser, len);
+    if (len == 2 && is_repeat_command(parser, str, len))
+    {
+        repeat_command(parser);
+        return;
+    }
+    if (parser->checksum != AT_PARSER_CHECKSUM_NONE && len > 0 && !check_line_checksum(parser, str, &len))
+    {
+        parser->checksum_failures++;
+        return;
+    }
+    if (len < 4)
+    {
+        return;
+    }
+    if (str[0] != 'A' || str[1] != 'T' || str[2] != '+')
+    {
+        return;
+    }
+    const char *command_start = str + 3; // + 3 for the AT+
+    const size_t command_length = get_command_length(command_start, len);
+    if (parser->reject.enabled && !can_match_name(parser, command_start, command_length, true))
+    {
+        write_result(parser, "ERROR\r\n", 7);
+        return;
+    }
+    // A line that is byte for byte the same as a recent one is dispatched with the arguments that were parsed back then.
+    uint32_t hash = 0;
+    if (parser->history.depth > 0)
+    {
+        hash = at_parser_command_table_hash(0, str, len);
+        struct history_entry *entry = find_history(parser, str, len, hash);
+        if (entry != NULL)
+        {
+            parser->history.hits++;
+            dispatch_history(parser, entry);
+            return;
+        }
+    }
+    const size_t extra_start_at = command_length + 3;
+    const size_t extra_length = len - extra_start_at;
+
+    struct at_parser_argument *args = NULL;
+    size_t arg_length = 0;
+    enum at_parser_command_type type = AT_PARSER_COMMAND_TYPE_EXECUTE;
+    bool error = false;
+    if (extra_length == 1 && str[extra_start_at] == '?')
+    {
+        type = AT_PARSER_COMMAND_TYPE_TEST;
+    }
+    else if (extra_length == 2 && (str[extra_start_at] == '=' && str[extra_start_at + 1] == '?'))
+    {
+        type = AT_PARSER_COMMAND_TYPE_QUERY;
+    }
+    else if (extra_length >= 2 && str[extra_start_at] == '=')
+    {
+        error = !parse_argument_list(parser, str + extra_start_at + 1, extra_length - 1, &args, &arg_length);
+        TRACE_ARGUMENT_PARSE(parser, extra_length - 1, arg_length);
+        type = AT_PARSER_COMMAND_TYPE_SET;
+    }
+    else if (extra_length != 0)
+    {
+        error = true;
+    }
+    if (!error)
+    {
+        dispatch_command(parser, command_start, command_length, type, args, arg_length);
+        if (parser->history.depth > 0)
+        {
+            store_history(parser, str, len, hash, command_length, type, args, arg_length);
+        }
+    }
+    free_argument_list(parser, args, arg_length);
+}
+
+static void dispatch_command(at_parser_handle_t parser, const char *command, size_t command_length, enum at_parser_command_type type, struct at_parser_argument *args, size_t arg_length)
+{
+    if (parser->batch.handler != NULL)
+    {
+        add_to_batch(parser, command, command_length, type, args, arg_length);
+    }
+    else if (!dispatch_command_table(parser, command, command_length, type, args, arg_length))
+    {
+        TRACE_DISPATCH_BEGIN(parser, command, command_length, type);
+        dispatch_registry(parser, command, command_length, type, args, arg_length);
+        dispatch_callbacks(parser, command, command_length, type, args, arg_length);
+        TRACE_DISPATCH_END(parser, command, command_length, type);
+    }
+}
+
+/**
+ * @brief Check for the V.250 repeat command "A/", it needs no line end.
+ * 
+ */
+static inline bool is_repeat_command(at_parser_handle_t parser, const char *str, size_t len)
+{
+    return parser->history.depth > 0 && len >= 2 && str[0] == 'A' && str[1] == '/';
+}
+
+static void repeat_command(at_parser_handle_t parser)
+{
+    if (parser->history.last == NULL)
+    {
+        write_result(parser, "ERROR\r\n", 7); // There is nothing to repeat.
+        return;
+    }
+    parser->history.hits++;
+    dispatch_history(parser, parser->history.last);
+}
+
+static struct history_entry *find_history(at_parser_handle_t parser, const char *str, size_t len, uint32_t hash)
+{
+    struct command_history *history = &parser->history;
+    for (size_t i = 0; i < history->depth; i++)
+    {
+        struct history_entry *entry = &history->entries[i];
+        if (entry->last_used != 0 && entry->hash == hash && entry->line_length == len &&
+            memcmp(entry->block + entry->argument_count * sizeof(struct at_parser_argument), str, len) == 0)
+        {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Keep a parsed line in the least recently used entry, its block is reused when it is large enough.
+ * 
+ */
+static void store_history(at_parser_handle_t parser, const char *str, size_t len, uint32_t hash, size_t command_length, enum at_parser_command_type type, const struct at_parser_argument *args, size_t arg_length)
+{
+    struct command_history *history = &parser->history;
+    if (history->dispatching)
+    {
+        return; // A handler fed a line while an entry is dispatched, which may be the entry that would be replaced.
+    }
+    struct history_entry *entry = &history->entries[0];
+    for (size_t i = 1; i < history->depth && entry->last_used != 0; i++)
+    {
+        if (history->entries[i].last_used < entry->last_used)
+        {
+            entry = &history->entries[i];
+        }
+    }
+    const size_t list_size = arg_length * sizeof(struct at_parser_argument);
+    size_t size = list_size + len;
+    for (size_t i = 0; i < arg_length; i++)
+    {
+        size += args[i].length;
+    }
+    if (size > entry->block_capacity)
+    {
+        char *block = entry->block == NULL ? parser_allocate(parser, size) : parser_reallocate(parser, entry->block, size);
+        if (block == NULL)
+        {
+            return;
+        }
+        entry->block = block;
+        entry->block_capacity = size;
+    }
+    struct at_parser_argument *list = (struct at_parser_argument *)entry->block;
+    char *values = entry->block + list_size + len;
+    memcpy(entry->block + list_size, str, len);
+    for (size_t i = 0; i < arg_length; i++)
+    {
+        memcpy(values, args[i].value, args[i].length);
+        list[i].value = values;
+        list[i].length = args[i].length;
+        values += args[i].length;
+    }
+    entry->line_length = len;
+    entry->hash = hash;
+    entry->type = type;
+    entry->name_length = command_length;
+    entry->argument_count = arg_length;
+    entry->last_used = ++history->uses;
+    history->last = entry;
+}
+
+static void dispatch_history(at_parser_handle_t parser, struct history_entry *entry)
+{
+    struct command_history *history = &parser->history;
+    const size_t list_size = entry->argument_count * sizeof(struct at_parser_argument);
+    const bool dispatching = history->dispatching;
+    entry->last_used = ++history->uses;
+    history->last = entry;
+    history->dispatching = true;
+    dispatch_command(parser, entry->block + list_size + 3, entry->name_length, entry->type, entry->argument_count > 0 ? (struct at_parser_argument *)entry->block : NULL, entry->argument_count); // + 3 for the AT+
+    history->dispatching = dispatching;
+}
+
+static void free_history(at_parser_handle_t parser)
+{
+    struct command_history *history = &parser->history;
+    for (size_t i = 0; i < history->depth; i++)
+    {
+        parser_deallocate(parser, history->entries[i].block);
+    }
+    parser_deallocate(parser, history->entries);
+    memset(history, 0, sizeof(struct command_history));
+}
+
+static bool is_binary_frame_start(at_parser_handle_t parser, const char *str)
+{
+    return parser->binary_framing && (unsigned char)str[0] == AT_PARSER_BINARY_FRAME_START;
+}
+
+/**
+ * @brief Get the total length of the binary frame at the start of str.
+ * 
+ * @return size_t The length of the frame, 0 when the header isn't complete yet.
+ */
+static size_t get_binary_frame_length(const char *str, size_t len)
+{
+    const unsigned char *header = (const unsigned char *)str;
+    if (len < AT_PARSER_BINARY_FRAME_HEADER_SIZE)
+    {
+        return 0;
+    }
+    const size_t argument_count = header[4];
+    size_t frame_length = AT_PARSER_BINARY_FRAME_HEADER_SIZE + 2 * argument_count;
+    if (len < frame_length)
+    {
+        return 0;
+    }
+    const unsigned char *lengths = header + AT_PARSER_BINARY_FRAME_HEADER_SIZE;
+    for (size_t i = 0; i < argument_count; i++)
+    {
+        frame_length += (size_t)lengths[2 * i] | ((size_t)lengths[2 * i + 1] << 8);
+    }
+    return frame_length;
+}
+
+/**
+ * @brief Dispatch the binary frame at the start of str, the arguments point into str.
+ * 
+ * @return size_t The amount of bytes used, 0 when the frame isn't complete yet.
+ */
+static size_t process_binary_frame(at_parser_handle_t parser, const char *str, size_t len)
+{
+    const size_t frame_length = get_binary_frame_length(str, len);
+    const size_t max_length = parser->adaptive.enabled ? max(parser->buffer_length, parser->adaptive.policy.max_size) : parser->buffer_length;
+    if (frame_length > max_length)
+    {
+        TRACE_BUFFER_DROP(parser, 1);
+        return 1; // Can never be buffered, so the start byte is dropped like garbage.
+    }
+    if (frame_length == 0 || frame_length > len)
+    {
+        return 0; // The buffer grows (up to the policy its maximum) while the rest of the frame is buffered.
+    }
+    record_window_length(parser, frame_length);
+    const unsigned char *header = (const unsigned char *)str;
+    const enum at_parser_command_type type = (enum at_parser_command_type)header[1];
+    const size_t command_id = (size_t)header[2] | ((size_t)header[3] << 8);
+    const size_t argument_count = header[4];
+    at_parser_registry_handle_t registry = parser->registry;
+    if (type > AT_PARSER_COMMAND_TYPE_EXECUTE || registry == NULL || command_id >= registry->name_count)
+    {
+        return frame_length;
+    }
+
+    struct at_parser_argument small_args[8];
+    struct at_parser_argument *args = small_args;
+    if (argument_count > sizeof(small_args) / sizeof(small_args[0]))
+    {
+        args = parser_allocate(parser, argument_count * sizeof(struct at_parser_argument));
+        if (args == NULL)
+        {
+            return frame_length;
+        }
+    }
+    const unsigned char *lengths = header + AT_PARSER_BINARY_FRAME_HEADER_SIZE;
+    const char *value = str + AT_PARSER_BINARY_FRAME_HEADER_SIZE + 2 * argument_count;
+    for (size_t i = 0; i < argument_count; i++)
+    {
+        args[i].value = value;
+        args[i].length = (size_t)lengths[2 * i] | ((size_t)lengths[2 * i + 1] << 8);
+        value += args[i].length;
+    }
+
+    const struct registry_name *name = &registry->names[command_id];
+    const char *command_name = registry->name_pool + name->name_offset;
+    TRACE_LINE_COMPLETE(parser, str, frame_length);
+    TRACE_ARGUMENT_PARSE(parser, frame_length - AT_PARSER_BINARY_FRAME_HEADER_SIZE, argument_count);
+    if (parser->batch.handler != NULL)
+    {
+        add_to_batch(parser, command_name, name->name_length, type, args, argument_count);
+    }
+    else
+    {
+        TRACE_DISPATCH_BEGIN(parser, command_name, name->name_length, type);
+        dispatch_registry_name(parser, name, type, argument_count > 0 ? args : NULL, argument_count);
+        dispatch_callbacks(parser, command_name, name->name_length, type, argument_count > 0 ? args : NULL, argument_count);
+        TRACE_DISPATCH_END(parser, command_name, name->name_length, type);
+    }
+    if (args != small_args)
+    {
+        parser_deallocate(parser, args);
+    }
+    return frame_length;
+}
+
+static size_t get_command_length(const char *str, size_t str_len)
+{
+    size_t length = 0;
+
+    while (isascii(str[length]) && isalpha((int)str[length]) && length < str_len)
+    {
+        length++;
+    }
+    return length;
+}
+
+static bool parse_argument_list(at_parser_handle_t parser, const char *arg_list, size_t str_len, struct at_parser_argument **list, size_t *list_length)
+{
+    if (list == NULL || arg_list == NULL || list_length == NULL)
+    {
+        return false;
+    }
+    size_t position = 0;
+    char separator = parser->arg_separator;
+    char escape = parser->escape_char;
+    do
     {
         bool found = false;
         int quote_count = 0;
@@ -390,20 +2226,22 @@ static bool parse_argument_list(at_parser_handle_t parser, const char *arg_list,
         }
         if (found == false && str_len == index && ((quote_count % 2) != 0))
         {
-            free_argument_list(*list);
+            free_argument_list(parser, *list, *list_length);
+            *list = NULL;
+            *list_length = 0;
             return false;
         }
         else
         {
-            struct at_parser_argument *new_list = add_to_argument_list(*list, *list_length, arg_list + position, index - position - (found ? 1 : 0), escape); // If last arg then no trailing ',' otherwise compensate string length.
+            struct at_parser_argument *new_list = add_to_argument_list(parser, *list, *list_length, arg_list + position, index - position - (found ? 1 : 0), escape); // If last arg then no trailing ',' otherwise compensate string length.
             if (new_list == NULL)
             {
-                free_argument_list(*list);
-            }
-            else
-            {
-                *list = new_list;
+                free_argument_list(parser, *list, *list_length);
+                *list = NULL;
+                *list_length = 0;
+                return false;
             }
+            *list = new_list;
             *list_length = *list_length + 1;
             position = index;
         }
@@ -411,33 +2249,46 @@ static bool parse_argument_list(at_parser_handle_t parser, const char *arg_list,
     return true;
 }
 
-static void free_argument_list(struct at_parser_argument *list)
+static void free_argument_list(at_parser_handle_t parser, struct at_parser_argument *list, size_t list_length)
 {
-    free(list);
+    if (list == NULL)
+    {
+        return;
+    }
+    for (size_t i = 0; i < list_length; i++)
+    {
+        parser_deallocate(parser, (char *)list[i].value);
+    }
+    parser_deallocate(parser, list);
 }
-static struct at_parser_argument *add_to_argument_list(struct at_parser_argument *list, size_t list_len, const char *value, size_t value_length, char escape_char)
+
+static struct at_parser_argument *add_to_argument_list(at_parser_handle_t parser, struct at_parser_argument *list, size_t list_len, const char *value, size_t value_length, char escape_char)
 {
+    // The value is allocated first, so on failure the list is still intact for the caller to free.
+    const size_t length = sanitize_quoted_string_length(value, value_length, escape_char);
+    char *sanitized = parser_allocate(parser, length + 1); // + 1 for the NULL terminator.
+    if (sanitized == NULL)
+    {
+        return NULL;
+    }
     struct at_parser_argument *new_list = NULL;
     if (list == NULL)
     {
-        new_list = malloc(sizeof(struct at_parser_argument));
+        new_list = parser_allocate(parser, sizeof(struct at_parser_argument));
     }
     else
     {
-        new_list = realloc(list, (list_len + 1) * sizeof(struct at_parser_argument));
+        new_list = parser_reallocate(parser, list, (list_len + 1) * sizeof(struct at_parser_argument));
     }
-    if (new_list != NULL)
+    if (new_list == NULL)
     {
-        new_list[list_len].length = sanitize_quoted_string_length(value, value_length, '\\');
-        new_list[list_len].value = malloc(new_list[list_len].length);
-        if (new_list[list_len].value == NULL)
-        {
-            free(new_list);
-            return NULL;
-        }
-        sanitize_quoted_string_to((char *)value, escape_char, value_length, (char *)new_list[list_len].value);
-        ((char *)new_list[list_len].value)[new_list[list_len].length] = '\0';
+        parser_deallocate(parser, sanitized);
+        return NULL;
     }
+    sanitize_quoted_string_to((char *)value, escape_char, value_length, sanitized);
+    sanitized[length] = '\0';
+    new_list[list_len].value = sanitized;
+    new_list[list_len].length = length;
     return new_list;
 }
 
@@ -503,3 +2354,408 @@ static size_t sanitize_quoted_string_length(const char *string, size_t length, c
     }
     return count;
 }
+
+static int compare_registry_sort_items(const void *one, const void *two)
+{
+    const struct registry_sort_item *first = one;
+    const struct registry_sort_item *second = two;
+    int res = strcmp(first->name, second->name);
+    if (res == 0)
+    {
+        // The entries are stored in registration order, so this keeps the sort stable.
+        res = first->entry < second->entry ? -1 : (first->entry > second->entry ? 1 : 0);
+    }
+    return res;
+}
+
+static const struct registry_name *find_registry_name(at_parser_registry_handle_t registry, const char *name, size_t name_length)
+{
+    size_t low = 0;
+    size_t high = registry->name_count;
+    while (low < high)
+    {
+        const size_t middle = low + (high - low) / 2;
+        const struct registry_name *current = &registry->names[middle];
+        int res = memcmp(registry->name_pool + current->name_offset, name, min(current->name_length, name_length));
+        if (res == 0)
+        {
+            res = current->name_length < name_length ? -1 : (current->name_length > name_length ? 1 : 0);
+        }
+        if (res == 0)
+        {
+            return current;
+        }
+        else if (res < 0)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Check if a name in the (frozen) registry starts with the prefix.
+ * 
+ */
+static bool has_registry_prefix(at_parser_registry_handle_t registry, const char *prefix, size_t prefix_length)
+{
+    // Find the first name that doesn't sort before the prefix, the names that start with the prefix follow it.
+    size_t low = 0;
+    size_t high = registry->name_count;
+    while (low < high)
+    {
+        const size_t middle = low + (high - low) / 2;
+        const struct registry_name *current = &registry->names[middle];
+        int res = memcmp(registry->name_pool + current->name_offset, prefix, min(current->name_length, prefix_length));
+        if (res == 0 && current->name_length < prefix_length)
+        {
+            res = -1;
+        }
+        if (res < 0)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+    if (low == registry->name_count)
+    {
+        return false;
+    }
+    const struct registry_name *name = &registry->names[low];
+    return name->name_length >= prefix_length && memcmp(registry->name_pool + name->name_offset, prefix, prefix_length) == 0;
+}
+
+static void dispatch_registry(at_parser_handle_t parser, const char *command, size_t command_length, enum at_parser_command_type type, struct at_parser_argument *args, size_t arg_length)
+{
+    at_parser_registry_handle_t registry = parser->registry;
+    if (registry == NULL)
+    {
+        return;
+    }
+    const struct registry_name *name = find_registry_name(registry, command, command_length);
+    if (name != NULL)
+    {
+        dispatch_registry_name(parser, name, type, args, arg_length);
+    }
+}
+
+static void dispatch_registry_name(at_parser_handle_t parser, const struct registry_name *name, enum at_parser_command_type type, struct at_parser_argument *args, size_t arg_length)
+{
+    at_parser_registry_handle_t registry = parser->registry;
+    const char *command_name = registry->name_pool + name->name_offset;
+    const struct registry_entry *entry = registry->entries + name->first_entry;
+    const struct registry_entry *end = entry + name->entry_count;
+    for (; entry != end; entry++)
+    {
+        entry->callback(parser, entry->userdata, command_name, type, args, arg_length);
+    }
+}
+
+static void dispatch_callbacks(at_parser_handle_t parser, const char *command, size_t command_length, enum at_parser_command_type type, struct at_parser_argument *args, size_t arg_length)
+{
+    callback_entry_handle_t item = parser->callbacks;
+    do
+    {
+        if (item != NULL)
+        {
+            if (strlen(item->command) == command_length && strncmp(item->command, command, command_length) == 0)
+            {
+                if (item->callback)
+                {
+                    item->callback(parser, item->userdata, item->command, type, args, arg_length);
+                }
+            }
+            item = item->next;
+        }
+    } while (item != NULL);
+}
+
+/**
+ * @brief Dispatch a command from the attached command table.
+ * 
+ * @return true The command is in the table and has been handled.
+ * @return false The command isn't in the table.
+ */
+static bool dispatch_command_table(at_parser_handle_t parser, const char *command, size_t command_length, enum at_parser_command_type type, struct at_parser_argument *args, size_t arg_length)
+{
+    const struct at_parser_table_command *entry = at_parser_command_table_find(parser->command_table, command, command_length);
+    if (entry == NULL)
+    {
+        return false;
+    }
+    TRACE_DISPATCH_BEGIN(parser, command, command_length, type);
+    if ((entry->types & AT_PARSER_COMMAND_TYPE_BIT(type)) == 0 || (type == AT_PARSER_COMMAND_TYPE_SET && !at_parser_command_table_validate(entry, args, arg_length)))
+    {
+        write_result(parser, "ERROR\r\n", 7);
+    }
+    else if (type == AT_PARSER_COMMAND_TYPE_QUERY && entry->help_response != NULL)
+    {
+        write_result(parser, entry->help_response, entry->help_response_length);
+    }
+    else if (entry->handler != NULL)
+    {
+        entry->handler(parser, parser->command_table_userdata, entry->name, type, args, arg_length);
+    }
+    TRACE_DISPATCH_END(parser, command, command_length, type);
+    return true;
+}
+
+static void write_result(at_parser_handle_t parser, const char *result, size_t length)
+{
+    if (parser->writer != NULL)
+    {
+        parser->writer(parser, parser->writer_userdata, result, length);
+    }
+}
+
+/**
+ * @brief Copy a command into the batch, the batch is dispatched when it reaches its limit.
+ * @details A command that doesn't fit because an allocation failed is dropped, like a command whose arguments can't be allocated.
+ * 
+ */
+static void add_to_batch(at_parser_handle_t parser, const char *command, size_t command_length, enum at_parser_command_type type, const struct at_parser_argument *args, size_t arg_length)
+{
+    struct command_batch *batch = &parser->batch;
+    size_t pool_needed = command_length + 1;
+    for (size_t i = 0; i < arg_length; i++)
+    {
+        pool_needed += args[i].length + 1;
+    }
+    size_t item_capacity = batch->item_capacity;
+    size_t argument_capacity = batch->argument_capacity;
+    if (!reserve_array(parser, (void **)&batch->items, &item_capacity, batch->item_count + 1, sizeof(struct batch_item)) ||
+        !reserve_array(parser, (void **)&batch->records, &batch->item_capacity, batch->item_count + 1, sizeof(struct at_parser_command_record)) ||
+        !reserve_array(parser, (void **)&batch->arguments, &argument_capacity, batch->argument_count + arg_length, sizeof(struct batch_argument)) ||
+        !reserve_array(parser, (void **)&batch->views, &batch->argument_capacity, batch->argument_count + arg_length, sizeof(struct at_parser_argument)) ||
+        !reserve_array(parser, (void **)&batch->pool, &batch->pool_capacity, batch->pool_used + pool_needed, sizeof(char)))
+    {
+        return;
+    }
+
+    struct batch_item *item = &batch->items[batch->item_count++];
+    item->name_offset = batch->pool_used;
+    item->name_length = command_length;
+    item->type = type;
+    item->first_argument = batch->argument_count;
+    item->argument_count = arg_length;
+    item->qos = get_command_qos(parser, command, command_length);
+    item->queued_at = parser->clock != NULL ? parser->clock(parser->clock_userdata) : 0;
+    struct at_parser_qos_stats *stats = &parser->qos.stats[item->qos];
+    stats->depth++;
+    stats->max_depth = max(stats->max_depth, stats->depth);
+    memcpy(batch->pool + batch->pool_used, command, command_length);
+    batch->pool[batch->pool_used + command_length] = '\0';
+    batch->pool_used += command_length + 1;
+    for (size_t i = 0; i < arg_length; i++)
+    {
+        struct batch_argument *argument = &batch->arguments[batch->argument_count++];
+        argument->value_offset = batch->pool_used;
+        argument->length = args[i].length;
+        memcpy(batch->pool + batch->pool_used, args[i].value, args[i].length);
+        batch->pool[batch->pool_used + args[i].length] = '\0';
+        batch->pool_used += args[i].length + 1;
+    }
+
+    if (item->qos == AT_PARSER_QOS_ABORT)
+    {
+        // The abort doesn't wait for the end of the call, or for the commands it cancels.
+        cancel_batch(parser);
+        flush_batch(parser);
+    }
+    else if (batch->limit != 0 && batch->item_count >= batch->limit)
+    {
+        flush_batch(parser);
+    }
+}
+
+/**
+ * @brief Cancel the queued commands that aren't abort commands, they are answered with ERROR.
+ * 
+ */
+static void cancel_batch(at_parser_handle_t parser)
+{
+    struct command_batch *batch = &parser->batch;
+    size_t kept = 0;
+    for (size_t i = 0; i < batch->item_count; i++)
+    {
+        if (batch->items[i].qos == AT_PARSER_QOS_ABORT)
+        {
+            batch->items[kept++] = batch->items[i]; // Their names and arguments stay in the pool until the batch is dispatched.
+            continue;
+        }
+        struct at_parser_qos_stats *stats = &parser->qos.stats[batch->items[i].qos];
+        stats->cancelled++;
+        stats->depth--;
+        write_result(parser, "ERROR\r\n", 7);
+    }
+    batch->item_count = kept;
+}
+
+/**
+ * @brief Order the batch on QoS class, highest first. Insertion sort keeps the arrival order within a class, and a
+ * batch is mostly in order already.
+ * 
+ */
+static void sort_batch(struct command_batch *batch)
+{
+    for (size_t i = 1; i < batch->item_count; i++)
+    {
+        const struct batch_item item = batch->items[i];
+        size_t position = i;
+        while (position > 0 && batch->items[position - 1].qos < item.qos)
+        {
+            batch->items[position] = batch->items[position - 1];
+            position--;
+        }
+        batch->items[position] = item;
+    }
+}
+
+static enum at_parser_qos_class get_command_qos(at_parser_handle_t parser, const char *command, size_t command_length)
+{
+    const struct qos_table *table = &parser->qos;
+    for (size_t i = 0; i < table->entry_count; i++)
+    {
+        const struct qos_entry *entry = &table->entries[i];
+        if (entry->name_length == command_length && memcmp(table->pool + entry->name_offset, command, command_length) == 0)
+        {
+            return entry->qos;
+        }
+    }
+    return AT_PARSER_QOS_NORMAL;
+}
+
+static void flush_batch(at_parser_handle_t parser)
+{
+    struct command_batch *batch = &parser->batch;
+    if (batch->item_count == 0 || batch->dispatching || batch->handler == NULL)
+    {
+        return;
+    }
+    sort_batch(batch);
+    const uint32_t now = parser->clock != NULL ? parser->clock(parser->clock_userdata) : 0;
+    // The pool doesn't move anymore, so the offsets can be turned into the views the handler gets.
+    for (size_t i = 0; i < batch->argument_count; i++)
+    {
+        batch->views[i].value = batch->pool + batch->arguments[i].value_offset;
+        batch->views[i].length = batch->arguments[i].length;
+    }
+    for (size_t i = 0; i < batch->item_count; i++)
+    {
+        const struct batch_item *item = &batch->items[i];
+        struct at_parser_command_record *record = &batch->records[i];
+        record->command_name = batch->pool + item->name_offset;
+        record->command_name_length = item->name_length;
+        record->type = item->type;
+        record->argument_list = item->argument_count > 0 ? batch->views + item->first_argument : NULL;
+        record->argument_list_length = item->argument_count;
+        record->response = NULL;
+        record->response_length = 0;
+        record->result = AT_PARSER_BATCH_RESULT_NONE;
+        record->qos = item->qos;
+        struct at_parser_qos_stats *stats = &parser->qos.stats[item->qos];
+        const uint32_t wait = now - item->queued_at;
+        stats->dispatched++;
+        stats->depth--;
+        stats->total_wait += wait;
+        stats->max_wait = max(stats->max_wait, wait);
+    }
+
+    batch->dispatching = true;
+    batch->handler(parser, batch->userdata, batch->records, batch->item_count);
+    for (size_t i = 0; i < batch->item_count && parser->writer != NULL; i++)
+    {
+        const struct at_parser_command_record *record = &batch->records[i];
+        if (record->response != NULL && record->response_length != 0)
+        {
+            write_result(parser, record->response, record->response_length);
+        }
+        if (record->result == AT_PARSER_BATCH_RESULT_OK)
+        {
+            write_result(parser, "OK\r\n", 4);
+        }
+        else if (record->result == AT_PARSER_BATCH_RESULT_ERROR)
+        {
+            write_result(parser, "ERROR\r\n", 7);
+        }
+    }
+    batch->item_count = 0;
+    batch->argument_count = 0;
+    batch->pool_used = 0;
+    batch->dispatching = false;
+}
+
+static void free_batch(at_parser_handle_t parser)
+{
+    struct command_batch *batch = &parser->batch;
+    parser_deallocate(parser, batch->items);
+    parser_deallocate(parser, batch->records);
+    parser_deallocate(parser, batch->arguments);
+    parser_deallocate(parser, batch->views);
+    parser_deallocate(parser, batch->pool);
+    memset(batch, 0, sizeof(struct command_batch));
+}
+
+/**
+ * @brief Grow an array to hold at least needed elements, the capacity is only updated when it succeeds.
+ * 
+ */
+static bool reserve_array(at_parser_handle_t parser, void **array, size_t *capacity, size_t needed, size_t element_size)
+{
+    if (needed <= *capacity)
+    {
+        return true;
+    }
+    const size_t new_capacity = max(needed, max(*capacity * 2, 8));
+    void *new_array = *array == NULL ? parser_allocate(parser, new_capacity * element_size) : parser_reallocate(parser, *array, new_capacity * element_size);
+    if (new_array == NULL)
+    {
+        return false;
+    }
+    *array = new_array;
+    *capacity = new_capacity;
+    return true;
+}
+
+static void *default_allocate(void *context, size_t size)
+{
+    (void)context;
+    return malloc(size);
+}
+
+static void *default_reallocate(void *context, void *ptr, size_t size)
+{
+    (void)context;
+    return realloc(ptr, size);
+}
+
+static void default_deallocate(void *context, void *ptr)
+{
+    (void)context;
+    free(ptr);
+}
+
+static inline void *parser_allocate(at_parser_handle_t parser, size_t size)
+{
+    return parser->allocator.allocate(parser->allocator.context, size);
+}
+
+static inline void *parser_reallocate(at_parser_handle_t parser, void *ptr, size_t size)
+{
+    return parser->allocator.reallocate(parser->allocator.context, ptr, size);
+}
+
+static inline void parser_deallocate(at_parser_handle_t parser, void *ptr)
+{
+    if (ptr != NULL)
+    {
+        parser->allocator.deallocate(parser->allocator.context, ptr);
+    }
+}
@@ -0,0 +1,635 @@
+/**
+ * @file at_parser_cache.c
+ * @author Giel Willemsen
+ * @brief Implementation of the TTL response cache with request coalescing.
+ * @version 0.1
+ * @date 2023-06-14
+ *
+ * @copyright See LICENSE
+ *
+ */
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include "at_parser/at_parser_cache.h"
+
+#define COMMAND_TYPE_COUNT (AT_PARSER_COMMAND_TYPE_EXECUTE + 1)
+
+enum entry_state
+{
+    ENTRY_STATE_PENDING,
+    ENTRY_STATE_READY,
+};
+
+struct cached_command
+{
+    at_parser_cache_handle_t cache;
+    char *name;
+    at_parser_received_command handler;
+    void *userdata;
+    uint32_t ttl;
+    char *static_responses[COMMAND_TYPE_COUNT];
+    size_t static_lengths[COMMAND_TYPE_COUNT];
+    struct cached_command *next;
+};
+
+struct at_parser_cache_entry
+{
+    struct at_parser_cache_entry *next;  ///< Next entry in the same bucket.
+    struct at_parser_cache_entry *older; ///< Age list, used for eviction.
+    struct at_parser_cache_entry *newer;
+    const struct cached_command *command;
+    uint32_t hash;
+    enum entry_state state;
+    bool deferred;
+    bool stale;                          ///< Invalidated while pending, so it isn't cached when completed.
+    uint32_t stored_at;                  ///< When the response was stored, or when it was requested while pending.
+    char *key;
+    size_t key_length;
+    char *data;
+    size_t data_length;
+    size_t data_capacity;
+    at_parser_handle_t *waiters;         ///< Parsers with coalesced requests, NULL for parsers that were detached.
+    size_t waiter_count;
+    size_t waiter_capacity;
+};
+
+struct at_parser_cache
+{
+    at_parser_clock clock;
+    void *clock_userdata;
+    struct cached_command *commands;
+    struct at_parser_cache_entry **buckets;
+    size_t bucket_count;
+    size_t entry_count;
+    size_t max_entries;
+    uint32_t pending_timeout;              ///< Clock ticks identical requests wait on a deferred response, 0 for no limit.
+    struct at_parser_cache_entry *oldest;
+    struct at_parser_cache_entry *newest;
+    struct at_parser_cache_entry *current; ///< Entry of the handler that is currently running.
+    struct at_parser_cache_stats stats;
+};
+
+struct capture_context
+{
+    struct at_parser_cache_entry *entry;
+    at_parser_response_writer writer;
+    void *writer_userdata;
+};
+
+static void cached_command_received(at_parser_handle_t parser, void *userdata, const char *command_name, enum at_parser_command_type type, struct at_parser_argument *argument_list, size_t argument_list_length);
+static void capture_response(at_parser_handle_t parser, void *userdata, const char *data, size_t length);
+static struct cached_command *find_command(at_parser_cache_handle_t cache, const char *name);
+static char *build_key(enum at_parser_command_type type, const struct at_parser_argument *argument_list, size_t argument_list_length, size_t *key_length);
+static uint32_t hash_key(const struct cached_command *command, const char *key, size_t key_length);
+static struct at_parser_cache_entry *find_entry(at_parser_cache_handle_t cache, const struct cached_command *command, uint32_t hash, const char *key, size_t key_length);
+static struct at_parser_cache_entry *insert_entry(at_parser_cache_handle_t cache, const struct cached_command *command, uint32_t hash, char *key, size_t key_length);
+static void remove_entry(at_parser_cache_handle_t cache, struct at_parser_cache_entry *entry);
+static int append_data(struct at_parser_cache_entry *entry, const char *data, size_t length);
+static int add_waiter(struct at_parser_cache_entry *entry, at_parser_handle_t parser);
+static bool is_expired(at_parser_cache_handle_t cache, const struct at_parser_cache_entry *entry);
+static bool is_overdue(at_parser_cache_handle_t cache, const struct at_parser_cache_entry *entry);
+static void finish_entry(at_parser_cache_handle_t cache, struct at_parser_cache_entry *entry);
+
+extern int at_parser_cache_create(at_parser_cache_handle_t *cache, size_t max_entries, at_parser_clock clock, void *clock_userdata)
+{
+    if (cache == NULL || max_entries == 0 || clock == NULL)
+    {
+        return -1;
+    }
+    at_parser_cache_handle_t handle = calloc(1, sizeof(struct at_parser_cache));
+    if (handle == NULL)
+    {
+        return -1;
+    }
+    handle->bucket_count = 16;
+    while (handle->bucket_count < max_entries)
+    {
+        handle->bucket_count *= 2;
+    }
+    handle->buckets = calloc(handle->bucket_count, sizeof(struct at_parser_cache_entry *));
+    if (handle->buckets == NULL)
+    {
+        free(handle);
+        return -1;
+    }
+    handle->max_entries = max_entries;
+    handle->clock = clock;
+    handle->clock_userdata = clock_userdata;
+    *cache = handle;
+    return 0;
+}
+
+extern void at_parser_cache_free(at_parser_cache_handle_t cache)
+{
+    if (cache != NULL)
+    {
+        while (cache->oldest != NULL)
+        {
+            remove_entry(cache, cache->oldest);
+        }
+        while (cache->commands != NULL)
+        {
+            struct cached_command *command = cache->commands;
+            cache->commands = command->next;
+            for (size_t i = 0; i < COMMAND_TYPE_COUNT; i++)
+            {
+                free(command->static_responses[i]);
+            }
+            free(command->name);
+            free(command);
+        }
+        free(cache->buckets);
+        free(cache);
+    }
+}
+
+extern int at_parser_cache_add_command(at_parser_cache_handle_t cache, const char *command_name, at_parser_received_command handler, void *userdata, uint32_t ttl)
+{
+    if (cache == NULL || command_name == NULL || handler == NULL || find_command(cache, command_name) != NULL)
+    {
+        return -1;
+    }
+    struct cached_command *command = calloc(1, sizeof(struct cached_command));
+    if (command == NULL)
+    {
+        return -1;
+    }
+    command->name = malloc(strlen(command_name) + 1);
+    if (command->name == NULL)
+    {
+        free(command);
+        return -1;
+    }
+    strcpy(command->name, command_name);
+    command->cache = cache;
+    command->handler = handler;
+    command->userdata = userdata;
+    command->ttl = ttl;
+    command->next = cache->commands;
+    cache->commands = command;
+    return 0;
+}
+
+extern int at_parser_cache_set_static_response(at_parser_cache_handle_t cache, const char *command_name, enum at_parser_command_type type, const char *response, size_t length)
+{
+    struct cached_command *command = find_command(cache, command_name);
+    if (command == NULL || response == NULL || (size_t)type >= COMMAND_TYPE_COUNT)
+    {
+        return -1;
+    }
+    char *copy = malloc(length > 0 ? length : 1);
+    if (copy == NULL)
+    {
+        return -1;
+    }
+    memcpy(copy, response, length);
+    free(command->static_responses[type]);
+    command->static_responses[type] = copy;
+    command->static_lengths[type] = length;
+    return 0;
+}
+
+extern int at_parser_cache_attach_parser(at_parser_cache_handle_t cache, at_parser_handle_t parser)
+{
+    if (cache == NULL || parser == NULL)
+    {
+        return -1;
+    }
+    for (struct cached_command *command = cache->commands; command != NULL; command = command->next)
+    {
+        if (at_parser_add_command_handler(parser, command->name, cached_command_received, command) != 0)
+        {
+            at_parser_cache_detach_parser(cache, parser);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+extern int at_parser_cache_detach_parser(at_parser_cache_handle_t cache, at_parser_handle_t parser)
+{
+    if (cache == NULL || parser == NULL)
+    {
+        return -1;
+    }
+    for (struct cached_command *command = cache->commands; command != NULL; command = command->next)
+    {
+        at_parser_remove_command_handler(parser, command->name, cached_command_received);
+    }
+    // Deferred responses must not be written to the parser anymore, it may be freed before they complete.
+    for (struct at_parser_cache_entry *entry = cache->oldest; entry != NULL; entry = entry->newer)
+    {
+        for (size_t i = 0; i < entry->waiter_count; i++)
+        {
+            if (entry->waiters[i] == parser)
+            {
+                entry->waiters[i] = NULL;
+            }
+        }
+    }
+    return 0;
+}
+
+extern int at_parser_cache_attach_registry(at_parser_cache_handle_t cache, at_parser_registry_handle_t registry)
+{
+    if (cache == NULL || registry == NULL)
+    {
+        return -1;
+    }
+    for (struct cached_command *command = cache->commands; command != NULL; command = command->next)
+    {
+        if (at_parser_registry_add_command_handler(registry, command->name, cached_command_received, command) != 0)
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+extern int at_parser_cache_invalidate(at_parser_cache_handle_t cache, const char *command_name)
+{
+    if (cache == NULL)
+    {
+        return -1;
+    }
+    const struct cached_command *command = NULL;
+    if (command_name != NULL)
+    {
+        command = find_command(cache, command_name);
+        if (command == NULL)
+        {
+            return -1;
+        }
+    }
+    struct at_parser_cache_entry *entry = cache->oldest;
+    while (entry != NULL)
+    {
+        struct at_parser_cache_entry *newer = entry->newer;
+        if (command == NULL || entry->command == command)
+        {
+            if (entry->state == ENTRY_STATE_PENDING)
+            {
+                entry->stale = true;
+            }
+            else
+            {
+                remove_entry(cache, entry);
+            }
+        }
+        entry = newer;
+    }
+    return 0;
+}
+
+extern int at_parser_cache_set_pending_timeout(at_parser_cache_handle_t cache, uint32_t timeout)
+{
+    if (cache == NULL)
+    {
+        return -1;
+    }
+    cache->pending_timeout = timeout;
+    return 0;
+}
+
+extern at_parser_cache_ticket_t at_parser_cache_defer(at_parser_cache_handle_t cache)
+{
+    if (cache == NULL || cache->current == NULL)
+    {
+        return NULL;
+    }
+    cache->current->deferred = true;
+    return cache->current;
+}
+
+extern int at_parser_cache_complete(at_parser_cache_handle_t cache, at_parser_cache_ticket_t ticket, const char *response, size_t length)
+{
+    if (cache == NULL || ticket == NULL || !ticket->deferred || ticket->state != ENTRY_STATE_PENDING || (response == NULL && length != 0))
+    {
+        return -1;
+    }
+    // The first waiter is the parser that made the request, it already got the part that was written from within the handler.
+    if (ticket->waiter_count > 0 && ticket->waiters[0] != NULL && length > 0)
+    {
+        at_parser_write_response(ticket->waiters[0], response, length);
+    }
+    int rc = length > 0 ? append_data(ticket, response, length) : 0;
+    for (size_t i = 1; i < ticket->waiter_count; i++)
+    {
+        if (ticket->waiters[i] != NULL)
+        {
+            at_parser_write_response(ticket->waiters[i], ticket->data, ticket->data_length);
+        }
+    }
+    ticket->deferred = false;
+    if (rc != 0)
+    {
+        ticket->stale = true;
+    }
+    finish_entry(cache, ticket);
+    return rc;
+}
+
+extern int at_parser_cache_get_stats(at_parser_cache_handle_t cache, struct at_parser_cache_stats *stats)
+{
+    if (cache == NULL || stats == NULL)
+    {
+        return -1;
+    }
+    *stats = cache->stats;
+    return 0;
+}
+
+static void cached_command_received(at_parser_handle_t parser, void *userdata, const char *command_name, enum at_parser_command_type type, struct at_parser_argument *argument_list, size_t argument_list_length)
+{
+    const struct cached_command *command = userdata;
+    at_parser_cache_handle_t cache = command->cache;
+    if ((size_t)type < COMMAND_TYPE_COUNT && command->static_responses[type] != NULL)
+    {
+        cache->stats.static_hits++;
+        at_parser_write_response(parser, command->static_responses[type], command->static_lengths[type]);
+        return;
+    }
+
+    size_t key_length = 0;
+    char *key = build_key(type, argument_list, argument_list_length, &key_length);
+    if (key == NULL)
+    {
+        cache->stats.misses++;
+        command->handler(parser, command->userdata, command_name, type, argument_list, argument_list_length);
+        return;
+    }
+    const uint32_t hash = hash_key(command, key, key_length);
+    struct at_parser_cache_entry *entry = find_entry(cache, command, hash, key, key_length);
+    if (entry != NULL && entry->state == ENTRY_STATE_READY && !is_expired(cache, entry))
+    {
+        free(key);
+        cache->stats.hits++;
+        at_parser_write_response(parser, entry->data, entry->data_length);
+        return;
+    }
+    if (entry != NULL && entry->state == ENTRY_STATE_PENDING && !entry->stale && is_overdue(cache, entry))
+    {
+        entry->stale = true; // Its ticket is overdue, this request starts a new one and the late response isn't cached.
+    }
+    if (entry != NULL && entry->state == ENTRY_STATE_PENDING && !entry->stale && add_waiter(entry, parser) == 0)
+    {
+        free(key);
+        cache->stats.coalesced++;
+        return;
+    }
+    if (entry != NULL && entry->state == ENTRY_STATE_READY)
+    {
+        remove_entry(cache, entry); // Expired.
+    }
+
+    cache->stats.misses++;
+    entry = insert_entry(cache, command, hash, key, key_length);
+    if (entry == NULL || add_waiter(entry, parser) != 0)
+    {
+        if (entry != NULL)
+        {
+            remove_entry(cache, entry);
+        }
+        command->handler(parser, command->userdata, command_name, type, argument_list, argument_list_length);
+        return;
+    }
+
+    // Capture everything the handler writes, while still passing it on to the original writer.
+    struct capture_context capture = {entry, NULL, NULL};
+    at_parser_get_response_writer(parser, &capture.writer, &capture.writer_userdata);
+    at_parser_set_response_writer(parser, capture_response, &capture);
+    struct at_parser_cache_entry *previous = cache->current;
+    cache->current = entry;
+    command->handler(parser, command->userdata, command_name, type, argument_list, argument_list_length);
+    cache->current = previous;
+    at_parser_set_response_writer(parser, capture.writer, capture.writer_userdata);
+    if (!entry->deferred)
+    {
+        finish_entry(cache, entry);
+    }
+}
+
+static void capture_response(at_parser_handle_t parser, void *userdata, const char *data, size_t length)
+{
+    struct capture_context *capture = userdata;
+    if (capture->writer != NULL)
+    {
+        capture->writer(parser, capture->writer_userdata, data, length);
+    }
+    if (append_data(capture->entry, data, length) != 0)
+    {
+        capture->entry->stale = true; // An incomplete response must never be served from the cache.
+    }
+}
+
+static struct cached_command *find_command(at_parser_cache_handle_t cache, const char *name)
+{
+    if (cache == NULL || name == NULL)
+    {
+        return NULL;
+    }
+    struct cached_command *command = cache->commands;
+    while (command != NULL && strcmp(command->name, name) != 0)
+    {
+        command = command->next;
+    }
+    return command;
+}
+
+static char *build_key(enum at_parser_command_type type, const struct at_parser_argument *argument_list, size_t argument_list_length, size_t *key_length)
+{
+    size_t length = 1;
+    for (size_t i = 0; i < argument_list_length; i++)
+    {
+        length += sizeof(size_t) + argument_list[i].length;
+    }
+    char *key = malloc(length);
+    if (key == NULL)
+    {
+        return NULL;
+    }
+    size_t position = 0;
+    key[position++] = (char)type;
+    for (size_t i = 0; i < argument_list_length; i++)
+    {
+        // The length is part of the key, so ("a,b") and ("a", "b") differ.
+        memcpy(key + position, &argument_list[i].length, sizeof(size_t));
+        position += sizeof(size_t);
+        memcpy(key + position, argument_list[i].value, argument_list[i].length);
+        position += argument_list[i].length;
+    }
+    *key_length = length;
+    return key;
+}
+
+static uint32_t hash_key(const struct cached_command *command, const char *key, size_t key_length)
+{
+    // FNV-1a, seeded with the command so equal arguments of different commands land in different buckets.
+    uint32_t hash = 2166136261u ^ (uint32_t)(uintptr_t)command;
+    for (size_t i = 0; i < key_length; i++)
+    {
+        hash ^= (uint8_t)key[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static struct at_parser_cache_entry *find_entry(at_parser_cache_handle_t cache, const struct cached_command *command, uint32_t hash, const char *key, size_t key_length)
+{
+    struct at_parser_cache_entry *entry = cache->buckets[hash & (cache->bucket_count - 1)];
+    while (entry != NULL && !(entry->hash == hash && entry->command == command && entry->key_length == key_length && memcmp(entry->key, key, key_length) == 0))
+    {
+        entry = entry->next;
+    }
+    return entry;
+}
+
+static struct at_parser_cache_entry *insert_entry(at_parser_cache_handle_t cache, const struct cached_command *command, uint32_t hash, char *key, size_t key_length)
+{
+    if (cache->entry_count >= cache->max_entries)
+    {
+        // Evict the oldest entry that isn't waiting on a deferred response.
+        struct at_parser_cache_entry *victim = cache->oldest;
+        while (victim != NULL && victim->state == ENTRY_STATE_PENDING)
+        {
+            victim = victim->newer;
+        }
+        if (victim == NULL)
+        {
+            free(key);
+            return NULL;
+        }
+        remove_entry(cache, victim);
+    }
+    struct at_parser_cache_entry *entry = calloc(1, sizeof(struct at_parser_cache_entry));
+    if (entry == NULL)
+    {
+        free(key);
+        return NULL;
+    }
+    entry->command = command;
+    entry->hash = hash;
+    entry->state = ENTRY_STATE_PENDING;
+    entry->stored_at = cache->clock(cache->clock_userdata);
+    entry->key = key;
+    entry->key_length = key_length;
+
+    struct at_parser_cache_entry **bucket = &cache->buckets[hash & (cache->bucket_count - 1)];
+    entry->next = *bucket;
+    *bucket = entry;
+    entry->older = cache->newest;
+    if (cache->newest != NULL)
+    {
+        cache->newest->newer = entry;
+    }
+    cache->newest = entry;
+    if (cache->oldest == NULL)
+    {
+        cache->oldest = entry;
+    }
+    cache->entry_count++;
+    return entry;
+}
+
+static void remove_entry(at_parser_cache_handle_t cache, struct at_parser_cache_entry *entry)
+{
+    struct at_parser_cache_entry **current = &cache->buckets[entry->hash & (cache->bucket_count - 1)];
+    while (*current != entry)
+    {
+        current = &(*current)->next;
+    }
+    *current = entry->next;
+    if (entry->older != NULL)
+    {
+        entry->older->newer = entry->newer;
+    }
+    else
+    {
+        cache->oldest = entry->newer;
+    }
+    if (entry->newer != NULL)
+    {
+        entry->newer->older = entry->older;
+    }
+    else
+    {
+        cache->newest = entry->older;
+    }
+    if (cache->current == entry)
+    {
+        cache->current = NULL;
+    }
+    cache->entry_count--;
+    free(entry->key);
+    free(entry->data);
+    free(entry->waiters);
+    free(entry);
+}
+
+static int append_data(struct at_parser_cache_entry *entry, const char *data, size_t length)
+{
+    if (entry->data_capacity - entry->data_length < length)
+    {
+        size_t new_capacity = entry->data_capacity == 0 ? 32 : entry->data_capacity;
+        while (new_capacity - entry->data_length < length)
+        {
+            new_capacity *= 2;
+        }
+        char *new_data = realloc(entry->data, new_capacity);
+        if (new_data == NULL)
+        {
+            return -1;
+        }
+        entry->data = new_data;
+        entry->data_capacity = new_capacity;
+    }
+    memcpy(entry->data + entry->data_length, data, length);
+    entry->data_length += length;
+    return 0;
+}
+
+static int add_waiter(struct at_parser_cache_entry *entry, at_parser_handle_t parser)
+{
+    if (entry->waiter_count == entry->waiter_capacity)
+    {
+        size_t new_capacity = entry->waiter_capacity == 0 ? 4 : entry->waiter_capacity * 2;
+        at_parser_handle_t *new_waiters = realloc(entry->waiters, new_capacity * sizeof(at_parser_handle_t));
+        if (new_waiters == NULL)
+        {
+            return -1;
+        }
+        entry->waiters = new_waiters;
+        entry->waiter_capacity = new_capacity;
+    }
+    entry->waiters[entry->waiter_count++] = parser;
+    return 0;
+}
+
+static bool is_expired(at_parser_cache_handle_t cache, const struct at_parser_cache_entry *entry)
+{
+    const uint32_t age = cache->clock(cache->clock_userdata) - entry->stored_at;
+    return age >= entry->command->ttl;
+}
+
+static bool is_overdue(at_parser_cache_handle_t cache, const struct at_parser_cache_entry *entry)
+{
+    const uint32_t age = cache->clock(cache->clock_userdata) - entry->stored_at;
+    return entry->deferred && cache->pending_timeout != 0 && age >= cache->pending_timeout;
+}
+
+static void finish_entry(at_parser_cache_handle_t cache, struct at_parser_cache_entry *entry)
+{
+    if (entry->stale || entry->command->ttl == 0)
+    {
+        remove_entry(cache, entry);
+        return;
+    }
+    entry->state = ENTRY_STATE_READY;
+    entry->stored_at = cache->clock(cache->clock_userdata);
+    free(entry->waiters);
+    entry->waiters = NULL;
+    entry->waiter_count = 0;
+    entry->waiter_capacity = 0;
+}
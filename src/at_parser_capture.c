@@ -0,0 +1,370 @@
+/**
+ * @file at_parser_capture.c
+ * @author Giel Willemsen
+ * @brief Implementation of the parallel, in place capture processing.
+ * @version 0.1
+ * @date 2023-06-14
+ *
+ * @copyright See LICENSE
+ *
+ */
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "at_parser/at_parser_capture.h"
+
+#ifndef min
+#define min(one, two) ((one) < (two) ? (one) : (two))
+#endif // min
+
+#ifndef max
+#define max(one, two) ((one) > (two) ? (one) : (two))
+#endif // max
+
+#define MIN_CHUNK_SIZE 4096
+
+/**
+ * @brief A command parsed by a worker, the name and arguments are offsets in the arena of the chunk.
+ *
+ */
+struct capture_command
+{
+    size_t name_offset;
+    size_t name_length;
+    enum at_parser_command_type type;
+    size_t first_argument;
+    size_t argument_count;
+};
+
+struct capture_argument
+{
+    size_t value_offset;
+    size_t length;
+};
+
+struct capture_chunk
+{
+    size_t index;
+    const char *start;
+    size_t length;
+    at_parser_registry_handle_t registry;
+    const struct at_parser_capture_options *options;
+    struct capture_command *commands; ///< Parsed commands that still need to be dispatched (global order only).
+    size_t parsed_count;
+    size_t parsed_capacity;
+    struct capture_argument *arguments;
+    size_t argument_count;
+    size_t argument_capacity;
+    char *arena; ///< Owns the names and argument values of the parsed commands.
+    size_t arena_used;
+    size_t arena_capacity;
+    size_t total_lines;
+    size_t command_count;
+    int rc;
+    pthread_t thread;
+};
+
+static _Thread_local size_t current_chunk = 0;
+
+static void *process_chunk(void *arg);
+static void collect_commands(at_parser_handle_t parser, void *userdata, struct at_parser_command_record *records, size_t record_count);
+static int add_command(struct capture_chunk *chunk, const struct at_parser_command_record *record);
+static bool reserve(void **array, size_t *capacity, size_t needed, size_t element_size);
+static size_t copy_to_arena(struct capture_chunk *chunk, const char *data, size_t length);
+static void free_chunk(struct capture_chunk *chunk);
+static int dispatch_chunks(struct capture_chunk *chunks, size_t chunk_count, at_parser_registry_handle_t registry, const struct at_parser_capture_options *options);
+
+extern int at_parser_capture_process_file(const char *path, at_parser_registry_handle_t registry, const struct at_parser_capture_options *options, struct at_parser_capture_result *result)
+{
+    if (path == NULL)
+    {
+        return -1;
+    }
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+    const size_t length = (size_t)info.st_size;
+    if (length == 0)
+    {
+        close(fd);
+        return at_parser_capture_process_memory("", 0, registry, options, result);
+    }
+    void *data = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+    {
+        return -1;
+    }
+    madvise(data, length, MADV_SEQUENTIAL);
+    int rc = at_parser_capture_process_memory(data, length, registry, options, result);
+    munmap(data, length);
+    return rc;
+}
+
+extern int at_parser_capture_process_memory(const char *data, size_t length, at_parser_registry_handle_t registry, const struct at_parser_capture_options *options, struct at_parser_capture_result *result)
+{
+    if (data == NULL || registry == NULL || options == NULL)
+    {
+        return -1;
+    }
+    size_t chunk_count = options->thread_count;
+    if (chunk_count == 0)
+    {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        chunk_count = cores > 0 ? (size_t)cores : 1;
+    }
+    chunk_count = max(min(chunk_count, length / MIN_CHUNK_SIZE), 1);
+
+    struct capture_chunk *chunks = calloc(chunk_count, sizeof(struct capture_chunk));
+    if (chunks == NULL)
+    {
+        return -1;
+    }
+    // Split at the line boundary after every (roughly) equal part.
+    size_t start = 0;
+    for (size_t i = 0; i < chunk_count; i++)
+    {
+        size_t end = length;
+        if (i + 1 < chunk_count)
+        {
+            end = max(start, (length / chunk_count) * (i + 1));
+            const char *line_end = end < length ? memchr(data + end, '\n', length - end) : NULL;
+            end = line_end != NULL ? (size_t)(line_end - data) + 1 : length;
+        }
+        chunks[i].index = i;
+        chunks[i].start = data + start;
+        chunks[i].length = end - start;
+        chunks[i].registry = registry;
+        chunks[i].options = options;
+        start = end;
+    }
+
+    size_t started = 1;
+    for (; started < chunk_count; started++)
+    {
+        if (pthread_create(&chunks[started].thread, NULL, process_chunk, &chunks[started]) != 0)
+        {
+            break;
+        }
+    }
+    process_chunk(&chunks[0]);
+    for (size_t i = started; i < chunk_count; i++)
+    {
+        process_chunk(&chunks[i]); // Couldn't start a thread for these, so do them here.
+    }
+    for (size_t i = 1; i < started; i++)
+    {
+        pthread_join(chunks[i].thread, NULL);
+    }
+
+    int rc = 0;
+    for (size_t i = 0; i < chunk_count; i++)
+    {
+        rc = chunks[i].rc != 0 ? chunks[i].rc : rc;
+    }
+    if (rc == 0 && options->order == AT_PARSER_CAPTURE_ORDER_GLOBAL)
+    {
+        rc = dispatch_chunks(chunks, chunk_count, registry, options);
+    }
+    if (result != NULL)
+    {
+        memset(result, 0, sizeof(struct at_parser_capture_result));
+        result->chunk_count = chunk_count;
+        for (size_t i = 0; i < chunk_count; i++)
+        {
+            result->line_count += chunks[i].total_lines;
+            result->command_count += chunks[i].command_count;
+        }
+    }
+    for (size_t i = 0; i < chunk_count; i++)
+    {
+        free_chunk(&chunks[i]);
+    }
+    free(chunks);
+    return rc;
+}
+
+extern size_t at_parser_capture_current_chunk(void)
+{
+    return current_chunk;
+}
+
+static void *process_chunk(void *arg)
+{
+    struct capture_chunk *chunk = arg;
+    const struct at_parser_capture_options *options = chunk->options;
+    const bool dispatch = options->order == AT_PARSER_CAPTURE_ORDER_PER_CHUNK;
+    // The lines are processed in place, so the parser its own buffer is never used.
+    // For the global order the parser collects the commands in the chunk, they're dispatched after all chunks are parsed.
+    at_parser_handle_t parser = NULL;
+    if (at_parser_create(&parser, 1, options->escape_char, options->arg_separator) != 0 || at_parser_attach_registry(parser, chunk->registry) != 0 ||
+        (!dispatch && at_parser_set_batch_handler(parser, collect_commands, chunk, 0) != 0))
+    {
+        at_parser_free(parser);
+        chunk->rc = -1;
+        return NULL;
+    }
+    current_chunk = chunk->index;
+
+    const char *position = chunk->start;
+    const char *end = chunk->start + chunk->length;
+    while (position < end)
+    {
+        const char *line_end = memchr(position, '\n', (size_t)(end - position));
+        const char *next = line_end != NULL ? line_end + 1 : end;
+        size_t line_length = (size_t)((line_end != NULL ? line_end : end) - position);
+        if (line_length > 0 && position[line_length - 1] == '\r')
+        {
+            line_length--;
+        }
+        chunk->total_lines++;
+        // Only lines that look like a command are worth dispatching, the rest is filtered here in parallel.
+        bool too_long = options->max_line_length != 0 && line_length > options->max_line_length;
+        if (!too_long && line_length >= 4 && position[0] == 'A' && position[1] == 'T' && position[2] == '+')
+        {
+            chunk->command_count++;
+            at_parser_process_line(parser, position, line_length);
+            if (chunk->rc != 0)
+            {
+                break;
+            }
+        }
+        position = next;
+    }
+    at_parser_free(parser);
+    return NULL;
+}
+
+static void collect_commands(at_parser_handle_t parser, void *userdata, struct at_parser_command_record *records, size_t record_count)
+{
+    (void)parser;
+    struct capture_chunk *chunk = userdata;
+    for (size_t i = 0; i < record_count && chunk->rc == 0; i++)
+    {
+        chunk->rc = add_command(chunk, &records[i]);
+    }
+}
+
+/**
+ * @brief Copy a parsed command into the chunk, the record only lives as long as the batch.
+ *
+ */
+static int add_command(struct capture_chunk *chunk, const struct at_parser_command_record *record)
+{
+    size_t arena_needed = chunk->arena_used + record->command_name_length;
+    for (size_t i = 0; i < record->argument_list_length; i++)
+    {
+        arena_needed += record->argument_list[i].length;
+    }
+    if (!reserve((void **)&chunk->commands, &chunk->parsed_capacity, chunk->parsed_count + 1, sizeof(struct capture_command)) ||
+        !reserve((void **)&chunk->arguments, &chunk->argument_capacity, chunk->argument_count + record->argument_list_length, sizeof(struct capture_argument)) ||
+        !reserve((void **)&chunk->arena, &chunk->arena_capacity, arena_needed, sizeof(char)))
+    {
+        return -1;
+    }
+    struct capture_command *command = &chunk->commands[chunk->parsed_count++];
+    command->name_offset = copy_to_arena(chunk, record->command_name, record->command_name_length);
+    command->name_length = record->command_name_length;
+    command->type = record->type;
+    command->first_argument = chunk->argument_count;
+    command->argument_count = record->argument_list_length;
+    for (size_t i = 0; i < record->argument_list_length; i++)
+    {
+        struct capture_argument *argument = &chunk->arguments[chunk->argument_count++];
+        argument->value_offset = copy_to_arena(chunk, record->argument_list[i].value, record->argument_list[i].length);
+        argument->length = record->argument_list[i].length;
+    }
+    return 0;
+}
+
+static bool reserve(void **array, size_t *capacity, size_t needed, size_t element_size)
+{
+    if (needed <= *capacity)
+    {
+        return true;
+    }
+    const size_t new_capacity = max(needed, max(*capacity * 2, 256));
+    void *new_array = realloc(*array, new_capacity * element_size);
+    if (new_array == NULL)
+    {
+        return false;
+    }
+    *array = new_array;
+    *capacity = new_capacity;
+    return true;
+}
+
+static size_t copy_to_arena(struct capture_chunk *chunk, const char *data, size_t length)
+{
+    const size_t offset = chunk->arena_used;
+    if (length > 0)
+    {
+        memcpy(chunk->arena + offset, data, length);
+    }
+    chunk->arena_used += length;
+    return offset;
+}
+
+static void free_chunk(struct capture_chunk *chunk)
+{
+    free(chunk->commands);
+    free(chunk->arguments);
+    free(chunk->arena);
+}
+
+static int dispatch_chunks(struct capture_chunk *chunks, size_t chunk_count, at_parser_registry_handle_t registry, const struct at_parser_capture_options *options)
+{
+    at_parser_handle_t parser = NULL;
+    if (at_parser_create(&parser, 1, options->escape_char, options->arg_separator) != 0 || at_parser_attach_registry(parser, registry) != 0)
+    {
+        at_parser_free(parser);
+        return -1;
+    }
+    // Room for the argument views of the command with the most arguments, they're rebuilt from the arena for every command.
+    size_t view_capacity = 0;
+    for (size_t i = 0; i < chunk_count; i++)
+    {
+        for (size_t command = 0; command < chunks[i].parsed_count; command++)
+        {
+            view_capacity = max(view_capacity, chunks[i].commands[command].argument_count);
+        }
+    }
+    struct at_parser_argument *views = view_capacity > 0 ? malloc(view_capacity * sizeof(struct at_parser_argument)) : NULL;
+    if (view_capacity > 0 && views == NULL)
+    {
+        at_parser_free(parser);
+        return -1;
+    }
+    for (size_t i = 0; i < chunk_count; i++)
+    {
+        const struct capture_chunk *chunk = &chunks[i];
+        current_chunk = i;
+        for (size_t index = 0; index < chunk->parsed_count; index++)
+        {
+            const struct capture_command *command = &chunk->commands[index];
+            for (size_t argument = 0; argument < command->argument_count; argument++)
+            {
+                views[argument].value = chunk->arena + chunk->arguments[command->first_argument + argument].value_offset;
+                views[argument].length = chunk->arguments[command->first_argument + argument].length;
+            }
+            at_parser_dispatch_command(parser, chunk->arena + command->name_offset, command->name_length, command->type, views, command->argument_count);
+        }
+    }
+    free(views);
+    at_parser_free(parser);
+    return 0;
+}
@@ -0,0 +1,677 @@
+/**
+ * @file at_parser_cmux.c
+ * @author Giel Willemsen
+ * @brief Implementation of the 3GPP TS 27.010 (CMUX) multiplexer layer.
+ * @version 0.1
+ * @date 2023-06-14
+ *
+ * @copyright See LICENSE
+ *
+ */
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include "at_parser/at_parser_cmux.h"
+
+#define BASIC_FLAG 0xF9
+#define ADVANCED_FLAG 0x7E
+#define ADVANCED_ESCAPE 0x7D
+#define ADVANCED_ESCAPE_XOR 0x20
+#define XON 0x11
+#define XOFF 0x13
+
+#define ADDRESS_EA 0x01
+#define ADDRESS_CR 0x02
+#define CONTROL_PF 0x10
+#define LENGTH_EA 0x01
+
+#define FRAME_SABM 0x2F
+#define FRAME_UA 0x63
+#define FRAME_DM 0x0F
+#define FRAME_DISC 0x43
+#define FRAME_UIH 0xEF
+#define FRAME_UI 0x03
+
+#define MESSAGE_EA 0x01
+#define MESSAGE_CR 0x02
+#define MESSAGE_CLD 0xC1
+
+#define FCS_INIT 0xFF
+#define FCS_GOOD 0xCF
+
+#define DLC_COUNT 64
+#define MAX_FRAME_SIZE 32767 ///< The two byte basic mode length field holds 15 bits.
+#define BASIC_OVERHEAD 6    ///< Address, control, two length bytes, FCS and closing flag.
+#define ADVANCED_OVERHEAD 3 ///< Address, control and FCS.
+
+/**
+ * @brief Reversed CRC-8 (x^8 + x^2 + x + 1) table from TS 27.010 section 5.2.1.6.
+ *
+ */
+static const uint8_t fcs_table[256] = {
+    0x00, 0x91, 0xE3, 0x72, 0x07, 0x96, 0xE4, 0x75, 0x0E, 0x9F, 0xED, 0x7C, 0x09, 0x98, 0xEA, 0x7B,
+    0x1C, 0x8D, 0xFF, 0x6E, 0x1B, 0x8A, 0xF8, 0x69, 0x12, 0x83, 0xF1, 0x60, 0x15, 0x84, 0xF6, 0x67,
+    0x38, 0xA9, 0xDB, 0x4A, 0x3F, 0xAE, 0xDC, 0x4D, 0x36, 0xA7, 0xD5, 0x44, 0x31, 0xA0, 0xD2, 0x43,
+    0x24, 0xB5, 0xC7, 0x56, 0x23, 0xB2, 0xC0, 0x51, 0x2A, 0xBB, 0xC9, 0x58, 0x2D, 0xBC, 0xCE, 0x5F,
+    0x70, 0xE1, 0x93, 0x02, 0x77, 0xE6, 0x94, 0x05, 0x7E, 0xEF, 0x9D, 0x0C, 0x79, 0xE8, 0x9A, 0x0B,
+    0x6C, 0xFD, 0x8F, 0x1E, 0x6B, 0xFA, 0x88, 0x19, 0x62, 0xF3, 0x81, 0x10, 0x65, 0xF4, 0x86, 0x17,
+    0x48, 0xD9, 0xAB, 0x3A, 0x4F, 0xDE, 0xAC, 0x3D, 0x46, 0xD7, 0xA5, 0x34, 0x41, 0xD0, 0xA2, 0x33,
+    0x54, 0xC5, 0xB7, 0x26, 0x53, 0xC2, 0xB0, 0x21, 0x5A, 0xCB, 0xB9, 0x28, 0x5D, 0xCC, 0xBE, 0x2F,
+    0xE0, 0x71, 0x03, 0x92, 0xE7, 0x76, 0x04, 0x95, 0xEE, 0x7F, 0x0D, 0x9C, 0xE9, 0x78, 0x0A, 0x9B,
+    0xFC, 0x6D, 0x1F, 0x8E, 0xFB, 0x6A, 0x18, 0x89, 0xF2, 0x63, 0x11, 0x80, 0xF5, 0x64, 0x16, 0x87,
+    0xD8, 0x49, 0x3B, 0xAA, 0xDF, 0x4E, 0x3C, 0xAD, 0xD6, 0x47, 0x35, 0xA4, 0xD1, 0x40, 0x32, 0xA3,
+    0xC4, 0x55, 0x27, 0xB6, 0xC3, 0x52, 0x20, 0xB1, 0xCA, 0x5B, 0x29, 0xB8, 0xCD, 0x5C, 0x2E, 0xBF,
+    0x90, 0x01, 0x73, 0xE2, 0x97, 0x06, 0x74, 0xE5, 0x9E, 0x0F, 0x7D, 0xEC, 0x99, 0x08, 0x7A, 0xEB,
+    0x8C, 0x1D, 0x6F, 0xFE, 0x8B, 0x1A, 0x68, 0xF9, 0x82, 0x13, 0x61, 0xF0, 0x85, 0x14, 0x66, 0xF7,
+    0xA8, 0x39, 0x4B, 0xDA, 0xAF, 0x3E, 0x4C, 0xDD, 0xA6, 0x37, 0x45, 0xD4, 0xA1, 0x30, 0x42, 0xD3,
+    0xB4, 0x25, 0x57, 0xC6, 0xB3, 0x22, 0x50, 0xC1, 0xBA, 0x2B, 0x59, 0xC8, 0xBD, 0x2C, 0x5E, 0xCF,
+};
+
+enum frame_result
+{
+    FRAME_RESULT_NEED_MORE,
+    FRAME_RESULT_INVALID,
+    FRAME_RESULT_COMPLETE,
+};
+
+struct frame
+{
+    uint8_t address;
+    uint8_t control;
+    const uint8_t *info;
+    size_t info_length;
+    size_t size; ///< Bytes from the address up to and including the closing flag.
+};
+
+struct cmux_channel
+{
+    at_parser_cmux_handle_t mux;
+    uint8_t dlci;
+    bool open;
+    at_parser_handle_t parser;
+};
+
+struct at_parser_cmux
+{
+    enum at_parser_cmux_mode mode;
+    uint8_t flag;
+    size_t max_frame_size;
+    at_parser_cmux_writer writer;
+    void *writer_userdata;
+    struct cmux_channel channels[DLC_COUNT];
+    bool synced;             ///< An opening flag was seen, the next byte starts a frame.
+    uint8_t *frame_buffer;   ///< Start of a frame that is split over multiple calls, without the opening flag.
+    size_t frame_buffer_used;
+    size_t frame_buffer_capacity;
+    uint8_t *unstuff_buffer; ///< Advanced mode frames that contain escaped bytes.
+    uint8_t *output;
+    size_t output_used;
+    size_t output_capacity;
+    struct at_parser_cmux_stats stats;
+};
+
+static uint8_t update_fcs(uint8_t fcs, const uint8_t *data, size_t length);
+static size_t parse_frames(at_parser_cmux_handle_t mux, const uint8_t *data, size_t length);
+static enum frame_result parse_basic_frame(at_parser_cmux_handle_t mux, const uint8_t *data, size_t length, struct frame *frame);
+static enum frame_result parse_advanced_frame(at_parser_cmux_handle_t mux, const uint8_t *data, size_t length, struct frame *frame);
+static bool check_fcs(at_parser_cmux_handle_t mux, const struct frame *frame, const uint8_t *header, size_t header_length, uint8_t fcs);
+static void handle_frame(at_parser_cmux_handle_t mux, const struct frame *frame);
+static void handle_control_message(at_parser_cmux_handle_t mux, const uint8_t *data, size_t length);
+static void close_all(at_parser_cmux_handle_t mux);
+static int send_frame(at_parser_cmux_handle_t mux, uint8_t dlci, bool command, uint8_t control, const uint8_t *data, size_t length);
+static int reserve_output(at_parser_cmux_handle_t mux, size_t length);
+static uint8_t *put_stuffed(uint8_t *out, uint8_t byte);
+static void cmux_response_writer(at_parser_handle_t parser, void *userdata, const char *data, size_t length);
+static inline size_t min(size_t a, size_t b);
+
+extern int at_parser_cmux_create(at_parser_cmux_handle_t *mux, enum at_parser_cmux_mode mode, size_t max_frame_size, at_parser_cmux_writer writer, void *userdata)
+{
+    if (mux == NULL || writer == NULL || max_frame_size == 0 || max_frame_size > MAX_FRAME_SIZE ||
+        (mode != AT_PARSER_CMUX_MODE_BASIC && mode != AT_PARSER_CMUX_MODE_ADVANCED))
+    {
+        return -1;
+    }
+    at_parser_cmux_handle_t handle = calloc(1, sizeof(struct at_parser_cmux));
+    if (handle == NULL)
+    {
+        return -1;
+    }
+    handle->mode = mode;
+    handle->flag = mode == AT_PARSER_CMUX_MODE_BASIC ? BASIC_FLAG : ADVANCED_FLAG;
+    handle->max_frame_size = max_frame_size;
+    handle->writer = writer;
+    handle->writer_userdata = userdata;
+    if (mode == AT_PARSER_CMUX_MODE_BASIC)
+    {
+        handle->frame_buffer_capacity = max_frame_size + BASIC_OVERHEAD;
+    }
+    else
+    {
+        // Every byte could be escaped.
+        handle->frame_buffer_capacity = 2 * (max_frame_size + ADVANCED_OVERHEAD) + 1;
+        handle->unstuff_buffer = malloc(handle->frame_buffer_capacity);
+    }
+    handle->frame_buffer = malloc(handle->frame_buffer_capacity);
+    if (handle->frame_buffer == NULL || (mode == AT_PARSER_CMUX_MODE_ADVANCED && handle->unstuff_buffer == NULL))
+    {
+        free(handle->frame_buffer);
+        free(handle->unstuff_buffer);
+        free(handle);
+        return -1;
+    }
+    for (size_t i = 0; i < DLC_COUNT; i++)
+    {
+        handle->channels[i].mux = handle;
+        handle->channels[i].dlci = (uint8_t)i;
+    }
+    *mux = handle;
+    return 0;
+}
+
+extern void at_parser_cmux_free(at_parser_cmux_handle_t mux)
+{
+    if (mux != NULL)
+    {
+        for (uint8_t dlci = 1; dlci < DLC_COUNT; dlci++)
+        {
+            at_parser_cmux_detach(mux, dlci);
+        }
+        free(mux->frame_buffer);
+        free(mux->unstuff_buffer);
+        free(mux->output);
+        free(mux);
+    }
+}
+
+extern int at_parser_cmux_attach(at_parser_cmux_handle_t mux, uint8_t dlci, at_parser_handle_t parser)
+{
+    if (mux == NULL || parser == NULL || dlci == 0 || dlci >= DLC_COUNT || mux->channels[dlci].parser != NULL)
+    {
+        return -1;
+    }
+    struct cmux_channel *channel = &mux->channels[dlci];
+    if (at_parser_set_response_writer(parser, cmux_response_writer, channel) != 0)
+    {
+        return -1;
+    }
+    channel->parser = parser;
+    return 0;
+}
+
+extern int at_parser_cmux_detach(at_parser_cmux_handle_t mux, uint8_t dlci)
+{
+    if (mux == NULL || dlci == 0 || dlci >= DLC_COUNT || mux->channels[dlci].parser == NULL)
+    {
+        return -1;
+    }
+    struct cmux_channel *channel = &mux->channels[dlci];
+    at_parser_set_response_writer(channel->parser, NULL, NULL);
+    channel->parser = NULL;
+    channel->open = false;
+    return 0;
+}
+
+extern bool at_parser_cmux_is_open(at_parser_cmux_handle_t mux, uint8_t dlci)
+{
+    return mux != NULL && dlci < DLC_COUNT && mux->channels[dlci].open;
+}
+
+extern int at_parser_cmux_process(at_parser_cmux_handle_t mux, const char *data, size_t length)
+{
+    if (mux == NULL || (data == NULL && length > 0))
+    {
+        return -1;
+    }
+    const uint8_t *input = (const uint8_t *)data;
+    while (length > 0)
+    {
+        if (mux->frame_buffer_used == 0)
+        {
+            size_t consumed = parse_frames(mux, input, length);
+            input += consumed;
+            length -= consumed;
+            if (length > 0)
+            {
+                // The start of a frame that ends in a later call, it always fits as longer frames are invalid.
+                memcpy(mux->frame_buffer, input, length);
+                mux->frame_buffer_used = length;
+                length = 0;
+            }
+            break;
+        }
+
+        size_t buffered = mux->frame_buffer_used;
+        size_t copy_length = min(length, mux->frame_buffer_capacity - buffered);
+        memcpy(mux->frame_buffer + buffered, input, copy_length);
+        mux->frame_buffer_used += copy_length;
+        input += copy_length;
+        length -= copy_length;
+
+        size_t consumed = parse_frames(mux, mux->frame_buffer, mux->frame_buffer_used);
+        if (consumed >= buffered)
+        {
+            // The split frame is done, the bytes after it are still in the input so continue from there without copying.
+            size_t unused = mux->frame_buffer_used - consumed;
+            input -= unused;
+            length += unused;
+            mux->frame_buffer_used = 0;
+            mux->stats.reassembled++;
+        }
+        else if (consumed > 0)
+        {
+            memmove(mux->frame_buffer, mux->frame_buffer + consumed, mux->frame_buffer_used - consumed);
+            mux->frame_buffer_used -= consumed;
+        }
+        else if (mux->frame_buffer_used == mux->frame_buffer_capacity)
+        {
+            mux->frame_buffer_used = 0;
+            mux->synced = false;
+        }
+    }
+    return at_parser_cmux_flush(mux);
+}
+
+extern int at_parser_cmux_write(at_parser_cmux_handle_t mux, uint8_t dlci, const char *data, size_t length)
+{
+    if (mux == NULL || dlci >= DLC_COUNT || !mux->channels[dlci].open || (data == NULL && length > 0))
+    {
+        return -1;
+    }
+    const uint8_t *bytes = (const uint8_t *)data;
+    while (length > 0)
+    {
+        size_t frame_length = min(length, mux->max_frame_size);
+        if (send_frame(mux, dlci, true, FRAME_UIH, bytes, frame_length) != 0)
+        {
+            return -1;
+        }
+        bytes += frame_length;
+        length -= frame_length;
+    }
+    return 0;
+}
+
+extern int at_parser_cmux_flush(at_parser_cmux_handle_t mux)
+{
+    if (mux == NULL)
+    {
+        return -1;
+    }
+    if (mux->output_used > 0)
+    {
+        size_t used = mux->output_used;
+        mux->output_used = 0;
+        mux->writer(mux, mux->writer_userdata, (const char *)mux->output, used);
+    }
+    return 0;
+}
+
+extern int at_parser_cmux_get_stats(at_parser_cmux_handle_t mux, struct at_parser_cmux_stats *stats)
+{
+    if (mux == NULL || stats == NULL)
+    {
+        return -1;
+    }
+    *stats = mux->stats;
+    return 0;
+}
+
+static uint8_t update_fcs(uint8_t fcs, const uint8_t *data, size_t length)
+{
+    for (size_t i = 0; i < length; i++)
+    {
+        fcs = fcs_table[fcs ^ data[i]];
+    }
+    return fcs;
+}
+
+/**
+ * @brief Decode and handle all complete frames in the data.
+ *
+ * @param mux The multiplexer.
+ * @param data The data, when the multiplexer is synced it starts right after an opening flag.
+ * @param length The length of the data.
+ * @return size_t The amount of bytes that were used, the rest is the start of an incomplete frame.
+ */
+static size_t parse_frames(at_parser_cmux_handle_t mux, const uint8_t *data, size_t length)
+{
+    size_t index = 0;
+    while (index < length)
+    {
+        if (!mux->synced)
+        {
+            const uint8_t *flag = memchr(data + index, mux->flag, length - index);
+            if (flag == NULL)
+            {
+                return length;
+            }
+            index = (size_t)(flag - data) + 1;
+            mux->synced = true;
+            continue;
+        }
+        if (data[index] == mux->flag)
+        {
+            // Closing flag followed by an opening flag, or idle fill.
+            index++;
+            continue;
+        }
+
+        struct frame frame;
+        enum frame_result result;
+        if (mux->mode == AT_PARSER_CMUX_MODE_BASIC)
+        {
+            result = parse_basic_frame(mux, data + index, length - index, &frame);
+        }
+        else
+        {
+            result = parse_advanced_frame(mux, data + index, length - index, &frame);
+        }
+        if (result == FRAME_RESULT_NEED_MORE)
+        {
+            return index;
+        }
+        if (result == FRAME_RESULT_INVALID)
+        {
+            mux->synced = false;
+            continue;
+        }
+        // The closing flag isn't consumed, it can be the opening flag of the next frame.
+        index += frame.size - 1;
+        handle_frame(mux, &frame);
+    }
+    return index;
+}
+
+static enum frame_result parse_basic_frame(at_parser_cmux_handle_t mux, const uint8_t *data, size_t length, struct frame *frame)
+{
+    if (length < 3)
+    {
+        return FRAME_RESULT_NEED_MORE;
+    }
+    size_t header_length = 3;
+    size_t info_length = data[2] >> 1;
+    if ((data[2] & LENGTH_EA) == 0)
+    {
+        if (length < 4)
+        {
+            return FRAME_RESULT_NEED_MORE;
+        }
+        info_length |= (size_t)data[3] << 7;
+        header_length = 4;
+    }
+    if ((data[0] & ADDRESS_EA) == 0 || info_length > mux->max_frame_size)
+    {
+        return FRAME_RESULT_INVALID;
+    }
+    size_t size = header_length + info_length + 2;
+    if (length < size)
+    {
+        return FRAME_RESULT_NEED_MORE;
+    }
+    if (data[size - 1] != BASIC_FLAG)
+    {
+        return FRAME_RESULT_INVALID;
+    }
+    frame->address = data[0];
+    frame->control = data[1];
+    frame->info = data + header_length;
+    frame->info_length = info_length;
+    frame->size = size;
+    return check_fcs(mux, frame, data, header_length, data[size - 2]) ? FRAME_RESULT_COMPLETE : FRAME_RESULT_INVALID;
+}
+
+static enum frame_result parse_advanced_frame(at_parser_cmux_handle_t mux, const uint8_t *data, size_t length, struct frame *frame)
+{
+    const uint8_t *end = memchr(data, ADVANCED_FLAG, length);
+    if (end == NULL)
+    {
+        return length < mux->frame_buffer_capacity ? FRAME_RESULT_NEED_MORE : FRAME_RESULT_INVALID;
+    }
+    size_t stuffed_length = (size_t)(end - data);
+    const uint8_t *body = data;
+    size_t body_length = stuffed_length;
+    if (memchr(data, ADVANCED_ESCAPE, stuffed_length) != NULL)
+    {
+        body_length = 0;
+        for (size_t i = 0; i < stuffed_length; i++)
+        {
+            if (data[i] == ADVANCED_ESCAPE)
+            {
+                if (++i == stuffed_length)
+                {
+                    return FRAME_RESULT_INVALID;
+                }
+                mux->unstuff_buffer[body_length++] = data[i] ^ ADVANCED_ESCAPE_XOR;
+            }
+            else
+            {
+                mux->unstuff_buffer[body_length++] = data[i];
+            }
+        }
+        body = mux->unstuff_buffer;
+    }
+    if (body_length < ADVANCED_OVERHEAD || body_length - ADVANCED_OVERHEAD > mux->max_frame_size || (body[0] & ADDRESS_EA) == 0)
+    {
+        return FRAME_RESULT_INVALID;
+    }
+    frame->address = body[0];
+    frame->control = body[1];
+    frame->info = body + 2;
+    frame->info_length = body_length - ADVANCED_OVERHEAD;
+    frame->size = stuffed_length + 1;
+    return check_fcs(mux, frame, body, 2, body[body_length - 1]) ? FRAME_RESULT_COMPLETE : FRAME_RESULT_INVALID;
+}
+
+static bool check_fcs(at_parser_cmux_handle_t mux, const struct frame *frame, const uint8_t *header, size_t header_length, uint8_t fcs)
+{
+    uint8_t value = update_fcs(FCS_INIT, header, header_length);
+    // The FCS of UIH frames only covers the header, so the payload doesn't have to be touched.
+    if ((frame->control & ~CONTROL_PF) != FRAME_UIH)
+    {
+        value = update_fcs(value, frame->info, frame->info_length);
+    }
+    if (fcs_table[value ^ fcs] != FCS_GOOD)
+    {
+        mux->stats.fcs_errors++;
+        return false;
+    }
+    return true;
+}
+
+static void handle_frame(at_parser_cmux_handle_t mux, const struct frame *frame)
+{
+    uint8_t dlci = frame->address >> 2;
+    struct cmux_channel *channel = &mux->channels[dlci];
+    mux->stats.frames++;
+    switch (frame->control & ~CONTROL_PF)
+    {
+    case FRAME_SABM:
+        if (dlci == 0 || channel->parser != NULL)
+        {
+            channel->open = true;
+            send_frame(mux, dlci, false, FRAME_UA | CONTROL_PF, NULL, 0);
+        }
+        else
+        {
+            send_frame(mux, dlci, false, FRAME_DM | CONTROL_PF, NULL, 0);
+        }
+        break;
+    case FRAME_DISC:
+        send_frame(mux, dlci, false, (channel->open ? FRAME_UA : FRAME_DM) | CONTROL_PF, NULL, 0);
+        if (dlci == 0)
+        {
+            close_all(mux);
+        }
+        channel->open = false;
+        break;
+    case FRAME_UIH:
+    case FRAME_UI:
+        if (!channel->open)
+        {
+            mux->stats.discarded++;
+        }
+        else if (dlci == 0)
+        {
+            handle_control_message(mux, frame->info, frame->info_length);
+        }
+        else
+        {
+            at_parser_process_buffer(channel->parser, (const char *)frame->info, frame->info_length);
+        }
+        break;
+    default:
+        // UA and DM are answers to commands, which this station doesn't send.
+        break;
+    }
+}
+
+/**
+ * @brief Answer a message on the control channel, commands are acknowledged by echoing them with the C/R bit cleared.
+ *
+ */
+static void handle_control_message(at_parser_cmux_handle_t mux, const uint8_t *data, size_t length)
+{
+    if (length == 0 || (data[0] & MESSAGE_CR) == 0)
+    {
+        return;
+    }
+    uint8_t *response = malloc(length);
+    if (response == NULL)
+    {
+        return;
+    }
+    memcpy(response, data, length);
+    response[0] &= (uint8_t)~MESSAGE_CR;
+    send_frame(mux, 0, true, FRAME_UIH, response, length);
+    free(response);
+    if ((data[0] & ~MESSAGE_CR) == MESSAGE_CLD)
+    {
+        close_all(mux);
+    }
+}
+
+static void close_all(at_parser_cmux_handle_t mux)
+{
+    for (size_t i = 0; i < DLC_COUNT; i++)
+    {
+        mux->channels[i].open = false;
+    }
+}
+
+/**
+ * @brief Encode a frame in the output buffer.
+ *
+ * @param mux The multiplexer.
+ * @param dlci The DLC of the frame.
+ * @param command True for a command, false for a response. Sets the C/R bit as the responding station.
+ * @param control The control field.
+ * @param data The information field.
+ * @param length The length of the information field.
+ * @return int 0 on success, other on error.
+ */
+static int send_frame(at_parser_cmux_handle_t mux, uint8_t dlci, bool command, uint8_t control, const uint8_t *data, size_t length)
+{
+    uint8_t header[4];
+    size_t header_length = 3;
+    header[0] = (uint8_t)(dlci << 2) | ADDRESS_EA | (command ? 0 : ADDRESS_CR);
+    header[1] = control;
+    if (length > 127)
+    {
+        header[2] = (uint8_t)(length << 1);
+        header[3] = (uint8_t)(length >> 7);
+        header_length = 4;
+    }
+    else
+    {
+        header[2] = (uint8_t)(length << 1) | LENGTH_EA;
+    }
+
+    uint8_t fcs = update_fcs(FCS_INIT, header, mux->mode == AT_PARSER_CMUX_MODE_BASIC ? header_length : 2);
+    if ((control & ~CONTROL_PF) != FRAME_UIH)
+    {
+        fcs = update_fcs(fcs, data, length);
+    }
+    fcs = 0xFF - fcs;
+
+    size_t needed = mux->mode == AT_PARSER_CMUX_MODE_BASIC ? length + BASIC_OVERHEAD + 1 : 2 * (length + ADVANCED_OVERHEAD) + 2;
+    if (reserve_output(mux, needed) != 0)
+    {
+        return -1;
+    }
+
+    uint8_t *out = mux->output + mux->output_used;
+    *out++ = mux->flag;
+    if (mux->mode == AT_PARSER_CMUX_MODE_BASIC)
+    {
+        memcpy(out, header, header_length);
+        out += header_length;
+        if (length > 0)
+        {
+            memcpy(out, data, length);
+            out += length;
+        }
+        *out++ = fcs;
+    }
+    else
+    {
+        out = put_stuffed(out, header[0]);
+        out = put_stuffed(out, header[1]);
+        for (size_t i = 0; i < length; i++)
+        {
+            out = put_stuffed(out, data[i]);
+        }
+        out = put_stuffed(out, fcs);
+    }
+    *out++ = mux->flag;
+    mux->output_used = (size_t)(out - mux->output);
+    return 0;
+}
+
+/**
+ * @brief Make sure there is room for length more bytes in the output buffer.
+ *
+ */
+static int reserve_output(at_parser_cmux_handle_t mux, size_t length)
+{
+    if (mux->output_capacity - mux->output_used >= length)
+    {
+        return 0;
+    }
+    size_t capacity = mux->output_capacity == 0 ? 256 : mux->output_capacity;
+    while (capacity - mux->output_used < length)
+    {
+        capacity *= 2;
+    }
+    uint8_t *output = realloc(mux->output, capacity);
+    if (output == NULL)
+    {
+        return -1;
+    }
+    mux->output = output;
+    mux->output_capacity = capacity;
+    return 0;
+}
+
+static uint8_t *put_stuffed(uint8_t *out, uint8_t byte)
+{
+    if (byte == ADVANCED_FLAG || byte == ADVANCED_ESCAPE || byte == XON || byte == XOFF)
+    {
+        *out++ = ADVANCED_ESCAPE;
+        byte ^= ADVANCED_ESCAPE_XOR;
+    }
+    *out++ = byte;
+    return out;
+}
+
+static void cmux_response_writer(at_parser_handle_t parser, void *userdata, const char *data, size_t length)
+{
+    (void)parser;
+    struct cmux_channel *channel = userdata;
+    at_parser_cmux_write(channel->mux, channel->dlci, data, length);
+}
+
+static inline size_t min(size_t a, size_t b)
+{
+    return a < b ? a : b;
+}
@@ -0,0 +1,111 @@
+/**
+ * @file at_parser_command_table.c
+ * @author Giel Willemsen
+ * @brief Lookup and argument validation of the generated command tables.
+ * @version 0.1
+ * @date 2023-06-14
+ *
+ * @copyright See LICENSE
+ *
+ */
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "at_parser/at_parser_command_table.h"
+
+static bool validate_argument(const struct at_parser_argument_schema *schema, const struct at_parser_argument *argument);
+static bool parse_integer(const char *value, size_t length, int64_t *result);
+
+extern const struct at_parser_table_command *at_parser_command_table_find(const struct at_parser_command_table *table, const char *name, size_t name_length)
+{
+    if (table == NULL || name == NULL || table->slots == NULL)
+    {
+        return NULL;
+    }
+    const size_t slot = at_parser_command_table_hash(table->seed, name, name_length) & table->slot_mask;
+    const size_t index = table->slots[slot];
+    if (index == 0 || index > table->command_count)
+    {
+        return NULL;
+    }
+    // The hash is only collision free for the names in the table, so the name still has to be compared.
+    const struct at_parser_table_command *command = &table->commands[index - 1];
+    if (command->name_length != name_length || memcmp(command->name, name, name_length) != 0)
+    {
+        return NULL;
+    }
+    return command;
+}
+
+extern bool at_parser_command_table_validate(const struct at_parser_table_command *command, const struct at_parser_argument *argument_list, size_t argument_list_length)
+{
+    if (command == NULL || (argument_list == NULL && argument_list_length != 0))
+    {
+        return false;
+    }
+    if (argument_list_length < command->required_arguments || argument_list_length > command->argument_count)
+    {
+        return false;
+    }
+    for (size_t i = 0; i < argument_list_length; i++)
+    {
+        if (!validate_argument(&command->arguments[i], &argument_list[i]))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool validate_argument(const struct at_parser_argument_schema *schema, const struct at_parser_argument *argument)
+{
+    if (argument->length == 0 && schema->optional)
+    {
+        return true;
+    }
+    if (schema->kind == AT_PARSER_ARGUMENT_INTEGER)
+    {
+        int64_t value = 0;
+        return parse_integer(argument->value, argument->length, &value) && value >= schema->min && value <= schema->max;
+    }
+    else if (schema->kind == AT_PARSER_ARGUMENT_STRING)
+    {
+        return (int64_t)argument->length >= schema->min && (int64_t)argument->length <= schema->max;
+    }
+    return false;
+}
+
+/**
+ * @brief Parse an optionally signed decimal integer, values that don't fit 32 bits are rejected.
+ *
+ */
+static bool parse_integer(const char *value, size_t length, int64_t *result)
+{
+    size_t position = 0;
+    bool negative = false;
+    if (length > 0 && (value[0] == '-' || value[0] == '+'))
+    {
+        negative = value[0] == '-';
+        position++;
+    }
+    if (position == length)
+    {
+        return false;
+    }
+    int64_t number = 0;
+    for (; position < length; position++)
+    {
+        if (value[position] < '0' || value[position] > '9')
+        {
+            return false;
+        }
+        number = number * 10 + (value[position] - '0');
+        if (number > (int64_t)UINT32_MAX)
+        {
+            return false;
+        }
+    }
+    *result = negative ? -number : number;
+    return *result >= INT32_MIN && *result <= INT32_MAX;
+}
@@ -0,0 +1,470 @@
+/**
+ * @file at_parser_linux_io.c
+ * @author Giel Willemsen
+ * @brief Implementation of the epoll based Linux tty/pty driver.
+ * @version 0.1
+ * @date 2023-06-14
+ *
+ * @copyright See LICENSE
+ *
+ */
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/uio.h>
+#include "at_parser/at_parser_linux_io.h"
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif // IOV_MAX
+
+struct output_segment
+{
+    const char *data; ///< Referenced data, or NULL when the data is copied into the channel its arena.
+    size_t offset;    ///< Offset in the arena for copied data.
+    size_t length;
+};
+
+struct io_channel
+{
+    int fd;
+    at_parser_handle_t parser;
+    bool hung_up;
+    bool wants_output;     ///< EPOLLOUT is enabled because the last flush would block.
+    bool dirty;            ///< Channel is in the dirty list.
+    struct io_channel *next_dirty;
+    struct output_segment *segments;
+    size_t segment_count;
+    size_t segment_capacity;
+    size_t first_segment;  ///< First segment that isn't (fully) written yet.
+    size_t first_written;  ///< Amount of bytes already written of the first segment.
+    char *arena;
+    size_t arena_used;
+    size_t arena_capacity;
+};
+
+struct at_parser_linux_io
+{
+    int epoll_fd;
+    struct epoll_event *events;
+    size_t max_events;
+    struct io_channel **channels; ///< Indexed on file descriptor.
+    size_t channel_capacity;
+    struct io_channel *dirty;
+    at_parser_linux_io_hangup hangup;
+    void *hangup_userdata;
+};
+
+static struct io_channel *get_channel(at_parser_linux_io_handle_t io, int fd);
+static void free_channel(struct io_channel *channel);
+static int update_interest(at_parser_linux_io_handle_t io, struct io_channel *channel, bool wants_output);
+static void mark_dirty(at_parser_linux_io_handle_t io, struct io_channel *channel);
+static int add_segment(struct io_channel *channel, const char *data, size_t length, bool copy);
+static int flush_channel(at_parser_linux_io_handle_t io, struct io_channel *channel);
+static bool read_channel(at_parser_linux_io_handle_t io, struct io_channel *channel);
+static void hang_up(at_parser_linux_io_handle_t io, struct io_channel *channel);
+
+extern int at_parser_linux_io_create(at_parser_linux_io_handle_t *io, size_t max_events)
+{
+    if (io == NULL || max_events == 0 || max_events > INT_MAX)
+    {
+        return -1;
+    }
+    at_parser_linux_io_handle_t handle = calloc(1, sizeof(struct at_parser_linux_io));
+    if (handle == NULL)
+    {
+        return -1;
+    }
+    handle->events = calloc(max_events, sizeof(struct epoll_event));
+    if (handle->events == NULL)
+    {
+        free(handle);
+        return -1;
+    }
+    handle->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (handle->epoll_fd < 0)
+    {
+        free(handle->events);
+        free(handle);
+        return -1;
+    }
+    handle->max_events = max_events;
+    *io = handle;
+    return 0;
+}
+
+extern void at_parser_linux_io_free(at_parser_linux_io_handle_t io)
+{
+    if (io != NULL)
+    {
+        for (size_t i = 0; i < io->channel_capacity; i++)
+        {
+            free_channel(io->channels[i]);
+        }
+        free(io->channels);
+        free(io->events);
+        close(io->epoll_fd);
+        free(io);
+    }
+}
+
+extern int at_parser_linux_io_set_hangup_callback(at_parser_linux_io_handle_t io, at_parser_linux_io_hangup callback, void *userdata)
+{
+    if (io == NULL)
+    {
+        return -1;
+    }
+    io->hangup = callback;
+    io->hangup_userdata = userdata;
+    return 0;
+}
+
+extern int at_parser_linux_io_add_channel(at_parser_linux_io_handle_t io, int fd, at_parser_handle_t parser)
+{
+    if (io == NULL || fd < 0 || parser == NULL || get_channel(io, fd) != NULL)
+    {
+        return -1;
+    }
+    if ((size_t)fd >= io->channel_capacity)
+    {
+        size_t new_capacity = io->channel_capacity == 0 ? 64 : io->channel_capacity;
+        while (new_capacity <= (size_t)fd)
+        {
+            new_capacity *= 2;
+        }
+        struct io_channel **new_channels = realloc(io->channels, new_capacity * sizeof(struct io_channel *));
+        if (new_channels == NULL)
+        {
+            return -1;
+        }
+        memset(new_channels + io->channel_capacity, 0, (new_capacity - io->channel_capacity) * sizeof(struct io_channel *));
+        io->channels = new_channels;
+        io->channel_capacity = new_capacity;
+    }
+    int flags = fcntl(fd, F_GETFL);
+    if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0)
+    {
+        return -1;
+    }
+    struct io_channel *channel = calloc(1, sizeof(struct io_channel));
+    if (channel == NULL)
+    {
+        return -1;
+    }
+    channel->fd = fd;
+    channel->parser = parser;
+    struct epoll_event event = {0};
+    event.events = EPOLLIN;
+    event.data.fd = channel->fd;
+    if (epoll_ctl(io->epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0)
+    {
+        free(channel);
+        return -1;
+    }
+    io->channels[fd] = channel;
+    return 0;
+}
+
+extern int at_parser_linux_io_remove_channel(at_parser_linux_io_handle_t io, int fd)
+{
+    struct io_channel *channel = get_channel(io, fd);
+    if (channel == NULL)
+    {
+        return -1;
+    }
+    if (!channel->hung_up)
+    {
+        epoll_ctl(io->epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+    }
+    if (channel->dirty)
+    {
+        struct io_channel **current = &io->dirty;
+        while (*current != channel)
+        {
+            current = &(*current)->next_dirty;
+        }
+        *current = channel->next_dirty;
+    }
+    io->channels[fd] = NULL;
+    free_channel(channel);
+    return 0;
+}
+
+extern int at_parser_linux_io_write(at_parser_linux_io_handle_t io, int fd, const char *data, size_t length, bool copy)
+{
+    struct io_channel *channel = get_channel(io, fd);
+    if (channel == NULL || data == NULL)
+    {
+        return -1;
+    }
+    if (length == 0)
+    {
+        return 0;
+    }
+    if (add_segment(channel, data, length, copy) != 0)
+    {
+        return -1;
+    }
+    if (!channel->wants_output)
+    {
+        mark_dirty(io, channel); // When waiting on EPOLLOUT the data is written once the channel is writable.
+    }
+    return 0;
+}
+
+extern int at_parser_linux_io_flush(at_parser_linux_io_handle_t io)
+{
+    if (io == NULL)
+    {
+        return -1;
+    }
+    int rc = 0;
+    while (io->dirty != NULL)
+    {
+        struct io_channel *channel = io->dirty;
+        io->dirty = channel->next_dirty;
+        channel->dirty = false;
+        channel->next_dirty = NULL;
+        if (flush_channel(io, channel) != 0)
+        {
+            rc = -1;
+        }
+    }
+    return rc;
+}
+
+extern int at_parser_linux_io_poll(at_parser_linux_io_handle_t io, int timeout_ms)
+{
+    if (io == NULL)
+    {
+        return -1;
+    }
+    int count = epoll_wait(io->epoll_fd, io->events, (int)io->max_events, timeout_ms);
+    if (count < 0)
+    {
+        return errno == EINTR ? 0 : -1;
+    }
+    for (int i = 0; i < count; i++)
+    {
+        // Looked up by fd, a callback earlier in this batch may have removed the channel.
+        struct io_channel *channel = get_channel(io, io->events[i].data.fd);
+        if (channel == NULL)
+        {
+            continue;
+        }
+        const uint32_t events = io->events[i].events;
+        if ((events & EPOLLIN) != 0 && read_channel(io, channel))
+        {
+            continue; // A handler or the hangup callback may have removed the channel.
+        }
+        if ((events & EPOLLOUT) != 0 && !channel->hung_up)
+        {
+            flush_channel(io, channel);
+        }
+        if ((events & (EPOLLHUP | EPOLLERR)) != 0 && (events & EPOLLIN) == 0 && !channel->hung_up)
+        {
+            hang_up(io, channel);
+        }
+    }
+    at_parser_linux_io_flush(io);
+    return count;
+}
+
+static struct io_channel *get_channel(at_parser_linux_io_handle_t io, int fd)
+{
+    if (io == NULL || fd < 0 || (size_t)fd >= io->channel_capacity)
+    {
+        return NULL;
+    }
+    return io->channels[fd];
+}
+
+static void free_channel(struct io_channel *channel)
+{
+    if (channel != NULL)
+    {
+        free(channel->segments);
+        free(channel->arena);
+        free(channel);
+    }
+}
+
+static int update_interest(at_parser_linux_io_handle_t io, struct io_channel *channel, bool wants_output)
+{
+    if (channel->wants_output == wants_output || channel->hung_up)
+    {
+        return 0;
+    }
+    struct epoll_event event = {0};
+    event.events = EPOLLIN | (wants_output ? EPOLLOUT : 0);
+    event.data.fd = channel->fd;
+    if (epoll_ctl(io->epoll_fd, EPOLL_CTL_MOD, channel->fd, &event) != 0)
+    {
+        return -1;
+    }
+    channel->wants_output = wants_output;
+    return 0;
+}
+
+static void mark_dirty(at_parser_linux_io_handle_t io, struct io_channel *channel)
+{
+    if (!channel->dirty)
+    {
+        channel->dirty = true;
+        channel->next_dirty = io->dirty;
+        io->dirty = channel;
+    }
+}
+
+static int add_segment(struct io_channel *channel, const char *data, size_t length, bool copy)
+{
+    if (channel->segment_count == channel->segment_capacity)
+    {
+        size_t new_capacity = channel->segment_capacity == 0 ? 8 : channel->segment_capacity * 2;
+        struct output_segment *new_segments = realloc(channel->segments, new_capacity * sizeof(struct output_segment));
+        if (new_segments == NULL)
+        {
+            return -1;
+        }
+        channel->segments = new_segments;
+        channel->segment_capacity = new_capacity;
+    }
+    struct output_segment *segment = &channel->segments[channel->segment_count];
+    segment->data = NULL;
+    segment->offset = 0;
+    segment->length = length;
+    if (copy)
+    {
+        if (channel->arena_capacity - channel->arena_used < length)
+        {
+            size_t new_capacity = channel->arena_capacity == 0 ? 256 : channel->arena_capacity;
+            while (new_capacity - channel->arena_used < length)
+            {
+                new_capacity *= 2;
+            }
+            char *new_arena = realloc(channel->arena, new_capacity);
+            if (new_arena == NULL)
+            {
+                return -1;
+            }
+            channel->arena = new_arena;
+            channel->arena_capacity = new_capacity;
+        }
+        memcpy(channel->arena + channel->arena_used, data, length);
+        segment->offset = channel->arena_used;
+        channel->arena_used += length;
+    }
+    else
+    {
+        segment->data = data;
+    }
+    channel->segment_count++;
+    return 0;
+}
+
+static int flush_channel(at_parser_linux_io_handle_t io, struct io_channel *channel)
+{
+    struct iovec iov[64];
+    while (channel->first_segment < channel->segment_count)
+    {
+        // The segments are resolved here since the arena may have been moved by a realloc while queueing.
+        int iov_count = 0;
+        for (size_t i = channel->first_segment; i < channel->segment_count && iov_count < (int)(sizeof(iov) / sizeof(iov[0])) && iov_count < IOV_MAX; i++)
+        {
+            const struct output_segment *segment = &channel->segments[i];
+            const char *data = segment->data != NULL ? segment->data : channel->arena + segment->offset;
+            size_t skip = i == channel->first_segment ? channel->first_written : 0;
+            iov[iov_count].iov_base = (void *)(data + skip);
+            iov[iov_count].iov_len = segment->length - skip;
+            iov_count++;
+        }
+        ssize_t written = writev(channel->fd, iov, iov_count);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                return update_interest(io, channel, true);
+            }
+            channel->segment_count = channel->first_segment = channel->first_written = channel->arena_used = 0;
+            return -1;
+        }
+        size_t remaining = (size_t)written;
+        while (remaining > 0)
+        {
+            const size_t left = channel->segments[channel->first_segment].length - channel->first_written;
+            if (remaining >= left)
+            {
+                remaining -= left;
+                channel->first_segment++;
+                channel->first_written = 0;
+            }
+            else
+            {
+                channel->first_written += remaining;
+                remaining = 0;
+            }
+        }
+    }
+    channel->segment_count = channel->first_segment = channel->first_written = channel->arena_used = 0;
+    return update_interest(io, channel, false);
+}
+
+static bool read_channel(at_parser_linux_io_handle_t io, struct io_channel *channel)
+{
+    const int fd = channel->fd;
+    while (true)
+    {
+        char *buffer = NULL;
+        size_t available = 0;
+        if (at_parser_get_ingest_buffer(channel->parser, &buffer, &available) != 0)
+        {
+            return false;
+        }
+        ssize_t count = read(channel->fd, buffer, available);
+        if (count > 0)
+        {
+            at_parser_commit_ingest(channel->parser, (size_t)count);
+            if (get_channel(io, fd) != channel)
+            {
+                return true; // A handler removed its own channel, it is freed already.
+            }
+            if ((size_t)count < available)
+            {
+                return false; // Short read, the fd is drained so don't spend another syscall on EAGAIN.
+            }
+        }
+        else if (count < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        else if (count == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+        {
+            hang_up(io, channel);
+            return true;
+        }
+        else
+        {
+            return false;
+        }
+    }
+}
+
+static void hang_up(at_parser_linux_io_handle_t io, struct io_channel *channel)
+{
+    epoll_ctl(io->epoll_fd, EPOLL_CTL_DEL, channel->fd, NULL);
+    channel->hung_up = true;
+    if (io->hangup != NULL)
+    {
+        io->hangup(io, io->hangup_userdata, channel->fd, channel->parser);
+    }
+}
@@ -0,0 +1,405 @@
+/**
+ * @file at_parser_output.c
+ * @author Giel Willemsen
+ * @brief Implementation of the output scheduler.
+ * @version 0.1
+ * @date 2023-06-14
+ *
+ * @copyright See LICENSE
+ *
+ */
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+#include "at_parser/at_parser_output.h"
+
+struct at_parser_output
+{
+    struct at_parser_output_config config;
+    at_parser_handle_t parser;
+    pthread_mutex_t lock;   ///< Held by every entry point (and the writer calls they make), URCs may come from any thread.
+    bool lock_initialized;
+    char *queue;            ///< Complete messages waiting for the link, in wire order.
+    size_t queue_used;
+    char *response;         ///< The open response, it is only queued once it is complete (or lines are forced out).
+    size_t response_used;
+    bool response_open;
+    char *urcs;             ///< URCs deferred while the response is open, they all go out together.
+    size_t urcs_used;
+    size_t urc_count;
+    uint32_t oldest_urc_at;
+    struct at_parser_output_stats stats;
+};
+
+static const char *const final_result_codes[] = {"OK", "ERROR", "+CME ERROR:", "+CMS ERROR:", "NO CARRIER", "BUSY", "NO ANSWER", "NO DIALTONE", "CONNECT", "CONNECT "};
+
+static int queue_urc(at_parser_output_handle_t output, const char *urc, size_t length);
+static void output_response_writer(at_parser_handle_t parser, void *userdata, const char *data, size_t length);
+static void append_response(at_parser_output_handle_t output, const char *data, size_t length);
+static void finish_response(at_parser_output_handle_t output);
+static void commit_response_lines(at_parser_output_handle_t output);
+static void release_urcs(at_parser_output_handle_t output);
+static void check_urc_delay(at_parser_output_handle_t output);
+static bool enqueue(at_parser_output_handle_t output, const char *data, size_t length);
+static void write_queue(at_parser_output_handle_t output);
+static void write_unless_coalescing(at_parser_output_handle_t output);
+static bool ends_with_final_result(const char *data, size_t length);
+static bool ends_with_prompt(const char *data, size_t length);
+
+extern int at_parser_output_create(at_parser_output_handle_t *output, const struct at_parser_output_config *config)
+{
+    if (output == NULL || config == NULL || config->queue_size == 0 || config->writer == NULL || (config->max_urc_delay != 0 && config->clock == NULL))
+    {
+        return -1;
+    }
+    at_parser_output_handle_t handle = calloc(1, sizeof(struct at_parser_output));
+    if (handle == NULL)
+    {
+        return -1;
+    }
+    handle->config = *config;
+    handle->lock_initialized = pthread_mutex_init(&handle->lock, NULL) == 0;
+    handle->queue = malloc(config->queue_size);
+    handle->response = malloc(config->queue_size);
+    handle->urcs = malloc(config->urc_queue_size > 0 ? config->urc_queue_size : 1);
+    if (!handle->lock_initialized || handle->queue == NULL || handle->response == NULL || handle->urcs == NULL)
+    {
+        at_parser_output_free(handle);
+        return -1;
+    }
+    *output = handle;
+    return 0;
+}
+
+extern void at_parser_output_free(at_parser_output_handle_t output)
+{
+    if (output != NULL)
+    {
+        if (output->lock_initialized)
+        {
+            at_parser_output_attach(output, NULL);
+            pthread_mutex_destroy(&output->lock);
+        }
+        free(output->queue);
+        free(output->response);
+        free(output->urcs);
+        free(output);
+    }
+}
+
+extern int at_parser_output_attach(at_parser_output_handle_t output, at_parser_handle_t parser)
+{
+    if (output == NULL)
+    {
+        return -1;
+    }
+    if (parser != NULL && at_parser_set_response_writer(parser, output_response_writer, output) != 0)
+    {
+        return -1;
+    }
+    pthread_mutex_lock(&output->lock);
+    at_parser_handle_t previous = output->parser;
+    output->parser = parser;
+    pthread_mutex_unlock(&output->lock);
+    if (previous != NULL && previous != parser)
+    {
+        at_parser_set_response_writer(previous, NULL, NULL);
+    }
+    return 0;
+}
+
+extern int at_parser_output_begin_response(at_parser_output_handle_t output)
+{
+    if (output == NULL)
+    {
+        return -1;
+    }
+    pthread_mutex_lock(&output->lock);
+    output->response_open = true;
+    pthread_mutex_unlock(&output->lock);
+    return 0;
+}
+
+extern int at_parser_output_end_response(at_parser_output_handle_t output)
+{
+    if (output == NULL)
+    {
+        return -1;
+    }
+    pthread_mutex_lock(&output->lock);
+    if (output->response_open)
+    {
+        finish_response(output);
+    }
+    pthread_mutex_unlock(&output->lock);
+    return 0;
+}
+
+extern int at_parser_output_send_urc(at_parser_output_handle_t output, const char *urc, size_t length)
+{
+    if (output == NULL || urc == NULL || length > output->config.queue_size)
+    {
+        return -1;
+    }
+    pthread_mutex_lock(&output->lock);
+    const int result = queue_urc(output, urc, length);
+    pthread_mutex_unlock(&output->lock);
+    return result;
+}
+
+extern int at_parser_output_poll(at_parser_output_handle_t output)
+{
+    if (output == NULL)
+    {
+        return -1;
+    }
+    pthread_mutex_lock(&output->lock);
+    check_urc_delay(output);
+    write_queue(output);
+    pthread_mutex_unlock(&output->lock);
+    return 0;
+}
+
+extern int at_parser_output_flush(at_parser_output_handle_t output)
+{
+    if (output == NULL)
+    {
+        return -1;
+    }
+    pthread_mutex_lock(&output->lock);
+    write_queue(output);
+    pthread_mutex_unlock(&output->lock);
+    return 0;
+}
+
+extern size_t at_parser_output_get_queued(at_parser_output_handle_t output)
+{
+    if (output == NULL)
+    {
+        return 0;
+    }
+    pthread_mutex_lock(&output->lock);
+    const size_t queued = output->queue_used;
+    pthread_mutex_unlock(&output->lock);
+    return queued;
+}
+
+extern int at_parser_output_get_stats(at_parser_output_handle_t output, struct at_parser_output_stats *stats)
+{
+    if (output == NULL || stats == NULL)
+    {
+        return -1;
+    }
+    pthread_mutex_lock(&output->lock);
+    *stats = output->stats;
+    pthread_mutex_unlock(&output->lock);
+    return 0;
+}
+
+static int queue_urc(at_parser_output_handle_t output, const char *urc, size_t length)
+{
+    output->stats.urcs++;
+    if (!output->response_open)
+    {
+        const bool queued = enqueue(output, urc, length);
+        write_unless_coalescing(output);
+        return queued ? 0 : -1;
+    }
+
+    output->stats.deferred_urcs++;
+    if (output->urcs_used + length > output->config.urc_queue_size)
+    {
+        // No room to defer it any longer, the deferred URCs go out at the current line boundary of the response.
+        commit_response_lines(output);
+        output->stats.forced_urcs += output->urc_count + 1;
+        release_urcs(output);
+        const bool queued = enqueue(output, urc, length);
+        write_unless_coalescing(output);
+        return queued ? 0 : -1;
+    }
+    if (output->urcs_used == 0 && output->config.clock != NULL)
+    {
+        output->oldest_urc_at = output->config.clock(output->config.clock_userdata);
+    }
+    memcpy(output->urcs + output->urcs_used, urc, length);
+    output->urcs_used += length;
+    output->urc_count++;
+    check_urc_delay(output);
+    return 0;
+}
+
+static void output_response_writer(at_parser_handle_t parser, void *userdata, const char *data, size_t length)
+{
+    (void)parser;
+    at_parser_output_handle_t output = (at_parser_output_handle_t)userdata;
+    pthread_mutex_lock(&output->lock);
+    append_response(output, data, length);
+    pthread_mutex_unlock(&output->lock);
+}
+
+static void append_response(at_parser_output_handle_t output, const char *data, size_t length)
+{
+    output->response_open = true;
+    if (output->response_used + length > output->config.queue_size)
+    {
+        // The response is too long to hold, the complete lines are queued already (URCs still wait for the end).
+        commit_response_lines(output);
+    }
+    if (output->response_used + length > output->config.queue_size)
+    {
+        enqueue(output, output->response, output->response_used);
+        output->response_used = 0;
+    }
+    if (length > output->config.queue_size)
+    {
+        enqueue(output, data, length);
+    }
+    else
+    {
+        memcpy(output->response + output->response_used, data, length);
+        output->response_used += length;
+    }
+    if (ends_with_final_result(output->response, output->response_used) || ends_with_prompt(output->response, output->response_used))
+    {
+        finish_response(output);
+    }
+    else
+    {
+        check_urc_delay(output);
+    }
+}
+
+static void finish_response(at_parser_output_handle_t output)
+{
+    enqueue(output, output->response, output->response_used);
+    output->response_used = 0;
+    output->response_open = false;
+    output->stats.responses++;
+    release_urcs(output);
+    write_unless_coalescing(output);
+}
+
+/**
+ * @brief Queue the complete lines of the open response, the unfinished line stays.
+ *
+ */
+static void commit_response_lines(at_parser_output_handle_t output)
+{
+    size_t length = output->response_used;
+    while (length > 0 && output->response[length - 1] != '\n')
+    {
+        length--;
+    }
+    if (length == 0)
+    {
+        return;
+    }
+    enqueue(output, output->response, length);
+    memmove(output->response, output->response + length, output->response_used - length);
+    output->response_used -= length;
+}
+
+static void release_urcs(at_parser_output_handle_t output)
+{
+    if (output->urcs_used > 0)
+    {
+        enqueue(output, output->urcs, output->urcs_used);
+    }
+    output->urcs_used = 0;
+    output->urc_count = 0;
+}
+
+static void check_urc_delay(at_parser_output_handle_t output)
+{
+    if (output->urcs_used == 0 || !output->response_open || output->config.max_urc_delay == 0)
+    {
+        return;
+    }
+    const uint32_t now = output->config.clock(output->config.clock_userdata);
+    if ((int32_t)(now - output->oldest_urc_at) >= (int32_t)output->config.max_urc_delay)
+    {
+        commit_response_lines(output);
+        output->stats.forced_urcs += output->urc_count;
+        release_urcs(output);
+        write_unless_coalescing(output);
+    }
+}
+
+/**
+ * @brief Queue a whole message, a message that doesn't fit (even after writing) is dropped as a whole.
+ *
+ */
+static bool enqueue(at_parser_output_handle_t output, const char *data, size_t length)
+{
+    if (output->queue_used + length > output->config.queue_size)
+    {
+        write_queue(output);
+    }
+    if (output->queue_used + length > output->config.queue_size)
+    {
+        output->stats.dropped += length;
+        return false;
+    }
+    memcpy(output->queue + output->queue_used, data, length);
+    output->queue_used += length;
+    return true;
+}
+
+static void write_queue(at_parser_output_handle_t output)
+{
+    if (output->queue_used == 0)
+    {
+        return;
+    }
+    size_t written = output->config.writer(output, output->config.writer_userdata, output->queue, output->queue_used);
+    written = written > output->queue_used ? output->queue_used : written;
+    memmove(output->queue, output->queue + written, output->queue_used - written);
+    output->queue_used -= written;
+    output->stats.writes++;
+    output->stats.bytes += written;
+}
+
+static void write_unless_coalescing(at_parser_output_handle_t output)
+{
+    if (!output->config.coalesce)
+    {
+        write_queue(output);
+    }
+}
+
+static bool ends_with_final_result(const char *data, size_t length)
+{
+    if (length < 2 || data[length - 2] != '\r' || data[length - 1] != '\n')
+    {
+        return false;
+    }
+    const size_t end = length - 2;
+    size_t start = end;
+    while (start > 0 && data[start - 1] != '\n')
+    {
+        start--;
+    }
+    const size_t line_length = end - start;
+    for (size_t i = 0; i < sizeof(final_result_codes) / sizeof(final_result_codes[0]); i++)
+    {
+        const char *code = final_result_codes[i];
+        const size_t code_length = strlen(code);
+        const bool is_prefix = code[code_length - 1] == ':' || code[code_length - 1] == ' '; // Codes with a value only have to match up to the colon (or space).
+        if ((is_prefix ? line_length >= code_length : line_length == code_length) && memcmp(data + start, code, code_length) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief The "> " prompt of body mode ends a response too, the other side waits for it before it sends the body.
+ *
+ */
+static bool ends_with_prompt(const char *data, size_t length)
+{
+    return length >= 4 && memcmp(data + length - 4, "\r\n> ", 4) == 0;
+}
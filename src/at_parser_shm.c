@@ -0,0 +1,423 @@
+/**
+ * @file at_parser_shm.c
+ * @author Giel Willemsen
+ * @brief Implementation of the shared memory ring.
+ * @version 0.1
+ * @date 2023-06-14
+ *
+ * @copyright See LICENSE
+ *
+ */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // memfd_create
+#endif // _GNU_SOURCE
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "at_parser/at_parser_shm.h"
+
+#define SHM_MAGIC 0x4D485341u // "ASHM"
+#define SHM_VERSION 1u
+#define RECORD_PAD 0u
+#define RECORD_ALIGNMENT 8u
+#define MIN_CAPACITY 64u
+
+_Static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "The ring needs lock free 64 bit atomics to work between processes.");
+
+/**
+ * @brief The start of the shared memory, the positions only grow (they never wrap in practice) and are masked with
+ * the capacity. Every position is on its own cache line, so the producer and consumer don't share one.
+ *
+ */
+struct shm_header
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t capacity;
+    _Alignas(64) _Atomic unsigned long long head; ///< Written by the producer.
+    _Alignas(64) _Atomic unsigned long long tail; ///< Written by the consumer.
+    _Alignas(64) _Atomic unsigned long long dropped;
+};
+
+struct record_header
+{
+    uint32_t size; ///< The size of the payload, the record is padded to RECORD_ALIGNMENT.
+    uint32_t kind; ///< An at_parser_shm_message_kind or RECORD_PAD.
+};
+
+struct command_header
+{
+    uint8_t type;
+    uint8_t reserved;
+    uint16_t argument_count;
+    uint32_t name_length;
+};
+
+struct argument_entry
+{
+    uint32_t offset; ///< Offset of the value from the start of the payload.
+    uint32_t length;
+};
+
+struct at_parser_shm_ring
+{
+    int fd;
+    struct shm_header *header;
+    char *data;
+    size_t map_length;
+    uint64_t mask;
+    uint64_t pending_head; ///< Producer, the head after the reserved record.
+    uint64_t peeked;       ///< Consumer, the size of the peeked record (0 when nothing is peeked).
+    uint64_t rejected;     ///< Consumer, records that were skipped because they don't fit the ring or their own size.
+};
+
+static int map_ring(at_parser_shm_ring_handle_t *ring, int fd, size_t map_length);
+static char *reserve_record(at_parser_shm_ring_handle_t ring, uint32_t kind, size_t size);
+static void commit_record(at_parser_shm_ring_handle_t ring);
+static inline uint64_t record_length(size_t size);
+static bool read_record(const char *record, const struct record_header *record_header, struct at_parser_shm_message *message);
+
+extern int at_parser_shm_ring_create(at_parser_shm_ring_handle_t *ring, size_t capacity)
+{
+    if (ring == NULL || capacity < MIN_CAPACITY || (capacity & (capacity - 1)) != 0 || capacity > UINT32_MAX)
+    {
+        return -1;
+    }
+    const int fd = memfd_create("at_parser_shm", MFD_CLOEXEC);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    const size_t map_length = sizeof(struct shm_header) + capacity;
+    if (ftruncate(fd, (off_t)map_length) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+    struct shm_header *header = mmap(NULL, map_length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (header == MAP_FAILED)
+    {
+        close(fd);
+        return -1;
+    }
+    header->magic = SHM_MAGIC;
+    header->version = SHM_VERSION;
+    header->capacity = capacity;
+    atomic_init(&header->head, 0);
+    atomic_init(&header->tail, 0);
+    atomic_init(&header->dropped, 0);
+    munmap(header, map_length);
+
+    const int result = map_ring(ring, fd, map_length);
+    if (result != 0)
+    {
+        close(fd);
+    }
+    return result;
+}
+
+extern int at_parser_shm_ring_open(at_parser_shm_ring_handle_t *ring, int fd)
+{
+    struct stat info;
+    if (ring == NULL || fd < 0 || fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(struct shm_header) + MIN_CAPACITY)
+    {
+        return -1;
+    }
+    const int own_fd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+    if (own_fd < 0)
+    {
+        return -1;
+    }
+    const int result = map_ring(ring, own_fd, (size_t)info.st_size);
+    if (result != 0)
+    {
+        close(own_fd);
+    }
+    return result;
+}
+
+extern void at_parser_shm_ring_free(at_parser_shm_ring_handle_t ring)
+{
+    if (ring != NULL)
+    {
+        munmap(ring->header, ring->map_length);
+        close(ring->fd);
+        free(ring);
+    }
+}
+
+extern int at_parser_shm_ring_get_fd(at_parser_shm_ring_handle_t ring)
+{
+    return ring != NULL ? ring->fd : -1;
+}
+
+extern int at_parser_shm_push_raw(at_parser_shm_ring_handle_t ring, const char *data, size_t length)
+{
+    if (ring == NULL || (data == NULL && length != 0) || length > UINT32_MAX)
+    {
+        return -1;
+    }
+    char *payload = reserve_record(ring, AT_PARSER_SHM_MESSAGE_RAW, length);
+    if (payload == NULL)
+    {
+        return -1;
+    }
+    if (length > 0)
+    {
+        memcpy(payload, data, length);
+    }
+    commit_record(ring);
+    return 0;
+}
+
+extern int at_parser_shm_push_command(at_parser_shm_ring_handle_t ring, const char *command_name, size_t command_name_length, enum at_parser_command_type type, const struct at_parser_argument *argument_list, size_t argument_list_length)
+{
+    if (ring == NULL || command_name == NULL || (argument_list == NULL && argument_list_length != 0) || argument_list_length > UINT16_MAX || command_name_length > UINT32_MAX)
+    {
+        return -1;
+    }
+    // Payload: command header | argument entries | name + '\0' | argument values.
+    size_t size = sizeof(struct command_header) + argument_list_length * sizeof(struct argument_entry) + command_name_length + 1;
+    for (size_t i = 0; i < argument_list_length; i++)
+    {
+        size += argument_list[i].length;
+    }
+    if (size > UINT32_MAX)
+    {
+        return -1;
+    }
+    char *payload = reserve_record(ring, AT_PARSER_SHM_MESSAGE_COMMAND, size);
+    if (payload == NULL)
+    {
+        return -1;
+    }
+    const struct command_header command = {(uint8_t)type, 0, (uint16_t)argument_list_length, (uint32_t)command_name_length};
+    memcpy(payload, &command, sizeof(command));
+    size_t offset = sizeof(struct command_header) + argument_list_length * sizeof(struct argument_entry);
+    memcpy(payload + offset, command_name, command_name_length);
+    payload[offset + command_name_length] = '\0';
+    offset += command_name_length + 1;
+    for (size_t i = 0; i < argument_list_length; i++)
+    {
+        const struct argument_entry entry = {(uint32_t)offset, (uint32_t)argument_list[i].length};
+        memcpy(payload + sizeof(struct command_header) + i * sizeof(struct argument_entry), &entry, sizeof(entry));
+        if (argument_list[i].length > 0)
+        {
+            memcpy(payload + offset, argument_list[i].value, argument_list[i].length);
+        }
+        offset += argument_list[i].length;
+    }
+    commit_record(ring);
+    return 0;
+}
+
+extern void at_parser_shm_forward_batch(at_parser_handle_t parser, void *userdata, struct at_parser_command_record *records, size_t record_count)
+{
+    (void)parser;
+    for (size_t i = 0; i < record_count; i++)
+    {
+        at_parser_shm_push_command((at_parser_shm_ring_handle_t)userdata, records[i].command_name, records[i].command_name_length, records[i].type, records[i].argument_list, records[i].argument_list_length);
+    }
+}
+
+extern int at_parser_shm_peek(at_parser_shm_ring_handle_t ring, struct at_parser_shm_message *message)
+{
+    if (ring == NULL || message == NULL)
+    {
+        return -1;
+    }
+    // Everything in the shared memory is written by the other process, so no size is trusted before it is checked.
+    struct shm_header *header = ring->header;
+    const uint64_t capacity = ring->mask + 1;
+    unsigned long long tail = atomic_load_explicit(&header->tail, memory_order_relaxed);
+    const unsigned long long head = atomic_load_explicit(&header->head, memory_order_acquire);
+    while (tail != head)
+    {
+        const uint64_t position = tail & ring->mask;
+        const char *record = ring->data + position;
+        struct record_header record_header = {0, RECORD_PAD};
+        if (position + sizeof(struct record_header) <= capacity)
+        {
+            memcpy(&record_header, record, sizeof(record_header));
+        }
+        const uint64_t length = record_length(record_header.size);
+        if (head - tail > capacity || position + length > capacity || length > head - tail)
+        {
+            // Without a valid length the next record can't be found, so everything that was published is skipped.
+            ring->rejected++;
+            tail = head;
+            atomic_store_explicit(&header->tail, tail, memory_order_release);
+            continue;
+        }
+        if (record_header.kind == RECORD_PAD)
+        {
+            tail += length;
+            atomic_store_explicit(&header->tail, tail, memory_order_release);
+            continue;
+        }
+        if (!read_record(record, &record_header, message))
+        {
+            ring->rejected++;
+            tail += length;
+            atomic_store_explicit(&header->tail, tail, memory_order_release);
+            continue;
+        }
+        ring->peeked = length;
+        return 0;
+    }
+    return -1;
+}
+
+extern int at_parser_shm_release(at_parser_shm_ring_handle_t ring)
+{
+    if (ring == NULL || ring->peeked == 0)
+    {
+        return -1;
+    }
+    const unsigned long long tail = atomic_load_explicit(&ring->header->tail, memory_order_relaxed);
+    atomic_store_explicit(&ring->header->tail, tail + ring->peeked, memory_order_release);
+    ring->peeked = 0;
+    return 0;
+}
+
+extern int at_parser_shm_message_get_argument(const struct at_parser_shm_message *message, size_t index, struct at_parser_argument *argument)
+{
+    if (message == NULL || argument == NULL || message->kind != AT_PARSER_SHM_MESSAGE_COMMAND || index >= message->argument_count)
+    {
+        return -1;
+    }
+    struct argument_entry entry;
+    memcpy(&entry, message->data + sizeof(struct command_header) + index * sizeof(struct argument_entry), sizeof(entry));
+    if ((size_t)entry.offset + entry.length > message->length)
+    {
+        return -1;
+    }
+    argument->value = message->data + entry.offset;
+    argument->length = entry.length;
+    return 0;
+}
+
+extern uint64_t at_parser_shm_get_dropped(at_parser_shm_ring_handle_t ring)
+{
+    return ring != NULL ? atomic_load_explicit(&ring->header->dropped, memory_order_relaxed) : 0;
+}
+
+extern uint64_t at_parser_shm_get_rejected(at_parser_shm_ring_handle_t ring)
+{
+    return ring != NULL ? ring->rejected : 0;
+}
+
+static int map_ring(at_parser_shm_ring_handle_t *ring, int fd, size_t map_length)
+{
+    struct shm_header *header = mmap(NULL, map_length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (header == MAP_FAILED)
+    {
+        return -1;
+    }
+    const uint64_t capacity = header->capacity;
+    if (header->magic != SHM_MAGIC || header->version != SHM_VERSION || capacity < MIN_CAPACITY || (capacity & (capacity - 1)) != 0 || sizeof(struct shm_header) + capacity != map_length)
+    {
+        munmap(header, map_length);
+        return -1;
+    }
+    at_parser_shm_ring_handle_t handle = calloc(1, sizeof(struct at_parser_shm_ring));
+    if (handle == NULL)
+    {
+        munmap(header, map_length);
+        return -1;
+    }
+    handle->fd = fd;
+    handle->header = header;
+    handle->data = (char *)header + sizeof(struct shm_header);
+    handle->map_length = map_length;
+    handle->mask = capacity - 1;
+    *ring = handle;
+    return 0;
+}
+
+/**
+ * @brief Reserve a record at the head, a record never wraps around (a pad record fills the end of the ring instead).
+ *
+ * @return char* The payload of the record, NULL when the ring is full.
+ */
+static char *reserve_record(at_parser_shm_ring_handle_t ring, uint32_t kind, size_t size)
+{
+    struct shm_header *header = ring->header;
+    unsigned long long head = atomic_load_explicit(&header->head, memory_order_relaxed);
+    const unsigned long long tail = atomic_load_explicit(&header->tail, memory_order_acquire);
+    const uint64_t capacity = ring->mask + 1; // Validated when mapped, the peer can still write the header.
+    const uint64_t needed = record_length(size);
+    const uint64_t contiguous = capacity - (head & ring->mask);
+    const uint64_t pad = needed > contiguous ? contiguous : 0;
+    if (needed > capacity || head + pad + needed - tail > capacity)
+    {
+        atomic_fetch_add_explicit(&header->dropped, 1, memory_order_relaxed);
+        return NULL;
+    }
+    if (pad != 0)
+    {
+        const struct record_header pad_header = {(uint32_t)(pad - sizeof(struct record_header)), RECORD_PAD};
+        memcpy(ring->data + (head & ring->mask), &pad_header, sizeof(pad_header));
+        head += pad;
+    }
+    char *record = ring->data + (head & ring->mask);
+    const struct record_header record_header = {(uint32_t)size, kind};
+    memcpy(record, &record_header, sizeof(record_header));
+    ring->pending_head = head + needed;
+    return record + sizeof(struct record_header);
+}
+
+/**
+ * @brief Publish the reserved record (and the pad record in front of it) to the consumer.
+ *
+ */
+static void commit_record(at_parser_shm_ring_handle_t ring)
+{
+    atomic_store_explicit(&ring->header->head, ring->pending_head, memory_order_release);
+}
+
+static inline uint64_t record_length(size_t size)
+{
+    return sizeof(struct record_header) + (((uint64_t)size + RECORD_ALIGNMENT - 1) & ~(uint64_t)(RECORD_ALIGNMENT - 1));
+}
+
+/**
+ * @brief Fill a message from a record whose length fits the ring, the contents of the payload are checked here.
+ *
+ * @return true The record is a valid message.
+ * @return false The kind is unknown, or the argument table or name don't fit the payload.
+ */
+static bool read_record(const char *record, const struct record_header *record_header, struct at_parser_shm_message *message)
+{
+    memset(message, 0, sizeof(*message));
+    message->kind = (enum at_parser_shm_message_kind)record_header->kind;
+    message->data = record + sizeof(struct record_header);
+    message->length = record_header->size;
+    if (record_header->kind == AT_PARSER_SHM_MESSAGE_RAW)
+    {
+        return true;
+    }
+    if (record_header->kind != AT_PARSER_SHM_MESSAGE_COMMAND || record_header->size < sizeof(struct command_header))
+    {
+        return false;
+    }
+    struct command_header command;
+    memcpy(&command, message->data, sizeof(command));
+    const uint64_t name_offset = sizeof(struct command_header) + (uint64_t)command.argument_count * sizeof(struct argument_entry);
+    if (name_offset + command.name_length + 1 > record_header->size || message->data[name_offset + command.name_length] != '\0')
+    {
+        return false;
+    }
+    message->type = (enum at_parser_command_type)command.type;
+    message->argument_count = command.argument_count;
+    message->command_name = message->data + name_offset;
+    message->command_name_length = command.name_length;
+    return true;
+}
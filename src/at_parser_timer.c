@@ -0,0 +1,322 @@
+/**
+ * @file at_parser_timer.c
+ * @author Giel Willemsen
+ * @brief Implementation of the hierarchical timer wheel.
+ * @version 0.1
+ * @date 2023-06-14
+ *
+ * @copyright See LICENSE
+ *
+ */
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "at_parser/at_parser_timer.h"
+
+#define ROOT_BITS 8
+#define ROOT_SIZE (1u << ROOT_BITS)
+#define ROOT_MASK (ROOT_SIZE - 1)
+#define LEVEL_BITS 6
+#define LEVEL_SIZE (1u << LEVEL_BITS)
+#define LEVEL_MASK (LEVEL_SIZE - 1)
+#define LEVEL_COUNT 3
+#define LEVEL_SHIFT(level) (ROOT_BITS + (level) * LEVEL_BITS)
+
+/**
+ * @brief The wheel, every slot is a circular list with the slot itself as head.
+ * @details The root level has a slot per tick for the next 256 ticks, every next level has a slot per 64 slots of the
+ * level below it. When the root level wraps around, the next slot of the level above is cascaded (re-placed) into
+ * the levels below it, so a timer is moved at most LEVEL_COUNT times before it expires.
+ *
+ */
+struct at_parser_timer_wheel
+{
+    at_parser_clock clock;
+    void *clock_userdata;
+    uint32_t current;       ///< The next tick to expire.
+    size_t armed;
+    size_t root_armed;      ///< The timers in the root level, when there are none the wheel can skip to the next cascade.
+    struct at_parser_timer root[ROOT_SIZE];
+    struct at_parser_timer levels[LEVEL_COUNT][LEVEL_SIZE];
+};
+
+static void init_list(struct at_parser_timer *head);
+static bool is_list_empty(const struct at_parser_timer *head);
+static void link_timer(struct at_parser_timer *head, struct at_parser_timer *timer);
+static void unlink_timer(struct at_parser_timer *timer);
+static void move_list(struct at_parser_timer *from, struct at_parser_timer *to);
+static void place_timer(at_parser_timer_wheel_handle_t wheel, struct at_parser_timer *timer);
+static size_t cascade(at_parser_timer_wheel_handle_t wheel, size_t level);
+static size_t expire_slot(struct at_parser_timer *head);
+
+extern int at_parser_timer_wheel_create(at_parser_timer_wheel_handle_t *wheel, at_parser_clock clock, void *userdata)
+{
+    if (wheel == NULL || clock == NULL)
+    {
+        return -1;
+    }
+    at_parser_timer_wheel_handle_t handle = malloc(sizeof(struct at_parser_timer_wheel));
+    if (handle == NULL)
+    {
+        return -1;
+    }
+    handle->clock = clock;
+    handle->clock_userdata = userdata;
+    handle->current = clock(userdata);
+    handle->armed = 0;
+    handle->root_armed = 0;
+    for (size_t i = 0; i < ROOT_SIZE; i++)
+    {
+        init_list(&handle->root[i]);
+    }
+    for (size_t level = 0; level < LEVEL_COUNT; level++)
+    {
+        for (size_t i = 0; i < LEVEL_SIZE; i++)
+        {
+            init_list(&handle->levels[level][i]);
+        }
+    }
+    *wheel = handle;
+    return 0;
+}
+
+extern void at_parser_timer_wheel_free(at_parser_timer_wheel_handle_t wheel)
+{
+    if (wheel != NULL)
+    {
+        for (size_t i = 0; i < ROOT_SIZE; i++)
+        {
+            while (!is_list_empty(&wheel->root[i]))
+            {
+                at_parser_timer_cancel(wheel->root[i].next);
+            }
+        }
+        for (size_t level = 0; level < LEVEL_COUNT; level++)
+        {
+            for (size_t i = 0; i < LEVEL_SIZE; i++)
+            {
+                while (!is_list_empty(&wheel->levels[level][i]))
+                {
+                    at_parser_timer_cancel(wheel->levels[level][i].next);
+                }
+            }
+        }
+        free(wheel);
+    }
+}
+
+extern size_t at_parser_timer_wheel_advance(at_parser_timer_wheel_handle_t wheel)
+{
+    if (wheel == NULL)
+    {
+        return 0;
+    }
+    const uint32_t now = wheel->clock(wheel->clock_userdata);
+    size_t expired = 0;
+    while ((int32_t)(now - wheel->current) >= 0)
+    {
+        if (wheel->armed == 0)
+        {
+            wheel->current = now + 1;
+            break;
+        }
+        if (wheel->root_armed == 0 && (wheel->current & ROOT_MASK) != 0)
+        {
+            // Nothing expires before the next cascade, so the ticks up to it don't have to be visited.
+            const uint32_t next_cascade = (wheel->current | ROOT_MASK) + 1;
+            if ((int32_t)(now - next_cascade) < 0)
+            {
+                wheel->current = now + 1;
+                break;
+            }
+            wheel->current = next_cascade;
+        }
+        const size_t index = wheel->current & ROOT_MASK;
+        if (index == 0)
+        {
+            for (size_t level = 0; level < LEVEL_COUNT && cascade(wheel, level) == 0; level++)
+            {
+            }
+        }
+        wheel->current++;
+        expired += expire_slot(&wheel->root[index]);
+    }
+    return expired;
+}
+
+extern int at_parser_timer_wheel_get_next_timeout(at_parser_timer_wheel_handle_t wheel, uint32_t *ticks)
+{
+    if (wheel == NULL || ticks == NULL || wheel->armed == 0)
+    {
+        return -1;
+    }
+    // Only the root level is scanned, anything above it is cascaded by the next wrap of the root level at the latest.
+    uint32_t next = (wheel->current | ROOT_MASK) + 1;
+    for (uint32_t offset = 0; wheel->root_armed != 0 && offset < ROOT_SIZE; offset++)
+    {
+        if (!is_list_empty(&wheel->root[(wheel->current + offset) & ROOT_MASK]))
+        {
+            next = wheel->current + offset;
+            break;
+        }
+    }
+    const uint32_t now = wheel->clock(wheel->clock_userdata);
+    *ticks = (int32_t)(next - now) > 0 ? next - now : 0;
+    return 0;
+}
+
+extern size_t at_parser_timer_wheel_get_armed(at_parser_timer_wheel_handle_t wheel)
+{
+    return wheel != NULL ? wheel->armed : 0;
+}
+
+extern void at_parser_timer_init(struct at_parser_timer *timer, at_parser_timer_callback callback, void *userdata)
+{
+    if (timer != NULL)
+    {
+        timer->next = NULL;
+        timer->prev = NULL;
+        timer->wheel = NULL;
+        timer->expires = 0;
+        timer->level = 0;
+        timer->callback = callback;
+        timer->userdata = userdata;
+    }
+}
+
+extern int at_parser_timer_arm(at_parser_timer_wheel_handle_t wheel, struct at_parser_timer *timer, uint32_t timeout)
+{
+    if (wheel == NULL || timer == NULL || timer->callback == NULL)
+    {
+        return -1;
+    }
+    at_parser_timer_cancel(timer);
+    timeout = timeout > AT_PARSER_TIMER_MAX_TIMEOUT ? AT_PARSER_TIMER_MAX_TIMEOUT : timeout;
+    timer->expires = wheel->clock(wheel->clock_userdata) + timeout;
+    timer->wheel = wheel;
+    wheel->armed++;
+    place_timer(wheel, timer);
+    return 0;
+}
+
+extern void at_parser_timer_cancel(struct at_parser_timer *timer)
+{
+    if (timer == NULL || timer->wheel == NULL)
+    {
+        return;
+    }
+    at_parser_timer_wheel_handle_t wheel = timer->wheel;
+    if (timer->level == 0)
+    {
+        wheel->root_armed--;
+    }
+    unlink_timer(timer);
+    timer->wheel = NULL;
+    wheel->armed--;
+}
+
+extern bool at_parser_timer_is_armed(const struct at_parser_timer *timer)
+{
+    return timer != NULL && timer->wheel != NULL;
+}
+
+static void init_list(struct at_parser_timer *head)
+{
+    head->next = head;
+    head->prev = head;
+    head->wheel = NULL;
+}
+
+static bool is_list_empty(const struct at_parser_timer *head)
+{
+    return head->next == head;
+}
+
+static void link_timer(struct at_parser_timer *head, struct at_parser_timer *timer)
+{
+    timer->prev = head->prev;
+    timer->next = head;
+    head->prev->next = timer;
+    head->prev = timer;
+}
+
+static void unlink_timer(struct at_parser_timer *timer)
+{
+    timer->prev->next = timer->next;
+    timer->next->prev = timer->prev;
+    timer->next = NULL;
+    timer->prev = NULL;
+}
+
+static void move_list(struct at_parser_timer *from, struct at_parser_timer *to)
+{
+    init_list(to);
+    if (!is_list_empty(from))
+    {
+        to->next = from->next;
+        to->prev = from->prev;
+        to->next->prev = to;
+        to->prev->next = to;
+        init_list(from);
+    }
+}
+
+static void place_timer(at_parser_timer_wheel_handle_t wheel, struct at_parser_timer *timer)
+{
+    const uint32_t delta = timer->expires - wheel->current;
+    if ((int32_t)delta < (int32_t)ROOT_SIZE)
+    {
+        // Timers that are already due go in the slot of the next tick.
+        const uint32_t slot_time = (int32_t)delta < 0 ? wheel->current : timer->expires;
+        link_timer(&wheel->root[slot_time & ROOT_MASK], timer);
+        timer->level = 0;
+        wheel->root_armed++;
+        return;
+    }
+    size_t level = 0;
+    while (level < LEVEL_COUNT - 1 && delta >= (UINT32_C(1) << LEVEL_SHIFT(level + 1)))
+    {
+        level++;
+    }
+    // The wheel can lag behind the clock, a timer past the top level waits in its last slot and is re-placed from there.
+    const uint32_t slot_time = delta > AT_PARSER_TIMER_MAX_TIMEOUT ? wheel->current + AT_PARSER_TIMER_MAX_TIMEOUT : timer->expires;
+    link_timer(&wheel->levels[level][(slot_time >> LEVEL_SHIFT(level)) & LEVEL_MASK], timer);
+    timer->level = (uint8_t)(level + 1);
+}
+
+/**
+ * @brief Re-place the timers of the current slot of a level, they end up in the levels below it.
+ *
+ * @return size_t The index of the slot, 0 means the level wrapped around and the level above has to cascade as well.
+ */
+static size_t cascade(at_parser_timer_wheel_handle_t wheel, size_t level)
+{
+    const size_t index = (wheel->current >> LEVEL_SHIFT(level)) & LEVEL_MASK;
+    struct at_parser_timer *head = &wheel->levels[level][index];
+    struct at_parser_timer work;
+    move_list(head, &work);
+    while (!is_list_empty(&work))
+    {
+        struct at_parser_timer *timer = work.next;
+        unlink_timer(timer);
+        place_timer(wheel, timer);
+    }
+    return index;
+}
+
+static size_t expire_slot(struct at_parser_timer *head)
+{
+    // The slot is taken as a whole, timers that the callbacks arm again can't end up in the current run.
+    struct at_parser_timer work;
+    move_list(head, &work);
+    size_t expired = 0;
+    while (!is_list_empty(&work))
+    {
+        struct at_parser_timer *timer = work.next;
+        at_parser_timer_cancel(timer);
+        timer->callback(timer, timer->userdata);
+        expired++;
+    }
+    return expired;
+}
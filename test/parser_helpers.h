@@ -54,6 +54,12 @@ extern "C"
         }
         commands.push_back(itm);
     }
+
+    // Response writer that appends to the std::string passed as userdata.
+    static void at_parser_collect_response(at_parser_handle_t, void *userdata, const char *data, size_t length)
+    {
+        static_cast<std::string *>(userdata)->append(data, length);
+    }
 }
 
 #endif // AT_PARSER_TEST_PARSER_HELPERS_H
@@ -0,0 +1,108 @@
+#include "doctest.h"
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include "at_parser/at_parser.h"
+#include "parser_helpers.h"
+
+namespace
+{
+    struct counting_allocator
+    {
+        size_t allocations = 0;
+        size_t deallocations = 0;
+        size_t reallocations = 0;
+        size_t live = 0;
+        size_t budget = SIZE_MAX; ///< Amount of allocations that succeed before the allocator runs out of memory.
+    };
+
+    extern "C" void *counting_allocate(void *context, size_t size)
+    {
+        counting_allocator *allocator = static_cast<counting_allocator *>(context);
+        if (allocator->budget == 0)
+        {
+            return nullptr;
+        }
+        allocator->budget--;
+        allocator->allocations++;
+        allocator->live++;
+        return malloc(size);
+    }
+
+    extern "C" void *counting_reallocate(void *context, void *ptr, size_t size)
+    {
+        counting_allocator *allocator = static_cast<counting_allocator *>(context);
+        if (allocator->budget == 0)
+        {
+            return nullptr;
+        }
+        allocator->budget--;
+        allocator->reallocations++;
+        return realloc(ptr, size);
+    }
+
+    extern "C" void counting_deallocate(void *context, void *ptr)
+    {
+        counting_allocator *allocator = static_cast<counting_allocator *>(context);
+        allocator->deallocations++;
+        allocator->live--;
+        free(ptr);
+    }
+}
+
+TEST_CASE("Test custom allocator")
+{
+    counting_allocator counter;
+    struct at_parser_allocator allocator = {counting_allocate, counting_reallocate, counting_deallocate, &counter};
+    at_parser_handle_t parser = nullptr;
+    commands.clear();
+
+    SUBCASE("Invalid allocator")
+    {
+        struct at_parser_allocator incomplete = {counting_allocate, nullptr, counting_deallocate, &counter};
+        CHECK_NE(0, at_parser_create_with_allocator(&parser, 100, '\x1B', ',', nullptr));
+        CHECK_NE(0, at_parser_create_with_allocator(&parser, 100, '\x1B', ',', &incomplete));
+        CHECK_EQ(0, counter.allocations);
+    }
+    SUBCASE("All allocations go through the allocator")
+    {
+        CHECK_EQ(0, at_parser_create_with_allocator(&parser, 100, '\x1B', ',', &allocator));
+        CHECK_EQ(0, at_parser_add_command_handler(parser, "CMD", at_parser_default_received_command, nullptr));
+        const size_t after_setup = counter.allocations;
+        CHECK_GT(after_setup, 0);
+
+        const std::string input = "AT+CMD=1,\"two\",3\r\nAT+CMD?\r\n";
+        CHECK_EQ(0, at_parser_process_buffer(parser, input.data(), input.size()));
+        REQUIRE_EQ(2, commands.size());
+        CHECK_EQ(3, commands[0].arguments.size());
+        CHECK_GT(counter.allocations, after_setup);
+        CHECK_GT(counter.reallocations, 0);
+
+        CHECK_EQ(0, at_parser_remove_command_handler(parser, "CMD", at_parser_default_received_command));
+        at_parser_free(parser);
+        CHECK_EQ(0, counter.live);
+        CHECK_EQ(counter.allocations, counter.deallocations);
+    }
+    SUBCASE("Running out of memory")
+    {
+        for (size_t budget = 0; budget < 8; budget++)
+        {
+            counter = counting_allocator();
+            counter.budget = budget;
+            commands.clear();
+            if (at_parser_create_with_allocator(&parser, 100, '\x1B', ',', &allocator) != 0)
+            {
+                CHECK_EQ(0, counter.live);
+                continue;
+            }
+            if (at_parser_add_command_handler(parser, "CMD", at_parser_default_received_command, nullptr) == 0)
+            {
+                const std::string input = "AT+CMD=1,2,3\r\nAT+CMD\r\n";
+                CHECK_EQ(0, at_parser_process_buffer(parser, input.data(), input.size()));
+                CHECK_LE(commands.size(), 2);
+            }
+            at_parser_free(parser);
+            CHECK_EQ(0, counter.live);
+        }
+    }
+}
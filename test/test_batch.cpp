@@ -0,0 +1,144 @@
+#include "doctest.h"
+#include <string.h>
+#include <string>
+#include <vector>
+#include "at_parser/at_parser.h"
+#include "parser_helpers.h"
+
+namespace
+{
+    struct batch_log
+    {
+        std::vector<std::vector<Command>> batches;
+        std::string output;
+    };
+
+    extern "C" void collect_batch(at_parser_handle_t, void *userdata, struct at_parser_command_record *records, size_t record_count)
+    {
+        batch_log *log = static_cast<batch_log *>(userdata);
+        std::vector<Command> batch;
+        for (size_t i = 0; i < record_count; i++)
+        {
+            Command command(records[i].type, std::string(records[i].command_name, records[i].command_name_length), nullptr);
+            for (size_t j = 0; j < records[i].argument_list_length; j++)
+            {
+                command.arguments.push_back(std::string(records[i].argument_list[j].value, records[i].argument_list[j].length));
+            }
+            if (command.command == "CSQ")
+            {
+                records[i].response = "+CSQ: 20,99\r\n";
+                records[i].response_length = 13;
+                records[i].result = AT_PARSER_BATCH_RESULT_OK;
+            }
+            else if (command.command == "FAIL")
+            {
+                records[i].result = AT_PARSER_BATCH_RESULT_ERROR;
+            }
+            batch.push_back(command);
+        }
+        log->batches.push_back(batch);
+    }
+}
+
+TEST_CASE("Test batched dispatch")
+{
+    at_parser_handle_t parser = nullptr;
+    batch_log log;
+    commands.clear();
+    CHECK_EQ(0, at_parser_create(&parser, 64, '\x1B', ','));
+    CHECK_EQ(0, at_parser_add_command_handler(parser, "CSQ", at_parser_default_received_command, nullptr));
+    CHECK_EQ(0, at_parser_set_response_writer(parser, at_parser_collect_response, &log.output));
+
+    const std::string input = "AT+CSQ\r\nAT+SET=1,\"a,b\"\r\nAT+FAIL=?\r\nAT+NOANSWER\r\nAT+CSQ";
+
+    SUBCASE("All commands of a call in one batch")
+    {
+        CHECK_EQ(0, at_parser_set_batch_handler(parser, collect_batch, &log, 0));
+        CHECK_EQ(0, at_parser_process_buffer(parser, input.data(), input.size()));
+        CHECK(commands.empty());
+        REQUIRE_EQ(1, log.batches.size());
+        const std::vector<Command> &batch = log.batches[0];
+        REQUIRE_EQ(4, batch.size());
+        CHECK_EQ("CSQ", batch[0].command);
+        CHECK_EQ(AT_PARSER_COMMAND_TYPE_EXECUTE, batch[0].type);
+        CHECK_EQ("SET", batch[1].command);
+        CHECK_EQ(AT_PARSER_COMMAND_TYPE_SET, batch[1].type);
+        REQUIRE_EQ(2, batch[1].arguments.size());
+        CHECK_EQ("1", batch[1].arguments[0]);
+        CHECK_EQ("a,b", batch[1].arguments[1]);
+        CHECK_EQ("FAIL", batch[2].command);
+        CHECK_EQ("NOANSWER", batch[3].command);
+        CHECK_EQ("+CSQ: 20,99\r\nOK\r\nERROR\r\n", log.output);
+
+        // The unfinished line is part of the next call.
+        CHECK_EQ(0, at_parser_process_buffer(parser, "\r\n", 2));
+        REQUIRE_EQ(2, log.batches.size());
+        REQUIRE_EQ(1, log.batches[1].size());
+        CHECK_EQ("CSQ", log.batches[1][0].command);
+
+        // Nothing parsed, no batch.
+        CHECK_EQ(0, at_parser_process_buffer(parser, "AT", 2));
+        CHECK_EQ(2, log.batches.size());
+    }
+    SUBCASE("Limited batch size")
+    {
+        CHECK_EQ(0, at_parser_set_batch_handler(parser, collect_batch, &log, 3));
+        for (char c : input + "\r\n")
+        {
+            CHECK_EQ(0, at_parser_process_buffer(parser, &c, 1));
+        }
+        CHECK_EQ(5, log.batches.size());
+        log.batches.clear();
+        const std::string twice = input + "\r\n" + input + "\r\n";
+        CHECK_EQ(0, at_parser_process_buffer(parser, twice.data(), twice.size()));
+        REQUIRE_EQ(4, log.batches.size());
+        CHECK_EQ(3, log.batches[0].size());
+        CHECK_EQ(3, log.batches[1].size());
+        CHECK_EQ(3, log.batches[2].size());
+        CHECK_EQ(1, log.batches[3].size());
+        CHECK_EQ("SET", log.batches[2][0].command);
+        CHECK_EQ("a,b", log.batches[2][0].arguments.at(1));
+    }
+    SUBCASE("Binary frames and the ingest buffer")
+    {
+        at_parser_registry_handle_t registry = nullptr;
+        CHECK_EQ(0, at_parser_registry_create(&registry));
+        CHECK_EQ(0, at_parser_registry_add_command_handler(registry, "CSQ", at_parser_default_received_command, nullptr));
+        CHECK_EQ(0, at_parser_registry_freeze(registry));
+        CHECK_EQ(0, at_parser_attach_registry(parser, registry));
+        CHECK_EQ(0, at_parser_set_binary_framing(parser, true));
+        CHECK_EQ(0, at_parser_set_batch_handler(parser, collect_batch, &log, 0));
+
+        uint16_t id = 0;
+        CHECK_EQ(0, at_parser_registry_get_command_id(registry, "CSQ", &id));
+        struct at_parser_argument argument = {"raw", 3};
+        char frame[32];
+        size_t frame_length = 0;
+        CHECK_EQ(0, at_parser_encode_binary_frame(frame, sizeof(frame), id, AT_PARSER_COMMAND_TYPE_SET, &argument, 1, &frame_length));
+        const std::string stream = std::string(frame, frame_length) + "AT+SET=2\r\n";
+
+        char *buffer = nullptr;
+        size_t available = 0;
+        CHECK_EQ(0, at_parser_get_ingest_buffer(parser, &buffer, &available));
+        REQUIRE(available >= stream.size());
+        memcpy(buffer, stream.data(), stream.size());
+        CHECK_EQ(0, at_parser_commit_ingest(parser, stream.size()));
+        CHECK(commands.empty());
+        REQUIRE_EQ(1, log.batches.size());
+        REQUIRE_EQ(2, log.batches[0].size());
+        CHECK_EQ("CSQ", log.batches[0][0].command);
+        CHECK_EQ("raw", log.batches[0][0].arguments.at(0));
+        CHECK_EQ("SET", log.batches[0][1].command);
+
+        CHECK_EQ(0, at_parser_set_batch_handler(parser, nullptr, nullptr, 0));
+        CHECK_EQ(0, at_parser_process_buffer(parser, "AT+CSQ\r\n", 8));
+        CHECK_EQ(2, commands.size()); // Registry and parser handler.
+        CHECK_EQ(1, log.batches.size());
+
+        at_parser_free(parser);
+        parser = nullptr;
+        at_parser_registry_free(registry);
+    }
+
+    at_parser_free(parser);
+}
@@ -0,0 +1,125 @@
+#include "doctest.h"
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "at_parser/at_parser.h"
+#include "parser_helpers.h"
+
+namespace
+{
+    std::string encode(uint16_t id, at_parser_command_type type, const std::vector<std::string> &arguments)
+    {
+        std::vector<at_parser_argument> list;
+        for (const std::string &argument : arguments)
+        {
+            list.push_back({argument.data(), argument.size()});
+        }
+        char frame[256];
+        size_t frame_length = 0;
+        CHECK_EQ(0, at_parser_encode_binary_frame(frame, sizeof(frame), id, type, list.data(), list.size(), &frame_length));
+        return std::string(frame, frame_length);
+    }
+}
+
+TEST_CASE("Test binary command framing")
+{
+    at_parser_registry_handle_t registry = nullptr;
+    at_parser_handle_t parser = nullptr;
+    commands.clear();
+    CHECK_EQ(0, at_parser_registry_create(&registry));
+    CHECK_EQ(0, at_parser_registry_add_command_handler(registry, "SEND", at_parser_default_received_command, (void *)0x0010));
+    CHECK_EQ(0, at_parser_registry_add_command_handler(registry, "CSQ", at_parser_default_received_command, (void *)0x0020));
+    CHECK_EQ(0, at_parser_registry_freeze(registry));
+    CHECK_EQ(0, at_parser_create(&parser, 64, '\x1B', ','));
+    CHECK_EQ(0, at_parser_attach_registry(parser, registry));
+    CHECK_EQ(0, at_parser_add_command_handler(parser, "SEND", at_parser_default_received_command, (void *)0x0030));
+
+    uint16_t send_id = 0;
+    uint16_t csq_id = 0;
+    CHECK_EQ(0, at_parser_registry_get_command_id(registry, "SEND", &send_id));
+    CHECK_EQ(0, at_parser_registry_get_command_id(registry, "CSQ", &csq_id));
+    CHECK_NE(send_id, csq_id);
+    CHECK_NE(0, at_parser_registry_get_command_id(registry, "UNKNOWN", &send_id));
+
+    // Arguments are passed as is, separators, quotes and line ends included.
+    const std::string stream = "AT+CSQ\r\n" + encode(send_id, AT_PARSER_COMMAND_TYPE_SET, {"1", "\"a,b\"\r\n", ""}) +
+                               encode(csq_id, AT_PARSER_COMMAND_TYPE_QUERY, {}) + encode(1000, AT_PARSER_COMMAND_TYPE_EXECUTE, {"x"}) +
+                               "AT+SEND=2\r\n";
+
+    SUBCASE("Binary frames are ignored unless enabled")
+    {
+        CHECK_EQ(0, at_parser_process_buffer(parser, stream.data(), stream.size()));
+        REQUIRE_EQ(1, commands.size());
+        CHECK_EQ("CSQ", commands[0].command);
+    }
+    SUBCASE("Mixed with text lines")
+    {
+        CHECK_EQ(0, at_parser_set_binary_framing(parser, true));
+        std::vector<size_t> chunk_sizes = {1, 7, stream.size()};
+        for (size_t chunk_size : chunk_sizes)
+        {
+            commands.clear();
+            for (size_t i = 0; i < stream.size(); i += chunk_size)
+            {
+                CHECK_EQ(0, at_parser_process_buffer(parser, stream.data() + i, std::min(chunk_size, stream.size() - i)));
+            }
+            REQUIRE_EQ(6, commands.size());
+            CHECK_EQ("CSQ", commands[0].command);
+            CHECK_EQ(AT_PARSER_COMMAND_TYPE_EXECUTE, commands[0].type);
+            for (size_t j = 1; j <= 2; j++)
+            {
+                CHECK_EQ("SEND", commands[j].command);
+                CHECK_EQ(AT_PARSER_COMMAND_TYPE_SET, commands[j].type);
+                REQUIRE_EQ(3, commands[j].arguments.size());
+                CHECK_EQ("1", commands[j].arguments[0]);
+                CHECK_EQ("\"a,b\"\r\n", commands[j].arguments[1]);
+                CHECK_EQ("", commands[j].arguments[2]);
+            }
+            CHECK_EQ((void *)0x0010, commands[1].userdata);
+            CHECK_EQ((void *)0x0030, commands[2].userdata);
+            CHECK_EQ("CSQ", commands[3].command);
+            CHECK_EQ(AT_PARSER_COMMAND_TYPE_QUERY, commands[3].type);
+            CHECK_EQ("SEND", commands[4].command);
+            REQUIRE_EQ(1, commands[4].arguments.size());
+            CHECK_EQ("2", commands[4].arguments[0]);
+        }
+    }
+    SUBCASE("Frames that don't fit the buffer are dropped")
+    {
+        CHECK_EQ(0, at_parser_set_binary_framing(parser, true));
+        const std::string large = encode(send_id, AT_PARSER_COMMAND_TYPE_SET, {std::string(100, 'x')}) + "\r\nAT+CSQ\r\n";
+        CHECK_EQ(0, at_parser_process_buffer(parser, large.data(), large.size()));
+        REQUIRE_EQ(1, commands.size());
+        CHECK_EQ("CSQ", commands[0].command);
+    }
+    SUBCASE("Frames grow the buffer under a buffer policy")
+    {
+        CHECK_EQ(0, at_parser_set_binary_framing(parser, true));
+        struct at_parser_buffer_policy policy = {64, 128, 2};
+        CHECK_EQ(0, at_parser_set_buffer_policy(parser, &policy));
+        const std::string large = encode(send_id, AT_PARSER_COMMAND_TYPE_SET, {std::string(100, 'x')});
+        for (char chr : large)
+        {
+            CHECK_EQ(0, at_parser_process_buffer(parser, &chr, 1));
+        }
+        CHECK_EQ(128, at_parser_get_buffer_size(parser));
+        CHECK_EQ(0, at_parser_process_buffer(parser, large.data(), large.size()));
+        REQUIRE_EQ(4, commands.size()); // Registry and callback handler for both frames.
+        CHECK_EQ(std::string(100, 'x'), commands[3].arguments[0]);
+
+        // The frames count as long lines, so the buffer only shrinks once a window without them passed.
+        CHECK_EQ(0, at_parser_process_buffer(parser, "AT+CSQ\r\n", 8));
+        CHECK_EQ(128, at_parser_get_buffer_size(parser));
+        CHECK_EQ(0, at_parser_process_buffer(parser, "AT+CSQ\r\nAT+CSQ\r\n", 16));
+        CHECK_EQ(64, at_parser_get_buffer_size(parser));
+
+        const std::string too_large = encode(send_id, AT_PARSER_COMMAND_TYPE_SET, {std::string(150, 'x')}) + "\r\nAT+CSQ\r\n";
+        CHECK_EQ(0, at_parser_process_buffer(parser, too_large.data(), too_large.size()));
+        CHECK_EQ("CSQ", commands.back().command);
+        CHECK_EQ(8, commands.size());
+    }
+
+    at_parser_free(parser);
+    at_parser_registry_free(registry);
+}
@@ -0,0 +1,148 @@
+#include "doctest.h"
+#include <string.h>
+#include <string>
+#include <vector>
+#include "at_parser/at_parser.h"
+#include "at_parser/at_parser_output.h"
+#include "parser_helpers.h"
+
+namespace
+{
+    struct body_log
+    {
+        std::string body;
+        std::vector<enum at_parser_body_event> events;
+        size_t chunks = 0;
+        size_t max_length = 0;
+        std::string output;
+    };
+
+    body_log body_state;
+
+    extern "C" void collect_body(at_parser_handle_t parser, void *, enum at_parser_body_event event, const char *data, size_t length)
+    {
+        if (event == AT_PARSER_BODY_DATA)
+        {
+            body_state.body.append(data, length);
+            body_state.chunks++;
+            return;
+        }
+        body_state.events.push_back(event);
+        if (event == AT_PARSER_BODY_END)
+        {
+            at_parser_write_response(parser, "+CMGS: 1\r\nOK\r\n", 14);
+        }
+    }
+
+    extern "C" void handle_cmgs(at_parser_handle_t parser, void *userdata, const char *command_name, enum at_parser_command_type type, struct at_parser_argument *argument_list, size_t argument_list_length)
+    {
+        at_parser_default_received_command(parser, userdata, command_name, type, argument_list, argument_list_length);
+        at_parser_enter_body_mode(parser, collect_body, nullptr, body_state.max_length);
+    }
+
+    extern "C" size_t write_body_link(at_parser_output_handle_t, void *, const char *data, size_t length)
+    {
+        body_state.output.append(data, length);
+        return length;
+    }
+}
+
+TEST_CASE("Test body mode")
+{
+    body_state = body_log();
+    commands.clear();
+    at_parser_handle_t parser = nullptr;
+    CHECK_EQ(0, at_parser_create(&parser, 32, '\\', ','));
+    CHECK_EQ(0, at_parser_set_response_writer(parser, at_parser_collect_response, &body_state.output));
+    CHECK_EQ(0, at_parser_add_command_handler(parser, "CMGS", handle_cmgs, nullptr));
+    CHECK_EQ(0, at_parser_add_command_handler(parser, "CSQ", at_parser_default_received_command, nullptr));
+
+    SUBCASE("Body in one buffer")
+    {
+        const std::string input = "AT+CMGS=\"+31600000000\"\r\nHello\r\nAT+CSQ\r\nworld\x1A" "AT+CSQ\r\n";
+        CHECK_EQ(0, at_parser_process_buffer(parser, input.data(), input.size()));
+        CHECK_EQ("Hello\r\nAT+CSQ\r\nworld", body_state.body);
+        REQUIRE_EQ(1, body_state.events.size());
+        CHECK_EQ(AT_PARSER_BODY_END, body_state.events[0]);
+        REQUIRE_EQ(2, commands.size());
+        CHECK_EQ("CMGS", commands[0].command);
+        CHECK_EQ("CSQ", commands[1].command);
+        CHECK_EQ("\r\n> +CMGS: 1\r\nOK\r\n", body_state.output);
+        CHECK_FALSE(at_parser_is_in_body_mode(parser));
+    }
+    SUBCASE("Body longer than the buffer, fed byte by byte")
+    {
+        std::string text;
+        for (int i = 0; i < 200; i++)
+        {
+            text += (char)('a' + i % 26);
+        }
+        const std::string input = "AT+CMGS=1\r\n" + text + "\x1A" + "AT+CSQ\r\n";
+        for (char chr : input)
+        {
+            CHECK_EQ(0, at_parser_process_buffer(parser, &chr, 1));
+        }
+        CHECK_EQ(text, body_state.body);
+        REQUIRE_EQ(1, body_state.events.size());
+        CHECK_EQ(AT_PARSER_BODY_END, body_state.events[0]);
+        REQUIRE_EQ(2, commands.size());
+        CHECK_EQ("CSQ", commands[1].command);
+    }
+    SUBCASE("Body with the zero copy ingest buffer")
+    {
+        const std::string input = "AT+CMGS=1\r\nab\x1B" "AT+CSQ\r\n";
+        char *buffer = nullptr;
+        size_t available = 0;
+        REQUIRE_EQ(0, at_parser_get_ingest_buffer(parser, &buffer, &available));
+        REQUIRE(available >= input.size());
+        memcpy(buffer, input.data(), input.size());
+        CHECK_EQ(0, at_parser_commit_ingest(parser, input.size()));
+        CHECK_EQ("ab", body_state.body);
+        REQUIRE_EQ(1, body_state.events.size());
+        CHECK_EQ(AT_PARSER_BODY_CANCEL, body_state.events[0]);
+        REQUIRE_EQ(2, commands.size());
+        CHECK_EQ("CSQ", commands[1].command);
+    }
+    SUBCASE("Size limit")
+    {
+        body_state.max_length = 4;
+        const std::string input = "AT+CMGS=1\r\nabc";
+        CHECK_EQ(0, at_parser_process_buffer(parser, input.data(), input.size()));
+        CHECK_EQ(0, at_parser_process_buffer(parser, "defAT+CSQ\r\n", 11));
+        CHECK(body_state.events.empty());
+        CHECK_EQ(0, at_parser_process_buffer(parser, "\x1A" "AT+CSQ\r\n", 9));
+        CHECK_EQ("abcd", body_state.body);
+        REQUIRE_EQ(1, body_state.events.size());
+        CHECK_EQ(AT_PARSER_BODY_OVERFLOW, body_state.events[0]);
+        REQUIRE_EQ(2, commands.size()); // The AT+CSQ inside the body was dropped.
+        CHECK_EQ("CSQ", commands[1].command);
+    }
+    SUBCASE("Prompt through the output scheduler")
+    {
+        struct at_parser_output_config config = {};
+        config.queue_size = 64;
+        config.urc_queue_size = 64;
+        config.writer = write_body_link;
+        at_parser_output_handle_t output = nullptr;
+        REQUIRE_EQ(0, at_parser_output_create(&output, &config));
+        CHECK_EQ(0, at_parser_output_attach(output, parser));
+        CHECK_EQ(0, at_parser_process_buffer(parser, "AT+CMGS=1\r\n", 11));
+        CHECK_EQ("\r\n> ", body_state.output);
+        // The prompt closed the response, so URCs aren't held back while the body arrives.
+        CHECK_EQ(0, at_parser_output_send_urc(output, "+CMTI: \"SM\",1\r\n", 15));
+        CHECK_EQ("\r\n> +CMTI: \"SM\",1\r\n", body_state.output);
+        CHECK_EQ(0, at_parser_process_buffer(parser, "text\x1A", 5));
+        CHECK_EQ("text", body_state.body);
+        CHECK_EQ("\r\n> +CMTI: \"SM\",1\r\n+CMGS: 1\r\nOK\r\n", body_state.output);
+        at_parser_output_free(output);
+    }
+    SUBCASE("Not in batch mode")
+    {
+        CHECK_EQ(0, at_parser_set_batch_handler(parser, [](at_parser_handle_t, void *, struct at_parser_command_record *, size_t) {}, nullptr, 0));
+        CHECK_NE(0, at_parser_enter_body_mode(parser, collect_body, nullptr, 0));
+        CHECK_NE(0, at_parser_enter_body_mode(nullptr, collect_body, nullptr, 0));
+        CHECK_FALSE(at_parser_is_in_body_mode(parser));
+    }
+
+    at_parser_free(parser);
+}
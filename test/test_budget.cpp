@@ -0,0 +1,94 @@
+#include "doctest.h"
+#include <string.h>
+#include <string>
+#include <vector>
+#include "at_parser/at_parser.h"
+#include "parser_helpers.h"
+
+namespace
+{
+    uint32_t clock_ticks = 0;
+
+    extern "C" uint32_t fake_clock(void *)
+    {
+        return clock_ticks;
+    }
+
+    extern "C" void slow_command(at_parser_handle_t parser, void *userdata, const char *command_name, enum at_parser_command_type type, struct at_parser_argument *argument_list, size_t argument_list_length)
+    {
+        at_parser_default_received_command(parser, userdata, command_name, type, argument_list, argument_list_length);
+        clock_ticks += 10;
+    }
+}
+
+TEST_CASE("Test budgeted processing")
+{
+    at_parser_handle_t handle = nullptr;
+    commands.clear();
+    CHECK_EQ(0, at_parser_create(&handle, 100, '\x1B', ','));
+    CHECK_EQ(0, at_parser_add_command_handler(handle, "ABC", slow_command, NULL));
+    const char *buffer = "AT+ABC=1\r\nAT+ABC=2\r\nAT+ABC=3\r\n";
+    struct at_parser_budget budget = {};
+    size_t consumed = 0;
+
+    SUBCASE("Line budget on unbuffered data")
+    {
+        budget.max_lines = 2;
+        CHECK_EQ(0, at_parser_process_buffer_budgeted(handle, buffer, strlen(buffer), &budget, &consumed));
+        CHECK_EQ(20, consumed);
+        CHECK_EQ(2, commands.size());
+        CHECK_FALSE(at_parser_has_pending_lines(handle));
+
+        CHECK_EQ(0, at_parser_process_buffer_budgeted(handle, buffer + consumed, strlen(buffer) - consumed, &budget, &consumed));
+        CHECK_EQ(10, consumed);
+        CHECK_EQ(3, commands.size());
+        CHECK_EQ(std::string("3"), commands[2].arguments[0]);
+    }
+
+    SUBCASE("Line budget on buffered data resumes the pending lines")
+    {
+        CHECK_EQ(0, at_parser_process_buffer(handle, "AT+AB", 5));
+        budget.max_lines = 1;
+        CHECK_EQ(0, at_parser_process_buffer_budgeted(handle, "C=0\r\n", 5, &budget, &consumed));
+        CHECK_EQ(5, consumed);
+        CHECK_EQ(1, commands.size());
+
+        CHECK_EQ(0, at_parser_process_buffer(handle, "AT+ABC=1\r\nAT+ABC=2\r\n", 20));
+        CHECK_EQ(3, commands.size());
+        CHECK_EQ(0, at_parser_process_buffer(handle, "AT+", 3));
+        CHECK_EQ(0, at_parser_process_buffer_budgeted(handle, "ABC=3\r\nAT+ABC=4\r\n", 17, &budget, &consumed));
+        CHECK_EQ(17, consumed);
+        CHECK_EQ(4, commands.size());
+        CHECK(at_parser_has_pending_lines(handle));
+
+        CHECK_EQ(0, at_parser_process_buffer_budgeted(handle, NULL, 0, &budget, &consumed));
+        CHECK_EQ(0, consumed);
+        CHECK_EQ(5, commands.size());
+        CHECK_EQ(std::string("4"), commands[4].arguments[0]);
+        CHECK_FALSE(at_parser_has_pending_lines(handle));
+    }
+
+    SUBCASE("Byte budget")
+    {
+        budget.max_bytes = 15;
+        CHECK_EQ(0, at_parser_process_buffer_budgeted(handle, buffer, strlen(buffer), &budget, &consumed));
+        CHECK_EQ(15, consumed);
+        CHECK_EQ(1, commands.size());
+        CHECK_EQ(0, at_parser_process_buffer_budgeted(handle, buffer + 15, strlen(buffer) - 15, &budget, &consumed));
+        CHECK_EQ(15, consumed);
+        CHECK_EQ(3, commands.size());
+    }
+
+    SUBCASE("Deadline from the clock hook")
+    {
+        clock_ticks = UINT32_MAX - 5; // The deadline has to survive the clock wrapping around.
+        CHECK_EQ(0, at_parser_set_clock(handle, fake_clock, NULL));
+        budget.use_deadline = true;
+        budget.deadline = clock_ticks + 15;
+        CHECK_EQ(0, at_parser_process_buffer_budgeted(handle, buffer, strlen(buffer), &budget, &consumed));
+        CHECK_EQ(2, commands.size());
+        CHECK_EQ(20, consumed);
+    }
+
+    at_parser_free(handle);
+}
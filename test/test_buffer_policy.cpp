@@ -0,0 +1,117 @@
+#include "doctest.h"
+#include <string.h>
+#include <string>
+#include "at_parser/at_parser.h"
+#include "parser_helpers.h"
+
+namespace
+{
+    void feed_policy_bytes(at_parser_handle_t parser, const std::string &input)
+    {
+        for (char chr : input)
+        {
+            CHECK_EQ(0, at_parser_process_buffer(parser, &chr, 1));
+        }
+    }
+}
+
+TEST_CASE("Test adaptive buffer size")
+{
+    commands.clear();
+    at_parser_handle_t parser = nullptr;
+    CHECK_EQ(0, at_parser_create(&parser, 16, '\\', ','));
+    CHECK_EQ(0, at_parser_add_command_handler(parser, "CSQ", at_parser_default_received_command, nullptr));
+    CHECK_EQ(0, at_parser_add_command_handler(parser, "CMGS", at_parser_default_received_command, nullptr));
+    const std::string long_line = "AT+CMGS=\"" + std::string(90, 'a') + "\"\r\n";
+
+    SUBCASE("Fixed size by default")
+    {
+        feed_policy_bytes(parser, long_line + "AT+CSQ\r\n");
+        CHECK_EQ(16, at_parser_get_buffer_size(parser));
+        REQUIRE_EQ(1, commands.size());
+        CHECK_EQ("CSQ", commands[0].command);
+    }
+    SUBCASE("Grow and shrink")
+    {
+        struct at_parser_buffer_policy policy = {16, 256, 4};
+        CHECK_EQ(0, at_parser_set_buffer_policy(parser, &policy));
+        feed_policy_bytes(parser, long_line);
+        CHECK_EQ(128, at_parser_get_buffer_size(parser));
+        REQUIRE_EQ(1, commands.size());
+        REQUIRE_EQ(1, commands[0].arguments.size());
+        CHECK_EQ(std::string(90, 'a'), commands[0].arguments[0]);
+
+        feed_policy_bytes(parser, "AT+CSQ\r\nAT+CSQ\r\nAT+CSQ\r\n"); // Together with the long line these are the first 4 lines.
+        CHECK_EQ(128, at_parser_get_buffer_size(parser));
+        feed_policy_bytes(parser, "AT+CSQ\r\nAT+CSQ\r\nAT+CSQ\r\n");
+        CHECK_EQ(128, at_parser_get_buffer_size(parser));
+        feed_policy_bytes(parser, "AT+CSQ\r\n");
+        CHECK_EQ(16, at_parser_get_buffer_size(parser)); // A 6 byte line and its line end fit a quarter of 32, not of 16.
+        CHECK_EQ(8, commands.size());
+
+        // Lines that don't fit the maximum are still dropped.
+        const std::string too_long = "AT+CMGS=\"" + std::string(300, 'b') + "\"\r\nAT+CSQ\r\n";
+        CHECK_EQ(0, at_parser_process_buffer(parser, too_long.data(), too_long.size()));
+        CHECK_EQ(256, at_parser_get_buffer_size(parser));
+        CHECK_EQ(9, commands.size());
+        CHECK_EQ("CSQ", commands.back().command);
+    }
+    SUBCASE("Zero copy ingest grows the buffer")
+    {
+        struct at_parser_buffer_policy policy = {8, 64, 0};
+        CHECK_EQ(0, at_parser_set_buffer_policy(parser, &policy));
+        const std::string input = "AT+CMGS=\"0123456789012345678901234567890123456789\"\r\n";
+        size_t offset = 0;
+        while (offset < input.size())
+        {
+            char *buffer = nullptr;
+            size_t available = 0;
+            REQUIRE_EQ(0, at_parser_get_ingest_buffer(parser, &buffer, &available));
+            const size_t length = available < input.size() - offset ? available : input.size() - offset;
+            memcpy(buffer, input.data() + offset, length);
+            CHECK_EQ(0, at_parser_commit_ingest(parser, length));
+            offset += length;
+        }
+        CHECK_EQ(64, at_parser_get_buffer_size(parser));
+        CHECK_EQ(1, commands.size());
+    }
+    SUBCASE("Policy limits")
+    {
+        struct at_parser_buffer_policy policy = {0, 64, 0};
+        CHECK_NE(0, at_parser_set_buffer_policy(parser, &policy));
+        policy = {128, 64, 0};
+        CHECK_NE(0, at_parser_set_buffer_policy(parser, &policy));
+        policy = {32, 64, 0};
+        CHECK_EQ(0, at_parser_set_buffer_policy(parser, &policy));
+        CHECK_EQ(32, at_parser_get_buffer_size(parser));
+        CHECK_EQ(0, at_parser_set_buffer_policy(parser, nullptr));
+        CHECK_EQ(0, at_parser_get_buffer_size(nullptr));
+    }
+
+    at_parser_free(parser);
+}
+
+TEST_CASE("Test line length histogram")
+{
+    at_parser_handle_t parser = nullptr;
+    CHECK_EQ(0, at_parser_create(&parser, 64, '\\', ','));
+    const std::string input = "\r\nA\r\nAT\r\nAT+CSQ\r\nAT+CFUN=1\r\n" + std::string(40, 'x') + "\r\n";
+    CHECK_EQ(0, at_parser_process_buffer(parser, input.data(), input.size()));
+
+    struct at_parser_line_histogram histogram;
+    CHECK_EQ(0, at_parser_get_line_histogram(parser, &histogram));
+    CHECK_EQ(2, histogram.counts[0]); // 0 and 1
+    CHECK_EQ(1, histogram.counts[1]); // 2
+    CHECK_EQ(1, histogram.counts[2]); // 6
+    CHECK_EQ(1, histogram.counts[3]); // 10
+    CHECK_EQ(1, histogram.counts[5]); // 40
+    CHECK_EQ(40, histogram.longest);
+
+    CHECK_EQ(0, at_parser_clear_line_histogram(parser));
+    CHECK_EQ(0, at_parser_get_line_histogram(parser, &histogram));
+    CHECK_EQ(0, histogram.counts[0]);
+    CHECK_EQ(0, histogram.longest);
+    CHECK_NE(0, at_parser_get_line_histogram(parser, nullptr));
+
+    at_parser_free(parser);
+}
@@ -0,0 +1,192 @@
+#include "doctest.h"
+#include <string.h>
+#include <string>
+#include <vector>
+#include "at_parser/at_parser.h"
+#include "at_parser/at_parser_cache.h"
+#include "parser_helpers.h"
+
+namespace
+{
+    uint32_t cache_ticks = 0;
+    int handler_calls = 0;
+    at_parser_cache_handle_t active_cache = nullptr;
+    at_parser_cache_ticket_t ticket = nullptr;
+
+    extern "C" uint32_t cache_clock(void *)
+    {
+        return cache_ticks;
+    }
+
+    extern "C" void signal_quality(at_parser_handle_t parser, void *, const char *, enum at_parser_command_type type, struct at_parser_argument *argument_list, size_t argument_list_length)
+    {
+        handler_calls++;
+        std::string response = "+CSQ: " + std::to_string(handler_calls);
+        if (type == AT_PARSER_COMMAND_TYPE_SET && argument_list_length > 0)
+        {
+            response += "," + std::string(argument_list[0].value, argument_list[0].length);
+        }
+        response += "\r\nOK\r\n";
+        CHECK_EQ(0, at_parser_write_response(parser, response.c_str(), response.size()));
+    }
+
+    extern "C" void slow_lookup(at_parser_handle_t parser, void *, const char *, enum at_parser_command_type, struct at_parser_argument *, size_t)
+    {
+        handler_calls++;
+        CHECK_EQ(0, at_parser_write_response(parser, "+SLOW: ", 7));
+        ticket = at_parser_cache_defer(active_cache);
+        CHECK_NE(nullptr, ticket);
+    }
+}
+
+TEST_CASE("Test response cache")
+{
+    at_parser_cache_handle_t cache = nullptr;
+    at_parser_handle_t first = nullptr;
+    at_parser_handle_t second = nullptr;
+    std::string first_output;
+    std::string second_output;
+    cache_ticks = 0;
+    handler_calls = 0;
+    ticket = nullptr;
+
+    CHECK_EQ(0, at_parser_cache_create(&cache, 4, cache_clock, NULL));
+    active_cache = cache;
+    CHECK_EQ(0, at_parser_cache_add_command(cache, "CSQ", signal_quality, NULL, 100));
+    CHECK_EQ(0, at_parser_cache_add_command(cache, "SLOW", slow_lookup, NULL, 100));
+    CHECK_NE(0, at_parser_cache_add_command(cache, "CSQ", signal_quality, NULL, 100));
+    CHECK_EQ(0, at_parser_cache_set_static_response(cache, "CSQ", AT_PARSER_COMMAND_TYPE_QUERY, "+CSQ: (0-31),(0-7)\r\nOK\r\n", 24));
+    CHECK_EQ(0, at_parser_create(&first, 50, '\x1B', ','));
+    CHECK_EQ(0, at_parser_create(&second, 50, '\x1B', ','));
+    CHECK_EQ(0, at_parser_set_response_writer(first, at_parser_collect_response, &first_output));
+    CHECK_EQ(0, at_parser_set_response_writer(second, at_parser_collect_response, &second_output));
+    CHECK_EQ(0, at_parser_cache_attach_parser(cache, first));
+    CHECK_EQ(0, at_parser_cache_attach_parser(cache, second));
+    struct at_parser_cache_stats stats = {};
+
+    SUBCASE("Responses are served until the time to live passes")
+    {
+        const char *buffer = "AT+CSQ\r\n";
+        CHECK_EQ(0, at_parser_process_buffer(first, buffer, strlen(buffer)));
+        CHECK_EQ(0, at_parser_process_buffer(second, buffer, strlen(buffer)));
+        cache_ticks = 99;
+        CHECK_EQ(0, at_parser_process_buffer(first, buffer, strlen(buffer)));
+        CHECK_EQ(1, handler_calls);
+        CHECK_EQ(std::string("+CSQ: 1\r\nOK\r\n+CSQ: 1\r\nOK\r\n"), first_output);
+        CHECK_EQ(std::string("+CSQ: 1\r\nOK\r\n"), second_output);
+
+        cache_ticks = 100;
+        CHECK_EQ(0, at_parser_process_buffer(second, buffer, strlen(buffer)));
+        CHECK_EQ(2, handler_calls);
+        CHECK_EQ(std::string("+CSQ: 1\r\nOK\r\n+CSQ: 2\r\nOK\r\n"), second_output);
+
+        CHECK_EQ(0, at_parser_cache_get_stats(cache, &stats));
+        CHECK_EQ(2, stats.hits);
+        CHECK_EQ(2, stats.misses);
+    }
+
+    SUBCASE("Type and argument bytes are part of the key")
+    {
+        const char *buffer = "AT+CSQ=1\r\nAT+CSQ=2\r\nAT+CSQ=\"1\"\r\nAT+CSQ?\r\n";
+        CHECK_EQ(0, at_parser_process_buffer(first, buffer, strlen(buffer)));
+        CHECK_EQ(3, handler_calls);
+        CHECK_EQ(std::string("+CSQ: 1,1\r\nOK\r\n+CSQ: 2,2\r\nOK\r\n+CSQ: 1,1\r\nOK\r\n+CSQ: 3\r\nOK\r\n"), first_output);
+    }
+
+    SUBCASE("Static responses never call the handler")
+    {
+        const char *buffer = "AT+CSQ=?\r\n";
+        CHECK_EQ(0, at_parser_process_buffer(first, buffer, strlen(buffer)));
+        CHECK_EQ(0, handler_calls);
+        CHECK_EQ(std::string("+CSQ: (0-31),(0-7)\r\nOK\r\n"), first_output);
+        CHECK_EQ(0, at_parser_cache_get_stats(cache, &stats));
+        CHECK_EQ(1, stats.static_hits);
+    }
+
+    SUBCASE("Invalidation drops the cached response")
+    {
+        const char *buffer = "AT+CSQ\r\n";
+        CHECK_EQ(0, at_parser_process_buffer(first, buffer, strlen(buffer)));
+        CHECK_EQ(0, at_parser_cache_invalidate(cache, "CSQ"));
+        CHECK_EQ(0, at_parser_process_buffer(first, buffer, strlen(buffer)));
+        CHECK_EQ(2, handler_calls);
+        CHECK_EQ(0, at_parser_cache_invalidate(cache, NULL));
+        CHECK_NE(0, at_parser_cache_invalidate(cache, "UNKNOWN"));
+    }
+
+    SUBCASE("Identical requests are coalesced while deferred")
+    {
+        const char *buffer = "AT+SLOW\r\n";
+        CHECK_EQ(0, at_parser_process_buffer(first, buffer, strlen(buffer)));
+        CHECK_EQ(0, at_parser_process_buffer(second, buffer, strlen(buffer)));
+        CHECK_EQ(0, at_parser_process_buffer(first, buffer, strlen(buffer)));
+        CHECK_EQ(1, handler_calls);
+        CHECK_EQ(std::string("+SLOW: "), first_output);
+        CHECK_EQ(std::string(""), second_output);
+
+        CHECK_EQ(0, at_parser_cache_complete(cache, ticket, "42\r\nOK\r\n", 8));
+        CHECK_EQ(std::string("+SLOW: 42\r\nOK\r\n+SLOW: 42\r\nOK\r\n"), first_output);
+        CHECK_EQ(std::string("+SLOW: 42\r\nOK\r\n"), second_output);
+        CHECK_NE(0, at_parser_cache_complete(cache, ticket, "", 0));
+
+        CHECK_EQ(0, at_parser_process_buffer(second, buffer, strlen(buffer)));
+        CHECK_EQ(1, handler_calls);
+        CHECK_EQ(std::string("+SLOW: 42\r\nOK\r\n+SLOW: 42\r\nOK\r\n"), second_output);
+        CHECK_EQ(0, at_parser_cache_get_stats(cache, &stats));
+        CHECK_EQ(2, stats.coalesced);
+    }
+
+    SUBCASE("Overdue tickets are no longer coalesced")
+    {
+        CHECK_EQ(0, at_parser_cache_set_pending_timeout(cache, 10));
+        const char *buffer = "AT+SLOW\r\n";
+        CHECK_EQ(0, at_parser_process_buffer(first, buffer, strlen(buffer)));
+        at_parser_cache_ticket_t overdue = ticket;
+        cache_ticks = 9;
+        CHECK_EQ(0, at_parser_process_buffer(second, buffer, strlen(buffer)));
+        CHECK_EQ(1, handler_calls);
+        cache_ticks = 10;
+        CHECK_EQ(0, at_parser_process_buffer(second, buffer, strlen(buffer)));
+        CHECK_EQ(2, handler_calls);
+        CHECK_NE(overdue, ticket);
+
+        // The late response still reaches the coalesced request, but only the new one is cached.
+        CHECK_EQ(0, at_parser_cache_complete(cache, overdue, "1\r\n", 3));
+        CHECK_EQ(std::string("+SLOW: 1\r\n"), first_output);
+        CHECK_EQ(std::string("+SLOW: +SLOW: 1\r\n"), second_output);
+        CHECK_EQ(0, at_parser_cache_complete(cache, ticket, "2\r\n", 3));
+        CHECK_EQ(0, at_parser_process_buffer(first, buffer, strlen(buffer)));
+        CHECK_EQ(2, handler_calls);
+        CHECK_EQ(std::string("+SLOW: 1\r\n+SLOW: 2\r\n"), first_output);
+        CHECK_NE(0, at_parser_cache_set_pending_timeout(nullptr, 10));
+    }
+
+    SUBCASE("Detached parsers don't get deferred responses")
+    {
+        const char *buffer = "AT+SLOW\r\n";
+        CHECK_EQ(0, at_parser_process_buffer(first, buffer, strlen(buffer)));
+        CHECK_EQ(0, at_parser_process_buffer(second, buffer, strlen(buffer)));
+        CHECK_EQ(0, at_parser_cache_detach_parser(cache, first));
+        CHECK_EQ(0, at_parser_cache_detach_parser(cache, second));
+        at_parser_free(first);
+        at_parser_free(second);
+        first = nullptr;
+        second = nullptr;
+        CHECK_EQ(0, at_parser_cache_complete(cache, ticket, "42\r\n", 4));
+        CHECK_EQ(std::string("+SLOW: "), first_output);
+        CHECK_EQ(std::string(""), second_output);
+    }
+
+    SUBCASE("Detached parsers no longer use the cache")
+    {
+        CHECK_EQ(0, at_parser_cache_detach_parser(cache, first));
+        const char *buffer = "AT+CSQ\r\n";
+        CHECK_EQ(0, at_parser_process_buffer(first, buffer, strlen(buffer)));
+        CHECK_EQ(0, handler_calls);
+        CHECK_EQ(std::string(""), first_output);
+    }
+
+    at_parser_free(first);
+    at_parser_free(second);
+    at_parser_cache_free(cache);
+}
@@ -0,0 +1,130 @@
+#include "doctest.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <algorithm>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "at_parser/at_parser.h"
+#include "at_parser/at_parser_capture.h"
+
+namespace
+{
+    std::mutex captured_mutex;
+    std::vector<std::pair<size_t, std::string>> captured;
+    std::vector<std::thread::id> captured_threads;
+
+    extern "C" void capture_command(at_parser_handle_t, void *, const char *command_name, enum at_parser_command_type, struct at_parser_argument *argument_list, size_t argument_list_length)
+    {
+        std::string itm(command_name);
+        if (argument_list_length > 0)
+        {
+            itm += "=" + std::string(argument_list[0].value, argument_list[0].length);
+        }
+        std::lock_guard<std::mutex> lock(captured_mutex);
+        captured.emplace_back(at_parser_capture_current_chunk(), itm);
+        captured_threads.push_back(std::this_thread::get_id());
+    }
+}
+
+TEST_CASE("Test processing capture files")
+{
+    at_parser_registry_handle_t registry = nullptr;
+    CHECK_EQ(0, at_parser_registry_create(&registry));
+    CHECK_EQ(0, at_parser_registry_add_command_handler(registry, "ABC", capture_command, NULL));
+    CHECK_EQ(0, at_parser_registry_add_command_handler(registry, "DEF", capture_command, NULL));
+    CHECK_EQ(0, at_parser_registry_freeze(registry));
+    captured.clear();
+    captured_threads.clear();
+
+    std::string capture;
+    std::vector<std::string> expected;
+    for (int i = 0; i < 5000; i++)
+    {
+        capture += "AT+ABC=" + std::to_string(i) + "\r\n+CSQ: 12,99\r\nOK\r\n";
+        expected.push_back("ABC=" + std::to_string(i));
+        if (i % 7 == 0)
+        {
+            capture += "AT+DEF\n"; // Line endings without \r are accepted in captures.
+            expected.push_back("DEF");
+        }
+    }
+    capture += "AT+ABC=last"; // No line ending on the last line.
+    expected.push_back("ABC=last");
+
+    struct at_parser_capture_options options = {};
+    options.thread_count = 4;
+    options.escape_char = '\x1B';
+    options.arg_separator = ',';
+    struct at_parser_capture_result result = {};
+
+    SUBCASE("Global order from a file")
+    {
+        char path[] = "/tmp/at_parser_capture_XXXXXX";
+        int fd = mkstemp(path);
+        REQUIRE(fd >= 0);
+        CHECK_EQ((ssize_t)capture.size(), write(fd, capture.data(), capture.size()));
+        close(fd);
+
+        options.order = AT_PARSER_CAPTURE_ORDER_GLOBAL;
+        CHECK_EQ(0, at_parser_capture_process_file(path, registry, &options, &result));
+        unlink(path);
+        CHECK_EQ(4, result.chunk_count);
+        CHECK_EQ(expected.size() + 10000, result.line_count);
+        CHECK_EQ(expected.size(), result.command_count);
+        REQUIRE_EQ(expected.size(), captured.size());
+        for (size_t i = 0; i < expected.size(); i++)
+        {
+            CHECK_EQ(expected[i], captured[i].second);
+        }
+        CHECK_EQ(0, captured.front().first);
+        CHECK_EQ(3, captured.back().first);
+        CHECK(std::is_sorted(captured.begin(), captured.end(), [](const auto &one, const auto &two) { return one.first < two.first; }));
+        // Parsed on the workers, but every handler is called from the calling thread.
+        CHECK_EQ(captured_threads.size(), (size_t)std::count(captured_threads.begin(), captured_threads.end(), std::this_thread::get_id()));
+    }
+
+    SUBCASE("Per chunk order from memory")
+    {
+        options.order = AT_PARSER_CAPTURE_ORDER_PER_CHUNK;
+        CHECK_EQ(0, at_parser_capture_process_memory(capture.data(), capture.size(), registry, &options, &result));
+        CHECK_EQ(4, result.chunk_count);
+        REQUIRE_EQ(expected.size(), captured.size());
+        // Within every chunk the order is kept, so sorting on chunk (stable) restores the global order.
+        std::stable_sort(captured.begin(), captured.end(), [](const auto &one, const auto &two) { return one.first < two.first; });
+        for (size_t i = 0; i < expected.size(); i++)
+        {
+            CHECK_EQ(expected[i], captured[i].second);
+        }
+    }
+
+    SUBCASE("Long lines are skipped")
+    {
+        options.order = AT_PARSER_CAPTURE_ORDER_GLOBAL;
+        options.max_line_length = 10;
+        const char *small = "AT+ABC=1\r\nAT+ABC=12345\r\nAT+DEF\r\n";
+        CHECK_EQ(0, at_parser_capture_process_memory(small, strlen(small), registry, &options, &result));
+        CHECK_EQ(1, result.chunk_count);
+        CHECK_EQ(2, result.command_count);
+        REQUIRE_EQ(2, captured.size());
+        CHECK_EQ(std::string("ABC=1"), captured[0].second);
+        CHECK_EQ(std::string("DEF"), captured[1].second);
+    }
+
+    SUBCASE("Parsed arguments outlive the line")
+    {
+        options.order = AT_PARSER_CAPTURE_ORDER_GLOBAL;
+        const char *quoted = "AT+ABC=\"a,b\",2\r\nAT+DEF?\r\nAT+ABC=\"\"\r\n";
+        CHECK_EQ(0, at_parser_capture_process_memory(quoted, strlen(quoted), registry, &options, &result));
+        REQUIRE_EQ(3, captured.size());
+        CHECK_EQ(std::string("ABC=a,b"), captured[0].second);
+        CHECK_EQ(std::string("DEF"), captured[1].second);
+        CHECK_EQ(std::string("ABC="), captured[2].second);
+    }
+
+    at_parser_registry_free(registry);
+}
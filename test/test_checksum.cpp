@@ -0,0 +1,118 @@
+#include "doctest.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include "at_parser/at_parser.h"
+#include "at_parser/at_parser_checksum.h"
+#include "parser_helpers.h"
+
+namespace
+{
+    uint32_t reference_crc32(uint32_t polynomial, const std::string &data)
+    {
+        uint32_t crc = 0xFFFFFFFF;
+        for (unsigned char chr : data)
+        {
+            crc ^= chr;
+            for (int bit = 0; bit < 8; bit++)
+            {
+                crc = (crc & 1) != 0 ? (crc >> 1) ^ polynomial : crc >> 1;
+            }
+        }
+        return crc ^ 0xFFFFFFFF;
+    }
+
+    std::string with_checksum(enum at_parser_checksum_type type, const std::string &line)
+    {
+        char suffix[16];
+        snprintf(suffix, sizeof(suffix), "*%0*X", (int)at_parser_checksum_get_digits(type), (unsigned)at_parser_checksum_compute(type, line.data(), line.size()));
+        return line + suffix + "\r\n";
+    }
+}
+
+TEST_CASE("Test checksum algorithms")
+{
+    const std::string check = "123456789";
+    SUBCASE("Check values")
+    {
+        CHECK_EQ(0x31, at_parser_checksum_compute(AT_PARSER_CHECKSUM_XOR, check.data(), check.size()));
+        CHECK_EQ(0x29B1, at_parser_checksum_compute(AT_PARSER_CHECKSUM_CRC16, check.data(), check.size()));
+        CHECK_EQ(0xCBF43926, at_parser_checksum_compute(AT_PARSER_CHECKSUM_CRC32, check.data(), check.size()));
+        CHECK_EQ(0xE3069283, at_parser_checksum_compute(AT_PARSER_CHECKSUM_CRC32C, check.data(), check.size()));
+        CHECK_EQ(0, at_parser_checksum_compute(AT_PARSER_CHECKSUM_NONE, check.data(), check.size()));
+    }
+    SUBCASE("All lengths and alignments match a bitwise CRC")
+    {
+        std::string data;
+        srand(42);
+        for (int i = 0; i < 300; i++)
+        {
+            data += (char)(rand() & 0xFF);
+        }
+        bool match = true;
+        for (size_t offset = 0; offset < 8; offset++)
+        {
+            for (size_t length = 0; length + offset <= data.size(); length += 7)
+            {
+                const std::string part = data.substr(offset, length);
+                match = match && at_parser_checksum_compute(AT_PARSER_CHECKSUM_CRC32C, part.data(), part.size()) == reference_crc32(0x82F63B78, part);
+                match = match && at_parser_checksum_compute(AT_PARSER_CHECKSUM_CRC32, part.data(), part.size()) == reference_crc32(0xEDB88320, part);
+            }
+        }
+        CHECK(match);
+    }
+}
+
+TEST_CASE("Test line checksum")
+{
+    commands.clear();
+    at_parser_handle_t parser = nullptr;
+    CHECK_EQ(0, at_parser_create(&parser, 100, '\\', ','));
+    CHECK_EQ(0, at_parser_add_command_handler(parser, "CSQ", at_parser_default_received_command, nullptr));
+    CHECK_EQ(0, at_parser_add_command_handler(parser, "CFUN", at_parser_default_received_command, nullptr));
+
+    SUBCASE("Valid lines")
+    {
+        const enum at_parser_checksum_type types[] = {AT_PARSER_CHECKSUM_XOR, AT_PARSER_CHECKSUM_CRC16, AT_PARSER_CHECKSUM_CRC32, AT_PARSER_CHECKSUM_CRC32C};
+        for (enum at_parser_checksum_type type : types)
+        {
+            commands.clear();
+            CHECK_EQ(0, at_parser_set_line_checksum(parser, type));
+            const std::string input = with_checksum(type, "AT+CSQ") + with_checksum(type, "AT+CFUN=1,\"a*b\"");
+            CHECK_EQ(0, at_parser_process_buffer(parser, input.data(), input.size()));
+            REQUIRE_EQ(2, commands.size());
+            CHECK_EQ("CSQ", commands[0].command);
+            REQUIRE_EQ(2, commands[1].arguments.size());
+            CHECK_EQ("1", commands[1].arguments[0]);
+            CHECK_EQ("a*b", commands[1].arguments[1]);
+        }
+        CHECK_EQ(0, at_parser_get_checksum_failures(parser));
+    }
+    SUBCASE("Corrupted lines are dropped and counted")
+    {
+        CHECK_EQ(0, at_parser_set_line_checksum(parser, AT_PARSER_CHECKSUM_CRC16));
+        std::string corrupted = with_checksum(AT_PARSER_CHECKSUM_CRC16, "AT+CFUN=1");
+        corrupted[8] = '4';
+        std::string lowercase = with_checksum(AT_PARSER_CHECKSUM_CRC16, "AT+CSQ");
+        for (size_t i = lowercase.find('*'); i < lowercase.size(); i++)
+        {
+            lowercase[i] = (lowercase[i] >= 'A' && lowercase[i] <= 'F') ? (char)(lowercase[i] - 'A' + 'a') : lowercase[i];
+        }
+        const std::string input = corrupted + "AT+CSQ\r\nAT+CSQ*12\r\nAT+CSQ*XYZW\r\n\r\n" + lowercase;
+        CHECK_EQ(0, at_parser_process_buffer(parser, input.data(), input.size()));
+        REQUIRE_EQ(1, commands.size());
+        CHECK_EQ("CSQ", commands[0].command);
+        CHECK_EQ(4, at_parser_get_checksum_failures(parser));
+    }
+    SUBCASE("Disabling")
+    {
+        CHECK_NE(0, at_parser_set_line_checksum(parser, (enum at_parser_checksum_type)99));
+        CHECK_EQ(0, at_parser_set_line_checksum(parser, AT_PARSER_CHECKSUM_XOR));
+        CHECK_EQ(0, at_parser_set_line_checksum(parser, AT_PARSER_CHECKSUM_NONE));
+        CHECK_EQ(0, at_parser_process_buffer(parser, "AT+CSQ\r\n", 8));
+        CHECK_EQ(1, commands.size());
+    }
+
+    at_parser_free(parser);
+}
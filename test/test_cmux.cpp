@@ -0,0 +1,234 @@
+#include "doctest.h"
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "at_parser/at_parser.h"
+#include "at_parser/at_parser_cmux.h"
+
+namespace
+{
+    struct mux_output
+    {
+        std::string data;
+        int writes = 0;
+    };
+
+    std::vector<std::string> received;
+
+    extern "C" void collect_output(at_parser_cmux_handle_t, void *userdata, const char *data, size_t length)
+    {
+        mux_output *output = static_cast<mux_output *>(userdata);
+        output->data.append(data, length);
+        output->writes++;
+    }
+
+    extern "C" void answer_command(at_parser_handle_t parser, void *userdata, const char *command_name, enum at_parser_command_type, struct at_parser_argument *, size_t)
+    {
+        received.push_back(std::string(static_cast<const char *>(userdata)) + ":" + command_name);
+        CHECK_EQ(0, at_parser_write_response(parser, "OK\r\n", 4));
+    }
+
+    // Bitwise FCS, independent of the table in the implementation.
+    uint8_t fcs(const std::string &bytes)
+    {
+        uint8_t value = 0xFF;
+        for (unsigned char byte : bytes)
+        {
+            value ^= byte;
+            for (int i = 0; i < 8; i++)
+            {
+                value = (value & 1) ? (value >> 1) ^ 0xE0 : value >> 1;
+            }
+        }
+        return 0xFF - value;
+    }
+
+    std::string basic_frame(uint8_t address, uint8_t control, const std::string &info)
+    {
+        std::string header{static_cast<char>(address), static_cast<char>(control), static_cast<char>((info.size() << 1) | 1)};
+        bool uih = (control & ~0x10) == 0xEF;
+        return "\xF9" + header + info + static_cast<char>(fcs(uih ? header : header + info)) + "\xF9";
+    }
+
+    std::string advanced_frame(uint8_t address, uint8_t control, const std::string &info)
+    {
+        std::string header{static_cast<char>(address), static_cast<char>(control)};
+        bool uih = (control & ~0x10) == 0xEF;
+        std::string body = header + info + static_cast<char>(fcs(uih ? header : header + info));
+        std::string frame = "\x7E";
+        for (char c : body)
+        {
+            if (c == '\x7E' || c == '\x7D' || c == '\x11' || c == '\x13')
+            {
+                frame += '\x7D';
+                c ^= 0x20;
+            }
+            frame += c;
+        }
+        return frame + "\x7E";
+    }
+}
+
+TEST_CASE("Test CMUX basic mode")
+{
+    at_parser_cmux_handle_t mux = nullptr;
+    at_parser_handle_t command_channel = nullptr;
+    at_parser_handle_t urc_channel = nullptr;
+    mux_output output;
+    received.clear();
+
+    // The basic mode length field holds 15 bits.
+    CHECK_NE(0, at_parser_cmux_create(&mux, AT_PARSER_CMUX_MODE_BASIC, 32768, collect_output, &output));
+    CHECK_EQ(0, at_parser_cmux_create(&mux, AT_PARSER_CMUX_MODE_BASIC, 32767, collect_output, &output));
+    at_parser_cmux_free(mux);
+    CHECK_EQ(0, at_parser_cmux_create(&mux, AT_PARSER_CMUX_MODE_BASIC, 127, collect_output, &output));
+    CHECK_EQ(0, at_parser_create(&command_channel, 100, '\x1B', ','));
+    CHECK_EQ(0, at_parser_create(&urc_channel, 100, '\x1B', ','));
+    CHECK_EQ(0, at_parser_add_command_handler(command_channel, "CSQ", answer_command, (void *)"cmd"));
+    CHECK_EQ(0, at_parser_add_command_handler(urc_channel, "CSQ", answer_command, (void *)"urc"));
+    CHECK_EQ(0, at_parser_cmux_attach(mux, 1, command_channel));
+    CHECK_EQ(0, at_parser_cmux_attach(mux, 2, urc_channel));
+    CHECK_NE(0, at_parser_cmux_attach(mux, 0, command_channel));
+
+    SUBCASE("Open channels")
+    {
+        std::string open_control = "\xF9\x03\x3F\x01\x1C\xF9";
+        CHECK_EQ(0, at_parser_cmux_process(mux, open_control.data(), open_control.size()));
+        CHECK_EQ(std::string("\xF9\x03\x73\x01\xD7\xF9"), output.data);
+        CHECK(at_parser_cmux_is_open(mux, 0));
+
+        output = mux_output();
+        std::string open = basic_frame(0x07, 0x3F, "") + basic_frame(0x0B, 0x3F, "") + basic_frame(0x0F, 0x3F, "");
+        CHECK_EQ(0, at_parser_cmux_process(mux, open.data(), open.size()));
+        // All answers are written at once, DLC 3 has no parser and is refused.
+        CHECK_EQ(1, output.writes);
+        CHECK_EQ(basic_frame(0x07, 0x73, "") + basic_frame(0x0B, 0x73, "") + basic_frame(0x0F, 0x1F, ""), output.data);
+        CHECK(at_parser_cmux_is_open(mux, 1));
+        CHECK(at_parser_cmux_is_open(mux, 2));
+        CHECK_FALSE(at_parser_cmux_is_open(mux, 3));
+
+        output = mux_output();
+        std::string data = basic_frame(0x05, 0xEF, "AT+CSQ\r\n") + basic_frame(0x09, 0xEF, "AT+CSQ\r\n") + basic_frame(0x0D, 0xEF, "AT+CSQ\r\n");
+
+        SUBCASE("In one buffer")
+        {
+            CHECK_EQ(0, at_parser_cmux_process(mux, data.data(), data.size()));
+            CHECK_EQ(1, output.writes);
+        }
+        SUBCASE("Byte per byte")
+        {
+            for (char c : data)
+            {
+                CHECK_EQ(0, at_parser_cmux_process(mux, &c, 1));
+            }
+            struct at_parser_cmux_stats stats;
+            CHECK_EQ(0, at_parser_cmux_get_stats(mux, &stats));
+            CHECK_EQ(3u, stats.reassembled);
+        }
+        REQUIRE_EQ(2u, received.size());
+        CHECK_EQ("cmd:CSQ", received[0]);
+        CHECK_EQ("urc:CSQ", received[1]);
+        // Responses go out as UIH commands (C/R cleared) on the DLC of the parser.
+        CHECK_EQ(basic_frame(0x05, 0xEF, "OK\r\n") + basic_frame(0x09, 0xEF, "OK\r\n"), output.data);
+
+        struct at_parser_cmux_stats stats;
+        CHECK_EQ(0, at_parser_cmux_get_stats(mux, &stats));
+        CHECK_EQ(1u, stats.discarded);
+        CHECK_EQ(0u, stats.fcs_errors);
+    }
+    SUBCASE("Corrupted frames and garbage are skipped")
+    {
+        std::string open = basic_frame(0x03, 0x3F, "") + basic_frame(0x07, 0x3F, "");
+        CHECK_EQ(0, at_parser_cmux_process(mux, open.data(), open.size()));
+        std::string bad = basic_frame(0x05, 0xEF, "AT+CSQ\r\n");
+        bad[bad.size() - 2] ^= 0x01;
+        std::string data = "garbage" + bad + basic_frame(0x05, 0xEF, "AT+CSQ\r\n");
+        CHECK_EQ(0, at_parser_cmux_process(mux, data.data(), data.size()));
+        CHECK_EQ(1u, received.size());
+        struct at_parser_cmux_stats stats;
+        CHECK_EQ(0, at_parser_cmux_get_stats(mux, &stats));
+        CHECK_EQ(1u, stats.fcs_errors);
+    }
+    SUBCASE("Control channel")
+    {
+        std::string open = basic_frame(0x03, 0x3F, "") + basic_frame(0x07, 0x3F, "");
+        CHECK_EQ(0, at_parser_cmux_process(mux, open.data(), open.size()));
+        output = mux_output();
+        // Modem status command for DLC 1, acknowledged with the C/R bit cleared.
+        std::string msc = basic_frame(0x03, 0xEF, std::string("\xE3\x05\x07\x0D", 4));
+        CHECK_EQ(0, at_parser_cmux_process(mux, msc.data(), msc.size()));
+        CHECK_EQ(basic_frame(0x01, 0xEF, std::string("\xE1\x05\x07\x0D", 4)), output.data);
+
+        output = mux_output();
+        std::string close = basic_frame(0x03, 0xEF, std::string("\xC3\x01", 2));
+        CHECK_EQ(0, at_parser_cmux_process(mux, close.data(), close.size()));
+        CHECK_EQ(basic_frame(0x01, 0xEF, std::string("\xC1\x01", 2)), output.data);
+        CHECK_FALSE(at_parser_cmux_is_open(mux, 0));
+        CHECK_FALSE(at_parser_cmux_is_open(mux, 1));
+    }
+    SUBCASE("Responses are split in frames")
+    {
+        std::string open = basic_frame(0x03, 0x3F, "") + basic_frame(0x07, 0x3F, "");
+        CHECK_EQ(0, at_parser_cmux_process(mux, open.data(), open.size()));
+        output = mux_output();
+        std::string urc(200, 'x');
+        CHECK_EQ(0, at_parser_cmux_write(mux, 1, urc.data(), urc.size()));
+        CHECK_NE(0, at_parser_cmux_write(mux, 2, urc.data(), urc.size()));
+        CHECK_EQ(0, output.writes);
+        CHECK_EQ(0, at_parser_cmux_flush(mux));
+        CHECK_EQ(1, output.writes);
+        CHECK_EQ(basic_frame(0x05, 0xEF, urc.substr(0, 127)) + basic_frame(0x05, 0xEF, urc.substr(127)), output.data);
+    }
+
+    at_parser_cmux_free(mux);
+    at_parser_free(command_channel);
+    at_parser_free(urc_channel);
+}
+
+TEST_CASE("Test CMUX advanced mode")
+{
+    at_parser_cmux_handle_t mux = nullptr;
+    at_parser_handle_t parser = nullptr;
+    mux_output output;
+    received.clear();
+
+    CHECK_EQ(0, at_parser_cmux_create(&mux, AT_PARSER_CMUX_MODE_ADVANCED, 64, collect_output, &output));
+    CHECK_EQ(0, at_parser_create(&parser, 100, '\x1B', ','));
+    CHECK_EQ(0, at_parser_add_command_handler(parser, "CSQ", answer_command, (void *)"adv"));
+    CHECK_EQ(0, at_parser_cmux_attach(mux, 31, parser));
+
+    // DLC 31 has address 0x7F/0x7D, which has to be escaped. Frames share their flags.
+    std::string open = advanced_frame(0x03, 0x3F, "") + advanced_frame(0x7F, 0x3F, "");
+    std::string data = open + advanced_frame(0x7D, 0xEF, "AT+CSQ\r\n").substr(1) + advanced_frame(0x7D, 0xEF, "AT+CSQ\r\n").substr(1);
+
+    std::string expected = advanced_frame(0x03, 0x73, "") + advanced_frame(0x7F, 0x73, "") + advanced_frame(0x7D, 0xEF, "OK\r\n") + advanced_frame(0x7D, 0xEF, "OK\r\n");
+
+    SUBCASE("In one buffer")
+    {
+        CHECK_EQ(0, at_parser_cmux_process(mux, data.data(), data.size()));
+        CHECK_EQ(1, output.writes);
+        REQUIRE_EQ(2u, received.size());
+        CHECK_EQ("adv:CSQ", received[0]);
+        CHECK_EQ(expected, output.data);
+    }
+    SUBCASE("Split at every position")
+    {
+        CHECK_EQ(0, at_parser_cmux_detach(mux, 31));
+        for (size_t split = 1; split < data.size(); split++)
+        {
+            at_parser_cmux_handle_t split_mux = nullptr;
+            mux_output split_output;
+            received.clear();
+            CHECK_EQ(0, at_parser_cmux_create(&split_mux, AT_PARSER_CMUX_MODE_ADVANCED, 64, collect_output, &split_output));
+            CHECK_EQ(0, at_parser_cmux_attach(split_mux, 31, parser));
+            CHECK_EQ(0, at_parser_cmux_process(split_mux, data.data(), split));
+            CHECK_EQ(0, at_parser_cmux_process(split_mux, data.data() + split, data.size() - split));
+            CHECK_EQ(2u, received.size());
+            CHECK_EQ(expected, split_output.data);
+            at_parser_cmux_free(split_mux);
+        }
+    }
+
+    at_parser_cmux_free(mux);
+    at_parser_free(parser);
+}
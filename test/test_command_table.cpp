@@ -0,0 +1,101 @@
+#include "doctest.h"
+#include <string.h>
+#include <string>
+#include <vector>
+#include "at_parser/at_parser.h"
+#include "at_parser/at_parser_command_table.h"
+#include "parser_helpers.h"
+#include "test_commands.h"
+
+namespace
+{
+    std::string table_output;
+}
+
+extern "C" void handle_table_command(at_parser_handle_t parser, void *userdata, const char *command_name, enum at_parser_command_type type, struct at_parser_argument *argument_list, size_t argument_list_length)
+{
+    at_parser_default_received_command(parser, userdata, command_name, type, argument_list, argument_list_length);
+}
+
+TEST_CASE("Test generated command table")
+{
+    const char *names[] = {"CSQ", "CGDCONT", "CFUN", "CREG", "COPS", "CMGS", "CMGF", "CPIN", "CCLK", "CGATT", "CGMI", "CGMM", "CGSN"};
+    at_parser_handle_t parser = nullptr;
+    commands.clear();
+    table_output.clear();
+    CHECK_EQ(0, at_parser_create(&parser, 100, '\x1B', ','));
+    CHECK_EQ(0, at_parser_set_response_writer(parser, at_parser_collect_response, &table_output));
+    CHECK_EQ(0, at_parser_add_command_handler(parser, "CSQ", at_parser_default_received_command, (void *)0x0010));
+    CHECK_EQ(0, at_parser_add_command_handler(parser, "OTHER", at_parser_default_received_command, (void *)0x0010));
+    CHECK_EQ(0, at_parser_attach_command_table(parser, &test_commands, (void *)0x0020));
+
+    SUBCASE("Lookup")
+    {
+        CHECK_EQ(sizeof(names) / sizeof(names[0]), test_commands.command_count);
+        for (const char *name : names)
+        {
+            const struct at_parser_table_command *command = at_parser_command_table_find(&test_commands, name, strlen(name));
+            REQUIRE_NE(nullptr, command);
+            CHECK_EQ(std::string(name), command->name);
+        }
+        CHECK_EQ(nullptr, at_parser_command_table_find(&test_commands, "CSQX", 4));
+        CHECK_EQ(nullptr, at_parser_command_table_find(&test_commands, "CS", 2));
+        CHECK_EQ(nullptr, at_parser_command_table_find(&test_commands, "", 0));
+        CHECK_EQ(nullptr, at_parser_command_table_find(&test_commands, "OTHER", 5));
+    }
+    SUBCASE("Dispatch and help")
+    {
+        const std::string input = "AT+CSQ\r\nAT+CSQ=?\r\nAT+CSQ=1\r\nAT+OTHER\r\nAT+CGDCONT=?\r\nAT+CCLK?\r\n";
+        CHECK_EQ(0, at_parser_process_buffer(parser, input.data(), input.size()));
+        REQUIRE_EQ(3, commands.size());
+        CHECK_EQ("CSQ", commands[0].command);
+        CHECK_EQ((void *)0x0020, commands[0].userdata); // Only the table handles CSQ.
+        CHECK_EQ("OTHER", commands[1].command);
+        CHECK_EQ("CCLK", commands[2].command);
+        CHECK_EQ(AT_PARSER_COMMAND_TYPE_TEST, commands[2].type);
+        CHECK_EQ("+CSQ: (0-31,99),(0-7,99)\r\nOK\r\n"
+                 "ERROR\r\n"
+                 "+CGDCONT: (1-24),\"IP\"\r\n+CGDCONT: (1-24),\"IPV6\"\r\nOK\r\n",
+                 table_output);
+    }
+    SUBCASE("Argument validation")
+    {
+        const std::vector<std::pair<std::string, bool>> lines = {
+            {"AT+CGDCONT=1,\"IP\"", true},
+            {"AT+CGDCONT=24,\"IPV6\",\"internet\"", true},
+            {"AT+CGDCONT=1,\"IP\",", true},
+            {"AT+CGDCONT=25,\"IP\"", false},
+            {"AT+CGDCONT=0,\"IP\"", false},
+            {"AT+CGDCONT=1", false},
+            {"AT+CGDCONT=1,\"\"", false},
+            {"AT+CGDCONT=1,\"TOOLONGPDP\"", false},
+            {"AT+CGDCONT=1,\"IP\",\"apn\",4", false},
+            {"AT+CGDCONT=x,\"IP\"", false},
+            {"AT+CFUN=1,-5", true},
+            {"AT+CFUN=0", true},
+            {"AT+CFUN=-1", false},
+            {"AT+CFUN=1,6", false},
+            {"AT+CFUN=99999999999999999999", false},
+            {"AT+CFUN?", false},
+        };
+        for (const auto &line : lines)
+        {
+            commands.clear();
+            table_output.clear();
+            const std::string input = line.first + "\r\n";
+            CHECK_EQ(0, at_parser_process_buffer(parser, input.data(), input.size()));
+            CHECK_MESSAGE(commands.size() == (line.second ? 1 : 0), line.first);
+            CHECK_EQ(line.second ? "" : "ERROR\r\n", table_output);
+        }
+    }
+    SUBCASE("Detached")
+    {
+        CHECK_EQ(0, at_parser_attach_command_table(parser, nullptr, nullptr));
+        CHECK_EQ(0, at_parser_process_buffer(parser, "AT+CSQ=1\r\n", 10));
+        REQUIRE_EQ(1, commands.size());
+        CHECK_EQ((void *)0x0010, commands[0].userdata);
+        CHECK_EQ("", table_output);
+    }
+
+    at_parser_free(parser);
+}
@@ -0,0 +1,30 @@
+# Command spec for test_command_table.cpp, turned into a table by at_parser_gen.
+command CSQ handle_table_command execute,test
+help +CSQ: (0-31,99),(0-7,99)
+
+command CGDCONT handle_table_command set,test
+    int 1 24
+    string 1 8
+    string 0 63 optional
+    help +CGDCONT: (1-24),"IP"
+    help +CGDCONT: (1-24),"IPV6"
+
+command CFUN handle_table_command set,query
+    int 0 1
+    int -5 5 optional
+
+command CREG handle_table_command execute,test,set
+    int 0 2
+command COPS handle_table_command execute
+command CMGS handle_table_command set
+    string 1 160
+command CMGF handle_table_command set
+    int 0 1
+command CPIN handle_table_command set,test
+    string 4 8
+command CCLK handle_table_command test
+command CGATT handle_table_command set,test
+    int 0 1
+command CGMI handle_table_command execute
+command CGMM handle_table_command execute
+command CGSN handle_table_command execute
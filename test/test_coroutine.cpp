@@ -0,0 +1,126 @@
+#include "doctest.h"
+#include <string.h>
+#include <coroutine>
+#include <string>
+#include <vector>
+#include "at_parser/at_parser.h"
+#include "at_parser/at_parser_coroutine.hpp"
+
+namespace
+{
+    struct detached_task
+    {
+        struct promise_type
+        {
+            detached_task get_return_object() { return {}; }
+            std::suspend_never initial_suspend() noexcept { return {}; }
+            std::suspend_never final_suspend() noexcept { return {}; }
+            void return_void() {}
+            void unhandled_exception() { std::terminate(); }
+        };
+    };
+
+    struct queued_executor
+    {
+        static constexpr bool resumes_inline = false;
+        std::vector<std::coroutine_handle<>> *queue;
+
+        void execute(std::coroutine_handle<> handle) const
+        {
+            queue->push_back(handle);
+        }
+    };
+
+    struct received
+    {
+        std::string name;
+        at_parser_command_type type;
+        std::vector<std::string> arguments;
+    };
+
+    template <typename Session>
+    detached_task collect(Session &session, std::vector<received> &out, size_t count, const char *only = nullptr)
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            at_parser_coroutine::command_view cmd = only == nullptr ? co_await session.next_command() : co_await session.next_command(only);
+            received itm{std::string(cmd.name), cmd.type, {}};
+            for (size_t arg = 0; arg < cmd.arguments.size(); arg++)
+            {
+                itm.arguments.emplace_back(cmd.argument(arg));
+            }
+            out.push_back(itm);
+        }
+    }
+}
+
+TEST_CASE("Test awaiting commands from a coroutine")
+{
+    at_parser_handle_t handle = nullptr;
+    CHECK_EQ(0, at_parser_create(&handle, 50, '\x1B', ','));
+    std::vector<received> out;
+
+    SUBCASE("Inline executor resumes from the parser callback")
+    {
+        at_parser_coroutine::session<> session(handle);
+        CHECK_EQ(0, session.listen("ABC"));
+        CHECK_EQ(0, session.listen("HELLOW"));
+        collect(session, out, 2);
+        CHECK_EQ(0, out.size());
+
+        const char *buffer = "AT+ABC=def,\"g,h\"\r\nAT+HELLOW?\r\n";
+        CHECK_EQ(0, at_parser_process_buffer(handle, buffer, strlen(buffer)));
+        CHECK_EQ(2, out.size());
+        CHECK_EQ(std::string("ABC"), out[0].name);
+        CHECK_EQ(AT_PARSER_COMMAND_TYPE_SET, out[0].type);
+        CHECK_EQ(2, out[0].arguments.size());
+        CHECK_EQ(std::string("def"), out[0].arguments[0]);
+        CHECK_EQ(std::string("g,h"), out[0].arguments[1]);
+        CHECK_EQ(std::string("HELLOW"), out[1].name);
+        CHECK_EQ(AT_PARSER_COMMAND_TYPE_TEST, out[1].type);
+    }
+
+    SUBCASE("Commands without a waiter are queued and a filter skips other commands")
+    {
+        at_parser_coroutine::session<> session(handle);
+        CHECK_EQ(0, session.listen("ABC"));
+        CHECK_EQ(0, session.listen("HELLOW"));
+
+        const char *buffer = "AT+ABC=first\r\nAT+HELLOW=second\r\n";
+        CHECK_EQ(0, at_parser_process_buffer(handle, buffer, strlen(buffer)));
+        CHECK_EQ(2, session.queued());
+
+        collect(session, out, 1, "HELLOW");
+        CHECK_EQ(1, out.size());
+        CHECK_EQ(std::string("HELLOW"), out[0].name);
+        CHECK_EQ(std::string("second"), out[0].arguments[0]);
+        CHECK_EQ(1, session.queued());
+
+        collect(session, out, 1);
+        CHECK_EQ(2, out.size());
+        CHECK_EQ(std::string("ABC"), out[1].name);
+        CHECK_EQ(std::string("first"), out[1].arguments[0]);
+        CHECK_EQ(0, session.queued());
+    }
+
+    SUBCASE("Deferred executor gets a copy that outlives the parser callback")
+    {
+        std::vector<std::coroutine_handle<>> queue;
+        at_parser_coroutine::session<queued_executor> session(handle, queued_executor{&queue});
+        CHECK_EQ(0, session.listen("ABC"));
+        collect(session, out, 2);
+
+        const char *buffer = "AT+ABC=one\r\nAT+ABC=two\r\n";
+        CHECK_EQ(0, at_parser_process_buffer(handle, buffer, strlen(buffer)));
+        CHECK_EQ(0, out.size());
+        CHECK_EQ(1, queue.size());
+        CHECK_EQ(1, session.queued());
+
+        queue.back().resume();
+        CHECK_EQ(2, out.size());
+        CHECK_EQ(std::string("one"), out[0].arguments[0]);
+        CHECK_EQ(std::string("two"), out[1].arguments[0]);
+    }
+
+    at_parser_free(handle);
+}
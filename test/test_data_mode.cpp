@@ -0,0 +1,170 @@
+#include "doctest.h"
+#include <string.h>
+#include <string>
+#include <vector>
+#include "at_parser/at_parser.h"
+#include "parser_helpers.h"
+
+namespace
+{
+    struct data_log
+    {
+        std::string data;
+        std::vector<const char *> views;
+        size_t escapes = 0;
+        std::string output;
+        uint32_t now = 0;
+        uint32_t guard_time = 0;
+    };
+
+    data_log data_state;
+
+    extern "C" void collect_data(at_parser_handle_t, void *, const char *data, size_t length)
+    {
+        data_state.data.append(data, length);
+        data_state.views.push_back(data);
+    }
+
+    extern "C" void count_escape(at_parser_handle_t, void *)
+    {
+        data_state.escapes++;
+    }
+
+    extern "C" uint32_t data_mode_clock(void *)
+    {
+        return data_state.now;
+    }
+
+    extern "C" void handle_dial(at_parser_handle_t parser, void *userdata, const char *command_name, enum at_parser_command_type type, struct at_parser_argument *argument_list, size_t argument_list_length)
+    {
+        at_parser_default_received_command(parser, userdata, command_name, type, argument_list, argument_list_length);
+        struct at_parser_data_mode_config config = {};
+        config.sink = collect_data;
+        config.guard_time = data_state.guard_time;
+        config.escaped = count_escape;
+        at_parser_write_response(parser, "CONNECT\r\n", 9);
+        at_parser_enter_data_mode(parser, &config);
+    }
+
+    void feed(at_parser_handle_t parser, const std::string &input)
+    {
+        CHECK_EQ(0, at_parser_process_buffer(parser, input.data(), input.size()));
+    }
+}
+
+TEST_CASE("Test data mode")
+{
+    data_state = data_log();
+    commands.clear();
+    at_parser_handle_t parser = nullptr;
+    CHECK_EQ(0, at_parser_create(&parser, 32, '\\', ','));
+    CHECK_EQ(0, at_parser_set_response_writer(parser, at_parser_collect_response, &data_state.output));
+    CHECK_EQ(0, at_parser_set_clock(parser, data_mode_clock, nullptr));
+    CHECK_EQ(0, at_parser_add_command_handler(parser, "DIAL", handle_dial, nullptr));
+    CHECK_EQ(0, at_parser_add_command_handler(parser, "CSQ", at_parser_default_received_command, nullptr));
+
+    SUBCASE("Without guard time")
+    {
+        const std::string input = "AT+DIAL\r\nraw AT+CSQ\r\n data + ++ more+++AT+CSQ\r\n";
+        feed(parser, input);
+        CHECK_EQ("raw AT+CSQ\r\n data + ++ more", data_state.data);
+        for (const char *view : data_state.views)
+        {
+            if (*view != '+')
+            {
+                CHECK((view >= input.data() && view < input.data() + input.size())); // Data is passed without copying it.
+            }
+        }
+        CHECK_EQ(1, data_state.escapes);
+        REQUIRE_EQ(2, commands.size());
+        CHECK_EQ("CSQ", commands[1].command);
+        CHECK_EQ("CONNECT\r\nOK\r\n", data_state.output);
+        CHECK_FALSE(at_parser_is_in_data_mode(parser));
+    }
+    SUBCASE("Escape split over buffers")
+    {
+        feed(parser, "AT+DIAL\r\nab+");
+        feed(parser, "+");
+        CHECK_EQ("ab", data_state.data);
+        feed(parser, "+AT+CSQ\r\n");
+        CHECK_EQ(1, data_state.escapes);
+        REQUIRE_EQ(2, commands.size());
+    }
+    SUBCASE("With guard time")
+    {
+        data_state.guard_time = 100;
+        feed(parser, "AT+DIAL\r\n");
+        data_state.now = 50;
+        feed(parser, "+++"); // No silence in front of it.
+        data_state.now = 200;
+        CHECK_EQ(0, at_parser_poll_data_mode(parser));
+        CHECK(at_parser_is_in_data_mode(parser));
+        CHECK_EQ("+++", data_state.data);
+        data_state.now = 250;
+        feed(parser, "x++"); // Not at the start of a burst.
+        data_state.now = 400;
+        feed(parser, "++");
+        data_state.now = 450;
+        feed(parser, "+");
+        data_state.now = 500;
+        feed(parser, "z"); // Not silent after it.
+        CHECK_EQ("+++x+++++z", data_state.data);
+        data_state.now = 700;
+        feed(parser, "++");
+        data_state.now = 799;
+        feed(parser, "+");
+        CHECK_EQ(0, at_parser_poll_data_mode(parser));
+        CHECK(at_parser_is_in_data_mode(parser));
+        data_state.now = 899;
+        CHECK_EQ(0, at_parser_poll_data_mode(parser));
+        CHECK_FALSE(at_parser_is_in_data_mode(parser));
+        CHECK_EQ("+++x+++++z", data_state.data);
+        CHECK_EQ(1, data_state.escapes);
+        feed(parser, "AT+CSQ\r\n");
+        REQUIRE_EQ(2, commands.size());
+    }
+    SUBCASE("Slow escape characters are data")
+    {
+        data_state.guard_time = 100;
+        feed(parser, "AT+DIAL\r\n");
+        data_state.now = 200;
+        feed(parser, "+");
+        data_state.now = 350;
+        feed(parser, "++");
+        data_state.now = 400;
+        feed(parser, "y");
+        CHECK_EQ("+++y", data_state.data);
+        CHECK(at_parser_is_in_data_mode(parser));
+    }
+    SUBCASE("The clock stays while the guard time needs it")
+    {
+        data_state.guard_time = 100;
+        feed(parser, "AT+DIAL\r\n");
+        data_state.now = 200;
+        feed(parser, "+++");
+        CHECK_NE(0, at_parser_set_clock(parser, nullptr, nullptr));
+        data_state.now = 300;
+        CHECK_EQ(0, at_parser_poll_data_mode(parser));
+        CHECK_FALSE(at_parser_is_in_data_mode(parser));
+        CHECK_EQ(0, at_parser_set_clock(parser, nullptr, nullptr));
+    }
+    SUBCASE("Leaving and configuration errors")
+    {
+        struct at_parser_data_mode_config config = {};
+        CHECK_NE(0, at_parser_enter_data_mode(parser, &config));
+        config.sink = collect_data;
+        config.guard_time = 10;
+        CHECK_EQ(0, at_parser_set_clock(parser, nullptr, nullptr));
+        CHECK_NE(0, at_parser_enter_data_mode(parser, &config));
+        config.guard_time = 0;
+        CHECK_EQ(0, at_parser_enter_data_mode(parser, &config));
+        feed(parser, "12+");
+        CHECK_EQ(0, at_parser_leave_data_mode(parser));
+        CHECK_EQ("12+", data_state.data);
+        feed(parser, "AT+CSQ\r\n");
+        REQUIRE_EQ(1, commands.size());
+        CHECK_EQ(0, data_state.escapes);
+    }
+
+    at_parser_free(parser);
+}
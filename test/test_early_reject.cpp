@@ -0,0 +1,127 @@
+#include "doctest.h"
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include "at_parser/at_parser.h"
+#include "parser_helpers.h"
+
+namespace
+{
+    std::string reject_output;
+
+    extern "C" void count_reject_batch(at_parser_handle_t, void *userdata, struct at_parser_command_record *, size_t record_count)
+    {
+        *static_cast<size_t *>(userdata) += record_count;
+    }
+
+    void feed_bytes(at_parser_handle_t parser, const std::string &input)
+    {
+        for (char chr : input)
+        {
+            CHECK_EQ(0, at_parser_process_buffer(parser, &chr, 1));
+        }
+    }
+}
+
+TEST_CASE("Test early rejection of unknown commands")
+{
+    reject_output.clear();
+    commands.clear();
+    at_parser_handle_t parser = nullptr;
+    CHECK_EQ(0, at_parser_create(&parser, 32, '\\', ','));
+    CHECK_EQ(0, at_parser_set_response_writer(parser, at_parser_collect_response, &reject_output));
+    CHECK_EQ(0, at_parser_add_command_handler(parser, "CSQ", at_parser_default_received_command, nullptr));
+    CHECK_EQ(0, at_parser_add_command_handler(parser, "CFUN", at_parser_default_received_command, nullptr));
+    CHECK_EQ(0, at_parser_set_early_reject(parser, true));
+
+    SUBCASE("Long unknown line is skipped")
+    {
+        const std::string input = "AT+XYZ=" + std::string(500, '1') + "\r\nAT+CSQ\r\n";
+        feed_bytes(parser, input);
+        CHECK_EQ("ERROR\r\n", reject_output);
+        REQUIRE_EQ(1, commands.size());
+        CHECK_EQ("CSQ", commands[0].command);
+        reject_output.clear();
+        commands.clear();
+        CHECK_EQ(0, at_parser_process_buffer(parser, input.data(), input.size()));
+        CHECK_EQ("ERROR\r\n", reject_output);
+        CHECK_EQ(1, commands.size());
+    }
+    SUBCASE("Names that can still match are buffered")
+    {
+        feed_bytes(parser, "AT+C");
+        CHECK(reject_output.empty());
+        feed_bytes(parser, "FUN=1,2\r\nAT+CS");
+        feed_bytes(parser, "Q\r\nAT+CF");
+        feed_bytes(parser, "X=1\r\n");
+        REQUIRE_EQ(2, commands.size());
+        CHECK_EQ("CFUN", commands[0].command);
+        CHECK_EQ(2, commands[0].arguments.size());
+        CHECK_EQ("CSQ", commands[1].command);
+        CHECK_EQ("ERROR\r\n", reject_output);
+    }
+    SUBCASE("Complete lines with unknown commands")
+    {
+        const std::string input = "AT+CSQX\r\nAT+CS\r\nAT+CSQ?\r\nAT+CFUNN=1\r\n";
+        CHECK_EQ(0, at_parser_process_buffer(parser, input.data(), input.size()));
+        CHECK_EQ("ERROR\r\nERROR\r\nERROR\r\n", reject_output);
+        REQUIRE_EQ(1, commands.size());
+        CHECK_EQ(AT_PARSER_COMMAND_TYPE_TEST, commands[0].type);
+    }
+    SUBCASE("Lines without AT+ are skipped silently")
+    {
+        feed_bytes(parser, "hello " + std::string(100, 'x') + "\r\n\r\nAT+CSQ\r\n");
+        CHECK(reject_output.empty());
+        CHECK_EQ(1, commands.size());
+    }
+    SUBCASE("Zero copy ingest")
+    {
+        const std::string input = "AT+NOPE=" + std::string(100, 'y') + "\r\nAT+CSQ\r\n";
+        size_t offset = 0;
+        while (offset < input.size())
+        {
+            char *buffer = nullptr;
+            size_t available = 0;
+            REQUIRE_EQ(0, at_parser_get_ingest_buffer(parser, &buffer, &available));
+            const size_t length = std::min(std::min(available, (size_t)10), input.size() - offset);
+            memcpy(buffer, input.data() + offset, length);
+            CHECK_EQ(0, at_parser_commit_ingest(parser, length));
+            offset += length;
+        }
+        CHECK_EQ("ERROR\r\n", reject_output);
+        CHECK_EQ(1, commands.size());
+    }
+    SUBCASE("Registry names")
+    {
+        at_parser_registry_handle_t registry = nullptr;
+        CHECK_EQ(0, at_parser_registry_create(&registry));
+        CHECK_EQ(0, at_parser_registry_add_command_handler(registry, "CGMI", at_parser_default_received_command, nullptr));
+        CHECK_EQ(0, at_parser_registry_add_command_handler(registry, "CGMR", at_parser_default_received_command, nullptr));
+        CHECK_EQ(0, at_parser_registry_add_command_handler(registry, "COPS", at_parser_default_received_command, nullptr));
+        CHECK_EQ(0, at_parser_registry_freeze(registry));
+        CHECK_EQ(0, at_parser_attach_registry(parser, registry));
+        feed_bytes(parser, "AT+CGMR\r\nAT+CGX\r\nAT+COPS?\r\nAT+CGM\r\nAT+D\r\n");
+        REQUIRE_EQ(2, commands.size());
+        CHECK_EQ("CGMR", commands[0].command);
+        CHECK_EQ("COPS", commands[1].command);
+        CHECK_EQ("ERROR\r\nERROR\r\nERROR\r\n", reject_output);
+        at_parser_free(parser);
+        parser = nullptr;
+        at_parser_registry_free(registry);
+    }
+    SUBCASE("Batch mode and disabled")
+    {
+        size_t batched = 0;
+        CHECK_EQ(0, at_parser_set_batch_handler(parser, count_reject_batch, &batched, 0));
+        feed_bytes(parser, "AT+ANY\r\nnoise\r\n");
+        CHECK_EQ(1, batched);
+        reject_output.clear();
+        CHECK_EQ(0, at_parser_set_batch_handler(parser, nullptr, nullptr, 0));
+        CHECK_EQ(0, at_parser_set_early_reject(parser, false));
+        feed_bytes(parser, "AT+XYZ\r\n");
+        CHECK(reject_output.empty());
+        CHECK_NE(0, at_parser_set_early_reject(nullptr, true));
+    }
+
+    at_parser_free(parser);
+}
@@ -0,0 +1,122 @@
+#include "doctest.h"
+#include <string.h>
+#include <string>
+#include <vector>
+#include "at_parser/at_parser.h"
+#include "parser_helpers.h"
+
+namespace
+{
+    std::vector<at_parser_flow_state> flow_states;
+    size_t queue_depth = 0;
+
+    extern "C" void record_flow_state(at_parser_handle_t, void *, enum at_parser_flow_state state)
+    {
+        flow_states.push_back(state);
+    }
+
+    extern "C" void queue_command(at_parser_handle_t parser, void *userdata, const char *command_name, enum at_parser_command_type type, struct at_parser_argument *argument_list, size_t argument_list_length)
+    {
+        at_parser_default_received_command(parser, userdata, command_name, type, argument_list, argument_list_length);
+        CHECK_EQ(0, at_parser_update_pending_commands(parser, ++queue_depth));
+    }
+}
+
+TEST_CASE("Test flow control signaling")
+{
+    at_parser_handle_t handle = nullptr;
+    commands.clear();
+    flow_states.clear();
+    queue_depth = 0;
+    CHECK_EQ(0, at_parser_create(&handle, 20, '\x1B', ','));
+    CHECK_EQ(0, at_parser_add_command_handler(handle, "ABC", queue_command, NULL));
+
+    struct at_parser_flow_control_config config = {};
+    config.callback = record_flow_state;
+
+    SUBCASE("Invalid watermarks are rejected")
+    {
+        config.pending_high_watermark = 1;
+        config.pending_low_watermark = 2;
+        CHECK_NE(0, at_parser_set_flow_control(handle, &config));
+    }
+
+    SUBCASE("Pending commands defer the remaining data")
+    {
+        config.pending_high_watermark = 2;
+        config.pending_low_watermark = 0;
+        CHECK_EQ(0, at_parser_set_flow_control(handle, &config));
+
+        const char *buffer = "AT+ABC=1\r\nAT+ABC=2\r\nAT+ABC=3\r\n";
+        size_t accepted = 0;
+        CHECK_EQ(0, at_parser_process_buffer_partial(handle, buffer, strlen(buffer), &accepted));
+        CHECK_EQ(20, accepted);
+        CHECK_EQ(2, commands.size());
+        CHECK_EQ(AT_PARSER_FLOW_PAUSE, at_parser_get_flow_state(handle));
+        REQUIRE_EQ(1, flow_states.size());
+        CHECK_EQ(AT_PARSER_FLOW_PAUSE, flow_states[0]);
+
+        CHECK_EQ(0, at_parser_process_buffer_partial(handle, buffer + accepted, strlen(buffer) - accepted, &accepted));
+        CHECK_EQ(0, accepted);
+
+        queue_depth = 1;
+        CHECK_EQ(0, at_parser_update_pending_commands(handle, queue_depth));
+        CHECK_EQ(AT_PARSER_FLOW_PAUSE, at_parser_get_flow_state(handle));
+        queue_depth = 0;
+        CHECK_EQ(0, at_parser_update_pending_commands(handle, queue_depth));
+        CHECK_EQ(AT_PARSER_FLOW_RESUME, at_parser_get_flow_state(handle));
+        REQUIRE_EQ(2, flow_states.size());
+        CHECK_EQ(AT_PARSER_FLOW_RESUME, flow_states[1]);
+
+        CHECK_EQ(0, at_parser_process_buffer_partial(handle, buffer + 20, strlen(buffer) - 20, &accepted));
+        CHECK_EQ(10, accepted);
+        CHECK_EQ(3, commands.size());
+        CHECK_EQ(std::string("3"), commands[2].arguments[0]);
+    }
+
+    SUBCASE("Reconfiguring while paused")
+    {
+        config.pending_high_watermark = 1;
+        CHECK_EQ(0, at_parser_set_flow_control(handle, &config));
+        CHECK_EQ(0, at_parser_process_buffer(handle, "AT+ABC=1\r\n", 10));
+        CHECK_EQ(AT_PARSER_FLOW_PAUSE, at_parser_get_flow_state(handle));
+
+        // The new config doesn't look at the pending commands anymore, so the parser resumes.
+        config.pending_high_watermark = 0;
+        CHECK_EQ(0, at_parser_set_flow_control(handle, &config));
+        CHECK_EQ(AT_PARSER_FLOW_RESUME, at_parser_get_flow_state(handle));
+        REQUIRE_EQ(2, flow_states.size());
+        CHECK_EQ(AT_PARSER_FLOW_RESUME, flow_states[1]);
+        size_t accepted = 0;
+        CHECK_EQ(0, at_parser_process_buffer_partial(handle, "AT+ABC=2\r\n", 10, &accepted));
+        CHECK_EQ(10, accepted);
+        CHECK_EQ(2, commands.size());
+
+        // A higher watermark than the pending commands doesn't pause again.
+        config.pending_high_watermark = 5;
+        config.pending_low_watermark = 1;
+        CHECK_EQ(0, at_parser_set_flow_control(handle, &config));
+        CHECK_EQ(AT_PARSER_FLOW_RESUME, at_parser_get_flow_state(handle));
+    }
+
+    SUBCASE("Buffer occupancy pauses and resumes")
+    {
+        config.buffer_high_watermark = 8;
+        config.buffer_low_watermark = 2;
+        CHECK_EQ(0, at_parser_set_flow_control(handle, &config));
+
+        const char *buffer = "AT+ABC=12";
+        CHECK_EQ(0, at_parser_process_buffer(handle, buffer, strlen(buffer)));
+        REQUIRE_EQ(1, flow_states.size());
+        CHECK_EQ(AT_PARSER_FLOW_PAUSE, flow_states[0]);
+
+        size_t accepted = 0;
+        CHECK_EQ(0, at_parser_process_buffer_partial(handle, "\r\n", 2, &accepted));
+        CHECK_EQ(2, accepted);
+        CHECK_EQ(1, commands.size());
+        REQUIRE_EQ(2, flow_states.size());
+        CHECK_EQ(AT_PARSER_FLOW_RESUME, flow_states[1]);
+    }
+
+    at_parser_free(handle);
+}
@@ -0,0 +1,72 @@
+#include "doctest.h"
+#include <string.h>
+#include <string>
+#include "at_parser/at_parser.h"
+#include "parser_helpers.h"
+
+namespace
+{
+    std::string history_output;
+}
+
+TEST_CASE("Test command history")
+{
+    history_output.clear();
+    commands.clear();
+    at_parser_handle_t parser = nullptr;
+    CHECK_EQ(0, at_parser_create(&parser, 64, '\\', ','));
+    CHECK_EQ(0, at_parser_set_response_writer(parser, at_parser_collect_response, &history_output));
+    CHECK_EQ(0, at_parser_add_command_handler(parser, "CMGS", at_parser_default_received_command, nullptr));
+    CHECK_EQ(0, at_parser_add_command_handler(parser, "CSQ", at_parser_default_received_command, nullptr));
+
+    SUBCASE("Repeated lines use the parsed arguments")
+    {
+        CHECK_EQ(0, at_parser_set_history(parser, 2));
+        const std::string input = "AT+CMGS=1,\"a\\\"b\"\r\nAT+CSQ\r\nAT+CMGS=1,\"a\\\"b\"\r\nAT+CMGS=2\r\nAT+CSQ?\r\nAT+CMGS=1,\"a\\\"b\"\r\n";
+        CHECK_EQ(0, at_parser_process_buffer(parser, input.data(), input.size()));
+        REQUIRE_EQ(6, commands.size());
+        for (size_t i : {0, 2, 5})
+        {
+            CHECK_EQ("CMGS", commands[i].command);
+            CHECK_EQ(AT_PARSER_COMMAND_TYPE_SET, commands[i].type);
+            REQUIRE_EQ(2, commands[i].arguments.size());
+            CHECK_EQ("1", commands[i].arguments[0]);
+            CHECK_EQ("a\"b", commands[i].arguments[1]);
+        }
+        CHECK_EQ(AT_PARSER_COMMAND_TYPE_TEST, commands[4].type);
+        CHECK_EQ(1, at_parser_get_history_hits(parser)); // The last line was pushed out by the two lines in front of it.
+    }
+    SUBCASE("A/ repeats the last command")
+    {
+        CHECK_EQ(0, at_parser_set_history(parser, 4));
+        CHECK_EQ(0, at_parser_process_buffer(parser, "A/", 2));
+        CHECK_EQ("ERROR\r\n", history_output);
+        CHECK_EQ(0, at_parser_process_buffer(parser, "AT+CMGS=7\r\nAT+CSQ\r\nAT+CMGS=7\r\nA", 31));
+        CHECK_EQ(3, commands.size());
+        CHECK_EQ(0, at_parser_process_buffer(parser, "/", 1)); // No line end needed.
+        REQUIRE_EQ(4, commands.size());
+        CHECK_EQ("CMGS", commands[3].command);
+        REQUIRE_EQ(1, commands[3].arguments.size());
+        CHECK_EQ("7", commands[3].arguments[0]);
+        CHECK_EQ(0, at_parser_process_buffer(parser, "A/\r\nAT+CSQ\r\nA/", 14));
+        REQUIRE_EQ(7, commands.size());
+        CHECK_EQ("CMGS", commands[4].command);
+        CHECK_EQ("CSQ", commands[6].command);
+        CHECK_EQ(0, at_parser_process_line(parser, "A/", 2));
+        CHECK_EQ(8, commands.size());
+        CHECK_EQ(6, at_parser_get_history_hits(parser));
+    }
+    SUBCASE("Disabled history")
+    {
+        CHECK_EQ(0, at_parser_set_history(parser, 3));
+        CHECK_EQ(0, at_parser_set_history(parser, 0));
+        const std::string input = "AT+CSQ\r\nA/AT+CSQ\r\nAT+CSQ\r\n";
+        CHECK_EQ(0, at_parser_process_buffer(parser, input.data(), input.size()));
+        CHECK_EQ(2, commands.size());
+        CHECK_EQ(0, at_parser_get_history_hits(parser));
+        CHECK(history_output.empty());
+        CHECK_NE(0, at_parser_set_history(nullptr, 1));
+    }
+
+    at_parser_free(parser);
+}
@@ -0,0 +1,33 @@
+#include "doctest.h"
+#include <string.h>
+#include <string>
+#include <vector>
+#include "at_parser/at_parser.h"
+#include "parser_helpers.h"
+
+TEST_CASE("Test ingesting directly into the parser buffer")
+{
+    at_parser_handle_t handle = nullptr;
+    commands.clear();
+    CHECK_EQ(0, at_parser_create(&handle, 16, '\x1B', ','));
+    CHECK_EQ(0, at_parser_add_command_handler(handle, "ABC", at_parser_default_received_command, NULL));
+
+    char *buffer = nullptr;
+    size_t available = 0;
+    CHECK_EQ(0, at_parser_get_ingest_buffer(handle, &buffer, &available));
+    CHECK_EQ(16, available);
+    memcpy(buffer, "AT+ABC=1\r\nAT+", 13);
+    CHECK_EQ(0, at_parser_commit_ingest(handle, 13));
+    CHECK_EQ(1, commands.size());
+    CHECK_EQ(std::string("1"), commands[0].arguments[0]);
+
+    CHECK_EQ(0, at_parser_get_ingest_buffer(handle, &buffer, &available));
+    CHECK_EQ(13, available);
+    CHECK_NE(0, at_parser_commit_ingest(handle, available + 1));
+    memcpy(buffer, "ABC\r\n", 5);
+    CHECK_EQ(0, at_parser_commit_ingest(handle, 5));
+    CHECK_EQ(2, commands.size());
+    CHECK_EQ(AT_PARSER_COMMAND_TYPE_EXECUTE, commands[1].type);
+
+    at_parser_free(handle);
+}
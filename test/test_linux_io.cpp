@@ -0,0 +1,175 @@
+#include "doctest.h"
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+#include "at_parser/at_parser.h"
+#include "at_parser/at_parser_linux_io.h"
+#include "parser_helpers.h"
+
+namespace
+{
+    struct pty_pair
+    {
+        int master = -1;
+        int slave = -1;
+
+        pty_pair()
+        {
+            master = posix_openpt(O_RDWR | O_NOCTTY);
+            REQUIRE(master >= 0);
+            CHECK_EQ(0, grantpt(master));
+            CHECK_EQ(0, unlockpt(master));
+            slave = open(ptsname(master), O_RDWR | O_NOCTTY);
+            REQUIRE(slave >= 0);
+            struct termios tio;
+            CHECK_EQ(0, tcgetattr(slave, &tio));
+            cfmakeraw(&tio);
+            CHECK_EQ(0, tcsetattr(slave, TCSANOW, &tio));
+        }
+
+        ~pty_pair()
+        {
+            close(master);
+            if (slave >= 0)
+            {
+                close(slave);
+            }
+        }
+    };
+
+    struct io_context
+    {
+        at_parser_linux_io_handle_t io;
+        int fd;
+    };
+
+    std::vector<int> hung_up;
+
+    extern "C" void reply_ok(at_parser_handle_t parser, void *userdata, const char *command_name, enum at_parser_command_type type, struct at_parser_argument *argument_list, size_t argument_list_length)
+    {
+        at_parser_default_received_command(parser, userdata, command_name, type, argument_list, argument_list_length);
+        io_context *ctx = static_cast<io_context *>(userdata);
+        std::string echo = std::string("+") + command_name + "\r\n";
+        CHECK_EQ(0, at_parser_linux_io_write(ctx->io, ctx->fd, echo.c_str(), echo.size(), true));
+        CHECK_EQ(0, at_parser_linux_io_write(ctx->io, ctx->fd, "OK\r\n", 4, false));
+    }
+
+    extern "C" void remove_other(at_parser_handle_t parser, void *userdata, const char *command_name, enum at_parser_command_type type, struct at_parser_argument *argument_list, size_t argument_list_length)
+    {
+        at_parser_default_received_command(parser, userdata, command_name, type, argument_list, argument_list_length);
+        io_context *ctx = static_cast<io_context *>(userdata);
+        CHECK_EQ(0, at_parser_linux_io_remove_channel(ctx->io, ctx->fd));
+    }
+
+    extern "C" void record_hangup(at_parser_linux_io_handle_t io, void *, int fd, at_parser_handle_t)
+    {
+        hung_up.push_back(fd);
+        CHECK_EQ(0, at_parser_linux_io_remove_channel(io, fd));
+    }
+
+    std::string read_available(int fd)
+    {
+        std::string result;
+        char buffer[64];
+        ssize_t count = 0;
+        while ((count = read(fd, buffer, sizeof(buffer))) > 0)
+        {
+            result.append(buffer, (size_t)count);
+        }
+        return result;
+    }
+}
+
+TEST_CASE("Test Linux I/O driver with pty pairs")
+{
+    at_parser_linux_io_handle_t io = nullptr;
+    at_parser_handle_t first = nullptr;
+    at_parser_handle_t second = nullptr;
+    commands.clear();
+    hung_up.clear();
+    CHECK_EQ(0, at_parser_linux_io_create(&io, 8));
+    CHECK_EQ(0, at_parser_create(&first, 50, '\x1B', ','));
+    CHECK_EQ(0, at_parser_create(&second, 50, '\x1B', ','));
+
+    pty_pair one;
+    pty_pair two;
+    io_context first_ctx{io, one.master};
+    io_context second_ctx{io, two.master};
+    CHECK_EQ(0, at_parser_add_command_handler(first, "ABC", reply_ok, &first_ctx));
+    CHECK_EQ(0, at_parser_add_command_handler(second, "DEF", reply_ok, &second_ctx));
+    CHECK_EQ(0, at_parser_linux_io_add_channel(io, one.master, first));
+    CHECK_EQ(0, at_parser_linux_io_add_channel(io, two.master, second));
+    CHECK_NE(0, at_parser_linux_io_add_channel(io, one.master, first));
+    fcntl(one.slave, F_SETFL, O_NONBLOCK);
+    fcntl(two.slave, F_SETFL, O_NONBLOCK);
+
+    SUBCASE("Data of multiple channels is parsed and the replies are written back")
+    {
+        CHECK_EQ(4, write(one.slave, "AT+A", 4));
+        CHECK_EQ(1, at_parser_linux_io_poll(io, 1000));
+        CHECK_EQ(0, commands.size());
+        CHECK_EQ(9, write(one.slave, "BC=1\r\nAT+", 9));
+        CHECK_EQ(17, write(two.slave, "AT+DEF?\r\nAT+DEF\r\n", 17));
+        int handled = 0;
+        for (int i = 0; i < 10 && commands.size() < 3; i++)
+        {
+            handled += at_parser_linux_io_poll(io, 1000);
+        }
+        CHECK_GE(handled, 2);
+        CHECK_EQ(3, commands.size());
+        CHECK_EQ(std::string("+ABC\r\nOK\r\n"), read_available(one.slave));
+        CHECK_EQ(std::string("+DEF\r\nOK\r\n+DEF\r\nOK\r\n"), read_available(two.slave));
+    }
+
+    SUBCASE("Hangup of the other side is reported")
+    {
+        CHECK_EQ(0, at_parser_linux_io_set_hangup_callback(io, record_hangup, NULL));
+        close(one.slave);
+        one.slave = -1;
+        for (int i = 0; i < 10 && hung_up.empty(); i++)
+        {
+            at_parser_linux_io_poll(io, 1000);
+        }
+        CHECK_EQ(1, hung_up.size());
+        CHECK_EQ(one.master, hung_up[0]);
+        CHECK_NE(0, at_parser_linux_io_write(io, one.master, "OK\r\n", 4, false));
+    }
+    SUBCASE("A handler removes another channel with a pending event")
+    {
+        // Each handler removes the other channel, whichever event is handled first the other one must be skipped.
+        io_context remove_second{io, two.master};
+        io_context remove_first{io, one.master};
+        CHECK_EQ(0, at_parser_add_command_handler(first, "RMV", remove_other, &remove_second));
+        CHECK_EQ(0, at_parser_add_command_handler(second, "RMV", remove_other, &remove_first));
+        CHECK_EQ(8, write(one.slave, "AT+RMV\r\n", 8));
+        CHECK_EQ(8, write(two.slave, "AT+RMV\r\n", 8));
+        for (int i = 0; i < 10 && commands.empty(); i++)
+        {
+            at_parser_linux_io_poll(io, 1000);
+        }
+        at_parser_linux_io_poll(io, 10);
+        CHECK_EQ(1, commands.size());
+    }
+    SUBCASE("A handler removes its own channel while more data is pending")
+    {
+        // The first read fills the whole parser buffer, so the driver would read the channel again after the handler.
+        io_context remove_self{io, one.master};
+        CHECK_EQ(0, at_parser_add_command_handler(first, "RMV", remove_other, &remove_self));
+        const std::string data = "AT+RMV\r\n" + std::string(100, 'x');
+        CHECK_EQ((ssize_t)data.size(), write(one.slave, data.c_str(), data.size()));
+        for (int i = 0; i < 10 && commands.empty(); i++)
+        {
+            at_parser_linux_io_poll(io, 1000);
+        }
+        CHECK_EQ(1, commands.size());
+        CHECK_NE(0, at_parser_linux_io_write(io, one.master, "OK\r\n", 4, false));
+    }
+
+    at_parser_linux_io_free(io);
+    at_parser_free(first);
+    at_parser_free(second);
+}
@@ -0,0 +1,259 @@
+#include "doctest.h"
+#include <string.h>
+#include <string>
+#include <thread>
+#include <vector>
+#include "at_parser/at_parser.h"
+#include "at_parser/at_parser_output.h"
+
+namespace
+{
+    struct link_log
+    {
+        std::vector<std::string> writes;
+        size_t accept = SIZE_MAX; ///< Bytes the link takes per write.
+        uint32_t now = 0;
+    };
+
+    extern "C" size_t write_output_link(at_parser_output_handle_t, void *userdata, const char *data, size_t length)
+    {
+        link_log *log = static_cast<link_log *>(userdata);
+        const size_t written = length < log->accept ? length : log->accept;
+        log->writes.push_back(std::string(data, written));
+        return written;
+    }
+
+    extern "C" uint32_t output_test_clock(void *userdata)
+    {
+        return static_cast<link_log *>(userdata)->now;
+    }
+
+    extern "C" void respond_multi_line(at_parser_handle_t parser, void *, const char *, enum at_parser_command_type, struct at_parser_argument *, size_t)
+    {
+        at_parser_write_response(parser, "+COPS: 0,0,\"A\"\r\n", 16);
+        at_parser_write_response(parser, "+COPS: 0,0,\"B\"\r\n", 16);
+        at_parser_write_response(parser, "OK\r\n", 4);
+    }
+
+    std::string joined(const std::vector<std::string> &writes)
+    {
+        std::string result;
+        for (const std::string &write : writes)
+        {
+            result += write;
+        }
+        return result;
+    }
+}
+
+TEST_CASE("Test output scheduler")
+{
+    link_log log;
+    struct at_parser_output_config config = {};
+    config.queue_size = 256;
+    config.urc_queue_size = 64;
+    config.writer = write_output_link;
+    config.writer_userdata = &log;
+    config.clock = output_test_clock;
+    config.clock_userdata = &log;
+    at_parser_handle_t parser = nullptr;
+    at_parser_output_handle_t output = nullptr;
+    struct at_parser_output_stats stats = {};
+    CHECK_EQ(0, at_parser_create(&parser, 100, '\x1B', ','));
+    CHECK_EQ(0, at_parser_add_command_handler(parser, "COPS", respond_multi_line, nullptr));
+
+    SUBCASE("Invalid config")
+    {
+        config.writer = nullptr;
+        CHECK_NE(0, at_parser_output_create(&output, &config));
+        config.writer = write_output_link;
+        config.clock = nullptr;
+        config.max_urc_delay = 10;
+        CHECK_NE(0, at_parser_output_create(&output, &config));
+    }
+    SUBCASE("Responses are written whole")
+    {
+        REQUIRE_EQ(0, at_parser_output_create(&output, &config));
+        CHECK_EQ(0, at_parser_output_attach(output, parser));
+        CHECK_EQ(0, at_parser_process_buffer(parser, "AT+COPS\r\n", 9));
+        REQUIRE_EQ(1, log.writes.size());
+        CHECK_EQ("+COPS: 0,0,\"A\"\r\n+COPS: 0,0,\"B\"\r\nOK\r\n", log.writes[0]);
+        CHECK_EQ(0, at_parser_output_get_stats(output, &stats));
+        CHECK_EQ(1, stats.responses);
+    }
+    SUBCASE("URCs wait for the final result code")
+    {
+        REQUIRE_EQ(0, at_parser_output_create(&output, &config));
+        CHECK_EQ(0, at_parser_output_attach(output, parser));
+        CHECK_EQ(0, at_parser_write_response(parser, "+CMGL: 1\r\n", 10));
+        CHECK_EQ(0, at_parser_output_send_urc(output, "+CREG: 1\r\n", 10));
+        CHECK(log.writes.empty());
+        CHECK_EQ(0, at_parser_write_response(parser, "+CME ERROR: 4\r\n", 15));
+        REQUIRE_EQ(1, log.writes.size());
+        CHECK_EQ("+CMGL: 1\r\n+CME ERROR: 4\r\n+CREG: 1\r\n", log.writes[0]);
+        CHECK_EQ(0, at_parser_output_send_urc(output, "RING\r\n", 6));
+        REQUIRE_EQ(2, log.writes.size());
+        CHECK_EQ("RING\r\n", log.writes[1]);
+        CHECK_EQ(0, at_parser_output_get_stats(output, &stats));
+        CHECK_EQ(2, stats.urcs);
+        CHECK_EQ(1, stats.deferred_urcs);
+        CHECK_EQ(0, stats.forced_urcs);
+    }
+    SUBCASE("CONNECT ends the response")
+    {
+        REQUIRE_EQ(0, at_parser_output_create(&output, &config));
+        CHECK_EQ(0, at_parser_output_attach(output, parser));
+        CHECK_EQ(0, at_parser_write_response(parser, "CONNECTED\r\n", 11));
+        CHECK_EQ(0, at_parser_output_send_urc(output, "RING\r\n", 6));
+        CHECK(log.writes.empty());
+        CHECK_EQ(0, at_parser_write_response(parser, "CONNECT 115200\r\n", 16));
+        REQUIRE_EQ(1, log.writes.size());
+        CHECK_EQ("CONNECTED\r\nCONNECT 115200\r\nRING\r\n", log.writes[0]);
+        CHECK_EQ(0, at_parser_write_response(parser, "CONNECT\r\n", 9));
+        REQUIRE_EQ(2, log.writes.size());
+        CHECK_EQ("CONNECT\r\n", log.writes[1]);
+    }
+    SUBCASE("Explicit response bounds")
+    {
+        REQUIRE_EQ(0, at_parser_output_create(&output, &config));
+        CHECK_EQ(0, at_parser_output_begin_response(output));
+        CHECK_EQ(0, at_parser_output_send_urc(output, "RING\r\n", 6));
+        CHECK(log.writes.empty());
+        CHECK_EQ(0, at_parser_output_end_response(output));
+        REQUIRE_EQ(1, log.writes.size());
+        CHECK_EQ("RING\r\n", log.writes[0]);
+    }
+    SUBCASE("Latency bound forces URCs out at a line boundary")
+    {
+        config.max_urc_delay = 10;
+        REQUIRE_EQ(0, at_parser_output_create(&output, &config));
+        CHECK_EQ(0, at_parser_output_attach(output, parser));
+        CHECK_EQ(0, at_parser_write_response(parser, "+CMGL: 1\r\n+CMGL", 15));
+        CHECK_EQ(0, at_parser_output_send_urc(output, "+CREG: 1\r\n", 10));
+        log.now = 9;
+        CHECK_EQ(0, at_parser_output_poll(output));
+        CHECK(log.writes.empty());
+        log.now = 10;
+        CHECK_EQ(0, at_parser_output_poll(output));
+        REQUIRE_EQ(1, log.writes.size());
+        CHECK_EQ("+CMGL: 1\r\n+CREG: 1\r\n", log.writes[0]);
+        CHECK_EQ(0, at_parser_write_response(parser, ": 2\r\nOK\r\n", 9));
+        REQUIRE_EQ(2, log.writes.size());
+        CHECK_EQ("+CMGL: 2\r\nOK\r\n", log.writes[1]);
+        CHECK_EQ(0, at_parser_output_get_stats(output, &stats));
+        CHECK_EQ(1, stats.forced_urcs);
+    }
+    SUBCASE("Full URC queue forces URCs out")
+    {
+        config.urc_queue_size = 8;
+        REQUIRE_EQ(0, at_parser_output_create(&output, &config));
+        CHECK_EQ(0, at_parser_output_attach(output, parser));
+        CHECK_EQ(0, at_parser_write_response(parser, "+CMGL: 1\r\n", 10));
+        CHECK_EQ(0, at_parser_output_send_urc(output, "RING\r\n", 6));
+        CHECK_EQ(0, at_parser_output_send_urc(output, "RING\r\n", 6));
+        REQUIRE_EQ(1, log.writes.size());
+        CHECK_EQ("+CMGL: 1\r\nRING\r\nRING\r\n", log.writes[0]);
+        CHECK_EQ(0, at_parser_output_get_stats(output, &stats));
+        CHECK_EQ(2, stats.forced_urcs);
+    }
+    SUBCASE("Slow link coalesces queued output")
+    {
+        log.accept = 4;
+        REQUIRE_EQ(0, at_parser_output_create(&output, &config));
+        CHECK_EQ(0, at_parser_output_attach(output, parser));
+        CHECK_EQ(0, at_parser_process_buffer(parser, "AT+COPS\r\n", 9));
+        CHECK_EQ(0, at_parser_output_send_urc(output, "RING\r\n", 6));
+        CHECK_EQ(2, log.writes.size());
+        log.accept = SIZE_MAX;
+        CHECK_EQ(0, at_parser_output_poll(output));
+        REQUIRE_EQ(3, log.writes.size());
+        CHECK_EQ("+COPS: 0,0,\"A\"\r\n+COPS: 0,0,\"B\"\r\nOK\r\nRING\r\n", joined(log.writes));
+        CHECK_EQ(0, at_parser_output_get_queued(output));
+    }
+    SUBCASE("Coalesce mode writes on flush")
+    {
+        config.coalesce = true;
+        REQUIRE_EQ(0, at_parser_output_create(&output, &config));
+        CHECK_EQ(0, at_parser_output_attach(output, parser));
+        CHECK_EQ(0, at_parser_process_buffer(parser, "AT+COPS\r\nAT+COPS\r\n", 18));
+        CHECK_EQ(0, at_parser_output_send_urc(output, "RING\r\n", 6));
+        CHECK(log.writes.empty());
+        CHECK_EQ(78, at_parser_output_get_queued(output));
+        CHECK_EQ(0, at_parser_output_flush(output));
+        REQUIRE_EQ(1, log.writes.size());
+        CHECK_EQ(78, log.writes[0].size());
+    }
+    SUBCASE("Full queue drops whole messages")
+    {
+        config.coalesce = true;
+        config.queue_size = 16;
+        log.accept = 0;
+        REQUIRE_EQ(0, at_parser_output_create(&output, &config));
+        CHECK_EQ(0, at_parser_output_send_urc(output, "+CREG: 1\r\n", 10));
+        CHECK_NE(0, at_parser_output_send_urc(output, "+CREG: 2\r\n", 10));
+        CHECK_NE(0, at_parser_output_send_urc(output, "+CREG: 3 too long\r\n", 19));
+        CHECK_EQ(10, at_parser_output_get_queued(output));
+        CHECK_EQ(0, at_parser_output_get_stats(output, &stats));
+        CHECK_EQ(10, stats.dropped);
+    }
+    SUBCASE("Detaching restores the parser")
+    {
+        REQUIRE_EQ(0, at_parser_output_create(&output, &config));
+        CHECK_EQ(0, at_parser_output_attach(output, parser));
+        CHECK_EQ(0, at_parser_output_attach(output, nullptr));
+        CHECK_EQ(0, at_parser_process_buffer(parser, "AT+COPS\r\n", 9));
+        CHECK(log.writes.empty());
+    }
+    SUBCASE("URCs from another thread while parsing")
+    {
+        config.urc_queue_size = 4096;
+        REQUIRE_EQ(0, at_parser_output_create(&output, &config));
+        CHECK_EQ(0, at_parser_output_attach(output, parser));
+        const int count = 500;
+        int failed_urcs = 0;
+        std::thread urc_thread([&]() {
+            for (int i = 0; i < count; i++)
+            {
+                failed_urcs += at_parser_output_send_urc(output, "+CREG: 1\r\n", 10) != 0;
+            }
+        });
+        for (int i = 0; i < count; i++)
+        {
+            CHECK_EQ(0, at_parser_process_buffer(parser, "AT+COPS\r\n", 9));
+        }
+        urc_thread.join();
+        CHECK_EQ(0, failed_urcs);
+
+        // The URCs only ever go out between whole responses.
+        const std::string response = "+COPS: 0,0,\"A\"\r\n+COPS: 0,0,\"B\"\r\nOK\r\n";
+        std::string wire = joined(log.writes);
+        int responses = 0;
+        int urcs = 0;
+        while (!wire.empty())
+        {
+            if (wire.compare(0, response.size(), response) == 0)
+            {
+                responses++;
+                wire.erase(0, response.size());
+            }
+            else if (wire.compare(0, 10, "+CREG: 1\r\n") == 0)
+            {
+                urcs++;
+                wire.erase(0, 10);
+            }
+            else
+            {
+                break;
+            }
+        }
+        CHECK(wire.empty());
+        CHECK_EQ(count, responses);
+        CHECK_EQ(count, urcs);
+        CHECK_EQ(0, at_parser_output_get_stats(output, &stats));
+        CHECK_EQ(0u, stats.forced_urcs);
+        CHECK_EQ(0u, stats.dropped);
+    }
+
+    at_parser_output_free(output);
+    at_parser_free(parser);
+}
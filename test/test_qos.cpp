@@ -0,0 +1,121 @@
+#include "doctest.h"
+#include <string.h>
+#include <string>
+#include <vector>
+#include "at_parser/at_parser.h"
+#include "parser_helpers.h"
+
+namespace
+{
+    struct qos_log
+    {
+        std::vector<std::vector<std::string>> batches;
+        std::vector<enum at_parser_qos_class> classes;
+        std::string output;
+        uint32_t now = 0;
+    };
+
+    qos_log qos_state;
+
+    extern "C" void collect_qos_batch(at_parser_handle_t, void *, struct at_parser_command_record *records, size_t record_count)
+    {
+        std::vector<std::string> batch;
+        for (size_t i = 0; i < record_count; i++)
+        {
+            batch.push_back(records[i].command_name);
+            qos_state.classes.push_back(records[i].qos);
+            records[i].response = records[i].command_name;
+            records[i].response_length = records[i].command_name_length;
+            records[i].result = AT_PARSER_BATCH_RESULT_OK;
+        }
+        qos_state.batches.push_back(batch);
+    }
+
+    extern "C" uint32_t qos_clock(void *)
+    {
+        return qos_state.now++;
+    }
+}
+
+TEST_CASE("Test QoS classes")
+{
+    qos_state = qos_log();
+    at_parser_handle_t parser = nullptr;
+    CHECK_EQ(0, at_parser_create(&parser, 64, '\\', ','));
+    CHECK_EQ(0, at_parser_set_response_writer(parser, at_parser_collect_response, &qos_state.output));
+    CHECK_EQ(0, at_parser_set_batch_handler(parser, collect_qos_batch, nullptr, 0));
+    CHECK_EQ(0, at_parser_set_command_qos(parser, "LOG", AT_PARSER_QOS_LOW));
+    CHECK_EQ(0, at_parser_set_command_qos(parser, "WDT", AT_PARSER_QOS_NORMAL));
+    CHECK_EQ(0, at_parser_set_command_qos(parser, "WDT", AT_PARSER_QOS_HIGH));
+    CHECK_EQ(0, at_parser_set_command_qos(parser, "ABORT", AT_PARSER_QOS_ABORT));
+
+    SUBCASE("Batches are ordered on class")
+    {
+        const std::string input = "AT+LOG\r\nAT+A\r\nAT+WDT\r\nAT+B=1\r\nAT+WDT\r\n";
+        CHECK_EQ(0, at_parser_process_buffer(parser, input.data(), input.size()));
+        REQUIRE_EQ(1, qos_state.batches.size());
+        const std::vector<std::string> &batch = qos_state.batches[0];
+        REQUIRE_EQ(5, batch.size());
+        CHECK_EQ("WDT", batch[0]);
+        CHECK_EQ("WDT", batch[1]);
+        CHECK_EQ("A", batch[2]);
+        CHECK_EQ("B", batch[3]);
+        CHECK_EQ("LOG", batch[4]);
+        CHECK_EQ(AT_PARSER_QOS_HIGH, qos_state.classes[0]);
+        CHECK_EQ(AT_PARSER_QOS_NORMAL, qos_state.classes[2]);
+        CHECK_EQ(AT_PARSER_QOS_LOW, qos_state.classes[4]);
+        CHECK_EQ("WDTOK\r\nWDTOK\r\nAOK\r\nBOK\r\nLOGOK\r\n", qos_state.output);
+    }
+    SUBCASE("Abort cancels the queued commands")
+    {
+        const std::string input = "AT+A\r\nAT+LOG\r\nAT+ABORT\r\nAT+C\r\n";
+        CHECK_EQ(0, at_parser_process_buffer(parser, input.data(), input.size()));
+        REQUIRE_EQ(2, qos_state.batches.size());
+        REQUIRE_EQ(1, qos_state.batches[0].size());
+        CHECK_EQ("ABORT", qos_state.batches[0][0]);
+        REQUIRE_EQ(1, qos_state.batches[1].size());
+        CHECK_EQ("C", qos_state.batches[1][0]);
+        CHECK_EQ("ERROR\r\nERROR\r\nABORTOK\r\nCOK\r\n", qos_state.output);
+
+        struct at_parser_qos_stats stats;
+        CHECK_EQ(0, at_parser_get_qos_stats(parser, AT_PARSER_QOS_NORMAL, &stats));
+        CHECK_EQ(1, stats.cancelled);
+        CHECK_EQ(1, stats.dispatched);
+        CHECK_EQ(0, stats.depth);
+        CHECK_EQ(0, at_parser_get_qos_stats(parser, AT_PARSER_QOS_LOW, &stats));
+        CHECK_EQ(1, stats.cancelled);
+        CHECK_EQ(0, at_parser_get_qos_stats(parser, AT_PARSER_QOS_ABORT, &stats));
+        CHECK_EQ(1, stats.dispatched);
+    }
+    SUBCASE("Depth and wait statistics")
+    {
+        CHECK_EQ(0, at_parser_set_clock(parser, qos_clock, nullptr));
+        const std::string input = "AT+A\r\nAT+B\r\nAT+WDT\r\n"; // Parsed at tick 0, 1 and 2, dispatched at tick 3.
+        CHECK_EQ(0, at_parser_process_buffer(parser, input.data(), input.size()));
+        struct at_parser_qos_stats stats;
+        CHECK_EQ(0, at_parser_get_qos_stats(parser, AT_PARSER_QOS_NORMAL, &stats));
+        CHECK_EQ(2, stats.dispatched);
+        CHECK_EQ(2, stats.max_depth);
+        CHECK_EQ(0, stats.depth);
+        CHECK_EQ(3, stats.max_wait);
+        CHECK_EQ(5, stats.total_wait);
+        CHECK_EQ(0, at_parser_get_qos_stats(parser, AT_PARSER_QOS_HIGH, &stats));
+        CHECK_EQ(1, stats.dispatched);
+        CHECK_EQ(1, stats.total_wait);
+
+        CHECK_EQ(0, at_parser_clear_qos_stats(parser));
+        CHECK_EQ(0, at_parser_get_qos_stats(parser, AT_PARSER_QOS_NORMAL, &stats));
+        CHECK_EQ(0, stats.dispatched);
+        CHECK_EQ(0, stats.max_wait);
+    }
+    SUBCASE("Errors")
+    {
+        struct at_parser_qos_stats stats;
+        CHECK_NE(0, at_parser_set_command_qos(parser, "X", (enum at_parser_qos_class)AT_PARSER_QOS_CLASS_COUNT));
+        CHECK_NE(0, at_parser_set_command_qos(parser, nullptr, AT_PARSER_QOS_HIGH));
+        CHECK_NE(0, at_parser_get_qos_stats(parser, (enum at_parser_qos_class)AT_PARSER_QOS_CLASS_COUNT, &stats));
+        CHECK_NE(0, at_parser_get_qos_stats(parser, AT_PARSER_QOS_LOW, nullptr));
+    }
+
+    at_parser_free(parser);
+}
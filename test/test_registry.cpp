@@ -0,0 +1,75 @@
+#include "doctest.h"
+#include <string.h>
+#include <string>
+#include <vector>
+#include "at_parser/at_parser.h"
+#include "parser_helpers.h"
+
+TEST_CASE("Test shared command registry")
+{
+    at_parser_registry_handle_t registry = nullptr;
+    at_parser_handle_t first = nullptr;
+    at_parser_handle_t second = nullptr;
+    commands.clear();
+    CHECK_EQ(0, at_parser_registry_create(&registry));
+    CHECK_EQ(0, at_parser_registry_add_command_handler(registry, "HELLOW", at_parser_default_received_command, (void*)0x0010));
+    CHECK_EQ(0, at_parser_registry_add_command_handler(registry, "ABC", at_parser_default_received_command, (void*)0x0020));
+    CHECK_EQ(0, at_parser_registry_add_command_handler(registry, "ABC", at_parser_default_received_command, (void*)0x0030)); // Same name and handler are only registered once.
+    CHECK_EQ(0, at_parser_create(&first, 50, '\x1B', ','));
+    CHECK_EQ(0, at_parser_create(&second, 50, '\x1B', ','));
+
+    SUBCASE("Registry must be frozen before attaching")
+    {
+        CHECK_NE(0, at_parser_attach_registry(first, registry));
+        CHECK_EQ(0, at_parser_registry_freeze(registry));
+        CHECK_NE(0, at_parser_registry_add_command_handler(registry, "DEF", at_parser_default_received_command, NULL));
+        CHECK_EQ(0, at_parser_attach_registry(first, registry));
+    }
+
+    SUBCASE("Multiple parsers share the registry")
+    {
+        CHECK_EQ(0, at_parser_registry_freeze(registry));
+        CHECK_EQ(0, at_parser_attach_registry(first, registry));
+        CHECK_EQ(0, at_parser_attach_registry(second, registry));
+
+        const char *buffer = "AT+ABC=def\r\nAT+HELLOW?\r\nAT+UNKNOWN\r\n";
+        CHECK_EQ(0, at_parser_process_buffer(first, buffer, strlen(buffer)));
+        CHECK_EQ(0, at_parser_process_buffer(second, buffer, strlen(buffer)));
+        CHECK_EQ(4, commands.size());
+        for (size_t i = 0; i < commands.size(); i += 2)
+        {
+            CHECK(std::string("ABC") == commands[i].command);
+            CHECK_EQ(1, commands[i].arguments.size());
+            CHECK_EQ(std::string("def"), commands[i].arguments[0]);
+            CHECK_EQ((void*)0x0020, commands[i].userdata);
+            CHECK_EQ(AT_PARSER_COMMAND_TYPE_SET, commands[i].type);
+            CHECK(std::string("HELLOW") == commands[i + 1].command);
+            CHECK_EQ((void*)0x0010, commands[i + 1].userdata);
+            CHECK_EQ(AT_PARSER_COMMAND_TYPE_TEST, commands[i + 1].type);
+        }
+    }
+
+    SUBCASE("Registry handlers run before the parser its own handlers")
+    {
+        CHECK_EQ(0, at_parser_registry_freeze(registry));
+        CHECK_EQ(0, at_parser_attach_registry(first, registry));
+        CHECK_EQ(0, at_parser_add_command_handler(first, "ABC", at_parser_default_received_command, (void*)0x0040));
+
+        const char *buffer = "AT+ABC\r\n";
+        CHECK_EQ(0, at_parser_process_buffer(first, buffer, strlen(buffer)));
+        CHECK_EQ(2, commands.size());
+        CHECK_EQ((void*)0x0020, commands[0].userdata);
+        CHECK_EQ((void*)0x0040, commands[1].userdata);
+        CHECK_EQ(AT_PARSER_COMMAND_TYPE_EXECUTE, commands[1].type);
+
+        commands.clear();
+        CHECK_EQ(0, at_parser_attach_registry(first, NULL));
+        CHECK_EQ(0, at_parser_process_buffer(first, buffer, strlen(buffer)));
+        CHECK_EQ(1, commands.size());
+        CHECK_EQ((void*)0x0040, commands[0].userdata);
+    }
+
+    at_parser_free(first);
+    at_parser_free(second);
+    at_parser_registry_free(registry);
+}
@@ -0,0 +1,238 @@
+#include "doctest.h"
+#include <string.h>
+#include <string>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "at_parser/at_parser.h"
+#include "at_parser/at_parser_shm.h"
+
+namespace
+{
+    constexpr int shm_command_count = 3000;
+
+    std::string message_argument(const struct at_parser_shm_message &message, size_t index)
+    {
+        struct at_parser_argument argument = {};
+        if (at_parser_shm_message_get_argument(&message, index, &argument) != 0)
+        {
+            return "<missing>";
+        }
+        return std::string(argument.value, argument.length);
+    }
+
+    /**
+     * Runs in the forked child: consume every command and the final raw message, no doctest asserts in here.
+     */
+    int consume_commands(int fd)
+    {
+        at_parser_shm_ring_handle_t ring = nullptr;
+        if (at_parser_shm_ring_open(&ring, fd) != 0)
+        {
+            return 1;
+        }
+        int result = 0;
+        int received = 0;
+        size_t idle = 0;
+        while (result == 0)
+        {
+            struct at_parser_shm_message message;
+            if (at_parser_shm_peek(ring, &message) != 0)
+            {
+                result = ++idle > 20000000 ? 2 : 0;
+                sched_yield();
+                continue;
+            }
+            idle = 0;
+            if (message.kind == AT_PARSER_SHM_MESSAGE_RAW)
+            {
+                result = (std::string(message.data, message.length) == "done" && received == shm_command_count) ? -1 : 3;
+            }
+            else
+            {
+                const std::string number = std::to_string(received);
+                const bool match = message.kind == AT_PARSER_SHM_MESSAGE_COMMAND && std::string(message.command_name) == "CMD" &&
+                                   message.type == AT_PARSER_COMMAND_TYPE_SET && message.argument_count == 2 &&
+                                   message_argument(message, 0) == number && message_argument(message, 1) == "v," + number;
+                result = match ? 0 : 4;
+                received++;
+            }
+            at_parser_shm_release(ring);
+        }
+        at_parser_shm_ring_free(ring);
+        return result == -1 ? 0 : result;
+    }
+}
+
+TEST_CASE("Test shared memory ring")
+{
+    at_parser_shm_ring_handle_t ring = nullptr;
+    struct at_parser_shm_message message;
+
+    CHECK_NE(0, at_parser_shm_ring_create(&ring, 100));
+    CHECK_NE(0, at_parser_shm_ring_create(&ring, 32));
+    CHECK_NE(0, at_parser_shm_ring_open(&ring, -1));
+    CHECK_NE(0, at_parser_shm_ring_open(&ring, STDIN_FILENO));
+    REQUIRE_EQ(0, at_parser_shm_ring_create(&ring, 128));
+
+    SUBCASE("Raw bytes and commands")
+    {
+        CHECK_NE(0, at_parser_shm_peek(ring, &message));
+        CHECK_NE(0, at_parser_shm_release(ring));
+        CHECK_EQ(0, at_parser_shm_push_raw(ring, "AT+X\r", 5));
+        const struct at_parser_argument arguments[] = {{"12", 2}, {"", 0}, {"abc", 3}};
+        CHECK_EQ(0, at_parser_shm_push_command(ring, "CFUN", 4, AT_PARSER_COMMAND_TYPE_SET, arguments, 3));
+
+        REQUIRE_EQ(0, at_parser_shm_peek(ring, &message));
+        CHECK_EQ(AT_PARSER_SHM_MESSAGE_RAW, message.kind);
+        CHECK_EQ("AT+X\r", std::string(message.data, message.length));
+        CHECK_EQ(nullptr, message.command_name);
+        CHECK_EQ(0, at_parser_shm_release(ring));
+
+        REQUIRE_EQ(0, at_parser_shm_peek(ring, &message));
+        CHECK_EQ(AT_PARSER_SHM_MESSAGE_COMMAND, message.kind);
+        CHECK_EQ("CFUN", std::string(message.command_name));
+        CHECK_EQ(4, message.command_name_length);
+        CHECK_EQ(AT_PARSER_COMMAND_TYPE_SET, message.type);
+        REQUIRE_EQ(3, message.argument_count);
+        CHECK_EQ("12", message_argument(message, 0));
+        CHECK_EQ("", message_argument(message, 1));
+        CHECK_EQ("abc", message_argument(message, 2));
+        struct at_parser_argument argument;
+        CHECK_NE(0, at_parser_shm_message_get_argument(&message, 3, &argument));
+        CHECK_EQ(0, at_parser_shm_release(ring));
+        CHECK_NE(0, at_parser_shm_peek(ring, &message));
+    }
+    SUBCASE("Full ring and wrapping")
+    {
+        const std::string block(40, 'x'); // 48 bytes per record.
+        CHECK_EQ(0, at_parser_shm_push_raw(ring, block.data(), block.size()));
+        CHECK_EQ(0, at_parser_shm_push_raw(ring, block.data(), block.size()));
+        CHECK_NE(0, at_parser_shm_push_raw(ring, block.data(), block.size()));
+        CHECK_NE(0, at_parser_shm_push_raw(ring, std::string(200, 'y').data(), 200));
+        CHECK_EQ(2, at_parser_shm_get_dropped(ring));
+
+        REQUIRE_EQ(0, at_parser_shm_peek(ring, &message));
+        CHECK_EQ(0, at_parser_shm_release(ring));
+        // 32 bytes are left at the end, the record is placed at the start of the ring behind a pad record.
+        const std::string wrapped(30, 'w'); // 40 bytes per record.
+        CHECK_EQ(0, at_parser_shm_push_raw(ring, wrapped.data(), wrapped.size()));
+        REQUIRE_EQ(0, at_parser_shm_peek(ring, &message));
+        CHECK_EQ(block, std::string(message.data, message.length));
+        CHECK_EQ(0, at_parser_shm_release(ring));
+        REQUIRE_EQ(0, at_parser_shm_peek(ring, &message));
+        CHECK_EQ(wrapped, std::string(message.data, message.length));
+        CHECK_EQ(0, at_parser_shm_release(ring));
+        CHECK_NE(0, at_parser_shm_peek(ring, &message));
+    }
+    SUBCASE("Opened by fd")
+    {
+        at_parser_shm_ring_handle_t other = nullptr;
+        REQUIRE_EQ(0, at_parser_shm_ring_open(&other, at_parser_shm_ring_get_fd(ring)));
+        CHECK_NE(at_parser_shm_ring_get_fd(ring), at_parser_shm_ring_get_fd(other));
+        CHECK_EQ(0, at_parser_shm_push_raw(ring, "shared", 6));
+        REQUIRE_EQ(0, at_parser_shm_peek(other, &message));
+        CHECK_EQ("shared", std::string(message.data, message.length));
+        CHECK_EQ(0, at_parser_shm_release(other));
+        at_parser_shm_ring_free(other);
+    }
+
+    SUBCASE("Corrupt records are rejected")
+    {
+        // Map the ring like a misbehaving producer would, the records start capacity bytes before the end.
+        struct stat info;
+        REQUIRE_EQ(0, fstat(at_parser_shm_ring_get_fd(ring), &info));
+        void *mapping = mmap(nullptr, (size_t)info.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, at_parser_shm_ring_get_fd(ring), 0);
+        REQUIRE(mapping != MAP_FAILED);
+        char *records = static_cast<char *>(mapping) + info.st_size - 128;
+        uint32_t value = 0;
+
+        const struct at_parser_argument arguments[] = {{"1", 1}};
+        CHECK_EQ(0, at_parser_shm_push_command(ring, "CSQ", 3, AT_PARSER_COMMAND_TYPE_SET, arguments, 1));
+        CHECK_EQ(0, at_parser_shm_push_raw(ring, "next", 4));
+        value = 1000; // Name length, past the end of the record.
+        memcpy(records + 12, &value, sizeof(value));
+        REQUIRE_EQ(0, at_parser_shm_peek(ring, &message));
+        CHECK_EQ("next", std::string(message.data, message.length));
+        CHECK_EQ(0, at_parser_shm_release(ring));
+        CHECK_EQ(1, at_parser_shm_get_rejected(ring));
+
+        CHECK_EQ(0, at_parser_shm_push_raw(ring, "big", 3));
+        CHECK_EQ(0, at_parser_shm_push_raw(ring, "lost", 4));
+        value = 0x10000; // Record size, larger than the ring.
+        memcpy(records + 48, &value, sizeof(value));
+        CHECK_NE(0, at_parser_shm_peek(ring, &message));
+        CHECK_EQ(2, at_parser_shm_get_rejected(ring));
+        CHECK_EQ(0, at_parser_shm_push_raw(ring, "after", 5));
+        REQUIRE_EQ(0, at_parser_shm_peek(ring, &message));
+        CHECK_EQ("after", std::string(message.data, message.length));
+        CHECK_EQ(0, at_parser_shm_release(ring));
+        munmap(mapping, (size_t)info.st_size);
+    }
+    SUBCASE("A corrupt capacity doesn't move the producer")
+    {
+        struct stat info;
+        REQUIRE_EQ(0, fstat(at_parser_shm_ring_get_fd(ring), &info));
+        void *mapping = mmap(nullptr, (size_t)info.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, at_parser_shm_ring_get_fd(ring), 0);
+        REQUIRE(mapping != MAP_FAILED);
+        const uint64_t capacity = 0x100000; // The capacity follows the magic and version.
+        memcpy(static_cast<char *>(mapping) + 8, &capacity, sizeof(capacity));
+
+        CHECK_NE(0, at_parser_shm_push_raw(ring, std::string(200, 'y').data(), 200));
+        const std::string block(40, 'x');
+        CHECK_EQ(0, at_parser_shm_push_raw(ring, block.data(), block.size()));
+        CHECK_EQ(0, at_parser_shm_push_raw(ring, block.data(), block.size()));
+        CHECK_NE(0, at_parser_shm_push_raw(ring, block.data(), block.size()));
+        CHECK_EQ(2, at_parser_shm_get_dropped(ring));
+        munmap(mapping, (size_t)info.st_size);
+    }
+
+    at_parser_shm_ring_free(ring);
+}
+
+TEST_CASE("Test shared memory ring between processes")
+{
+    at_parser_shm_ring_handle_t ring = nullptr;
+    REQUIRE_EQ(0, at_parser_shm_ring_create(&ring, 1024));
+    at_parser_handle_t parser = nullptr;
+    CHECK_EQ(0, at_parser_create(&parser, 64, '\\', ','));
+    CHECK_EQ(0, at_parser_set_batch_handler(parser, at_parser_shm_forward_batch, ring, 0));
+
+    const pid_t child = fork();
+    REQUIRE(child >= 0);
+    if (child == 0)
+    {
+        _exit(consume_commands(at_parser_shm_ring_get_fd(ring)));
+    }
+
+    // The small ring fills up, a dropped command is fed again after the child made room.
+    bool fed = true;
+    for (int i = 0; i < shm_command_count && fed; i++)
+    {
+        const std::string number = std::to_string(i);
+        const std::string line = "AT+CMD=" + number + ",\"v," + number + "\"\r\n";
+        uint64_t dropped = at_parser_shm_get_dropped(ring);
+        fed = at_parser_process_buffer(parser, line.data(), line.size()) == 0;
+        while (fed && at_parser_shm_get_dropped(ring) != dropped)
+        {
+            sched_yield();
+            dropped = at_parser_shm_get_dropped(ring);
+            fed = at_parser_process_buffer(parser, line.data(), line.size()) == 0;
+        }
+    }
+    CHECK(fed);
+    while (at_parser_shm_push_raw(ring, "done", 4) != 0)
+    {
+        sched_yield();
+    }
+
+    int status = 0;
+    CHECK_EQ(child, waitpid(child, &status, 0));
+    CHECK(WIFEXITED(status));
+    CHECK_EQ(0, WEXITSTATUS(status));
+
+    at_parser_free(parser);
+    at_parser_shm_ring_free(ring);
+}
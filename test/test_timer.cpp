@@ -0,0 +1,259 @@
+#include "doctest.h"
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include "at_parser/at_parser.h"
+#include "at_parser/at_parser_timer.h"
+#include "parser_helpers.h"
+
+namespace
+{
+    struct test_timer
+    {
+        struct at_parser_timer timer;
+        uint32_t expires = 0;
+        uint32_t fired_at = 0;
+        size_t fired = 0;
+    };
+
+    uint32_t timer_now = 0;
+    std::vector<test_timer *> fire_order;
+
+    extern "C" uint32_t timer_test_clock(void *)
+    {
+        return timer_now;
+    }
+
+    extern "C" void record_timer(struct at_parser_timer *, void *userdata)
+    {
+        test_timer *timer = static_cast<test_timer *>(userdata);
+        timer->fired_at = timer_now;
+        timer->fired++;
+        fire_order.push_back(timer);
+    }
+
+    at_parser_timer_wheel_handle_t periodic_wheel = nullptr;
+
+    extern "C" void rearm_timer(struct at_parser_timer *timer, void *userdata)
+    {
+        record_timer(timer, userdata);
+        if (static_cast<test_timer *>(userdata)->fired < 3)
+        {
+            at_parser_timer_arm(periodic_wheel, timer, 10);
+        }
+    }
+}
+
+TEST_CASE("Test timer wheel")
+{
+    timer_now = 0xFFFFF000; // Close to the wrap around of the clock.
+    fire_order.clear();
+    at_parser_timer_wheel_handle_t wheel = nullptr;
+    CHECK_NE(0, at_parser_timer_wheel_create(&wheel, nullptr, nullptr));
+    REQUIRE_EQ(0, at_parser_timer_wheel_create(&wheel, timer_test_clock, nullptr));
+
+    SUBCASE("Timers expire on their tick")
+    {
+        const uint32_t timeouts[] = {0, 1, 255, 256, 257, 1000, 16383, 16384, 70000, 1048576, 3000000};
+        std::vector<test_timer> timers(sizeof(timeouts) / sizeof(timeouts[0]));
+        for (size_t i = 0; i < timers.size(); i++)
+        {
+            at_parser_timer_init(&timers[i].timer, record_timer, &timers[i]);
+            CHECK_EQ(0, at_parser_timer_arm(wheel, &timers[i].timer, timeouts[i]));
+            timers[i].expires = timer_now + timeouts[i];
+        }
+        CHECK_EQ(timers.size(), at_parser_timer_wheel_get_armed(wheel));
+        const uint32_t start = timer_now;
+        while (timer_now - start <= 3000000)
+        {
+            at_parser_timer_wheel_advance(wheel);
+            timer_now++;
+        }
+        for (size_t i = 0; i < timers.size(); i++)
+        {
+            CHECK_EQ(1, timers[i].fired);
+            CHECK_EQ(timers[i].expires, timers[i].fired_at);
+        }
+        REQUIRE_EQ(timers.size(), fire_order.size());
+        for (size_t i = 0; i < timers.size(); i++)
+        {
+            CHECK_EQ(&timers[i], fire_order[i]);
+        }
+        CHECK_EQ(0, at_parser_timer_wheel_get_armed(wheel));
+    }
+    SUBCASE("Many timers with cancels and irregular advances")
+    {
+        std::vector<test_timer> timers(20000);
+        srand(1234);
+        for (test_timer &timer : timers)
+        {
+            const uint32_t timeout = (uint32_t)rand() % (1u << 22);
+            at_parser_timer_init(&timer.timer, record_timer, &timer);
+            CHECK_EQ(0, at_parser_timer_arm(wheel, &timer.timer, timeout));
+            timer.expires = timer_now + timeout;
+        }
+        for (size_t i = 0; i < timers.size(); i += 3)
+        {
+            at_parser_timer_cancel(&timers[i].timer);
+            CHECK_FALSE(at_parser_timer_is_armed(&timers[i].timer));
+        }
+        CHECK_EQ(timers.size() - (timers.size() + 2) / 3, at_parser_timer_wheel_get_armed(wheel));
+        const uint32_t start = timer_now;
+        uint32_t previous = timer_now;
+        bool in_time = true;
+        while (at_parser_timer_wheel_get_armed(wheel) != 0 && timer_now - start < (1u << 23))
+        {
+            timer_now += (uint32_t)rand() % 5000;
+            const size_t before = fire_order.size();
+            at_parser_timer_wheel_advance(wheel);
+            for (size_t i = before; i < fire_order.size(); i++)
+            {
+                // A timer fires on the first advance at or after its expiry.
+                in_time = in_time && (int32_t)(timer_now - fire_order[i]->expires) >= 0 && (int32_t)(previous - fire_order[i]->expires) < 0;
+            }
+            previous = timer_now;
+        }
+        CHECK(in_time);
+        CHECK_EQ(0, at_parser_timer_wheel_get_armed(wheel));
+        for (size_t i = 0; i < timers.size(); i++)
+        {
+            CHECK_EQ(i % 3 == 0 ? 0 : 1, timers[i].fired);
+        }
+    }
+    SUBCASE("Re-arming and next timeout")
+    {
+        test_timer timer;
+        uint32_t ticks = 0;
+        CHECK_NE(0, at_parser_timer_wheel_get_next_timeout(wheel, &ticks));
+        at_parser_timer_init(&timer.timer, record_timer, &timer);
+        CHECK_EQ(0, at_parser_timer_arm(wheel, &timer.timer, 100));
+        CHECK_EQ(0, at_parser_timer_wheel_get_next_timeout(wheel, &ticks));
+        CHECK(ticks <= 100);
+        CHECK_EQ(0, at_parser_timer_arm(wheel, &timer.timer, 50));
+        CHECK_EQ(1, at_parser_timer_wheel_get_armed(wheel));
+        timer_now += 50;
+        CHECK_EQ(1, at_parser_timer_wheel_advance(wheel));
+        CHECK_FALSE(at_parser_timer_is_armed(&timer.timer));
+        CHECK_EQ(0, at_parser_timer_arm(wheel, &timer.timer, 100000));
+        CHECK_EQ(0, at_parser_timer_wheel_get_next_timeout(wheel, &ticks));
+        CHECK(ticks <= 100000);
+        timer_now += 99999;
+        CHECK_EQ(0, at_parser_timer_wheel_advance(wheel));
+        timer_now += 1;
+        CHECK_EQ(1, at_parser_timer_wheel_advance(wheel));
+        CHECK_EQ(2, timer.fired);
+    }
+    SUBCASE("Callbacks can re-arm")
+    {
+        test_timer timer;
+        periodic_wheel = wheel;
+        at_parser_timer_init(&timer.timer, rearm_timer, &timer);
+        CHECK_EQ(0, at_parser_timer_arm(wheel, &timer.timer, 10));
+        timer_now += 10;
+        CHECK_EQ(1, at_parser_timer_wheel_advance(wheel));
+        timer_now += 1000; // The timeout of a re-armed timer starts at the clock, not at the tick it expired on.
+        CHECK_EQ(1, at_parser_timer_wheel_advance(wheel));
+        timer_now += 9;
+        CHECK_EQ(0, at_parser_timer_wheel_advance(wheel));
+        timer_now += 1;
+        CHECK_EQ(1, at_parser_timer_wheel_advance(wheel));
+        CHECK_EQ(3, timer.fired);
+        CHECK_FALSE(at_parser_timer_is_armed(&timer.timer));
+    }
+    SUBCASE("Freeing the wheel disarms timers")
+    {
+        test_timer timer;
+        at_parser_timer_init(&timer.timer, record_timer, &timer);
+        CHECK_EQ(0, at_parser_timer_arm(wheel, &timer.timer, 100000));
+        at_parser_timer_wheel_free(wheel);
+        wheel = nullptr;
+        CHECK_FALSE(at_parser_timer_is_armed(&timer.timer));
+        at_parser_timer_cancel(&timer.timer);
+    }
+
+    at_parser_timer_wheel_free(wheel);
+}
+
+TEST_CASE("Test parser line timeout")
+{
+    timer_now = 1000;
+    commands.clear();
+    at_parser_timer_wheel_handle_t wheel = nullptr;
+    at_parser_handle_t parser = nullptr;
+    REQUIRE_EQ(0, at_parser_timer_wheel_create(&wheel, timer_test_clock, nullptr));
+    CHECK_EQ(0, at_parser_create(&parser, 100, '\x1B', ','));
+    CHECK_EQ(0, at_parser_add_command_handler(parser, "CSQ", at_parser_default_received_command, nullptr));
+
+    SUBCASE("Discard")
+    {
+        CHECK_EQ(0, at_parser_set_line_timeout(parser, wheel, 20, AT_PARSER_LINE_TIMEOUT_DISCARD));
+        CHECK_EQ(0, at_parser_process_buffer(parser, "AT+CS", 5));
+        timer_now += 15;
+        at_parser_timer_wheel_advance(wheel);
+        CHECK_EQ(0, at_parser_process_buffer(parser, "Q", 1)); // Restarts the timeout.
+        timer_now += 15;
+        CHECK_EQ(0, at_parser_timer_wheel_advance(wheel));
+        timer_now += 5;
+        CHECK_EQ(1, at_parser_timer_wheel_advance(wheel));
+        CHECK_EQ(0, at_parser_process_buffer(parser, "\r\nAT+CSQ\r\n", 10));
+        REQUIRE_EQ(1, commands.size());
+        CHECK_EQ("CSQ", commands[0].command);
+        CHECK_EQ(0, at_parser_timer_wheel_get_armed(wheel));
+    }
+    SUBCASE("Commit")
+    {
+        CHECK_EQ(0, at_parser_set_line_timeout(parser, wheel, 20, AT_PARSER_LINE_TIMEOUT_COMMIT));
+        CHECK_EQ(0, at_parser_process_buffer(parser, "AT+CSQ\r\nAT+CSQ=1\r", 17));
+        REQUIRE_EQ(1, commands.size());
+        timer_now += 20;
+        CHECK_EQ(1, at_parser_timer_wheel_advance(wheel));
+        REQUIRE_EQ(2, commands.size());
+        CHECK_EQ(AT_PARSER_COMMAND_TYPE_SET, commands[1].type);
+        REQUIRE_EQ(1, commands[1].arguments.size());
+        CHECK_EQ("1", commands[1].arguments[0]);
+        CHECK_EQ(0, at_parser_has_pending_lines(parser));
+    }
+    SUBCASE("Complete lines stop the timeout")
+    {
+        CHECK_EQ(0, at_parser_set_line_timeout(parser, wheel, 20, AT_PARSER_LINE_TIMEOUT_COMMIT));
+        CHECK_EQ(0, at_parser_process_buffer(parser, "AT+CSQ", 6));
+        CHECK_EQ(1, at_parser_timer_wheel_get_armed(wheel));
+        CHECK_EQ(0, at_parser_process_buffer(parser, "\r\n", 2));
+        CHECK_EQ(0, at_parser_timer_wheel_get_armed(wheel));
+        CHECK_EQ(0, at_parser_process_buffer(parser, "AT+CSQ", 6));
+        CHECK_EQ(0, at_parser_set_line_timeout(parser, nullptr, 0, AT_PARSER_LINE_TIMEOUT_COMMIT));
+        CHECK_EQ(0, at_parser_timer_wheel_get_armed(wheel));
+        CHECK_EQ(1, commands.size());
+    }
+    SUBCASE("Many parsers share a wheel")
+    {
+        std::vector<at_parser_handle_t> parsers(10000);
+        for (at_parser_handle_t &channel : parsers)
+        {
+            REQUIRE_EQ(0, at_parser_create(&channel, 32, '\x1B', ','));
+            CHECK_EQ(0, at_parser_add_command_handler(channel, "CSQ", at_parser_default_received_command, nullptr));
+            CHECK_EQ(0, at_parser_set_line_timeout(channel, wheel, 100, AT_PARSER_LINE_TIMEOUT_COMMIT));
+            CHECK_EQ(0, at_parser_process_buffer(channel, "AT+CSQ", 6));
+        }
+        CHECK_EQ(parsers.size(), at_parser_timer_wheel_get_armed(wheel));
+        timer_now += 100;
+        CHECK_EQ(parsers.size(), at_parser_timer_wheel_advance(wheel));
+        CHECK_EQ(parsers.size(), commands.size());
+        for (at_parser_handle_t channel : parsers)
+        {
+            at_parser_free(channel);
+        }
+    }
+    SUBCASE("Freeing the parser cancels the timeout")
+    {
+        CHECK_EQ(0, at_parser_set_line_timeout(parser, wheel, 20, AT_PARSER_LINE_TIMEOUT_DISCARD));
+        CHECK_EQ(0, at_parser_process_buffer(parser, "AT+CSQ", 6));
+        at_parser_free(parser);
+        parser = nullptr;
+        CHECK_EQ(0, at_parser_timer_wheel_get_armed(wheel));
+    }
+
+    at_parser_free(parser);
+    at_parser_timer_wheel_free(wheel);
+}
@@ -44,3 +44,19 @@ TEST_CASE("Unkown AT Command")
     
     at_parser_free(handle);
 }
+
+TEST_CASE("Unbalanced quotes in the arguments")
+{
+    at_parser_handle_t handle = nullptr;
+    commands.clear();
+    CHECK_EQ(0, at_parser_create(&handle, 50, '\x1B', ','));
+    CHECK_EQ(0, at_parser_add_command_handler(handle, "ABC", at_parser_default_received_command, NULL));
+
+    const char *buffer = "AT+ABC=first,\"second\r\nAT+ABC=def\r\n";
+    CHECK_EQ(0, at_parser_process_buffer(handle, buffer, strlen(buffer)));
+    CHECK_EQ(1, commands.size());
+    CHECK_EQ(1, commands[0].arguments.size());
+    CHECK_EQ(std::string("def"), commands[0].arguments[0]);
+
+    at_parser_free(handle);
+}
@@ -0,0 +1,623 @@
+/**
+ * @file at_parser_gen.c
+ * @author Giel Willemsen
+ * @brief Offline generator of read only command tables (see at_parser_command_table.h) from a command spec.
+ * @version 0.1
+ * @date 2023-06-14
+ *
+ * @copyright See LICENSE
+ *
+ * The spec is a line based text file, empty lines and lines starting with # are ignored:
+ *
+ *   command NAME HANDLER TYPE[,TYPE...]   Start a command, TYPE is query ("=?"), test ("?"), set or execute.
+ *   int MIN MAX [optional]                Add an integer argument to the last command.
+ *   string MIN MAX [optional]             Add a string argument with a length between MIN and MAX to the last command.
+ *   help TEXT                             Add a line to the "=?" answer of the last command (OK is appended).
+ *
+ * The output is a C source with the table, a collision free hash on the names and the help answers, all const,
+ * and a header that declares the table and the handlers.
+ */
+#define _POSIX_C_SOURCE 200809L
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <getopt.h>
+#include "at_parser/at_parser_command_table.h"
+
+#define MAX_SLOTS (1u << 16)
+#define SEED_ATTEMPTS 4096
+
+struct argument_spec
+{
+    bool is_string;
+    bool optional;
+    long min;
+    long max;
+};
+
+struct command_spec
+{
+    char *name;
+    char *handler;
+    unsigned types;
+    struct argument_spec *arguments;
+    size_t argument_count;
+    char *help;
+    size_t help_length;
+};
+
+struct spec
+{
+    const char *path;
+    size_t line;
+    struct command_spec *commands;
+    size_t command_count;
+};
+
+static bool parse_spec(FILE *file, struct spec *spec);
+static bool parse_line(struct spec *spec, char *line);
+static bool parse_command(struct spec *spec, char *arguments);
+static bool parse_argument(struct spec *spec, bool is_string, char *arguments);
+static bool add_help(struct spec *spec, const char *text);
+static bool check_spec(struct spec *spec);
+static bool parse_types(const char *list, unsigned *types);
+static bool is_identifier(const char *text);
+static bool is_command_name(const char *text);
+static bool spec_error(const struct spec *spec, const char *message, const char *detail);
+static bool find_hash(const struct spec *spec, uint32_t *seed, uint16_t **slots, size_t *slot_count);
+static void write_string(FILE *out, const char *text, size_t length);
+static void write_types(FILE *out, unsigned types);
+static void write_handler_declarations(FILE *out, const struct spec *spec);
+static void write_source(FILE *out, const struct spec *spec, const char *name, const char *header, uint32_t seed, const uint16_t *slots, size_t slot_count);
+static void write_header(FILE *out, const struct spec *spec, const char *name);
+static const char *base_name(const char *path);
+static void free_spec(struct spec *spec);
+static void print_usage(const char *program);
+
+int main(int argc, char **argv)
+{
+    const char *name = "at_parser_commands";
+    static const struct option long_options[] = {
+        {"name", required_argument, NULL, 'n'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0},
+    };
+    int option;
+    while ((option = getopt_long(argc, argv, "n:h", long_options, NULL)) != -1)
+    {
+        switch (option)
+        {
+        case 'n':
+            name = optarg;
+            break;
+        case 'h':
+            print_usage(argv[0]);
+            return 0;
+        default:
+            print_usage(argv[0]);
+            return 2;
+        }
+    }
+    if (argc - optind != 3 || !is_identifier(name))
+    {
+        print_usage(argv[0]);
+        return 2;
+    }
+    const char *spec_path = argv[optind];
+    const char *source_path = argv[optind + 1];
+    const char *header_path = argv[optind + 2];
+
+    FILE *file = fopen(spec_path, "r");
+    if (file == NULL)
+    {
+        perror(spec_path);
+        return 1;
+    }
+    struct spec spec = {spec_path, 0, NULL, 0};
+    bool valid = parse_spec(file, &spec) && check_spec(&spec);
+    fclose(file);
+
+    uint32_t seed = 0;
+    uint16_t *slots = NULL;
+    size_t slot_count = 0;
+    if (valid && !find_hash(&spec, &seed, &slots, &slot_count))
+    {
+        fprintf(stderr, "%s: no collision free hash found\n", spec_path);
+        valid = false;
+    }
+
+    if (valid)
+    {
+        const char *header = base_name(header_path);
+        FILE *source_file = fopen(source_path, "w");
+        FILE *header_file = fopen(header_path, "w");
+        if (source_file == NULL || header_file == NULL)
+        {
+            perror(source_file == NULL ? source_path : header_path);
+            valid = false;
+        }
+        else
+        {
+            write_source(source_file, &spec, name, header, seed, slots, slot_count);
+            write_header(header_file, &spec, name);
+        }
+        if (source_file != NULL && fclose(source_file) != 0)
+        {
+            valid = false;
+        }
+        if (header_file != NULL && fclose(header_file) != 0)
+        {
+            valid = false;
+        }
+    }
+    free(slots);
+    free_spec(&spec);
+    return valid ? 0 : 1;
+}
+
+static bool parse_spec(FILE *file, struct spec *spec)
+{
+    char *line = NULL;
+    size_t capacity = 0;
+    ssize_t length;
+    bool valid = true;
+    while (valid && (length = getline(&line, &capacity, file)) != -1)
+    {
+        spec->line++;
+        while (length > 0 && (line[length - 1] == '\n' || line[length - 1] == '\r'))
+        {
+            line[--length] = '\0';
+        }
+        valid = parse_line(spec, line);
+    }
+    free(line);
+    return valid;
+}
+
+static bool parse_line(struct spec *spec, char *line)
+{
+    while (isspace((unsigned char)*line))
+    {
+        line++;
+    }
+    if (*line == '\0' || *line == '#')
+    {
+        return true;
+    }
+    char *keyword = line;
+    while (*line != '\0' && !isspace((unsigned char)*line))
+    {
+        line++;
+    }
+    if (*line != '\0')
+    {
+        *line++ = '\0';
+    }
+    if (strcmp(keyword, "command") == 0)
+    {
+        return parse_command(spec, line);
+    }
+    else if (strcmp(keyword, "int") == 0 || strcmp(keyword, "string") == 0)
+    {
+        return parse_argument(spec, keyword[0] == 's', line);
+    }
+    else if (strcmp(keyword, "help") == 0)
+    {
+        return add_help(spec, line);
+    }
+    return spec_error(spec, "unknown keyword", keyword);
+}
+
+static bool parse_command(struct spec *spec, char *arguments)
+{
+    char *name = strtok(arguments, " \t");
+    char *handler = strtok(NULL, " \t");
+    char *types = strtok(NULL, " \t");
+    if (name == NULL || handler == NULL || types == NULL || strtok(NULL, " \t") != NULL)
+    {
+        return spec_error(spec, "expected: command NAME HANDLER TYPE[,TYPE...]", NULL);
+    }
+    if (!is_command_name(name))
+    {
+        return spec_error(spec, "command names can only contain letters", name);
+    }
+    if (!is_identifier(handler))
+    {
+        return spec_error(spec, "the handler is not a C identifier", handler);
+    }
+    struct command_spec command = {0};
+    if (!parse_types(types, &command.types))
+    {
+        return spec_error(spec, "unknown command type in", types);
+    }
+    struct command_spec *commands = realloc(spec->commands, (spec->command_count + 1) * sizeof(struct command_spec));
+    if (commands == NULL)
+    {
+        return spec_error(spec, "out of memory", NULL);
+    }
+    spec->commands = commands;
+    command.name = strdup(name);
+    command.handler = strdup(handler);
+    spec->commands[spec->command_count++] = command;
+    return command.name != NULL && command.handler != NULL ? true : spec_error(spec, "out of memory", NULL);
+}
+
+static bool parse_argument(struct spec *spec, bool is_string, char *arguments)
+{
+    if (spec->command_count == 0)
+    {
+        return spec_error(spec, "argument before the first command", NULL);
+    }
+    struct command_spec *command = &spec->commands[spec->command_count - 1];
+    struct argument_spec argument = {is_string, false, 0, 0};
+    char flag[16] = "";
+    int fields = sscanf(arguments, "%ld %ld %15s", &argument.min, &argument.max, flag);
+    if (fields < 2 || (fields == 3 && strcmp(flag, "optional") != 0))
+    {
+        return spec_error(spec, "expected: int|string MIN MAX [optional]", NULL);
+    }
+    argument.optional = fields == 3;
+    if (argument.min > argument.max || argument.min < INT32_MIN || argument.max > INT32_MAX || (is_string && argument.min < 0))
+    {
+        return spec_error(spec, "invalid range", NULL);
+    }
+    if (!argument.optional && command->argument_count > 0 && command->arguments[command->argument_count - 1].optional)
+    {
+        return spec_error(spec, "only trailing arguments can be optional", NULL);
+    }
+    struct argument_spec *list = realloc(command->arguments, (command->argument_count + 1) * sizeof(struct argument_spec));
+    if (list == NULL)
+    {
+        return spec_error(spec, "out of memory", NULL);
+    }
+    command->arguments = list;
+    command->arguments[command->argument_count++] = argument;
+    return true;
+}
+
+static bool add_help(struct spec *spec, const char *text)
+{
+    if (spec->command_count == 0)
+    {
+        return spec_error(spec, "help before the first command", NULL);
+    }
+    struct command_spec *command = &spec->commands[spec->command_count - 1];
+    const size_t length = strlen(text);
+    char *help = realloc(command->help, command->help_length + length + 3);
+    if (help == NULL)
+    {
+        return spec_error(spec, "out of memory", NULL);
+    }
+    memcpy(help + command->help_length, text, length);
+    memcpy(help + command->help_length + length, "\r\n", 3);
+    command->help = help;
+    command->help_length += length + 2;
+    command->types |= AT_PARSER_COMMAND_TYPE_BIT(AT_PARSER_COMMAND_TYPE_QUERY);
+    return true;
+}
+
+static bool check_spec(struct spec *spec)
+{
+    spec->line = 0;
+    if (spec->command_count == 0)
+    {
+        return spec_error(spec, "no commands", NULL);
+    }
+    if (spec->command_count >= UINT16_MAX)
+    {
+        return spec_error(spec, "too many commands", NULL);
+    }
+    for (size_t i = 0; i < spec->command_count; i++)
+    {
+        for (size_t j = i + 1; j < spec->command_count; j++)
+        {
+            if (strcmp(spec->commands[i].name, spec->commands[j].name) == 0)
+            {
+                return spec_error(spec, "duplicate command", spec->commands[i].name);
+            }
+        }
+    }
+    return true;
+}
+
+static bool parse_types(const char *list, unsigned *types)
+{
+    static const struct
+    {
+        const char *name;
+        enum at_parser_command_type type;
+    } names[] = {
+        {"query", AT_PARSER_COMMAND_TYPE_QUERY},
+        {"test", AT_PARSER_COMMAND_TYPE_TEST},
+        {"set", AT_PARSER_COMMAND_TYPE_SET},
+        {"execute", AT_PARSER_COMMAND_TYPE_EXECUTE},
+    };
+    *types = 0;
+    while (*list != '\0')
+    {
+        const size_t length = strcspn(list, ",");
+        bool found = false;
+        for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+        {
+            if (strlen(names[i].name) == length && strncmp(names[i].name, list, length) == 0)
+            {
+                *types |= AT_PARSER_COMMAND_TYPE_BIT(names[i].type);
+                found = true;
+            }
+        }
+        if (!found)
+        {
+            return false;
+        }
+        list += length + (list[length] == ',' ? 1 : 0);
+    }
+    return *types != 0;
+}
+
+static bool is_identifier(const char *text)
+{
+    if (!isalpha((unsigned char)text[0]) && text[0] != '_')
+    {
+        return false;
+    }
+    for (; *text != '\0'; text++)
+    {
+        if (!isalnum((unsigned char)*text) && *text != '_')
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool is_command_name(const char *text)
+{
+    for (const char *chr = text; *chr != '\0'; chr++)
+    {
+        if (!isalpha((unsigned char)*chr))
+        {
+            return false;
+        }
+    }
+    return *text != '\0';
+}
+
+static bool spec_error(const struct spec *spec, const char *message, const char *detail)
+{
+    if (spec->line != 0)
+    {
+        fprintf(stderr, "%s:%zu: ", spec->path, spec->line);
+    }
+    else
+    {
+        fprintf(stderr, "%s: ", spec->path);
+    }
+    fprintf(stderr, detail != NULL ? "%s '%s'\n" : "%s\n", message, detail);
+    return false;
+}
+
+/**
+ * @brief Search the smallest power of two table and a seed for which every name gets its own slot.
+ *
+ */
+static bool find_hash(const struct spec *spec, uint32_t *seed, uint16_t **slots, size_t *slot_count)
+{
+    size_t count = 1;
+    while (count < spec->command_count)
+    {
+        count <<= 1;
+    }
+    for (; count <= MAX_SLOTS; count <<= 1)
+    {
+        uint16_t *table = calloc(count, sizeof(uint16_t));
+        if (table == NULL)
+        {
+            return false;
+        }
+        for (uint32_t attempt = 0; attempt < SEED_ATTEMPTS; attempt++)
+        {
+            bool collision = false;
+            memset(table, 0, count * sizeof(uint16_t));
+            for (size_t i = 0; i < spec->command_count && !collision; i++)
+            {
+                const char *name = spec->commands[i].name;
+                const size_t slot = at_parser_command_table_hash(attempt, name, strlen(name)) & (count - 1);
+                collision = table[slot] != 0;
+                table[slot] = (uint16_t)(i + 1);
+            }
+            if (!collision)
+            {
+                *seed = attempt;
+                *slots = table;
+                *slot_count = count;
+                return true;
+            }
+        }
+        free(table);
+    }
+    return false;
+}
+
+static void write_string(FILE *out, const char *text, size_t length)
+{
+    fputc('"', out);
+    for (size_t i = 0; i < length; i++)
+    {
+        const unsigned char chr = (unsigned char)text[i];
+        if (chr == '"' || chr == '\\')
+        {
+            fprintf(out, "\\%c", chr);
+        }
+        else if (chr == '\r')
+        {
+            fputs("\\r", out);
+        }
+        else if (chr == '\n')
+        {
+            fputs("\\n", out);
+        }
+        else if (chr < 0x20 || chr >= 0x7F)
+        {
+            fprintf(out, "\\%03o", chr); // Octal escapes are at most 3 digits, so the next character can't continue it.
+        }
+        else
+        {
+            fputc(chr, out);
+        }
+    }
+    fputc('"', out);
+}
+
+static void write_types(FILE *out, unsigned types)
+{
+    static const char *names[] = {"AT_PARSER_COMMAND_TYPE_QUERY", "AT_PARSER_COMMAND_TYPE_TEST", "AT_PARSER_COMMAND_TYPE_SET", "AT_PARSER_COMMAND_TYPE_EXECUTE"};
+    bool first = true;
+    for (unsigned type = AT_PARSER_COMMAND_TYPE_QUERY; type <= AT_PARSER_COMMAND_TYPE_EXECUTE; type++)
+    {
+        if (types & AT_PARSER_COMMAND_TYPE_BIT(type))
+        {
+            fprintf(out, "%sAT_PARSER_COMMAND_TYPE_BIT(%s)", first ? "" : " | ", names[type]);
+            first = false;
+        }
+    }
+}
+
+static void write_handler_declarations(FILE *out, const struct spec *spec)
+{
+    for (size_t i = 0; i < spec->command_count; i++)
+    {
+        bool declared = false;
+        for (size_t j = 0; j < i && !declared; j++)
+        {
+            declared = strcmp(spec->commands[i].handler, spec->commands[j].handler) == 0;
+        }
+        if (!declared)
+        {
+            fprintf(out, "void %s(at_parser_handle_t parser, void *userdata, const char *command_name, enum at_parser_command_type type, "
+                         "struct at_parser_argument *argument_list, size_t argument_list_length);\n",
+                    spec->commands[i].handler);
+        }
+    }
+}
+
+static void write_source(FILE *out, const struct spec *spec, const char *name, const char *header, uint32_t seed, const uint16_t *slots, size_t slot_count)
+{
+    fprintf(out, "/* Generated by at_parser_gen from %s, do not edit. */\n", base_name(spec->path));
+    fprintf(out, "#include <stddef.h>\n#include \"at_parser/at_parser_command_table.h\"\n#include \"%s\"\n\n", header);
+    for (size_t i = 0; i < spec->command_count; i++)
+    {
+        const struct command_spec *command = &spec->commands[i];
+        if (command->argument_count == 0)
+        {
+            continue;
+        }
+        fprintf(out, "static const struct at_parser_argument_schema %s_%s_arguments[] = {\n", name, command->name);
+        for (size_t j = 0; j < command->argument_count; j++)
+        {
+            const struct argument_spec *argument = &command->arguments[j];
+            fprintf(out, "    {%s, %s, %ld, %ld},\n", argument->is_string ? "AT_PARSER_ARGUMENT_STRING" : "AT_PARSER_ARGUMENT_INTEGER",
+                    argument->optional ? "true" : "false", argument->min, argument->max);
+        }
+        fprintf(out, "};\n\n");
+    }
+
+    fprintf(out, "static const struct at_parser_table_command %s_commands[] = {\n", name);
+    for (size_t i = 0; i < spec->command_count; i++)
+    {
+        const struct command_spec *command = &spec->commands[i];
+        size_t required = 0;
+        while (required < command->argument_count && !command->arguments[required].optional)
+        {
+            required++;
+        }
+        fprintf(out, "    {\"%s\", %zu, ", command->name, strlen(command->name));
+        write_types(out, command->types);
+        if (command->argument_count > 0)
+        {
+            fprintf(out, ", %s_%s_arguments, %zu, %zu, ", name, command->name, command->argument_count, required);
+        }
+        else
+        {
+            fprintf(out, ", NULL, 0, 0, ");
+        }
+        if (command->help != NULL)
+        {
+            char *response = malloc(command->help_length + 4);
+            if (response != NULL)
+            {
+                memcpy(response, command->help, command->help_length);
+                memcpy(response + command->help_length, "OK\r\n", 4);
+                write_string(out, response, command->help_length + 4);
+                fprintf(out, ", %zu, ", command->help_length + 4);
+                free(response);
+            }
+        }
+        else
+        {
+            fprintf(out, "NULL, 0, ");
+        }
+        fprintf(out, "%s},\n", command->handler);
+    }
+    fprintf(out, "};\n\n");
+
+    fprintf(out, "static const uint16_t %s_slots[%zu] = {", name, slot_count);
+    for (size_t i = 0; i < slot_count; i++)
+    {
+        fprintf(out, "%s%s%u", i == 0 ? "" : ",", i % 16 == 0 ? "\n    " : " ", (unsigned)slots[i]);
+    }
+    fprintf(out, "\n};\n\n");
+
+    fprintf(out, "const struct at_parser_command_table %s = {%s_commands, %zu, %s_slots, %zu, %luu};\n", name, name, spec->command_count, name, slot_count - 1, (unsigned long)seed);
+}
+
+static void write_header(FILE *out, const struct spec *spec, const char *name)
+{
+    fprintf(out, "/* Generated by at_parser_gen from %s, do not edit. */\n", base_name(spec->path));
+    fprintf(out, "#ifndef ");
+    for (const char *chr = name; *chr != '\0'; chr++)
+    {
+        fputc(toupper((unsigned char)*chr), out);
+    }
+    fprintf(out, "_H\n#define ");
+    for (const char *chr = name; *chr != '\0'; chr++)
+    {
+        fputc(toupper((unsigned char)*chr), out);
+    }
+    fprintf(out, "_H\n\n#include \"at_parser/at_parser_command_table.h\"\n\n");
+    fprintf(out, "#ifdef __cplusplus\nextern \"C\" {\n#endif // __cplusplus\n\n");
+    fprintf(out, "extern const struct at_parser_command_table %s;\n\n", name);
+    write_handler_declarations(out, spec);
+    fprintf(out, "\n#ifdef __cplusplus\n}\n#endif // __cplusplus\n\n#endif\n");
+}
+
+static const char *base_name(const char *path)
+{
+    const char *separator = strrchr(path, '/');
+    return separator != NULL ? separator + 1 : path;
+}
+
+static void free_spec(struct spec *spec)
+{
+    for (size_t i = 0; i < spec->command_count; i++)
+    {
+        free(spec->commands[i].name);
+        free(spec->commands[i].handler);
+        free(spec->commands[i].arguments);
+        free(spec->commands[i].help);
+    }
+    free(spec->commands);
+    spec->commands = NULL;
+    spec->command_count = 0;
+}
+
+static void print_usage(const char *program)
+{
+    printf("Usage: %s [options] SPEC OUTPUT_C OUTPUT_H\n"
+           "  -n, --name NAME  Name of the generated table (default at_parser_commands)\n"
+           "  -h, --help       Show this help\n",
+           program);
+}
@@ -0,0 +1,571 @@
+/**
+ * @file at_parser_soak.c
+ * @author Giel Willemsen
+ * @brief Synthetic multi-device traffic generator and soak test for the AT parser.
+ * @version 0.1
+ * @date 2023-06-14
+ *
+ * @copyright See LICENSE
+ *
+ * Drives a configurable amount of parser instances with generated traffic (command mix, argument sizes,
+ * quote/escape density, garbage lines and random chunk fragmentation) and periodically reports the throughput,
+ * the dispatch latency percentiles and the resident memory, so leaks and latency regressions show up in long runs.
+ * The exit code is non zero when the amount of dispatched commands doesn't match the amount that was generated.
+ */
+#define _POSIX_C_SOURCE 200809L
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <getopt.h>
+#include <time.h>
+#include <unistd.h>
+#include "at_parser/at_parser.h"
+
+#define MAX_COMMANDS 32
+#define MAX_COMMAND_NAME 16
+#define STREAM_SIZE (64 * 1024)
+#define HISTOGRAM_SUB_BUCKETS 16
+#define HISTOGRAM_BUCKETS (64 * HISTOGRAM_SUB_BUCKETS)
+
+struct command_spec
+{
+    char name[MAX_COMMAND_NAME];
+    unsigned weight;
+};
+
+struct soak_options
+{
+    struct command_spec commands[MAX_COMMANDS];
+    size_t command_count;
+    unsigned total_weight;
+    size_t devices;
+    double duration;
+    double report_interval;
+    size_t buffer_size;
+    size_t min_args;
+    size_t max_args;
+    size_t min_arg_length;
+    size_t max_arg_length;
+    double set_ratio;
+    double quote_ratio;
+    double escape_density;
+    double garbage_ratio;
+    size_t min_chunk;
+    size_t max_chunk;
+    uint64_t seed;
+};
+
+struct device
+{
+    at_parser_handle_t parser;
+    char *stream;
+    size_t stream_used;
+    size_t stream_position;
+};
+
+struct histogram
+{
+    uint64_t counts[HISTOGRAM_BUCKETS];
+    uint64_t total;
+    uint64_t max;
+};
+
+struct soak_counters
+{
+    uint64_t bytes;
+    uint64_t lines;
+    uint64_t garbage_lines;
+    uint64_t expected_commands;
+    uint64_t dispatched_commands;
+};
+
+static uint64_t rng_state;
+static uint64_t call_started_ns;
+static struct soak_counters counters;
+static struct histogram latencies;
+
+static uint64_t next_random(void);
+static size_t random_between(size_t low, size_t high);
+static bool random_chance(double ratio);
+static uint64_t now_ns(void);
+static size_t resident_kib(void);
+static void histogram_add(struct histogram *histogram, uint64_t value);
+static uint64_t histogram_percentile(const struct histogram *histogram, double percentile);
+static void command_received(at_parser_handle_t parser, void *userdata, const char *command_name, enum at_parser_command_type type, struct at_parser_argument *argument_list, size_t argument_list_length);
+static size_t generate_argument(const struct soak_options *options, char *out);
+static size_t generate_line(const struct soak_options *options, char *out);
+static void fill_stream(const struct soak_options *options, struct device *device);
+static size_t max_line_length(const struct soak_options *options);
+static bool parse_command_mix(const char *mix, struct soak_options *options);
+static void print_usage(const char *program);
+static void report(double elapsed, const struct soak_counters *interval, double interval_seconds, size_t rss_kib, size_t baseline_kib);
+
+int main(int argc, char **argv)
+{
+    struct soak_options options = {
+        .devices = 16,
+        .duration = 10,
+        .report_interval = 1,
+        .buffer_size = 256,
+        .min_args = 0,
+        .max_args = 4,
+        .min_arg_length = 1,
+        .max_arg_length = 16,
+        .set_ratio = 0.6,
+        .quote_ratio = 0.3,
+        .escape_density = 0.05,
+        .garbage_ratio = 0.01,
+        .min_chunk = 1,
+        .max_chunk = 64,
+        .seed = 1,
+    };
+    parse_command_mix("CSQ:5,CREG:2,COPS:1,CMGS:1", &options);
+
+    static const struct option long_options[] = {
+        {"commands", required_argument, NULL, 'c'},
+        {"devices", required_argument, NULL, 'd'},
+        {"duration", required_argument, NULL, 't'},
+        {"interval", required_argument, NULL, 'i'},
+        {"buffer-size", required_argument, NULL, 'b'},
+        {"args", required_argument, NULL, 'a'},
+        {"arg-length", required_argument, NULL, 'l'},
+        {"set-ratio", required_argument, NULL, 's'},
+        {"quote-ratio", required_argument, NULL, 'q'},
+        {"escape-density", required_argument, NULL, 'e'},
+        {"garbage-ratio", required_argument, NULL, 'g'},
+        {"chunk", required_argument, NULL, 'k'},
+        {"seed", required_argument, NULL, 'r'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0},
+    };
+    int option;
+    while ((option = getopt_long(argc, argv, "c:d:t:i:b:a:l:s:q:e:g:k:r:h", long_options, NULL)) != -1)
+    {
+        bool valid = true;
+        switch (option)
+        {
+        case 'c':
+            valid = parse_command_mix(optarg, &options);
+            break;
+        case 'd':
+            options.devices = strtoul(optarg, NULL, 10);
+            valid = options.devices > 0;
+            break;
+        case 't':
+            options.duration = strtod(optarg, NULL);
+            break;
+        case 'i':
+            options.report_interval = strtod(optarg, NULL);
+            valid = options.report_interval > 0;
+            break;
+        case 'b':
+            options.buffer_size = strtoul(optarg, NULL, 10);
+            break;
+        case 'a':
+            valid = sscanf(optarg, "%zu-%zu", &options.min_args, &options.max_args) == 2 && options.min_args <= options.max_args;
+            break;
+        case 'l':
+            valid = sscanf(optarg, "%zu-%zu", &options.min_arg_length, &options.max_arg_length) == 2 && options.min_arg_length <= options.max_arg_length;
+            break;
+        case 's':
+            options.set_ratio = strtod(optarg, NULL);
+            break;
+        case 'q':
+            options.quote_ratio = strtod(optarg, NULL);
+            break;
+        case 'e':
+            options.escape_density = strtod(optarg, NULL);
+            break;
+        case 'g':
+            options.garbage_ratio = strtod(optarg, NULL);
+            break;
+        case 'k':
+            valid = sscanf(optarg, "%zu-%zu", &options.min_chunk, &options.max_chunk) == 2 && options.min_chunk > 0 && options.min_chunk <= options.max_chunk;
+            break;
+        case 'r':
+            options.seed = strtoull(optarg, NULL, 10);
+            break;
+        case 'h':
+            print_usage(argv[0]);
+            return 0;
+        default:
+            valid = false;
+            break;
+        }
+        if (!valid)
+        {
+            print_usage(argv[0]);
+            return 2;
+        }
+    }
+    if (max_line_length(&options) > options.buffer_size)
+    {
+        fprintf(stderr, "The longest generated command (%zu bytes) doesn't fit the parser buffer (%zu bytes).\n", max_line_length(&options), options.buffer_size);
+        return 2;
+    }
+    rng_state = options.seed != 0 ? options.seed : 1;
+
+    struct device *devices = calloc(options.devices, sizeof(struct device));
+    if (devices == NULL)
+    {
+        return 1;
+    }
+    for (size_t i = 0; i < options.devices; i++)
+    {
+        devices[i].stream = malloc(STREAM_SIZE);
+        if (devices[i].stream == NULL || at_parser_create(&devices[i].parser, options.buffer_size, '\\', ',') != 0)
+        {
+            fprintf(stderr, "Failed to create device %zu.\n", i);
+            return 1;
+        }
+        for (size_t j = 0; j < options.command_count; j++)
+        {
+            at_parser_add_command_handler(devices[i].parser, options.commands[j].name, command_received, NULL);
+        }
+        fill_stream(&options, &devices[i]);
+    }
+
+    printf("%10s %12s %10s %12s %10s %10s %10s %10s %12s %10s\n", "elapsed_s", "commands/s", "MiB/s", "commands", "p50_ns", "p99_ns", "p999_ns", "max_ns", "rss_kib", "rss_delta");
+    const uint64_t start = now_ns();
+    uint64_t last_report = start;
+    struct soak_counters last_counters = counters;
+    size_t baseline_kib = 0;
+    bool done = false;
+    while (!done)
+    {
+        for (size_t i = 0; i < options.devices; i++)
+        {
+            struct device *device = &devices[i];
+            if (device->stream_position == device->stream_used)
+            {
+                fill_stream(&options, device);
+            }
+            const size_t chunk = random_between(options.min_chunk, options.max_chunk);
+            const size_t length = chunk < device->stream_used - device->stream_position ? chunk : device->stream_used - device->stream_position;
+            call_started_ns = now_ns();
+            at_parser_process_buffer(device->parser, device->stream + device->stream_position, length);
+            device->stream_position += length;
+            counters.bytes += length;
+        }
+
+        const uint64_t now = now_ns();
+        if ((double)(now - last_report) >= options.report_interval * 1e9)
+        {
+            struct soak_counters interval = counters;
+            interval.bytes -= last_counters.bytes;
+            interval.dispatched_commands -= last_counters.dispatched_commands;
+            const size_t rss = resident_kib();
+            if (baseline_kib == 0)
+            {
+                baseline_kib = rss; // The first interval is the warm up.
+            }
+            report((double)(now - start) / 1e9, &interval, (double)(now - last_report) / 1e9, rss, baseline_kib);
+            memset(&latencies, 0, sizeof(latencies));
+            last_counters = counters;
+            last_report = now;
+            done = (double)(now - start) >= options.duration * 1e9;
+        }
+    }
+
+    // Flush the lines that are still in the streams, so every generated command should be dispatched.
+    for (size_t i = 0; i < options.devices; i++)
+    {
+        struct device *device = &devices[i];
+        at_parser_process_buffer(device->parser, device->stream + device->stream_position, device->stream_used - device->stream_position);
+        at_parser_free(device->parser);
+        free(device->stream);
+    }
+    free(devices);
+
+    printf("total: %llu bytes, %llu lines (%llu garbage), %llu of %llu commands dispatched\n",
+           (unsigned long long)counters.bytes, (unsigned long long)counters.lines, (unsigned long long)counters.garbage_lines,
+           (unsigned long long)counters.dispatched_commands, (unsigned long long)counters.expected_commands);
+    if (counters.dispatched_commands != counters.expected_commands)
+    {
+        fprintf(stderr, "Dispatched commands don't match the generated commands.\n");
+        return 1;
+    }
+    return 0;
+}
+
+static uint64_t next_random(void)
+{
+    // xorshift64*
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545F4914F6CDD1DULL;
+}
+
+static size_t random_between(size_t low, size_t high)
+{
+    return low + (size_t)(next_random() % (high - low + 1));
+}
+
+static bool random_chance(double ratio)
+{
+    return (double)(next_random() >> 11) / (double)(1ULL << 53) < ratio;
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (uint64_t)time.tv_sec * 1000000000ULL + (uint64_t)time.tv_nsec;
+}
+
+static size_t resident_kib(void)
+{
+    FILE *file = fopen("/proc/self/statm", "r");
+    if (file == NULL)
+    {
+        return 0;
+    }
+    unsigned long size = 0;
+    unsigned long resident = 0;
+    int read = fscanf(file, "%lu %lu", &size, &resident);
+    fclose(file);
+    return read == 2 ? resident * (size_t)sysconf(_SC_PAGESIZE) / 1024 : 0;
+}
+
+/**
+ * @brief Log-linear histogram, each power of two is split into HISTOGRAM_SUB_BUCKETS buckets.
+ *
+ */
+static void histogram_add(struct histogram *histogram, uint64_t value)
+{
+    size_t index = value < HISTOGRAM_SUB_BUCKETS ? (size_t)value : 0;
+    if (value >= HISTOGRAM_SUB_BUCKETS)
+    {
+        const int magnitude = 63 - __builtin_clzll(value);
+        const size_t sub_bucket = (size_t)(value >> (magnitude - 4)) & (HISTOGRAM_SUB_BUCKETS - 1);
+        index = (size_t)(magnitude - 3) * HISTOGRAM_SUB_BUCKETS + sub_bucket;
+    }
+    histogram->counts[index]++;
+    histogram->total++;
+    histogram->max = value > histogram->max ? value : histogram->max;
+}
+
+static uint64_t histogram_percentile(const struct histogram *histogram, double percentile)
+{
+    const uint64_t target = (uint64_t)(percentile * (double)histogram->total);
+    uint64_t seen = 0;
+    for (size_t index = 0; index < HISTOGRAM_BUCKETS; index++)
+    {
+        seen += histogram->counts[index];
+        if (seen > target)
+        {
+            if (index < HISTOGRAM_SUB_BUCKETS)
+            {
+                return index;
+            }
+            // Upper bound of the bucket.
+            const size_t magnitude = index / HISTOGRAM_SUB_BUCKETS + 3;
+            const uint64_t sub_bucket = index % HISTOGRAM_SUB_BUCKETS;
+            return ((HISTOGRAM_SUB_BUCKETS + sub_bucket + 1) << (magnitude - 4)) - 1;
+        }
+    }
+    return histogram->max;
+}
+
+static void command_received(at_parser_handle_t parser, void *userdata, const char *command_name, enum at_parser_command_type type, struct at_parser_argument *argument_list, size_t argument_list_length)
+{
+    (void)parser;
+    (void)userdata;
+    (void)command_name;
+    (void)type;
+    // Touch the arguments like a real handler would.
+    volatile size_t total = 0;
+    for (size_t i = 0; i < argument_list_length; i++)
+    {
+        total += argument_list[i].length;
+    }
+    counters.dispatched_commands++;
+    histogram_add(&latencies, now_ns() - call_started_ns);
+}
+
+static size_t generate_argument(const struct soak_options *options, char *out)
+{
+    static const char characters[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789+-.";
+    const size_t length = random_between(options->min_arg_length, options->max_arg_length);
+    const bool quoted = random_chance(options->quote_ratio);
+    size_t used = 0;
+    if (quoted)
+    {
+        out[used++] = '"';
+    }
+    for (size_t i = 0; i < length; i++)
+    {
+        if (quoted && random_chance(options->escape_density))
+        {
+            // An escaped quote or a separator, both only valid inside quotes.
+            if (random_chance(0.5))
+            {
+                out[used++] = '\\';
+                out[used++] = '"';
+            }
+            else
+            {
+                out[used++] = ',';
+            }
+        }
+        else
+        {
+            out[used++] = characters[next_random() % (sizeof(characters) - 1)];
+        }
+    }
+    if (quoted)
+    {
+        out[used++] = '"';
+    }
+    return used;
+}
+
+static size_t generate_line(const struct soak_options *options, char *out)
+{
+    size_t used = 0;
+    counters.lines++;
+    if (random_chance(options->garbage_ratio))
+    {
+        // Never starts with AT+, so it must not be dispatched.
+        const size_t length = random_between(1, options->buffer_size * 2);
+        for (size_t i = 0; i < length; i++)
+        {
+            char chr = (char)(next_random() & 0xFF);
+            out[used++] = chr == '\n' || chr == '\r' ? '#' : chr;
+        }
+        out[0] = '#';
+        out[used++] = '\r';
+        out[used++] = '\n';
+        counters.garbage_lines++;
+        return used;
+    }
+
+    unsigned pick = (unsigned)(next_random() % options->total_weight);
+    const struct command_spec *command = options->commands;
+    while (pick >= command->weight)
+    {
+        pick -= command->weight;
+        command++;
+    }
+    used += (size_t)sprintf(out, "AT+%s", command->name);
+    if (random_chance(options->set_ratio))
+    {
+        out[used++] = '=';
+        const size_t argument_count = random_between(options->min_args > 0 ? options->min_args : 1, options->max_args > 0 ? options->max_args : 1);
+        for (size_t i = 0; i < argument_count; i++)
+        {
+            if (i != 0)
+            {
+                out[used++] = ',';
+            }
+            used += generate_argument(options, out + used);
+        }
+    }
+    else
+    {
+        static const char *const suffixes[] = {"", "?", "=?"};
+        const char *suffix = suffixes[next_random() % 3];
+        memcpy(out + used, suffix, strlen(suffix));
+        used += strlen(suffix);
+    }
+    out[used++] = '\r';
+    out[used++] = '\n';
+    counters.expected_commands++;
+    return used;
+}
+
+static void fill_stream(const struct soak_options *options, struct device *device)
+{
+    const size_t line_capacity = options->buffer_size * 2 + 2;
+    device->stream_used = 0;
+    device->stream_position = 0;
+    while (STREAM_SIZE - device->stream_used >= line_capacity)
+    {
+        device->stream_used += generate_line(options, device->stream + device->stream_used);
+    }
+}
+
+static size_t max_line_length(const struct soak_options *options)
+{
+    size_t name_length = 0;
+    for (size_t i = 0; i < options->command_count; i++)
+    {
+        const size_t length = strlen(options->commands[i].name);
+        name_length = length > name_length ? length : name_length;
+    }
+    // Every character of a quoted argument could be an escaped quote.
+    const size_t max_args = options->max_args > 0 ? options->max_args : 1;
+    const size_t argument_length = 2 * options->max_arg_length + 2;
+    return 3 + name_length + 1 + max_args * (argument_length + 1) + 2;
+}
+
+static bool parse_command_mix(const char *mix, struct soak_options *options)
+{
+    options->command_count = 0;
+    options->total_weight = 0;
+    const char *position = mix;
+    while (*position != '\0')
+    {
+        if (options->command_count == MAX_COMMANDS)
+        {
+            return false;
+        }
+        struct command_spec *command = &options->commands[options->command_count];
+        int consumed = 0;
+        if (sscanf(position, "%15[A-Za-z]:%u%n", command->name, &command->weight, &consumed) != 2 || command->weight == 0)
+        {
+            return false;
+        }
+        options->total_weight += command->weight;
+        options->command_count++;
+        position += consumed;
+        if (*position == ',')
+        {
+            position++;
+        }
+        else if (*position != '\0')
+        {
+            return false;
+        }
+    }
+    return options->command_count > 0;
+}
+
+static void print_usage(const char *program)
+{
+    printf("Usage: %s [options]\n"
+           "  -c, --commands NAME:WEIGHT,...  Command mix (default CSQ:5,CREG:2,COPS:1,CMGS:1)\n"
+           "  -d, --devices N                 Amount of parser instances (default 16)\n"
+           "  -t, --duration SECONDS          Run time (default 10)\n"
+           "  -i, --interval SECONDS          Report interval (default 1)\n"
+           "  -b, --buffer-size BYTES         Parser buffer size (default 256)\n"
+           "  -a, --args MIN-MAX              Arguments per set command (default 0-4)\n"
+           "  -l, --arg-length MIN-MAX        Argument length (default 1-16)\n"
+           "  -s, --set-ratio RATIO           Share of set commands (default 0.6)\n"
+           "  -q, --quote-ratio RATIO         Share of quoted arguments (default 0.3)\n"
+           "  -e, --escape-density RATIO      Share of escaped quotes/separators in quoted arguments (default 0.05)\n"
+           "  -g, --garbage-ratio RATIO       Share of garbage lines (default 0.01)\n"
+           "  -k, --chunk MIN-MAX             Bytes per process call (default 1-64)\n"
+           "  -r, --seed N                    Random seed (default 1)\n",
+           program);
+}
+
+static void report(double elapsed, const struct soak_counters *interval, double interval_seconds, size_t rss_kib, size_t baseline_kib)
+{
+    printf("%10.1f %12.0f %10.2f %12llu %10llu %10llu %10llu %10llu %12zu %+10lld\n",
+           elapsed,
+           (double)interval->dispatched_commands / interval_seconds,
+           (double)interval->bytes / interval_seconds / (1024.0 * 1024.0),
+           (unsigned long long)interval->dispatched_commands,
+           (unsigned long long)histogram_percentile(&latencies, 0.50),
+           (unsigned long long)histogram_percentile(&latencies, 0.99),
+           (unsigned long long)histogram_percentile(&latencies, 0.999),
+           (unsigned long long)latencies.max,
+           rss_kib,
+           (long long)rss_kib - (long long)baseline_kib);
+    fflush(stdout);
+}